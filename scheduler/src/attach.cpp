@@ -0,0 +1,336 @@
+#include "attach.hpp"
+#include "cgroup.hpp"
+#include "sysfs.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/syscall.h>
+
+// Attach mode.
+//
+// Instead of spawning the application, an already running process (and
+// every thread of it) or every process of a cgroup is adopted. Exit of a
+// process is detected through a pidfd (falling back to probing the pid on
+// kernels without pidfd_open), and exit of a cgroup through the populated
+// flag of its `cgroup.events`.
+//
+// The affinity of every thread is saved on adoption and restored on detach,
+// so a long-running service is left as we found it.
+
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+
+/// Maximum number of threads whose original affinity is saved.
+constexpr int MAX_SAVED_THREADS = 1024;
+
+/// Maximum number of ancestors walked to tell whether a process descends
+/// from the adopted one.
+constexpr int MAX_ANCESTRY_DEPTH = 32;
+
+enum AttachMode
+{
+    ATTACH_NONE,
+    ATTACH_PID,
+    ATTACH_CGROUP,
+};
+
+struct SavedAffinity
+{
+    int pid;
+    int tid;
+    cpu_set_t mask;
+};
+
+static AttachMode mode = ATTACH_NONE;
+static int main_pid = -1;
+static int pidfd = -1;
+static char cgroup_path[PATH_MAX];
+static char counting_cgroup[PATH_MAX];
+static char name[64];
+static SavedAffinity saved[MAX_SAVED_THREADS];
+static int num_saved;
+static bool is_adopted;
+
+/// Calls `fn(tid)` for every thread of the process `pid`.
+template<class Fn>
+static void for_each_thread(int pid, Fn fn)
+{
+    char path[64];
+    sprintf(path, "/proc/%d/task", pid);
+
+    DIR* dir = opendir(path);
+    if(!dir)
+        return;
+
+    while(auto entry = readdir(dir))
+    {
+        if(entry->d_name[0] != '.')
+            fn(atoi(entry->d_name));
+    }
+
+    closedir(dir);
+}
+
+/// Reads the parent of `pid` from its stat.
+static int read_parent(int pid)
+{
+    char path[64];
+    char buffer[512];
+
+    sprintf(path, "/proc/%d/stat", pid);
+    if(!sysfs_read(path, buffer, sizeof(buffer)))
+        return -1;
+
+    int ppid;
+    const char* p = strrchr(buffer, ')');
+    if(!p || sscanf(p + 2, "%*c %d", &ppid) != 1)
+        return -1;
+    return ppid;
+}
+
+/// Whether `pid` is `ancestor` or one of its descendants.
+static bool descends_from(int pid, int ancestor)
+{
+    for(int depth = 0; depth < MAX_ANCESTRY_DEPTH && pid > 1; ++depth)
+    {
+        if(pid == ancestor)
+            return true;
+        pid = read_parent(pid);
+    }
+    return false;
+}
+
+/// Counts the processes of the group `path` that are not the adopted
+/// process or its descendants.
+static int count_foreign_processes(const char* path)
+{
+    char procs_path[PATH_MAX + 16];
+    snprintf(procs_path, sizeof(procs_path), "%s/cgroup.procs", path);
+
+    FILE* stream = fopen(procs_path, "r");
+    if(!stream)
+        return 0;
+
+    int pid, count = 0;
+    while(fscanf(stream, "%d", &pid) == 1)
+    {
+        if(!descends_from(pid, main_pid))
+            ++count;
+    }
+
+    fclose(stream);
+    return count;
+}
+
+static auto find_saved(int tid) -> SavedAffinity*
+{
+    for(int i = 0; i < num_saved; ++i)
+    {
+        if(saved[i].tid == tid)
+            return &saved[i];
+    }
+    return nullptr;
+}
+
+bool attach_parse(char* argv[])
+{
+    mode = ATTACH_NONE;
+
+    if(!argv[0])
+        return true;
+
+    if(!strcmp(argv[0], "--pid"))
+    {
+        if(!argv[1] || atoi(argv[1]) <= 0)
+        {
+            fprintf(stderr, "scheduler: --pid requires a process id\n");
+            return false;
+        }
+        mode = ATTACH_PID;
+        main_pid = atoi(argv[1]);
+        snprintf(name, sizeof(name), "pid%d", main_pid);
+    }
+    else if(!strcmp(argv[0], "--cgroup"))
+    {
+        if(!argv[1])
+        {
+            fprintf(stderr, "scheduler: --cgroup requires a cgroup path\n");
+            return false;
+        }
+        mode = ATTACH_CGROUP;
+        snprintf(cgroup_path, sizeof(cgroup_path), "%s", argv[1]);
+        const char* base = strrchr(cgroup_path, '/');
+        snprintf(name, sizeof(name), "%.63s", base? base + 1 : cgroup_path);
+    }
+
+    return true;
+}
+
+bool attach_enabled()
+{
+    return mode != ATTACH_NONE;
+}
+
+const char* attach_name()
+{
+    return name;
+}
+
+int attach_pids(int* pids, int max_pids)
+{
+    if(mode == ATTACH_PID)
+    {
+        pids[0] = main_pid;
+        return 1;
+    }
+
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/cgroup.procs", cgroup_path);
+
+    FILE* stream = fopen(path, "r");
+    if(!stream)
+        return 0;
+
+    int count = 0;
+    while(count < max_pids && fscanf(stream, "%d", &pids[count]) == 1)
+        ++count;
+
+    fclose(stream);
+    return count;
+}
+
+int attach_start()
+{
+    num_saved = 0;
+
+    if(mode == ATTACH_CGROUP)
+    {
+        int pids[ATTACH_MAX_PROCESSES];
+        if(attach_pids(pids, ATTACH_MAX_PROCESSES) == 0)
+        {
+            fprintf(stderr, "scheduler: no process to adopt in %s\n", cgroup_path);
+            return -1;
+        }
+        main_pid = pids[0];
+    }
+    else if(kill(main_pid, 0) == -1)
+    {
+        perror("scheduler: cannot adopt process");
+        return -1;
+    }
+
+    if(mode == ATTACH_PID)
+    {
+        pidfd = syscall(__NR_pidfd_open, main_pid, 0);
+        if(pidfd == -1)
+            fprintf(stderr, "scheduler: pidfd_open unavailable, probing pid %d for exit\n", main_pid);
+    }
+
+    int pids[ATTACH_MAX_PROCESSES];
+    const int num_pids = attach_pids(pids, ATTACH_MAX_PROCESSES);
+    for(int p = 0; p < num_pids; ++p)
+    {
+        const int pid = pids[p];
+        for_each_thread(pid, [&](int tid) {
+            if(num_saved == MAX_SAVED_THREADS)
+                return;
+            auto& entry = saved[num_saved];
+            entry.pid = pid;
+            entry.tid = tid;
+            if(sched_getaffinity(tid, sizeof(entry.mask), &entry.mask) == 0)
+                ++num_saved;
+        });
+    }
+
+    is_adopted = true;
+    fprintf(stderr, "scheduler: adopted %s (%d processes, %d threads)\n", name, num_pids, num_saved);
+    return main_pid;
+}
+
+const char* attach_counting_cgroup()
+{
+    if(mode == ATTACH_CGROUP)
+        return cgroup_path;
+
+    // A process in the root group is counted system-wide. Otherwise its
+    // group is usually the unit of a service, which may hold other processes
+    // (sidecars, cron jobs, ...) that are counted along with it. Moving the
+    // process elsewhere would break the service manager, so only warn.
+    if(mode == ATTACH_PID && cgroup_of_process(main_pid, counting_cgroup, sizeof(counting_cgroup)))
+    {
+        const size_t length = strlen(counting_cgroup);
+        if(length && counting_cgroup[length - 1] != '/')
+        {
+            if(const int num_foreign = count_foreign_processes(counting_cgroup))
+            {
+                fprintf(stderr, "scheduler: warning: %s holds %d processes unrelated to %s, "
+                                "which are counted along with it\n", counting_cgroup, num_foreign, name);
+            }
+            return counting_cgroup;
+        }
+    }
+
+    return nullptr;
+}
+
+bool attach_exited()
+{
+    if(mode == ATTACH_CGROUP)
+    {
+        char path[PATH_MAX + 16];
+        char buffer[256];
+        snprintf(path, sizeof(path), "%s/cgroup.events", cgroup_path);
+        if(!sysfs_read(path, buffer, sizeof(buffer)))
+            return true;
+        return strstr(buffer, "populated 0") != nullptr;
+    }
+
+    if(pidfd != -1)
+    {
+        struct pollfd pfd = {pidfd, POLLIN, 0};
+        return poll(&pfd, 1, 0) > 0;
+    }
+
+    return kill(main_pid, 0) == -1 && errno == ESRCH;
+}
+
+void attach_detach()
+{
+    if(!is_adopted)
+        return;
+
+    int pids[ATTACH_MAX_PROCESSES];
+    const int num_pids = attach_pids(pids, ATTACH_MAX_PROCESSES);
+
+    // Threads created after adoption get the original affinity of their
+    // process (that of its main thread).
+    for(int p = 0; p < num_pids; ++p)
+    {
+        const auto main_thread = find_saved(pids[p]);
+        for_each_thread(pids[p], [&](int tid) {
+            const auto entry = find_saved(tid);
+            if(entry)
+                sched_setaffinity(tid, sizeof(entry->mask), &entry->mask);
+            else if(main_thread)
+                sched_setaffinity(tid, sizeof(main_thread->mask), &main_thread->mask);
+        });
+    }
+
+    if(pidfd != -1)
+    {
+        close(pidfd);
+        pidfd = -1;
+    }
+
+    fprintf(stderr, "scheduler: detached from %s, original affinity restored\n", name);
+    num_saved = 0;
+    is_adopted = false;
+}
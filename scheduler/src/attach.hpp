@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+
+/// Maximum number of processes adopted from a cgroup.
+constexpr int ATTACH_MAX_PROCESSES = 64;
+
+/// Parses the application arguments. `--pid <pid>` adopts a running process
+/// and its threads, and `--cgroup <path>` adopts every process of a cgroup v2
+/// group. Anything else is a command to be spawned.
+///
+/// Returns false on malformed attach arguments.
+extern bool attach_parse(char* argv[]);
+
+/// Whether an existing application is being managed instead of a spawned one.
+extern bool attach_enabled();
+
+/// Short name of the adopted application, for logs.
+extern const char* attach_name();
+
+/// Adopts the application, saving the affinity of every one of its threads.
+///
+/// Returns the main pid of the application, or -1 on failure.
+extern int attach_start();
+
+/// Gets the cgroup the adopted application is counted on, or null if it
+/// must be counted system-wide.
+///
+/// With `--pid` this is the whole group of the process, so the counters
+/// also cover any other process in it (a warning is printed if there is).
+extern const char* attach_counting_cgroup();
+
+/// Gets the pids of every adopted process. Returns how many there are.
+extern int attach_pids(int* pids, int max_pids);
+
+/// Whether the adopted application has exited.
+extern bool attach_exited();
+
+/// Restores the original affinity of every thread still alive and stops
+/// managing the application.
+extern void attach_detach();
@@ -0,0 +1,259 @@
+#include "cgroup.hpp"
+#include "sysfs.hpp"
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <linux/limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// CPU bandwidth capping through the cgroup v2 `cpu.max` interface.
+//
+// The managed application is moved into its own group under the cgroup root
+// (`SCHEDULER_CGROUP_ROOT`, defaulting to /sys/fs/cgroup). The quota of the
+// group is a percentage of the CPUs available on the current `State`, thus
+// it must be reapplied after every reconfiguration. This gives a throttle
+// finer than moving the application between clusters.
+
+/// Period used for `cpu.max` in microseconds.
+constexpr uint64_t QUOTA_PERIOD_USEC = 100000;
+
+/// Times the processes left in the group are moved out before removing it.
+constexpr int DETACH_PASSES = 4;
+
+static bool is_enabled;
+static char cgroup_root[PATH_MAX];
+static char cgroup_path[PATH_MAX];
+static char original_cgroup_path[PATH_MAX];
+static int quota_step;
+static CgroupCpuStat prev_stat;
+
+/// Reads the cgroup v2 path (relative to the root) a process belongs to.
+static bool read_process_cgroup(int pid, char* out, size_t size)
+{
+    char path[64];
+    char buffer[PATH_MAX];
+
+    sprintf(path, "/proc/%d/cgroup", pid);
+    if(!sysfs_read(path, buffer, sizeof(buffer)))
+        return false;
+
+    // The unified hierarchy line looks like "0::/path/to/group".
+    for(char* line = strtok(buffer, "\n"); line; line = strtok(nullptr, "\n"))
+    {
+        if(!strncmp(line, "0::", 3))
+        {
+            snprintf(out, size, "%s", line + 3);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static auto read_cpu_stat() -> CgroupCpuStat
+{
+    char path[PATH_MAX + 16];
+    char buffer[1024];
+    CgroupCpuStat stat;
+
+    snprintf(path, sizeof(path), "%s/cpu.stat", cgroup_path);
+    if(!sysfs_read(path, buffer, sizeof(buffer)))
+        return stat;
+
+    for(char* line = strtok(buffer, "\n"); line; line = strtok(nullptr, "\n"))
+    {
+        sscanf(line, "nr_throttled %" SCNu64, &stat.nr_throttled);
+        sscanf(line, "throttled_usec %" SCNu64, &stat.throttled_usec);
+    }
+
+    return stat;
+}
+
+bool cgroup_init()
+{
+    is_enabled = false;
+    quota_step = 0;
+    cgroup_path[0] = '\0';
+    strcpy(cgroup_root, "/sys/fs/cgroup");
+
+    if(auto s = std::getenv("SCHEDULER_CGROUP"))
+    {
+        if(!strcmp(s, "true") || !strcmp(s, "1"))
+            is_enabled = true;
+        else if(strcmp(s, "false") && strcmp(s, "0"))
+            fprintf(stderr, "scheduler: Unrecognized SCHEDULER_CGROUP: %s\n", s);
+    }
+
+    if(auto s = std::getenv("SCHEDULER_CGROUP_ROOT"))
+        snprintf(cgroup_root, sizeof(cgroup_root), "%s", s);
+
+    if(is_enabled)
+        fprintf(stderr, "scheduler: cpu bandwidth capping under %s\n", cgroup_root);
+
+    return is_enabled;
+}
+
+bool cgroup_of_process(int pid, char* path, size_t size)
+{
+    char relative[PATH_MAX];
+    if(!read_process_cgroup(pid, relative, sizeof(relative)))
+        return false;
+
+    if(!cgroup_root[0])
+        strcpy(cgroup_root, "/sys/fs/cgroup");
+    snprintf(path, size, "%s%s", cgroup_root, relative);
+    return true;
+}
+
+bool cgroup_enabled()
+{
+    return is_enabled;
+}
+
+bool cgroup_attach(int pid)
+{
+    if(!is_enabled)
+        return false;
+
+    char path[PATH_MAX + 32];
+
+    if(!read_process_cgroup(pid, original_cgroup_path, sizeof(original_cgroup_path)))
+        strcpy(original_cgroup_path, "/");
+
+    // Delegate the cpu controller to the children of the root. This fails
+    // harmlessly when it is already delegated.
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgroup_root);
+    sysfs_write(path, "+cpu");
+
+    if(snprintf(cgroup_path, sizeof(cgroup_path), "%s/scheduler.%d", cgroup_root, pid)
+        >= (int) sizeof(cgroup_path))
+    {
+        fprintf(stderr, "scheduler: cgroup path under %s is too long\n", cgroup_root);
+        cgroup_path[0] = '\0';
+        return false;
+    }
+
+    if(mkdir(cgroup_path, 0755) == -1 && errno != EEXIST)
+    {
+        perror("scheduler: failed to create cgroup");
+        cgroup_path[0] = '\0';
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "%s/cgroup.procs", cgroup_path);
+    if(!sysfs_write(path, "%d", pid))
+    {
+        perror("scheduler: failed to move application into cgroup");
+        rmdir(cgroup_path);
+        cgroup_path[0] = '\0';
+        return false;
+    }
+
+    quota_step = 0;
+    prev_stat = read_cpu_stat();
+    fprintf(stderr, "scheduler: application %d moved into %s\n", pid, cgroup_path);
+    return true;
+}
+
+void cgroup_detach()
+{
+    if(cgroup_path[0] == '\0')
+        return;
+
+    char path[PATH_MAX + 32];
+    char original_procs[PATH_MAX + 32];
+    static char procs[65536];
+
+    // The application may have forked, and its children are in the group
+    // too. Every process must leave before the group can be removed, and a
+    // few passes catch those forked in the meantime.
+    snprintf(path, sizeof(path), "%s/cgroup.procs", cgroup_path);
+    if(snprintf(original_procs, sizeof(original_procs), "%s%s/cgroup.procs", cgroup_root, original_cgroup_path)
+        >= (int) sizeof(original_procs))
+    {
+        fprintf(stderr, "scheduler: cgroup path %s is too long\n", original_cgroup_path);
+    }
+    else
+    {
+        for(int pass = 0; pass < DETACH_PASSES && sysfs_read(path, procs, sizeof(procs)) && procs[0]; ++pass)
+        {
+            for(char* line = strtok(procs, "\n"); line; line = strtok(nullptr, "\n"))
+            {
+                if(!sysfs_write(original_procs, "%s", line) && errno != ESRCH)
+                    fprintf(stderr, "scheduler: failed to move %s back to its cgroup: %s\n", line, strerror(errno));
+            }
+        }
+    }
+
+    if(rmdir(cgroup_path) == -1)
+    {
+        perror("scheduler: failed to remove cgroup");
+
+        // At least do not leave whatever is left throttled.
+        snprintf(path, sizeof(path), "%s/cpu.max", cgroup_path);
+        sysfs_write(path, "max %" PRIu64, QUOTA_PERIOD_USEC);
+    }
+
+    cgroup_path[0] = '\0';
+}
+
+bool cgroup_set_quota(int step, int num_cpus)
+{
+    if(cgroup_path[0] == '\0')
+        return false;
+
+    if(step < 0 || step >= CGROUP_NUM_QUOTA_STEPS)
+    {
+        fprintf(stderr, "scheduler: invalid quota step %d\n", step);
+        return false;
+    }
+
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/cpu.max", cgroup_path);
+
+    bool ok;
+    const int percent = CGROUP_QUOTA_STEPS[step];
+    if(percent >= 100)
+    {
+        ok = sysfs_write(path, "max %" PRIu64, QUOTA_PERIOD_USEC);
+    }
+    else
+    {
+        const uint64_t quota = QUOTA_PERIOD_USEC * num_cpus * percent / 100;
+        ok = sysfs_write(path, "%" PRIu64 " %" PRIu64, quota, QUOTA_PERIOD_USEC);
+    }
+
+    if(!ok)
+    {
+        perror("scheduler: failed to write cpu.max");
+        return false;
+    }
+
+    if(step != quota_step)
+        fprintf(stderr, "scheduler: cpu quota set to %d%% of %d cpus\n", percent, num_cpus);
+
+    quota_step = step;
+    return true;
+}
+
+int cgroup_quota_step()
+{
+    return quota_step;
+}
+
+auto cgroup_consume_stat() -> CgroupCpuStat
+{
+    if(cgroup_path[0] == '\0')
+        return CgroupCpuStat{};
+
+    const auto stat = read_cpu_stat();
+
+    CgroupCpuStat delta;
+    delta.nr_throttled = stat.nr_throttled - prev_stat.nr_throttled;
+    delta.throttled_usec = stat.throttled_usec - prev_stat.throttled_usec;
+    prev_stat = stat;
+    return delta;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// Bandwidth steps (in percentage of the cores of the current state)
+/// that may be selected as the CPU quota of the managed cgroup.
+constexpr int CGROUP_QUOTA_STEPS[] = { 100, 75, 50, 25 };
+
+/// Number of entries in `CGROUP_QUOTA_STEPS`.
+constexpr int CGROUP_NUM_QUOTA_STEPS = sizeof(CGROUP_QUOTA_STEPS) / sizeof(int);
+
+/// Throttling statistics of the managed cgroup (from its `cpu.stat`).
+struct CgroupCpuStat
+{
+    uint64_t nr_throttled = 0;
+    uint64_t throttled_usec = 0;
+};
+
+/// Initialises the cgroup subsystem.
+///
+/// Returns whether CPU bandwidth capping is enabled (see `SCHEDULER_CGROUP`).
+extern bool cgroup_init();
+
+/// Whether CPU bandwidth capping is enabled.
+extern bool cgroup_enabled();
+
+/// Gets the absolute path of the cgroup v2 group the process `pid` is in.
+extern bool cgroup_of_process(int pid, char* path, size_t size);
+
+/// Creates a cgroup v2 group for the process `pid` and moves it into it.
+extern bool cgroup_attach(int pid);
+
+/// Moves the managed process back to its original group (if still alive)
+/// and removes the group created by `cgroup_attach`.
+extern void cgroup_detach();
+
+/// Sets `cpu.max` of the managed group to `CGROUP_QUOTA_STEPS[step]` percent
+/// of `num_cpus` CPUs.
+extern bool cgroup_set_quota(int step, int num_cpus);
+
+/// Gets the quota step currently applied to the managed group.
+extern int cgroup_quota_step();
+
+/// Consumes the throttling statistics of the managed group.
+///
+/// A consume operation obtains counters as if they were reset during
+/// the previous consume operation.
+extern auto cgroup_consume_stat() -> CgroupCpuStat;
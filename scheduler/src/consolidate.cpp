@@ -0,0 +1,633 @@
+#include "consolidate.hpp"
+#include "sysfs.hpp"
+#include "time.hpp"
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+
+// Background consolidation.
+//
+// Unrelated processes and kernel threads still wake up on the cores of the
+// application and interfere with it. Every other user-space process is moved
+// into a cgroup v2 group whose cpuset is the background CPUs (processes they
+// fork later inherit it), kernel threads that cannot be moved into a group
+// get their affinity restricted instead (per-CPU ones refuse, as they must),
+// and every IRQ accepting it is steered to the background CPUs.
+//
+// Unless the background CPUs are given, they are the cluster the application
+// is not on: LITTLE while its state has big cores, big otherwise. The group,
+// the kernel threads and the IRQs follow whenever the state crosses over.
+//
+// The original group of every moved process, the affinity of every kernel
+// thread and the `smp_affinity` of every IRQ are saved and restored on stop.
+// Processes forked in the background group go back to the group of their
+// closest moved ancestor. Processes we could not keep track of are not moved.
+//
+// Interference is measured on the cluster of the application as the rate of
+// context switches and the variance of IPC between sampling windows,
+// separately before and after consolidation is applied.
+
+/// Maximum number of processes moved into the background group.
+constexpr int MAX_MOVED_PROCESSES = 4096;
+
+/// Maximum number of distinct cgroups processes are moved from.
+constexpr int MAX_ORIGINAL_CGROUPS = 128;
+
+/// Maximum number of kernel threads whose affinity is restricted.
+constexpr int MAX_KERNEL_THREADS = 1024;
+
+/// Maximum number of IRQs steered.
+constexpr int MAX_IRQS = 512;
+
+/// Maximum number of application processes excluded.
+constexpr int MAX_APP_PROCESSES = 64;
+
+/// Maximum depth searched for an ancestor of a process.
+constexpr int MAX_ANCESTRY_DEPTH = 32;
+
+struct MovedProcess
+{
+    int pid;
+    int cgroup;     //< index into `original_cgroups`
+};
+
+struct KernelThread
+{
+    int pid;
+    cpu_set_t mask;
+};
+
+struct SteeredIrq
+{
+    int irq;        //< -1 for `default_smp_affinity`
+    char original[80];
+};
+
+/// Interference statistics of one phase (before or after consolidation).
+struct PhaseStats
+{
+    uint64_t windows = 0;
+    uint64_t context_switches = 0;
+    uint64_t interval = 0;
+    double ipc_mean = 0.0;
+    double ipc_m2 = 0.0;        //< sum of squared deviations (Welford)
+    uint64_t ipc_windows = 0;
+
+    void add(const CounterSample& window, bool on_big);
+    double context_switch_rate() const;
+    double ipc_variance() const;
+};
+
+static bool is_enabled;
+static bool is_armed;
+static bool is_applied;
+static uint64_t apply_delay_ns;
+static uint64_t apply_time;
+static uint64_t background_mask;
+static char background_cpus[64];
+static bool background_explicit;
+static bool app_on_big;
+static char proc_root[PATH_MAX];
+static char cgroup_root[PATH_MAX];
+static char background_path[PATH_MAX + 32];
+static bool fake_root;
+
+static int app_pids[MAX_APP_PROCESSES];
+static int num_app_pids;
+
+static char original_cgroups[MAX_ORIGINAL_CGROUPS][PATH_MAX];
+static int num_original_cgroups;
+static MovedProcess moved[MAX_MOVED_PROCESSES];
+static int num_moved;
+static KernelThread kernel_threads[MAX_KERNEL_THREADS];
+static int num_kernel_threads;
+static SteeredIrq irqs[MAX_IRQS];
+static int num_irqs;
+
+static PhaseStats before;
+static PhaseStats after;
+
+void PhaseStats::add(const CounterSample& window, bool on_big)
+{
+    windows += 1;
+    context_switches += on_big? window.big_context_switches
+                              : window.context_switches - window.big_context_switches;
+    interval += window.interval;
+
+    const double cycles = on_big? window.big.get<Cycles>() : window.little.get<Cycles>();
+    if(cycles > 0)
+    {
+        const double instructions = on_big? window.big.get<Instructions>() : window.little.get<Instructions>();
+        const double ipc = instructions / cycles;
+        ipc_windows += 1;
+        const double delta = ipc - ipc_mean;
+        ipc_mean += delta / ipc_windows;
+        ipc_m2 += delta * (ipc - ipc_mean);
+    }
+}
+
+double PhaseStats::context_switch_rate() const
+{
+    return (interval > 0)? context_switches * 1e9 / interval : 0.0;
+}
+
+double PhaseStats::ipc_variance() const
+{
+    return (ipc_windows > 1)? ipc_m2 / (ipc_windows - 1) : 0.0;
+}
+
+/// Reads the parent of `pid` from its stat.
+static int read_parent(int pid)
+{
+    char path[PATH_MAX + 32];
+    char buffer[512];
+
+    snprintf(path, sizeof(path), "%s/%d/stat", proc_root, pid);
+    if(!sysfs_read(path, buffer, sizeof(buffer)))
+        return -1;
+
+    int ppid;
+    const char* p = strrchr(buffer, ')');
+    if(!p || sscanf(p + 2, "%*c %d", &ppid) != 1)
+        return -1;
+    return ppid;
+}
+
+/// Whether `pid` is us, the application or a descendant of either.
+static bool is_excluded(int pid)
+{
+    const int self = getpid();
+    for(int depth = 0; depth < MAX_ANCESTRY_DEPTH && pid > 1; ++depth)
+    {
+        if(pid == self)
+            return true;
+        for(int i = 0; i < num_app_pids; ++i)
+        {
+            if(pid == app_pids[i])
+                return true;
+        }
+        pid = read_parent(pid);
+    }
+    return false;
+}
+
+/// Reads the cgroup v2 path (relative to the root) of `pid`.
+static bool read_cgroup(int pid, char* out, size_t size)
+{
+    char path[PATH_MAX + 32];
+    char buffer[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%d/cgroup", proc_root, pid);
+    if(!sysfs_read(path, buffer, sizeof(buffer)))
+        return false;
+
+    for(char* line = strtok(buffer, "\n"); line; line = strtok(nullptr, "\n"))
+    {
+        if(!strncmp(line, "0::", 3))
+        {
+            snprintf(out, size, "%s", line + 3);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int intern_cgroup(const char* relative)
+{
+    for(int i = 0; i < num_original_cgroups; ++i)
+    {
+        if(!strcmp(original_cgroups[i], relative))
+            return i;
+    }
+
+    if(num_original_cgroups == MAX_ORIGINAL_CGROUPS)
+        return -1;
+
+    snprintf(original_cgroups[num_original_cgroups], PATH_MAX, "%s", relative);
+    return num_original_cgroups++;
+}
+
+/// Gets the background CPUs as an affinity mask.
+static void get_background_set(cpu_set_t& mask)
+{
+    CPU_ZERO(&mask);
+    for(int cpu = 0; cpu < 64; ++cpu)
+    {
+        if(background_mask & (uint64_t(1) << cpu))
+            CPU_SET(cpu, &mask);
+    }
+}
+
+/// Makes the background CPUs the cluster the application is not on, unless
+/// they were given.
+static void set_background_cluster(bool on_big)
+{
+    app_on_big = on_big;
+    if(background_explicit)
+        return;
+
+    if(on_big)
+        snprintf(background_cpus, sizeof(background_cpus), "%d-%d", START_INDEX_LITTLE, END_INDEX_LITTLE);
+    else
+        snprintf(background_cpus, sizeof(background_cpus), "%d-%d", START_INDEX_BIG, END_INDEX_BIG);
+    background_mask = sysfs_parse_cpu_list(background_cpus);
+}
+
+/// Gets the path of the `smp_affinity` of `irq`, or the default one if -1.
+static void get_irq_path(int irq, char* path, size_t size)
+{
+    if(irq == -1)
+        snprintf(path, size, "%s/irq/default_smp_affinity", proc_root);
+    else
+        snprintf(path, size, "%s/irq/%d/smp_affinity", proc_root, irq);
+}
+
+/// Restricts the affinity of a kernel thread, saving the original one.
+static void restrict_kernel_thread(int pid)
+{
+    // The pids of a fake tree are not the pids of this system.
+    if(fake_root || num_kernel_threads == MAX_KERNEL_THREADS)
+        return;
+
+    auto& entry = kernel_threads[num_kernel_threads];
+    if(sched_getaffinity(pid, sizeof(entry.mask), &entry.mask) == -1)
+        return;
+
+    cpu_set_t mask;
+    get_background_set(mask);
+    if(sched_setaffinity(pid, sizeof(mask), &mask) == 0)
+    {
+        entry.pid = pid;
+        ++num_kernel_threads;
+    }
+}
+
+static void move_processes()
+{
+    char path[PATH_MAX + 32];
+    char relative[PATH_MAX];
+
+    const char* background_relative = background_path + strlen(cgroup_root);
+
+    DIR* dir = opendir(proc_root);
+    if(!dir)
+    {
+        perror("scheduler: failed to list processes");
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/cgroup.procs", background_path);
+    while(auto entry = readdir(dir))
+    {
+        const int pid = atoi(entry->d_name);
+        if(pid <= 0 || is_excluded(pid))
+            continue;
+
+        if(!read_cgroup(pid, relative, sizeof(relative)) || !strcmp(relative, background_relative))
+            continue;
+
+        // A process we could not move back is better left where it is.
+        const int cgroup = (num_moved < MAX_MOVED_PROCESSES)? intern_cgroup(relative) : -1;
+        if(cgroup == -1)
+            continue;
+
+        // Kernel threads cannot leave the root group.
+        if(!sysfs_write(path, "%d", pid))
+        {
+            if(errno == EINVAL)
+                restrict_kernel_thread(pid);
+            continue;
+        }
+
+        moved[num_moved++] = MovedProcess{pid, cgroup};
+    }
+
+    closedir(dir);
+}
+
+/// Writes the background CPUs as the hexadecimal mask of an `smp_affinity`.
+static bool steer_irq(const char* path, int irq)
+{
+    if(num_irqs == MAX_IRQS)
+        return false;
+
+    auto& entry = irqs[num_irqs];
+    if(!sysfs_read(path, entry.original, sizeof(entry.original)))
+        return false;
+    entry.original[strcspn(entry.original, "\n")] = '\0';
+
+    // Unmovable IRQs refuse the write (EIO).
+    if(!sysfs_write(path, "%llx", (unsigned long long) background_mask))
+        return false;
+
+    entry.irq = irq;
+    ++num_irqs;
+    return true;
+}
+
+static void steer_irqs()
+{
+    char path[PATH_MAX + 64];
+
+    get_irq_path(-1, path, sizeof(path));
+    steer_irq(path, -1);
+
+    snprintf(path, sizeof(path), "%s/irq", proc_root);
+    DIR* dir = opendir(path);
+    if(!dir)
+        return;
+
+    while(auto entry = readdir(dir))
+    {
+        if(entry->d_name[0] < '0' || entry->d_name[0] > '9')
+            continue;
+
+        const int irq = atoi(entry->d_name);
+        get_irq_path(irq, path, sizeof(path));
+        steer_irq(path, irq);
+    }
+
+    closedir(dir);
+}
+
+static void apply()
+{
+    char path[PATH_MAX + 64];
+
+    // Delegate the cpuset controller to the children of the root. This fails
+    // harmlessly when it is already delegated.
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgroup_root);
+    sysfs_write(path, "+cpuset");
+
+    snprintf(background_path, sizeof(background_path), "%s/scheduler.background", cgroup_root);
+    if(mkdir(background_path, 0755) == -1 && errno != EEXIST)
+    {
+        perror("scheduler: failed to create background cgroup");
+        background_path[0] = '\0';
+    }
+    else
+    {
+        snprintf(path, sizeof(path), "%s/cpuset.cpus", background_path);
+        if(!sysfs_write(path, "%s", background_cpus))
+            perror("scheduler: failed to write cpuset.cpus");
+        move_processes();
+    }
+
+    steer_irqs();
+
+    is_applied = true;
+    apply_time = get_time();
+    fprintf(stderr, "scheduler: consolidated %d processes, %d kernel threads and %d irqs onto cpus %s\n",
+            num_moved, num_kernel_threads, num_irqs, background_cpus);
+}
+
+/// Moves the background group, kernel threads and IRQs already consolidated
+/// onto the current background CPUs.
+static void retarget()
+{
+    char path[PATH_MAX + 64];
+
+    if(background_path[0] != '\0')
+    {
+        snprintf(path, sizeof(path), "%s/cpuset.cpus", background_path);
+        if(!sysfs_write(path, "%s", background_cpus))
+            perror("scheduler: failed to write cpuset.cpus");
+    }
+
+    cpu_set_t mask;
+    get_background_set(mask);
+    for(int i = 0; i < num_kernel_threads; ++i)
+        sched_setaffinity(kernel_threads[i].pid, sizeof(mask), &mask);
+
+    for(int i = 0; i < num_irqs; ++i)
+    {
+        get_irq_path(irqs[i].irq, path, sizeof(path));
+        sysfs_write(path, "%llx", (unsigned long long) background_mask);
+    }
+
+    fprintf(stderr, "scheduler: background moved onto cpus %s\n", background_cpus);
+}
+
+/// Gets the original group of a process forked in the background group,
+/// which is that of its closest moved ancestor, or -1.
+static int find_original_cgroup(int pid)
+{
+    for(int depth = 0; depth < MAX_ANCESTRY_DEPTH && pid > 1; ++depth)
+    {
+        for(int i = 0; i < num_moved; ++i)
+        {
+            if(moved[i].pid == pid)
+                return moved[i].cgroup;
+        }
+        pid = read_parent(pid);
+    }
+    return -1;
+}
+
+static void report()
+{
+    char filename[64];
+    sprintf(filename, "scheduler_%d.consolidate", getpid());
+
+    FILE* stream = fopen(filename, "w");
+    if(stream)
+        fprintf(stream, "phase,windows,context_switches_per_sec,ipc_mean,ipc_variance\n");
+
+    const PhaseStats* phases[] = { &before, &after };
+    const char* names[] = { "before", "after" };
+    for(int i = 0; i < 2; ++i)
+    {
+        const auto& stats = *phases[i];
+        fprintf(stderr, "scheduler: %s consolidation: %" PRIu64 " windows, %.1lf context switches/s, "
+                        "ipc %.3lf (variance %.5lf)\n",
+                names[i], stats.windows, stats.context_switch_rate(), stats.ipc_mean, stats.ipc_variance());
+        if(stream)
+        {
+            fprintf(stream, "%s,%" PRIu64 ",%.2lf,%.4lf,%.6lf\n", names[i], stats.windows,
+                    stats.context_switch_rate(), stats.ipc_mean, stats.ipc_variance());
+        }
+    }
+
+    if(stream)
+        fclose(stream);
+}
+
+bool consolidate_init()
+{
+    is_enabled = false;
+    is_armed = false;
+    is_applied = false;
+    apply_delay_ns = 2000 * 1000000ull;
+    background_explicit = false;
+    set_background_cluster(true);
+
+    if(auto s = std::getenv("SCHEDULER_CONSOLIDATE"))
+    {
+        if(!strcmp(s, "true") || !strcmp(s, "1"))
+            is_enabled = true;
+        else if(strcmp(s, "false") && strcmp(s, "0"))
+            fprintf(stderr, "scheduler: Unrecognized SCHEDULER_CONSOLIDATE: %s\n", s);
+    }
+
+    if(!is_enabled)
+        return false;
+
+    if(auto s = std::getenv("SCHEDULER_CONSOLIDATE_CPUS"))
+    {
+        snprintf(background_cpus, sizeof(background_cpus), "%s", s);
+        background_explicit = true;
+    }
+
+    if(auto s = std::getenv("SCHEDULER_CONSOLIDATE_AFTER_MS"))
+        apply_delay_ns = strtoull(s, nullptr, 10) * 1000000ull;
+
+    const char* root = std::getenv("SCHEDULER_CONSOLIDATE_ROOT");
+    fake_root = (root && root[0]);
+    if(!fake_root)
+        root = "";
+
+    snprintf(proc_root, sizeof(proc_root), "%s/proc", root);
+    if(!fake_root && std::getenv("SCHEDULER_CGROUP_ROOT"))
+        snprintf(cgroup_root, sizeof(cgroup_root), "%s", std::getenv("SCHEDULER_CGROUP_ROOT"));
+    else
+        snprintf(cgroup_root, sizeof(cgroup_root), "%s/sys/fs/cgroup", root);
+
+    background_mask = sysfs_parse_cpu_list(background_cpus);
+    if(background_mask == 0)
+    {
+        fprintf(stderr, "scheduler: invalid SCHEDULER_CONSOLIDATE_CPUS: %s\n", background_cpus);
+        is_enabled = false;
+        return false;
+    }
+
+    fprintf(stderr, "scheduler: background consolidation onto cpus %s%s%s\n",
+            background_explicit? background_cpus : "of the cluster the application is not on",
+            fake_root? " under " : "", fake_root? root : "");
+    return true;
+}
+
+bool consolidate_enabled()
+{
+    return is_enabled;
+}
+
+void consolidate_start(const int* pids, int num_pids, uint64_t start_time)
+{
+    if(!is_enabled)
+        return;
+
+    num_app_pids = 0;
+    for(int i = 0; i < num_pids && num_app_pids < MAX_APP_PROCESSES; ++i)
+        app_pids[num_app_pids++] = pids[i];
+
+    before = PhaseStats{};
+    after = PhaseStats{};
+    num_original_cgroups = 0;
+    num_moved = 0;
+    num_kernel_threads = 0;
+    num_irqs = 0;
+    background_path[0] = '\0';
+    apply_time = start_time + apply_delay_ns;
+    is_applied = false;
+    is_armed = true;
+
+    if(apply_delay_ns == 0)
+        apply();
+}
+
+void consolidate_observe(const CounterSample& window, int num_big)
+{
+    if(!is_armed)
+        return;
+
+    const bool on_big = (num_big > 0);
+    if(on_big != app_on_big)
+    {
+        set_background_cluster(on_big);
+        if(is_applied && !background_explicit)
+            retarget();
+    }
+
+    // A window straddling the switch belongs to neither phase.
+    if(!is_applied)
+    {
+        if(window.time < apply_time)
+            before.add(window, on_big);
+        else
+            apply();
+    }
+    else if(window.time - window.interval >= apply_time)
+    {
+        after.add(window, on_big);
+    }
+}
+
+void consolidate_stop()
+{
+    if(!is_armed)
+        return;
+
+    char path[PATH_MAX + 64];
+
+    for(int i = 0; i < num_moved; ++i)
+    {
+        snprintf(path, sizeof(path), "%s%s/cgroup.procs", cgroup_root, original_cgroups[moved[i].cgroup]);
+        if(!sysfs_write(path, "%d", moved[i].pid) && errno != ESRCH)
+            fprintf(stderr, "scheduler: failed to move %d back to %s: %s\n",
+                    moved[i].pid, original_cgroups[moved[i].cgroup], strerror(errno));
+    }
+
+    if(background_path[0] != '\0')
+    {
+        // Processes forked in the background group since go where their
+        // ancestor came from, or to the root if it is gone.
+        char buffer[8192];
+        snprintf(path, sizeof(path), "%s/cgroup.procs", background_path);
+        if(sysfs_read(path, buffer, sizeof(buffer)))
+        {
+            for(char* line = strtok(buffer, "\n"); line; line = strtok(nullptr, "\n"))
+            {
+                const int cgroup = find_original_cgroup(atoi(line));
+                snprintf(path, sizeof(path), "%s%s/cgroup.procs", cgroup_root,
+                         (cgroup == -1)? "" : original_cgroups[cgroup]);
+                sysfs_write(path, "%s", line);
+            }
+        }
+
+        if(rmdir(background_path) == -1 && !fake_root)
+            perror("scheduler: failed to remove background cgroup");
+        background_path[0] = '\0';
+    }
+
+    for(int i = 0; i < num_kernel_threads; ++i)
+        sched_setaffinity(kernel_threads[i].pid, sizeof(kernel_threads[i].mask), &kernel_threads[i].mask);
+
+    for(int i = 0; i < num_irqs; ++i)
+    {
+        get_irq_path(irqs[i].irq, path, sizeof(path));
+        if(!sysfs_write(path, "%s", irqs[i].original))
+            fprintf(stderr, "scheduler: failed to restore irq %d affinity\n", irqs[i].irq);
+    }
+
+    if(is_applied)
+    {
+        fprintf(stderr, "scheduler: restored %d processes, %d kernel threads and %d irqs\n",
+                num_moved, num_kernel_threads, num_irqs);
+    }
+
+    report();
+
+    num_moved = 0;
+    num_kernel_threads = 0;
+    num_irqs = 0;
+    is_armed = false;
+    is_applied = false;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include "sampler.hpp"
+
+/// Initialises background consolidation.
+///
+/// When `SCHEDULER_CONSOLIDATE=1`, every task not belonging to the
+/// application (nor to us) is confined to `SCHEDULER_CONSOLIDATE_CPUS` (by
+/// default the cluster the application is not on, following its state)
+/// through a cgroup v2 cpuset, and every movable IRQ is steered to those
+/// CPUs. `SCHEDULER_CONSOLIDATE_ROOT` prefixes every
+/// /proc and /sys path, so a fake tree can be used for testing.
+///
+/// Returns whether consolidation is enabled.
+extern bool consolidate_init();
+
+/// Whether background consolidation is enabled.
+extern bool consolidate_enabled();
+
+/// Arms consolidation for an application made of the processes `pids`
+/// (and their descendants) started at `start_time`.
+///
+/// Consolidation is applied `SCHEDULER_CONSOLIDATE_AFTER_MS` (2000ms by
+/// default) later, so interference is measured both before and after it.
+extern void consolidate_start(const int* pids, int num_pids, uint64_t start_time);
+
+/// Accounts the interference seen in `window` (context switches and IPC of
+/// the cluster of the application, which has `num_big` big cores in its
+/// current state), applying consolidation once its delay has elapsed.
+extern void consolidate_observe(const CounterSample& window, int num_big);
+
+/// Moves every task and IRQ back where it was and reports the interference
+/// measured before and after consolidation.
+extern void consolidate_stop();
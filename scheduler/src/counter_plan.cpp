@@ -0,0 +1,210 @@
+#include "counter_plan.hpp"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Counter-group planner.
+//
+// A PMU only counts as many events at once as it has programmable counters,
+// and some events can only be counted by specific counters. Every episode of
+// a collection run measures one group, so the number of groups is the number
+// of times the application has to be run.
+//
+// Events are placed tightest first (fewest eligible counters) on the first
+// group with room for them. Whether an event fits in a group is decided by a
+// bipartite matching between the events of the group and the counters, so an
+// event already placed may be moved to another counter to make room.
+
+/// Counters able to count `event` on `pmu`.
+static auto eligible_counters(const PmuConstraints& pmu, const PmuEvent& event) -> uint32_t
+{
+    const uint32_t all = (1u << pmu.num_counters) - 1;
+    return event.counter_mask? (event.counter_mask & all) : all;
+}
+
+static int popcount(uint32_t mask)
+{
+    int count = 0;
+    for(; mask; mask &= mask - 1)
+        ++count;
+    return count;
+}
+
+/// Tries to place the event at `index` of `group` on a counter, moving the
+/// other events of the group around if needed.
+static bool place_event(const PmuConstraints& pmu, CounterGroup& group,
+                        int* occupant, int index, uint32_t& visited)
+{
+    const auto mask = eligible_counters(pmu, *group.events[index]);
+    for(int c = 0; c < pmu.num_counters; ++c)
+    {
+        if(!(mask & (1u << c)) || (visited & (1u << c)))
+            continue;
+
+        visited |= 1u << c;
+        if(occupant[c] == -1 || place_event(pmu, group, occupant, occupant[c], visited))
+        {
+            occupant[c] = index;
+            group.counters[index] = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Adds `event` to `group` if it can be scheduled together with the others.
+static bool try_add(const PmuConstraints& pmu, CounterGroup& group, const PmuEvent* event)
+{
+    if(group.num_events == pmu.num_counters)
+        return false;
+
+    int occupant[PLAN_MAX_COUNTERS];
+    std::fill(occupant, occupant + PLAN_MAX_COUNTERS, -1);
+    for(int i = 0; i < group.num_events; ++i)
+        occupant[group.counters[i]] = i;
+
+    const auto saved = group;
+    const int index = group.num_events++;
+    group.events[index] = event;
+
+    uint32_t visited = 0;
+    if(!place_event(pmu, group, occupant, index, visited))
+    {
+        group = saved;
+        return false;
+    }
+    return true;
+}
+
+int plan_select_events(const PmuEvent* catalogue, int catalogue_size,
+                       const char* spec, const PmuEvent** selected,
+                       int max_selected)
+{
+    int count = 0;
+
+    if(!spec)
+    {
+        for(int i = 0; i < catalogue_size && count < max_selected; ++i)
+            selected[count++] = &catalogue[i];
+        return count;
+    }
+
+    char buffer[1024];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+
+    char* saveptr;
+    for(char* token = strtok_r(buffer, ", ", &saveptr); token; token = strtok_r(nullptr, ", ", &saveptr))
+    {
+        char* end;
+        const uint64_t code = strtoull(token, &end, 0);
+        const bool is_code = (*end == '\0');
+
+        const PmuEvent* event = nullptr;
+        for(int i = 0; i < catalogue_size && !event; ++i)
+        {
+            if(is_code? catalogue[i].code == code : !strcasecmp(catalogue[i].name, token))
+                event = &catalogue[i];
+        }
+
+        if(!event)
+        {
+            fprintf(stderr, "scheduler: unknown event %s\n", token);
+            return -1;
+        }
+
+        if(count == max_selected)
+        {
+            fprintf(stderr, "scheduler: too many events selected\n");
+            return -1;
+        }
+
+        selected[count++] = event;
+    }
+
+    return count;
+}
+
+bool plan_counter_groups(const PmuConstraints& pmu,
+                         const PmuEvent* const* events, int num_events,
+                         CounterPlan& plan)
+{
+    if(pmu.num_counters <= 0 || pmu.num_counters > PLAN_MAX_COUNTERS)
+    {
+        fprintf(stderr, "scheduler: %s has an unsupported number of counters\n", pmu.name);
+        return false;
+    }
+
+    // Drop the cycle counter (always counted) and duplicates.
+    const PmuEvent* order[PLAN_MAX_GROUPS * PLAN_MAX_COUNTERS];
+    int num_order = 0;
+    for(int i = 0; i < num_events; ++i)
+    {
+        const auto event = events[i];
+        if(event->code == pmu.cycles_code)
+            continue;
+        if(std::any_of(order, order + num_order, [&](const PmuEvent* e) { return e->code == event->code; }))
+            continue;
+
+        if(eligible_counters(pmu, *event) == 0)
+        {
+            fprintf(stderr, "scheduler: event %s cannot be counted on %s\n", event->name, pmu.name);
+            return false;
+        }
+
+        if(num_order == PLAN_MAX_GROUPS * PLAN_MAX_COUNTERS)
+        {
+            fprintf(stderr, "scheduler: too many events to plan on %s\n", pmu.name);
+            return false;
+        }
+
+        order[num_order++] = event;
+    }
+
+    std::stable_sort(order, order + num_order, [&](const PmuEvent* a, const PmuEvent* b) {
+        return popcount(eligible_counters(pmu, *a)) < popcount(eligible_counters(pmu, *b));
+    });
+
+    plan.num_groups = 0;
+    for(int i = 0; i < num_order; ++i)
+    {
+        bool placed = false;
+        for(int g = 0; g < plan.num_groups && !placed; ++g)
+            placed = try_add(pmu, plan.groups[g], order[i]);
+
+        if(!placed)
+        {
+            if(plan.num_groups == PLAN_MAX_GROUPS)
+            {
+                fprintf(stderr, "scheduler: too many counter groups needed on %s\n", pmu.name);
+                return false;
+            }
+
+            auto& group = plan.groups[plan.num_groups++];
+            group.num_events = 0;
+            try_add(pmu, group, order[i]);
+        }
+    }
+
+    std::stable_sort(plan.groups, plan.groups + plan.num_groups,
+                     [](const CounterGroup& a, const CounterGroup& b) {
+                         return a.num_events > b.num_events;
+                     });
+
+    fprintf(stderr, "scheduler: planned %d events in %d groups of %d counters on %s\n",
+            num_order, plan.num_groups, pmu.num_counters, pmu.name);
+
+    return true;
+}
+
+void plan_group_label(const CounterGroup& group, char* buffer, size_t size)
+{
+    size_t length = 0;
+    buffer[0] = '\0';
+    for(int i = 0; i < group.num_events && length < size; ++i)
+    {
+        length += snprintf(buffer + length, size - length, "%s0x%02" PRIX64,
+                           i? "_" : "", group.events[i]->code);
+    }
+}
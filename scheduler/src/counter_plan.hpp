@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// Maximum number of programmable counters of a PMU.
+constexpr int PLAN_MAX_COUNTERS = 8;
+
+/// Maximum number of groups (collection episodes) of a plan.
+constexpr int PLAN_MAX_GROUPS = 64;
+
+/// A named hardware event.
+struct PmuEvent
+{
+    const char* name;
+    uint64_t code;
+    /// Programmable counters able to count this event (bit `i` for counter
+    /// `i`), or zero if any of them can.
+    uint32_t counter_mask;
+};
+
+/// Counting constraints of a core type.
+struct PmuConstraints
+{
+    const char* name;
+    /// Number of programmable counters.
+    int num_counters;
+    /// Event counted by the fixed cycle counter. It leads every group, so it
+    /// is never planned on a programmable counter.
+    uint64_t cycles_code;
+};
+
+/// Events counted together during one collection episode.
+struct CounterGroup
+{
+    int num_events;
+    const PmuEvent* events[PLAN_MAX_COUNTERS];
+    /// Programmable counter each event has been placed on.
+    int counters[PLAN_MAX_COUNTERS];
+};
+
+/// Groups to be collected, in rotation order.
+struct CounterPlan
+{
+    int num_groups;
+    CounterGroup groups[PLAN_MAX_GROUPS];
+};
+
+/// Selects events from `catalogue` given a comma separated list `spec` of
+/// event names or raw codes. The whole catalogue is selected if `spec` is null.
+///
+/// Returns the number of events selected, or -1 on error.
+extern int plan_select_events(const PmuEvent* catalogue, int catalogue_size,
+                              const char* spec, const PmuEvent** selected,
+                              int max_selected);
+
+/// Packs `events` into as few groups as the constraints of `pmu` allow.
+///
+/// Events restricted to specific counters are placed first. Groups are
+/// ordered fullest first, so a partially filled group is collected last.
+extern bool plan_counter_groups(const PmuConstraints& pmu,
+                                const PmuEvent* const* events, int num_events,
+                                CounterPlan& plan);
+
+/// Writes the codes of the events of `group` as `0x01_0x02_...`.
+extern void plan_group_label(const CounterGroup& group, char* buffer, size_t size);
@@ -0,0 +1,355 @@
+#include "daemon.hpp"
+#include "housekeeping.hpp"
+#include "perf.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "time.hpp"
+
+// System-wide daemon mode.
+//
+// The CPU time of every process is read from /proc/<pid>/stat once per
+// period, which is the only cost an idle process has. The hottest processes
+// get disjoint big cores, so they neither fight each other nor share their
+// cores with anything else, while every other active process is moved onto
+// the LITTLE cluster. The original affinity of a process is saved the first
+// time we touch it and restored on exit.
+
+/// Maximum number of processes tracked at once.
+constexpr int MAX_PROCESSES = 4096;
+
+/// Minimum usage (percentage of a core) for a process to be managed.
+constexpr double MIN_MANAGED_USAGE = 10.0;
+
+/// Maximum number of processes managed at once.
+constexpr int MAX_TOP_K = 16;
+
+/// `PF_KTHREAD` from the flags of /proc/<pid>/stat.
+constexpr unsigned long PF_KTHREAD = 0x00200000;
+
+struct ProcEntry
+{
+    int pid = 0;
+    uint64_t start_time = 0;    //< to detect reused pids
+    uint64_t cpu_time = 0;      //< utime + stime at the last scan, in ticks
+    double usage = 0.0;         //< percentage of a core over the last period
+    bool touched = false;       //< whether `original` holds a saved affinity
+    bool managed = false;
+    cpu_set_t original;         //< affinity before we touched it
+    cpu_set_t applied;          //< affinity we last applied
+};
+
+static ProcEntry tables[2][MAX_PROCESSES];
+static int table_sizes[2];
+static int curr_table;
+
+static volatile sig_atomic_t stop_requested;
+
+static void stop_handler(int)
+{
+    stop_requested = 1;
+}
+
+/// Parses the fields we need from /proc/<pid>/stat.
+static bool read_proc_stat(int pid, int& ppid, unsigned long& flags, uint64_t& cpu_time, uint64_t& start_time)
+{
+    char path[64];
+    char buffer[1024];
+
+    sprintf(path, "/proc/%d/stat", pid);
+    FILE* stream = fopen(path, "r");
+    if(!stream)
+        return false;
+
+    const bool ok = fgets(buffer, sizeof(buffer), stream) != nullptr;
+    fclose(stream);
+    if(!ok)
+        return false;
+
+    // The command name may contain spaces and parentheses.
+    const char* p = strrchr(buffer, ')');
+    if(!p)
+        return false;
+
+    unsigned long long utime, stime, starttime;
+    if(sscanf(p + 2, "%*c %d %*d %*d %*d %*d %lu %*u %*u %*u %*u %llu %llu "
+                     "%*d %*d %*d %*d %*d %*d %llu",
+              &ppid, &flags, &utime, &stime, &starttime) != 5)
+        return false;
+
+    cpu_time = utime + stime;
+    start_time = starttime;
+    return true;
+}
+
+/// Finds the entry of `pid` in the previous table.
+static auto find_prev(int pid) -> ProcEntry*
+{
+    // The previous table is sorted by pid at the end of its scan.
+    const auto first = tables[curr_table ^ 1];
+    const auto last = first + table_sizes[curr_table ^ 1];
+    const auto it = std::lower_bound(first, last, pid, [](const ProcEntry& e, int p) { return e.pid < p; });
+    return (it != last && it->pid == pid)? it : nullptr;
+}
+
+/// Applies `mask` to every thread of `entry`, saving its original affinity.
+static void apply_mask(ProcEntry& entry, const cpu_set_t& mask)
+{
+    if(entry.touched && CPU_EQUAL(&entry.applied, &mask))
+        return;
+
+    if(!entry.touched)
+    {
+        if(sched_getaffinity(entry.pid, sizeof(entry.original), &entry.original) == -1)
+            return;
+        entry.touched = true;
+    }
+
+    char path[64];
+    sprintf(path, "/proc/%d/task", entry.pid);
+    if(DIR* dir = opendir(path))
+    {
+        while(auto task = readdir(dir))
+        {
+            if(task->d_name[0] != '.')
+                sched_setaffinity(atoi(task->d_name), sizeof(mask), &mask);
+        }
+        closedir(dir);
+    }
+
+    entry.applied = mask;
+}
+
+static void restore_mask(const ProcEntry& entry)
+{
+    char path[64];
+    sprintf(path, "/proc/%d/task", entry.pid);
+    if(DIR* dir = opendir(path))
+    {
+        while(auto task = readdir(dir))
+        {
+            if(task->d_name[0] != '.')
+                sched_setaffinity(atoi(task->d_name), sizeof(entry.original), &entry.original);
+        }
+        closedir(dir);
+    }
+}
+
+/// Reads the CPU usage of every process into the current table.
+static void scan(double period_ticks)
+{
+    auto& table = tables[curr_table];
+    int& size = table_sizes[curr_table];
+    size = 0;
+
+    DIR* dir = opendir("/proc");
+    if(!dir)
+    {
+        perror("scheduler: failed to scan /proc");
+        return;
+    }
+
+    // Neither init, kernel threads nor ourselves (and the helpers we run)
+    // are ever moved.
+    const int self = getpid();
+    while(auto proc = readdir(dir))
+    {
+        const int pid = atoi(proc->d_name);
+        if(pid <= 1 || pid == self || size == MAX_PROCESSES)
+            continue;
+
+        int ppid;
+        unsigned long flags;
+        uint64_t cpu_time, start_time;
+        if(!read_proc_stat(pid, ppid, flags, cpu_time, start_time)
+        || (flags & PF_KTHREAD) || ppid == self)
+            continue;
+
+        auto& entry = table[size++];
+        const auto prev = find_prev(pid);
+        if(prev && prev->start_time == start_time)
+        {
+            entry = *prev;
+            entry.usage = 100.0 * (cpu_time - prev->cpu_time) / period_ticks;
+        }
+        else
+        {
+            entry = ProcEntry{};
+            entry.pid = pid;
+            entry.start_time = start_time;
+        }
+        entry.cpu_time = cpu_time;
+    }
+
+    closedir(dir);
+    std::sort(table, table + size, [](const ProcEntry& a, const ProcEntry& b) { return a.pid < b.pid; });
+}
+
+bool daemon_requested(char* argv[])
+{
+    return argv[0] && !strcmp(argv[0], "--daemon");
+}
+
+int daemon_run()
+{
+    uint64_t period_ms = 1000;
+    int top_k = 4;
+
+    if(auto s = std::getenv("SCHEDULER_DAEMON_PERIOD_MS"))
+        period_ms = std::max(1ull, strtoull(s, nullptr, 10));
+    if(auto s = std::getenv("SCHEDULER_DAEMON_TOP_K"))
+    {
+        top_k = atoi(s);
+        if(top_k < 1 || top_k > MAX_TOP_K)
+        {
+            fprintf(stderr, "scheduler: SCHEDULER_DAEMON_TOP_K must be between 1 and %d\n", MAX_TOP_K);
+            top_k = std::min(MAX_TOP_K, std::max(1, top_k));
+        }
+    }
+
+    const int hk_cpu = housekeeping_cpu();
+
+    cpu_set_t little_mask;
+    CPU_ZERO(&little_mask);
+    for(int cpu = START_INDEX_LITTLE; cpu <= END_INDEX_LITTLE; ++cpu)
+    {
+        if(cpu != hk_cpu)
+            CPU_SET(cpu, &little_mask);
+    }
+
+    int big_cores[END_INDEX_BIG - START_INDEX_BIG + 1];
+    int num_big_cores = 0;
+    for(int cpu = START_INDEX_BIG; cpu <= END_INDEX_BIG; ++cpu)
+    {
+        if(cpu != hk_cpu)
+            big_cores[num_big_cores++] = cpu;
+    }
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    fprintf(stderr, "scheduler: daemon managing the %d hottest processes every %llums\n",
+            top_k, (unsigned long long) period_ms);
+
+    const double ticks_per_sec = sysconf(_SC_CLK_TCK);
+    uint64_t num_scans = 0;
+    uint64_t total_overhead_usec = 0;
+    uint64_t start_time = get_time();
+    uint64_t prev_time = start_time;
+    table_sizes[0] = table_sizes[1] = 0;
+
+    while(!stop_requested)
+    {
+        usleep(period_ms * 1000);
+
+        struct rusage usage_before;
+        getrusage(RUSAGE_SELF, &usage_before);
+
+        const uint64_t now = get_time();
+        const double period_ticks = std::max(1.0, (now - prev_time) * 1e-9 * ticks_per_sec);
+        prev_time = now;
+
+        curr_table ^= 1;
+        scan(period_ticks);
+
+        auto& table = tables[curr_table];
+        const int size = table_sizes[curr_table];
+
+        // Select the hottest processes.
+        ProcEntry* hottest[MAX_TOP_K];
+        int num_hottest = 0;
+        for(int i = 0; i < size; ++i)
+        {
+            table[i].managed = false;
+            if(table[i].usage < MIN_MANAGED_USAGE)
+                continue;
+
+            if(num_hottest < top_k)
+                hottest[num_hottest++] = &table[i];
+            else if(table[i].usage > hottest[num_hottest - 1]->usage)
+                hottest[num_hottest - 1] = &table[i];
+            else
+                continue;
+
+            std::sort(hottest, hottest + num_hottest,
+                      [](const ProcEntry* a, const ProcEntry* b) { return a->usage > b->usage; });
+        }
+
+        // Hand out the big cores, hottest first.
+        int next_big = 0;
+        for(int i = 0; i < num_hottest && next_big < num_big_cores; ++i)
+        {
+            const int wanted = std::max(1, (int) std::ceil(hottest[i]->usage / 100.0));
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            for(int c = 0; c < wanted && next_big < num_big_cores; ++c)
+                CPU_SET(big_cores[next_big++], &mask);
+
+            hottest[i]->managed = true;
+            apply_mask(*hottest[i], mask);
+        }
+
+        // Consolidate everything else that is active onto LITTLE.
+        for(int i = 0; i < size; ++i)
+        {
+            if(!table[i].managed && table[i].usage > 0.0)
+                apply_mask(table[i], little_mask);
+        }
+
+        struct rusage usage_after;
+        getrusage(RUSAGE_SELF, &usage_after);
+        const auto to_usec = [](const struct timeval& tv) { return tv.tv_sec * 1000000ull + tv.tv_usec; };
+        total_overhead_usec += (to_usec(usage_after.ru_utime) + to_usec(usage_after.ru_stime))
+                             - (to_usec(usage_before.ru_utime) + to_usec(usage_before.ru_stime));
+        num_scans += 1;
+
+        if(num_scans % 60 == 0)
+        {
+            fprintf(stderr, "scheduler: daemon scanned %d processes, managing %d, overhead %.3lf%% of a core\n",
+                    size, num_hottest, total_overhead_usec / (std::max<uint64_t>(1, to_millis(get_time() - start_time)) * 10.0));
+        }
+    }
+
+    // Restore every process we touched that is still the same process.
+    int num_restored = 0;
+    for(int i = 0, n = table_sizes[curr_table]; i < n; ++i)
+    {
+        const auto& entry = tables[curr_table][i];
+        int ppid;
+        unsigned long flags;
+        uint64_t cpu_time, start_time;
+        if(entry.touched && read_proc_stat(entry.pid, ppid, flags, cpu_time, start_time)
+        && start_time == entry.start_time)
+        {
+            restore_mask(entry);
+            num_restored += 1;
+        }
+    }
+
+    const uint64_t elapsed_ms = std::max<uint64_t>(1, to_millis(get_time() - start_time));
+
+    char filename[64];
+    sprintf(filename, "scheduler_%d.daemon", getpid());
+    if(FILE* stream = fopen(filename, "w"))
+    {
+        fprintf(stream, "scans,elapsed_ms,overhead_ms,overhead_pct,restored\n");
+        fprintf(stream, "%llu,%llu,%.3lf,%.4lf,%d\n",
+                (unsigned long long) num_scans, (unsigned long long) elapsed_ms,
+                total_overhead_usec / 1000.0, total_overhead_usec / (elapsed_ms * 10.0),
+                num_restored);
+        fclose(stream);
+    }
+
+    fprintf(stderr, "scheduler: daemon stopped, %d processes restored, overhead %.3lf%% of a core\n",
+            num_restored, total_overhead_usec / (elapsed_ms * 10.0));
+    return 0;
+}
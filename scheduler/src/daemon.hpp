@@ -0,0 +1,19 @@
+#pragma once
+
+/// Whether the application arguments request the system-wide daemon mode
+/// (`--daemon`).
+extern bool daemon_requested(char* argv[]);
+
+/// Runs the daemon until SIGINT or SIGTERM, then restores the affinity of
+/// every process it touched.
+///
+/// Every `SCHEDULER_DAEMON_PERIOD_MS` (1000ms by default) the CPU usage of
+/// every process is sampled from /proc. The `SCHEDULER_DAEMON_TOP_K` (4 by
+/// default) hottest ones are managed: each gets dedicated big cores out of
+/// the global budget (the big cluster) as its usage requires and the budget
+/// allows. Every other active process is consolidated onto the LITTLE
+/// cluster. Idle processes, init, kernel threads and the scheduler (and its
+/// children) are never touched.
+///
+/// Returns the exit code of the scheduler.
+extern int daemon_run();
@@ -0,0 +1,139 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+#include <utility>
+
+// Compile-time event sets.
+//
+// An event set is a list of event tags, each one a type providing its perf
+// `type`, its `code` and its `name()`. The set is opened as a single perf
+// group in the order of its tags (the first one leading), so a group read
+// without PERF_FORMAT_ID lays the values out in that same order. Offsets
+// and deltas are therefore resolved at compile time, and counts are
+// accessed by tag instead of by position.
+
+namespace event_set_detail
+{
+    template<class E, class... Events>
+    struct IndexOf;
+
+    template<class E, class... Events>
+    struct IndexOf<E, E, Events...> : std::integral_constant<size_t, 0> {};
+
+    template<class E, class F, class... Events>
+    struct IndexOf<E, F, Events...> : std::integral_constant<size_t, 1 + IndexOf<E, Events...>::value> {};
+}
+
+/// Writes `count` values formatted with `fmt` one after the other.
+inline void format_counts(char* buffer, size_t size, const uint64_t* values,
+                          size_t count, const char* fmt)
+{
+    size_t length = 0;
+    buffer[0] = '\0';
+    for(size_t i = 0; i < count && length < size; ++i)
+        length += snprintf(&buffer[length], size - length, fmt, (double) values[i]);
+}
+
+template<class... Events>
+struct EventSet
+{
+    static constexpr size_t size = sizeof...(Events);
+
+    /// Layout of a group read (PERF_FORMAT_GROUP without PERF_FORMAT_ID).
+    struct ReadFormat
+    {
+        uint64_t nr;
+        uint64_t values[size];
+    };
+
+    uint64_t values[size] = {};
+
+    /// Count of the event `E`.
+    template<class E>
+    uint64_t get() const
+    {
+        return values[event_set_detail::IndexOf<E, Events...>::value];
+    }
+
+    static uint32_t type(size_t i)
+    {
+        static constexpr uint32_t types[] = {Events::type...};
+        return types[i];
+    }
+
+    static uint64_t code(size_t i)
+    {
+        static constexpr uint64_t codes[] = {Events::code...};
+        return codes[i];
+    }
+
+    static const char* name(size_t i)
+    {
+        static const char* const names[] = {Events::name()...};
+        return names[i];
+    }
+
+    /// Writes the names of the events separated by `separator`.
+    static void names(char* buffer, size_t buffer_size, const char* separator)
+    {
+        size_t length = 0;
+        buffer[0] = '\0';
+        for(size_t i = 0; i < size && length < buffer_size; ++i)
+            length += snprintf(&buffer[length], buffer_size - length, "%s%s", i? separator : "", name(i));
+    }
+
+    /// Counts since `prev` given a group read, which becomes the new `prev`.
+    ///
+    /// Unsigned subtraction already accounts for counters wrapping around.
+    static auto delta(const ReadFormat& data, uint64_t* prev) -> EventSet
+    {
+        return delta(data, prev, std::make_index_sequence<size>{});
+    }
+
+    EventSet& operator+=(const EventSet& other)
+    {
+        add(other, std::make_index_sequence<size>{});
+        return *this;
+    }
+
+    /// Subtracts the counts `other` has of the events of this set, without
+    /// going below zero. Every event of this set must be in `other`.
+    template<class... Others>
+    void subtract(const EventSet<Others...>& other)
+    {
+        subtract(other, std::make_index_sequence<size>{});
+    }
+
+    /// Writes every count formatted with `fmt`, in order.
+    void format(char* buffer, size_t buffer_size, const char* fmt) const
+    {
+        format_counts(buffer, buffer_size, values, size, fmt);
+    }
+
+private:
+    template<size_t... I>
+    static auto delta(const ReadFormat& data, uint64_t* prev, std::index_sequence<I...>) -> EventSet
+    {
+        EventSet result;
+        using expand = int[];
+        (void) expand{0, (result.values[I] = data.values[I] - prev[I], prev[I] = data.values[I], 0)...};
+        return result;
+    }
+
+    template<class Other, size_t... I>
+    void subtract(const Other& other, std::index_sequence<I...>)
+    {
+        using expand = int[];
+        (void) expand{0, (values[I] -= std::min(values[I], other.template get<Events>()), 0)...};
+    }
+
+    template<size_t... I>
+    void add(const EventSet& other, std::index_sequence<I...>)
+    {
+        using expand = int[];
+        (void) expand{0, (values[I] += other.values[I], 0)...};
+    }
+};
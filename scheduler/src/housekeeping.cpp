@@ -0,0 +1,146 @@
+#include "housekeeping.hpp"
+#include "sysfs.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sysinfo.h>
+
+// Housekeeping isolation.
+//
+// Counting is system-wide, so anything we run on the cores of the
+// application is measured as if it were the application. Every process of
+// ours is kept on a single housekeeping CPU the application never gets, and
+// the user-space counts of our own tasks (the scheduler threads and the
+// agent) are subtracted from the cluster of that CPU. Short-lived helpers
+// (`ps`, `taskset`) are only pinned, not subtracted.
+
+/// Priority of the sampler thread when running on SCHED_FIFO.
+constexpr int SAMPLER_PRIORITY = 10;
+
+static int hk_cpu = -1;
+static bool use_rt = false;
+
+bool housekeeping_init()
+{
+    hk_cpu = -1;
+    use_rt = false;
+
+    if(auto s = std::getenv("SCHEDULER_HOUSEKEEPING_CPU"))
+    {
+        hk_cpu = atoi(s);
+    }
+
+    if(hk_cpu < 0)
+        return false;
+
+    if(hk_cpu >= get_nprocs_conf())
+    {
+        fprintf(stderr, "scheduler: invalid housekeeping cpu %d\n", hk_cpu);
+        hk_cpu = -1;
+        return false;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(hk_cpu, &set);
+    if(sched_setaffinity(0, sizeof(set), &set) == -1)
+    {
+        perror("scheduler: failed to pin to housekeeping cpu");
+        hk_cpu = -1;
+        return false;
+    }
+
+    if(auto s = std::getenv("SCHEDULER_HOUSEKEEPING_RT"))
+    {
+        use_rt = (atoi(s) != 0);
+    }
+
+    if(use_rt && mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+        perror("scheduler: failed to lock memory");
+
+    perf_self_attach(0, hk_cpu);
+
+    fprintf(stderr, "scheduler: housekeeping on cpu %d%s\n", hk_cpu,
+            use_rt? " (real-time sampler)" : "");
+    return true;
+}
+
+int housekeeping_cpu()
+{
+    return hk_cpu;
+}
+
+void housekeeping_track(int tid)
+{
+    if(hk_cpu != -1)
+        perf_self_attach(tid, hk_cpu);
+}
+
+void housekeeping_prepare_child()
+{
+    if(hk_cpu == -1)
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu = 0, max_cpu = get_nprocs_conf(); cpu < max_cpu; ++cpu)
+    {
+        if(cpu != hk_cpu)
+            CPU_SET(cpu, &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+void housekeeping_filter_cpus(const char* cpus, char* buffer, size_t size)
+{
+    snprintf(buffer, size, "%s", cpus);
+    if(hk_cpu == -1)
+        return;
+
+    const uint64_t mask = sysfs_parse_cpu_list(cpus);
+    const uint64_t filtered = mask & ~(uint64_t(1) << hk_cpu);
+    if(filtered == 0)
+        return;
+
+    sysfs_format_cpu_list(filtered, buffer, size);
+}
+
+void housekeeping_enter_sampler()
+{
+    if(hk_cpu == -1)
+        return;
+
+    perf_self_attach(0, hk_cpu);
+
+    if(use_rt)
+    {
+        struct sched_param param;
+        param.sched_priority = SAMPLER_PRIORITY;
+        const int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if(error)
+            fprintf(stderr, "scheduler: failed to make sampler real-time: %s\n", strerror(error));
+    }
+}
+
+void housekeeping_leave_sampler()
+{
+    if(hk_cpu != -1)
+        perf_self_detach(0);
+}
+
+void housekeeping_subtract(LittleEvents& little, BigEvents& big)
+{
+    // Our own tasks are never counted when counting a cgroup.
+    if(hk_cpu == -1 || perf_cgroup_scoped())
+        return;
+
+    const auto self = perf_consume_self();
+    if(hk_cpu >= START_INDEX_LITTLE && hk_cpu <= END_INDEX_LITTLE)
+        little.subtract(self);
+    else
+        big.subtract(self);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include "perf.hpp"
+
+/// Initialises housekeeping isolation.
+///
+/// When `SCHEDULER_HOUSEKEEPING_CPU` is set, the scheduler (and so every
+/// process it spawns but the application: the agent, `ps`, `taskset`) is
+/// pinned to that CPU, which is removed from the CPUs of every state. With
+/// `SCHEDULER_HOUSEKEEPING_RT=1` the sampler thread also runs on SCHED_FIFO
+/// with our memory locked.
+///
+/// Returns whether housekeeping isolation is enabled.
+extern bool housekeeping_init();
+
+/// The housekeeping CPU, or -1 if disabled.
+extern int housekeeping_cpu();
+
+/// Also counts the task `tid` (e.g. the agent) as housekeeping work.
+extern void housekeeping_track(int tid);
+
+/// Must be called from the forked application before exec, so it does not
+/// inherit our affinity.
+extern void housekeeping_prepare_child();
+
+/// Writes to `buffer` the CPU list `cpus` (as accepted by taskset) without
+/// the housekeeping CPU. The list is kept as is if nothing else would be left.
+extern void housekeeping_filter_cpus(const char* cpus, char* buffer, size_t size);
+
+/// Must be called by the sampler thread when it starts and before it exits.
+extern void housekeeping_enter_sampler();
+extern void housekeeping_leave_sampler();
+
+/// Subtracts our own counts from the cluster of the housekeeping CPU.
+extern void housekeeping_subtract(LittleEvents& little, BigEvents& big);
@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cinttypes>
 #include <cstring>
+#include <algorithm>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/prctl.h>
@@ -12,6 +13,19 @@
 #include "perf.hpp"
 #include "time.hpp"
 #include "states.hpp" 
+#include "thread_policy.hpp"
+#include "cgroup.hpp"
+#include "malleable.hpp"
+#include "predictor.hpp"
+#include "prediction_monitor.hpp"
+#include "sampler.hpp"
+#include "housekeeping.hpp"
+#include "attach.hpp"
+#include "daemon.hpp"
+#include "consolidate.hpp"
+#include "numa.hpp"
+#include "resctrl.hpp"
+#include "sysfs.hpp"
 
 #define FLAG_ONLY_PARALLEL_REGION 0
 #define NUM_EPISODES 1000
@@ -40,9 +54,33 @@ static uint64_t application_start_time = 0;
 static State current_state;
 static int num_time_steps = 0;
 static int flag_update_schedule;
+static double qos_target = 0.0;
+static PredictorFeatures prev_features;
+static bool has_prev_features = false;
+static uint64_t switch_cost_time = 0; // spent moving the application since the last tick
+
+/// Maximum number of optional observations.
+constexpr int MAX_EXTRA_OBSERVATIONS = 20;
+
+/// Optional observations appended after the base fields of every agent
+/// message and collect row. Each enabled subsystem adds its own values, so
+/// agents must ignore trailing fields they do not know about.
+struct ExtraObservations
+{
+    int count = 0;
+    double values[MAX_EXTRA_OBSERVATIONS];
+
+    void add(double value)
+    {
+        assert(count < MAX_EXTRA_OBSERVATIONS);
+        values[count++] = value;
+    }
+};
 
 
 static void update_scheduler_to_serial_region();
+static int get_state_num_cores(State state);
+static void publish_state_cores(State state);
 
 
 void get_cpu_usage(double *cpu_usage)
@@ -125,7 +163,7 @@ void get_cpu_usage(double *cpu_usage)
 
 static void send_to_scheduler(const char* fmt, ...)
 {
-    char buffer[512];
+    char buffer[1024];
 
     va_list va;
     va_start(va, fmt);
@@ -180,11 +218,34 @@ static void recv_from_scheduler(const char* fmt, ...)
     va_end(va);
 }
 
+/// Formats the extra observations using `fmt` for each value.
+static void format_observations(char* buffer, size_t size,
+                                const ExtraObservations& obs, const char* fmt)
+{
+    size_t count = 0;
+    buffer[0] = '\0';
+    for(int i = 0; i < obs.count && count < size; ++i)
+        count += snprintf(&buffer[count], size - count, fmt, obs.values[i]);
+}
+
 static void cleanup()
 {
     fprintf(stderr, "scheduler: cleaning up\n");
 
-    if(application_pid != -1)
+    sampler_stop();
+
+    consolidate_stop();
+    thread_policy_restore();
+    cgroup_detach();
+    resctrl_detach();
+    malleable_shutdown();
+
+    if(attach_enabled())
+    {
+        attach_detach();
+        application_pid = -1;
+    }
+    else if(application_pid != -1)
     {
         kill(application_pid, SIGTERM);
         waitpid(application_pid, nullptr, 0);
@@ -221,38 +282,13 @@ static bool create_logging_file()
 {
 
 
-#ifdef PMCS_A15_ONLY
-     char pmcs[10][35] ={  "0x01_0x02_0x03_0x04_0x05_0x08",
-                           "0x09_0x10_0x12_0x13_0x14_0x15",
-                           "0x16_0x17_0x18_0x19_0x1B_0x1D",
-                           "0x40_0x41_0x42_0x43_0x46_0x47",
-                           "0x48_0x4C_0x4D_0x50_0x51_0x52",
-                           "0x53_0x56_0x58_0x60_0x61_0x62",
-                           "0x64_0x66_0x67_0x68_0x69_0x6A",
-                           "0x6C_0x6D_0x6E_0x70_0x71_0x72",
-                           "0x73_0x74_0x75_0x76_0x78_0x79",
-                           "0x7A_0x7E_0x00_0x00_0x00_0x00"};
-
-#elif defined PMCS_A7_ONLY
-    char pmcs[9][35] ={ "0x01_0x02_0x03_0x04",
-                        "0x05_0x06_0x07_0x08",
-                        "0x09_0x0A_0x0C_0x0D",
-                        "0x0E_0x0F_0x10_0x12",
-                        "0x13_0x14_0x15_0x16",
-                        "0x17_0x18_0x19_0x1D",
-                        "0x60_0x61_0xC0_0xC1",
-                        "0xC4_0xC5_0xC6_0xC9",
-                        "0xCA_0x00_0x00_0x00"};
-#endif
-
     static int index_pmc=0;
     char filename[PATH_MAX];
 
 #if defined PMCS_A7_ONLY || defined PMCS_A15_ONLY 
-    if(index_pmc >=0 && index_pmc<=10){
-       sprintf(filename, "%s.csv", pmcs[index_pmc]);
-       index_pmc ++;
-    }
+    char label[PATH_MAX - 8];
+    perf_collect_group_label(index_pmc++, label, sizeof(label));
+    sprintf(filename, "%s.csv", label);
 #else
     sprintf(filename, "scheduler_%d.csv", application_pid); //getpid() get fathers'pid  
 #endif
@@ -326,6 +362,7 @@ static bool spawn_agent(const char* command)
         close(outpipefd[0]);
         close(inpipefd[1]);
         ::scheduler_pid = pid;
+        housekeeping_track(pid);
         ::scheduler_input_pipe = outpipefd[1];
         ::scheduler_output_pipe = inpipefd[0];
         return true;
@@ -334,6 +371,8 @@ static bool spawn_agent(const char* command)
 
 static bool spawn_application(char* argv[])
 {
+    publish_state_cores(STATE_4b);
+
     int pid = fork();
     if(pid == -1)
     {
@@ -342,6 +381,8 @@ static bool spawn_application(char* argv[])
     }
     else if(pid == 0)
     {
+        malleable_prepare_child();
+        housekeeping_prepare_child();
         execvp(argv[0], argv);
         perror("scheduler: execvp failed");
         return false;
@@ -350,22 +391,94 @@ static bool spawn_application(char* argv[])
     {
         ::application_pid = pid;
         ::application_start_time = get_time();
+        ::has_prev_features = false;
         ::current_state = STATE_4b;
+
+        if(cgroup_attach(pid))
+            cgroup_set_quota(0, get_state_num_cores(::current_state));
+        resctrl_attach(pid);
         //update_scheduler_to_serial_region();
         return true;
     }
 }
 
+/// Starts managing the application given by `--pid` or `--cgroup`.
+///
+/// Adopted processes are left in their own cgroup (no bandwidth capping),
+/// which is also where they are counted.
+static bool adopt_application()
+{
+    const int pid = attach_start();
+    if(pid == -1)
+        return false;
 
-static void update_scheduler_to_serial_region()
+    ::application_pid = pid;
+    ::application_start_time = get_time();
+    ::has_prev_features = false;
+    ::current_state = STATE_4l4b; // services usually run unrestricted
+    resctrl_attach(pid);
+
+    return perf_set_cgroup(attach_counting_cgroup());
+}
+
+/// Gets the CPU list the state `state` is applied on.
+static void get_state_cpus(State state, char* buffer, size_t size)
 {
-//    if(::application_pid != -1 && current_state != STATE_4b)
-    if(::application_pid != -1)
+    char grouped[64];
+    numa_group_cpus(configs[state], grouped, sizeof(grouped)); //configs declared in states.hpp
+    housekeeping_filter_cpus(grouped, buffer, size);
+}
+
+/// Gets the number of LITTLE and big cores the state `state` is applied on,
+/// which leaves out the housekeeping CPU if it is one of them.
+static void get_state_cores(State state, int& num_little, int& num_big)
+{
+    num_little = state_num_little(state);
+    num_big = state_num_big(state);
+
+    char grouped[64];
+    char filtered[64];
+    numa_group_cpus(configs[state], grouped, sizeof(grouped));
+    housekeeping_filter_cpus(grouped, filtered, sizeof(filtered));
+    if(__builtin_popcountll(sysfs_parse_cpu_list(filtered)) == __builtin_popcountll(sysfs_parse_cpu_list(grouped)))
+        return;
+
+    const int hk_cpu = housekeeping_cpu();
+    if(hk_cpu >= START_INDEX_LITTLE && hk_cpu <= END_INDEX_LITTLE)
+        num_little -= 1;
+    else
+        num_big -= 1;
+}
+
+/// Gets the number of cores the state `state` is applied on.
+static int get_state_num_cores(State state)
+{
+    int num_little, num_big;
+    get_state_cores(state, num_little, num_big);
+    return num_little + num_big;
+}
+
+/// Tells the malleable applications how many cores the state `state` has.
+static void publish_state_cores(State state)
+{
+    int num_little, num_big;
+    get_state_cores(state, num_little, num_big);
+    malleable_publish(num_little, num_big);
+}
+
+/// Moves every thread of the application (and its memory, if following it
+/// across nodes) onto the CPU list `cpus`.
+static void set_application_cpus(const char* cpus)
+{
+    int pids[ATTACH_MAX_PROCESSES] = { ::application_pid };
+    const int num_pids = attach_enabled()? attach_pids(pids, ATTACH_MAX_PROCESSES) : 1;
+    const uint64_t start_time = get_time();
+
+    for(int i = 0; i < num_pids; ++i)
     {
         char buffer[512];
-        auto cfg = configs[STATE_4b];
-
-        sprintf(buffer, "taskset -pac %s %d >/dev/null", cfg, application_pid);
+        sprintf(buffer, "taskset -pac %s %d >/dev/null", cpus, pids[i]);
+        fprintf(stderr, "scheduler: %s\n", buffer);
 
         int status = system(buffer);
         if(status == -1)
@@ -377,6 +490,21 @@ static void update_scheduler_to_serial_region()
             fprintf(stderr, "scheduler: taskset returned %d :(\n", status);
         }
 
+        numa_follow(pids[i], cpus);
+    }
+
+    ::switch_cost_time += get_time() - start_time;
+}
+
+static void update_scheduler_to_serial_region()
+{
+//    if(::application_pid != -1 && current_state != STATE_4b)
+    if(::application_pid != -1)
+    {
+        char cfg[64];
+        get_state_cpus(STATE_4b, cfg, sizeof(cfg));
+        set_application_cpus(cfg);
+
         current_state = STATE_4b;
     }
 
@@ -388,146 +516,240 @@ static void update_scheduler()
     get_cpu_usage(cpu_usage);
 
 
-    double l_total_pmu_1 = 0;
-    double l_total_pmu_2 = 0;
-    double l_total_pmu_3 = 0;
-    double l_total_pmu_4 = 0;
-    double l_total_pmu_5 = 0;
+    // Counters sampled since the previous tick (see sampler.cpp).
+    const auto window = sampler_consume();
+    const auto& little = window.little;
+    const auto& big = window.big;
+    const auto& collect = window.collect;
 
-    double b_total_pmu_1 = 0;
-    double b_total_pmu_2 = 0;
-    double b_total_pmu_3 = 0;
-    double b_total_pmu_4 = 0;
-    double b_total_pmu_5 = 0;
-    double b_total_pmu_6 = 0;
-    double b_total_pmu_7 = 0;
+    consolidate_observe(window, state_num_big(current_state));
 
+    const double little_instructions = little.get<Instructions>();
+    const double big_instructions = big.get<Instructions>();
+    const double total_cpu_migration = window.cpu_migrations;
+    const double total_context_switch = window.context_switches;
 
-    for(int cpu = START_INDEX_LITTLE; cpu <= END_INDEX_LITTLE; ++cpu)
-    {
-        const auto hw_data = perf_consume_hw(cpu);
-        l_total_pmu_1 += (double)hw_data.pmu_1;   //cycles
-        l_total_pmu_2 += (double)hw_data.pmu_2;   //instructions
-        l_total_pmu_3 += (double)hw_data.pmu_3;   //cache_misses
-        l_total_pmu_4 += (double)hw_data.pmu_4;   //bus access
-        l_total_pmu_5 += (double)hw_data.pmu_5;   //l2 cache refill
+    const uint64_t elapsed_time = to_millis(window.time - ::application_start_time);
+    const uint64_t interval_time = window.interval;
+    State next_state = current_state;
+    int next_quota_step = cgroup_quota_step();
 
-    }
+    ExtraObservations extra_obs;
 
-    for(int cpu = START_INDEX_BIG; cpu < END_INDEX_BIG; ++cpu)
+    if(cgroup_enabled())
     {
-        const auto hw_data = perf_consume_hw(cpu);
-        b_total_pmu_1 += (double)hw_data.pmu_1;   //cycles
-        b_total_pmu_2 += (double)hw_data.pmu_2;   //instructions
-        b_total_pmu_3 += (double)hw_data.pmu_3;   //cache_misses
-        b_total_pmu_4 += (double)hw_data.pmu_4;   //bus access
-        b_total_pmu_5 += (double)hw_data.pmu_5;   //l2 cache refill
-        b_total_pmu_6 += (double)hw_data.pmu_6;   //bus access
-        b_total_pmu_7 += (double)hw_data.pmu_7;   //l2 cache refill
-
+        const auto cg_stat = cgroup_consume_stat();
+        extra_obs.add(cg_stat.throttled_usec / 1000.0);
+        extra_obs.add((double) cg_stat.nr_throttled);
+        extra_obs.add((double) CGROUP_QUOTA_STEPS[cgroup_quota_step()]);
+
+        // Slow down an application that is ahead of its throughput target
+        // (in instructions per second) and release it once it falls behind.
+        if(qos_target > 0.0 && interval_time > 0)
+        {
+            const double throughput = (little_instructions + big_instructions) * 1e9 / interval_time;
+            if(throughput > qos_target * 1.10 && next_quota_step < CGROUP_NUM_QUOTA_STEPS - 1)
+                next_quota_step += 1;
+            else if(throughput < qos_target * 0.95 && next_quota_step > 0)
+                next_quota_step -= 1;
+        }
     }
 
-    double total_cpu_migration = 0;
-    double total_context_switch = 0;
+    int next_l3_step = resctrl_l3_step();
+    int next_mba_step = resctrl_mba_step();
+    if(resctrl_enabled())
+    {
+        // LLC occupancy in MB, memory bandwidth in MB/s and the allocation.
+        const auto monitor = resctrl_consume_monitor();
+        const double seconds = std::max<uint64_t>(1, interval_time) / 1e9;
+        extra_obs.add(monitor.llc_occupancy / 1048576.0);
+        extra_obs.add(monitor.mbm_total_bytes / 1048576.0 / seconds);
+        extra_obs.add(monitor.mbm_local_bytes / 1048576.0 / seconds);
+        extra_obs.add((double) RESCTRL_L3_STEPS[resctrl_l3_step()]);
+        extra_obs.add((double) RESCTRL_MBA_STEPS[resctrl_mba_step()]);
+    }
 
+    if(malleable_enabled())
+    {
+        // Threads per core of the last parallel region, as sized by the shim.
+        const auto mstats = malleable_consume();
+        extra_obs.add(mstats.applied_threads / (double) get_state_num_cores(current_state));
+    }
 
-    for(int cpu = 0, max_cpu = perf_nprocs(); cpu < max_cpu; ++cpu)
+    if(numa_enabled())
+    {
+        // Locality of the memory to the CPUs of the current state, the cost
+        // of the switches since the previous tick and, out of it, that of the
+        // migrations (in thousands of pages and milliseconds).
+        char cfg[64];
+        get_state_cpus(current_state, cfg, sizeof(cfg));
+        const auto migration = numa_consume_cost();
+        extra_obs.add(numa_local_fraction(::application_pid, cfg));
+        extra_obs.add(::switch_cost_time / 1e6);
+        extra_obs.add(migration.pages / 1000.0);
+        extra_obs.add(migration.usec / 1000.0);
+        ::switch_cost_time = 0;
+    }
+
+    if(perf_split_enabled())
+    {
+        // Fraction of the cycles of each cluster spent in the kernel, and
+        // the IPC of the kernel over both clusters.
+        const double little_user = little.get<Cycles>(), big_user = big.get<Cycles>();
+        const double little_kernel = window.kernel_little.get<Cycles>();
+        const double big_kernel = window.kernel_big.get<Cycles>();
+        const double kernel_cycles = little_kernel + big_kernel;
+        const double kernel_instructions = window.kernel_little.get<Instructions>()
+                                         + window.kernel_big.get<Instructions>();
+        extra_obs.add((little_user + little_kernel > 0)? little_kernel / (little_user + little_kernel) : 0.0);
+        extra_obs.add((big_user + big_kernel > 0)? big_kernel / (big_user + big_kernel) : 0.0);
+        extra_obs.add((kernel_cycles > 0)? kernel_instructions / kernel_cycles : 0.0);
+    }
+
+#if SCHEDULER_TYPE == SCHEDULER_TYPE_PREDICTOR
+    // Throughput in instructions per nanosecond.
+    const double total_instructions = little_instructions + big_instructions;
+    const double throughput = (interval_time > 0)? total_instructions / interval_time : 0.0;
+    const double inst_div = std::max(1.0, total_instructions);
+    const double little_cycles = little.get<Cycles>();
+    const double big_cycles = big.get<Cycles>();
+
+    PredictorFeatures features = {{
+        1.0,
+        (little_cycles > 0)? little_instructions / little_cycles : 0.0,
+        (big_cycles > 0)? big_instructions / big_cycles : 0.0,
+        double(little.get<MemAccess>() + big.get<MemAccess>()) / inst_div,
+        double(little.get<L2Refill>() + big.get<L2Refill>()) / inst_div,
+        double(little.get<BusAccess>() + big.get<BusAccess>()) / inst_div,
+        (interval_time > 0)? total_context_switch * 1e6 / interval_time : 0.0,
+        cpu_usage[0] / 400.0,
+        cpu_usage[1] / 400.0,
+        state_num_little(current_state) / 4.0,
+        state_num_big(current_state) / 4.0,
+    }};
+
+    // The features of the previous tick explain the throughput of this one.
+    if(::has_prev_features)
     {
-        const auto sw_data = perf_consume_sw(cpu);
-        total_cpu_migration += (double)sw_data.cpu_migrations;
-        total_context_switch += (double)sw_data.context_switches;
+        const double error = predictor_update(current_state, ::prev_features, throughput);
+        extra_obs.add(100.0 * error);
+    }
+    else
+    {
+        extra_obs.add(0.0);
     }
 
-    const uint64_t elapsed_time = to_millis(get_time() - ::application_start_time);
-    State next_state = current_state;
+    ::prev_features = features;
+    ::has_prev_features = true;
+#endif
 
-#if SCHEDULER_TYPE == SCHEDULER_TYPE_COLLECT
+    char extra_csv[32 * MAX_EXTRA_OBSERVATIONS];
+    char extra_agent[32 * MAX_EXTRA_OBSERVATIONS];
+    format_observations(extra_csv, sizeof(extra_csv), extra_obs, ",%.2lf");
+    format_observations(extra_agent, sizeof(extra_agent), extra_obs, " %a");
 
-#ifdef PMCS_A15_ONLY
-    /* fprintf(stderr,"%.2lf,%.2lf,%.2lf,%.2lf,%.2lf,%.2lf,%.2lf," \
-                   "%.2lf,%.2lf,%.2lf,%.2lf\n", \
-                   b_total_pmu_1, b_total_pmu_2, b_total_pmu_3, b_total_pmu_4, b_total_pmu_5, b_total_pmu_6, b_total_pmu_7, \
-                   total_cpu_migration, total_context_switch, cpu_usage[0], cpu_usage[1]);
-    */
-    fprintf(collect_stream, "%" PRIu64 \
-                            ",%.2lf,%.2lf,%.2lf,%.2lf,%.2lf,%.2lf,%.2lf," \
-                            "%.2lf,%.2lf,%.2lf,%.2lf\n" ,
-                            elapsed_time, \
-                            b_total_pmu_1, b_total_pmu_2, b_total_pmu_3, b_total_pmu_4, b_total_pmu_5, b_total_pmu_6, b_total_pmu_7, \
-                            total_cpu_migration, total_context_switch, cpu_usage[0], cpu_usage[1]);
-
-
-#elif defined PMCS_A7_ONLY    
-    /*fprintf(stderr,"%.2lf,%.2lf,%.2lf,%.2lf,%.2lf," \
-                   "%.2lf,%.2lf,%.2lf,%.2lf\n", \
-                   l_total_pmu_1, l_total_pmu_2, l_total_pmu_3, l_total_pmu_4, l_total_pmu_5, \
-                   total_cpu_migration, total_context_switch, cpu_usage[0], cpu_usage[1]);
-    */
+#if SCHEDULER_TYPE == SCHEDULER_TYPE_COLLECT
 
-    fprintf(collect_stream, "%" PRIu64 \
-                            ",%.2lf,%.2lf,%.2lf,%.2lf,%.2lf," \
-                            "%.2lf,%.2lf,%.2lf,%.2lf\n" ,
-                            elapsed_time, \
-                            l_total_pmu_1, l_total_pmu_2, l_total_pmu_3, l_total_pmu_4, l_total_pmu_5, \
-                            total_cpu_migration, total_context_switch, cpu_usage[0], cpu_usage[1]);
+#if defined PMCS_A15_ONLY || defined PMCS_A7_ONLY
+    char counters_csv[32 * PERF_MAX_GROUP_EVENTS];
+    format_counts(counters_csv, sizeof(counters_csv), collect.values, collect.count, ",%.2lf");
 
+    fprintf(collect_stream, "%" PRIu64 "%s," \
+                            "%.2lf,%.2lf,%.2lf,%.2lf%s\n" ,
+                            elapsed_time, counters_csv, \
+                            total_cpu_migration, total_context_switch, cpu_usage[0], cpu_usage[1], extra_csv);
 
 #else
-    fprintf(stderr,"%.2lf,%.2lf,%.2lf,%.2lf,%.2lf,%.2lf,%.2lf,%.2lf,%.2lf,%.2lf,%.2lf,%.2lf," \
-                   "%.2lf,%.2lf,%.2lf,%.2lf\n", \
-                   l_total_pmu_1, l_total_pmu_2, l_total_pmu_3, l_total_pmu_4, l_total_pmu_5, \
-                   b_total_pmu_1, b_total_pmu_2, b_total_pmu_3, b_total_pmu_4, b_total_pmu_5, b_total_pmu_6, b_total_pmu_7, \
+    char little_csv[32 * LittleEvents::size];
+    char big_csv[32 * BigEvents::size];
+
+    little.format(little_csv, sizeof(little_csv), "%.2lf,");
+    big.format(big_csv, sizeof(big_csv), "%.2lf,");
+    fprintf(stderr, "%s%s%.2lf,%.2lf,%.2lf,%.2lf\n", little_csv, big_csv, \
                    total_cpu_migration, total_context_switch, cpu_usage[0], cpu_usage[1]);
 
-    fprintf(collect_stream, "%" PRIu64 \
-                            ",%lf,%lf,%lf,%lf,%lf," \
-                            "%lf,%lf,%lf,%lf,%lf,%lf,%lf," \
-                            "%.2lf,%.2lf,%.2lf,%.2lf\n" ,
-                            elapsed_time, \
-                            l_total_pmu_1, l_total_pmu_2, l_total_pmu_3, l_total_pmu_4, l_total_pmu_5, \
-                            b_total_pmu_1, b_total_pmu_2, b_total_pmu_3, b_total_pmu_4, b_total_pmu_5, b_total_pmu_6, b_total_pmu_7, \
-                            total_cpu_migration, total_context_switch, cpu_usage[0], cpu_usage[1]);
+    little.format(little_csv, sizeof(little_csv), ",%lf");
+    big.format(big_csv, sizeof(big_csv), ",%lf");
+    fprintf(collect_stream, "%" PRIu64 "%s%s," \
+                            "%.2lf,%.2lf,%.2lf,%.2lf%s\n" ,
+                            elapsed_time, little_csv, big_csv, \
+                            total_cpu_migration, total_context_switch, cpu_usage[0], cpu_usage[1], extra_csv);
 #endif
 
 
 
-#elif SCHEDULER_TYPE == SCHEDULER_TYPE_PREDICTOR || SCHEDULER_TYPE == SCHEDULER_TYPE_AGENT  
+#elif SCHEDULER_TYPE == SCHEDULER_TYPE_PREDICTOR
+    monitor_tick(throughput);
+
+    if(monitor_in_fallback())
+    {
+        next_state = monitor_fallback_state(cpu_usage[0], cpu_usage[1]);
+    }
+    else if(!monitor_is_evaluating())
+    {
+        next_state = predictor_choose(current_state, features);
+        if(next_state != current_state)
+        {
+            monitor_switch("rls", current_state, next_state,
+                           predictor_predict(current_state, features),
+                           predictor_predict(next_state, features));
+        }
+    }
+    ::num_time_steps += 1;
+
+#elif SCHEDULER_TYPE == SCHEDULER_TYPE_AGENT
     int state_index_reply;
+    int quota_step_reply = -1;
+    int l3_step_reply = -1;
+    int mba_step_reply = -1;
     float exec_time = -1.0;
 
-    send_to_scheduler("%a %a %a %a %a %a %a %a %a %a %a %a %a %a %a %a %d %f", \
-                      l_total_pmu_1, l_total_pmu_2, l_total_pmu_3, l_total_pmu_4, l_total_pmu_5, \
-                      b_total_pmu_1, b_total_pmu_2, b_total_pmu_3, b_total_pmu_4, b_total_pmu_5, b_total_pmu_6, b_total_pmu_7, \
+    char little_agent[32 * LittleEvents::size];
+    char big_agent[32 * BigEvents::size];
+    little.format(little_agent, sizeof(little_agent), "%a ");
+    big.format(big_agent, sizeof(big_agent), "%a ");
+
+    send_to_scheduler("%s%s%a %a %a %a %d %f%s", \
+                      little_agent, big_agent, \
                       total_cpu_migration, total_context_switch, cpu_usage[0], cpu_usage[1], \
-                      current_state, exec_time);
+                      current_state, exec_time, extra_agent);
 
-    recv_from_scheduler("%d", &state_index_reply);//Here is State enumerate
+    // The agent may optionally reply with a quota step after the state, and
+    // then with the L3 and memory bandwidth steps.
+    recv_from_scheduler("%d %d %d %d", &state_index_reply, &quota_step_reply,
+                        &l3_step_reply, &mba_step_reply);//Here is State enumerate
     ::num_time_steps += 1;
     next_state = static_cast<State>(state_index_reply);
+    if(quota_step_reply >= 0 && quota_step_reply < CGROUP_NUM_QUOTA_STEPS)
+        next_quota_step = quota_step_reply;
+    if(l3_step_reply >= 0 && l3_step_reply < RESCTRL_NUM_L3_STEPS)
+        next_l3_step = l3_step_reply;
+    if(mba_step_reply >= 0 && mba_step_reply < RESCTRL_NUM_MBA_STEPS)
+        next_mba_step = mba_step_reply;
 #endif
 
 
     if(::application_pid != -1 && next_state != current_state)
     {
-        char buffer[512];
-        auto cfg = configs[next_state];//extern variable declared in States.h
-
-        sprintf(buffer, "taskset -pac %s %d >/dev/null", cfg, application_pid);
-        fprintf(stderr, "scheduler: %s\n", buffer);
-
-        int status = system(buffer);
-        if(status == -1)
-        {
-            perror("scheduler: system() failed");
-        }
-        else if(status != 0)
-        {
-            fprintf(stderr, "scheduler: taskset returned %d :(\n", status);
-        }
+        char cfg[64];
+        get_state_cpus(next_state, cfg, sizeof(cfg));
+        set_application_cpus(cfg);
 
         current_state = next_state;
+        publish_state_cores(current_state);
+
+        // The quota is relative to the number of cores of the state.
+        cgroup_set_quota(next_quota_step, get_state_num_cores(current_state));
     }
-    
+    else if(next_quota_step != cgroup_quota_step())
+    {
+        cgroup_set_quota(next_quota_step, get_state_num_cores(current_state));
+    }
+
+    if(next_l3_step != resctrl_l3_step() || next_mba_step != resctrl_mba_step())
+        resctrl_set_allocation(next_l3_step, next_mba_step);
+
+    thread_policy_update(::application_pid);
 }
 
 
@@ -569,27 +791,56 @@ int main(int argc, char* argv[])
 
     if(argc < 2)
     {
-        fprintf(stderr, "usage: %s command args...\n", argv[0]);
+        fprintf(stderr, "usage: %s {command args... | --pid pid | --cgroup path | --daemon}\n", argv[0]);
         return 1;
     }
 
-#if SCHEDULER_TYPE == SCHEDULER_TYPE_COLLECT
-
-#if defined PMCS_A15_ONLY
-    const int num_episodes = 10;//number of time to collect all pmcs from big core
-#elif defined PMCS_A7_ONLY
-    const int num_episodes = 9;//number of time to collect all pmcs from little core
+#if SCHEDULER_TYPE == SCHEDULER_TYPE_AGENT
+    char** app_argv = &argv[2];
 #else
-    const int num_episodes = 1;
+    char** app_argv = &argv[1];
 #endif
+    if(!attach_parse(app_argv))
+        return 1;
+
+    housekeeping_init();
+
+    // The daemon manages every process of the system on its own.
+    if(daemon_requested(app_argv))
+        return daemon_run();
+
+    thread_policy_init();
+    cgroup_init();
+    resctrl_init();
+    malleable_init();
+    consolidate_init();
+    numa_init();
+
+    if(auto s = std::getenv("SCHEDULER_QOS_TARGET"))
+    {
+        sscanf(s, "%lf", &qos_target);
+        fprintf(stderr, "scheduler: QoS target set to %.0lf instructions/s\n", qos_target);
+    }
+
+    sampler_init();
+
+#if SCHEDULER_TYPE == SCHEDULER_TYPE_COLLECT
+
+    const int num_episodes = perf_num_collect_groups(); // one per counter group
+    if(num_episodes == 0)
+    {
+        cleanup();
+        return 1;
+    }
 
 #elif SCHEDULER_TYPE == SCHEDULER_TYPE_PREDICTOR
     const int num_episodes = 1; // Predictor should run a single episode
-    if(!spawn_agent("python3 ./predictor.py"))
+    if(!predictor_init())
     {
         cleanup();
         return 1;
     }
+    monitor_init(attach_enabled()? attach_name() : app_argv[0]);
 #elif SCHEDULER_TYPE == SCHEDULER_TYPE_AGENT
     const int num_episodes = NUM_EPISODES;
     char cmd[50];
@@ -607,8 +858,17 @@ int main(int argc, char* argv[])
 
 
 
-    for(int curr_episode = 0; curr_episode < num_episodes; ++curr_episode)
+    // An adopted application only runs once.
+    const int num_runs = attach_enabled()? 1 : num_episodes;
+
+    for(int curr_episode = 0; curr_episode < num_runs; ++curr_episode)
     {
+        if(attach_enabled() && !adopt_application())
+        {
+            cleanup();
+            return 1;
+        }
+
         perf_init();
 
 #if SCHEDULER_TYPE == SCHEDULER_TYPE_COLLECT
@@ -617,20 +877,34 @@ int main(int argc, char* argv[])
             cleanup();
             return 1;
         }
-        if(!spawn_application(&argv[1]))
-#elif SCHEDULER_TYPE == SCHEDULER_TYPE_AGENT
-        if(!spawn_application(&argv[2]))
 #endif
+        if(!attach_enabled() && !spawn_application(app_argv))
         {
             cleanup();
             return 1;
         }
 
+        if(!sampler_start(::application_start_time))
+        {
+            cleanup();
+            return 1;
+        }
+
+        if(consolidate_enabled())
+        {
+            int pids[ATTACH_MAX_PROCESSES];
+            const int num_pids = attach_enabled()? attach_pids(pids, ATTACH_MAX_PROCESSES) : 1;
+            if(!attach_enabled())
+                pids[0] = ::application_pid;
+            consolidate_start(pids, num_pids, ::application_start_time);
+        }
+
         fprintf(stderr, "\n\nscheduler: starting episode %d with pid %d\n\n", curr_episode + 1, application_pid);
 
         while(::application_pid != -1)
         {
-            int pid = waitpid(::application_pid, NULL, WNOHANG);
+            int pid = attach_enabled()? (attach_exited()? ::application_pid : 0)
+                                      : waitpid(::application_pid, NULL, WNOHANG);
 
             if(pid == -1)
             {
@@ -660,17 +934,40 @@ int main(int argc, char* argv[])
             {
                 update_scheduler();
             }
+            #elif SCHEDULER_TYPE == SCHEDULER_TYPE_PREDICTOR
+            else
+            {
+                predictor_poll_reload();
+                update_scheduler();
+            }
             #endif
             usleep(200000);//20 miliseconds
         }
 
+        sampler_stop();
         perf_shutdown();
+        consolidate_stop();
+        thread_policy_restore();
+        cgroup_detach();
+        resctrl_detach();
+        attach_detach();
+        malleable_report();
 
 
         #if SCHEDULER_TYPE == SCHEDULER_TYPE_PREDICTOR || SCHEDULER_TYPE == SCHEDULER_TYPE_COLLECT
               create_time_file(to_millis(get_time() - ::application_start_time));
         #endif
 
+        #if SCHEDULER_TYPE == SCHEDULER_TYPE_PREDICTOR
+        {
+            char model_path[PATH_MAX];
+            sprintf(model_path, "scheduler_%d.model", getpid());
+            predictor_report(model_path);
+            sprintf(model_path, "scheduler_%d.prederr", getpid());
+            monitor_report(model_path);
+        }
+        #endif
+
         usleep(5000000); //only to clear anything in cpu - 2 seconds
         fprintf(stderr, "scheduler: episode %d finished\n", curr_episode + 1);
     }
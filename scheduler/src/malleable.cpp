@@ -0,0 +1,203 @@
+#include "malleable.hpp"
+#include "malleable_channel.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <libgen.h>
+#include <linux/limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Thread-count malleability channel.
+//
+// An OpenMP application started with as many threads as the board has cores
+// oversubscribes the cores left to it whenever we switch to a smaller state
+// (e.g. from STATE_4l4b to STATE_2b). We publish the core count of the
+// current state on a shared memory object, and a small shim preloaded into
+// the application (bin/libomp_malleable.so) adjusts the team size at the
+// entry of each parallel region.
+
+static bool is_enabled;
+static char channel_name[64];
+static char shim_path[PATH_MAX];
+static MalleableChannel* channel;
+static uint64_t prev_num_regions;
+
+/// Accumulators for the oversubscription summary of an episode.
+static uint32_t published_cpus;
+static double sum_default_oversub;
+static double sum_applied_oversub;
+static uint64_t num_samples;
+
+bool malleable_init()
+{
+    is_enabled = false;
+    channel = nullptr;
+
+    if(auto s = std::getenv("SCHEDULER_MALLEABLE"))
+    {
+        if(!strcmp(s, "true") || !strcmp(s, "1"))
+            is_enabled = true;
+        else if(strcmp(s, "false") && strcmp(s, "0"))
+            fprintf(stderr, "scheduler: Unrecognized SCHEDULER_MALLEABLE: %s\n", s);
+    }
+
+    if(!is_enabled)
+        return false;
+
+    // The shim lives next to the scheduler binary unless told otherwise.
+    if(auto s = std::getenv("SCHEDULER_MALLEABLE_SHIM"))
+    {
+        snprintf(shim_path, sizeof(shim_path), "%s", s);
+    }
+    else
+    {
+        char exe_path[PATH_MAX];
+        const auto count = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+        exe_path[count > 0? count : 0] = '\0';
+        snprintf(shim_path, sizeof(shim_path), "%s/libomp_malleable.so", dirname(exe_path));
+    }
+
+    sprintf(channel_name, "/scheduler_malleable.%d", (int) getpid());
+
+    const int fd = shm_open(channel_name, O_CREAT | O_RDWR, 0644);
+    if(fd == -1)
+    {
+        perror("scheduler: failed to create malleability channel");
+        is_enabled = false;
+        return false;
+    }
+
+    if(ftruncate(fd, sizeof(MalleableChannel)) == -1)
+    {
+        perror("scheduler: failed to size malleability channel");
+        close(fd);
+        shm_unlink(channel_name);
+        is_enabled = false;
+        return false;
+    }
+
+    void* ptr = mmap(nullptr, sizeof(MalleableChannel), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(ptr == MAP_FAILED)
+    {
+        perror("scheduler: failed to map malleability channel");
+        shm_unlink(channel_name);
+        is_enabled = false;
+        return false;
+    }
+
+    channel = static_cast<MalleableChannel*>(ptr);
+    channel->num_threads.store(0);
+    channel->num_little.store(0);
+    channel->num_big.store(0);
+    channel->default_threads.store(0);
+    channel->applied_threads.store(0);
+    channel->num_regions.store(0);
+    channel->magic = MalleableChannel::MAGIC;
+
+    prev_num_regions = 0;
+    published_cpus = 0;
+    sum_default_oversub = 0.0;
+    sum_applied_oversub = 0.0;
+    num_samples = 0;
+
+    fprintf(stderr, "scheduler: malleability channel %s (shim %s)\n",
+            channel_name, shim_path);
+    return true;
+}
+
+bool malleable_enabled()
+{
+    return is_enabled;
+}
+
+void malleable_prepare_child()
+{
+    if(!is_enabled)
+        return;
+
+    char preload[PATH_MAX * 2];
+    if(auto s = std::getenv("LD_PRELOAD"))
+        snprintf(preload, sizeof(preload), "%s:%s", shim_path, s);
+    else
+        snprintf(preload, sizeof(preload), "%s", shim_path);
+
+    setenv("LD_PRELOAD", preload, 1);
+    setenv(MALLEABLE_CHANNEL_ENV, channel_name, 1);
+}
+
+void malleable_publish(int num_little, int num_big)
+{
+    if(!channel)
+        return;
+
+    channel->num_little.store(num_little, std::memory_order_relaxed);
+    channel->num_big.store(num_big, std::memory_order_relaxed);
+    channel->num_threads.store(num_little + num_big, std::memory_order_release);
+    published_cpus = num_little + num_big;
+}
+
+auto malleable_consume() -> MalleableStats
+{
+    MalleableStats stats;
+    if(!channel)
+        return stats;
+
+    const auto num_regions = channel->num_regions.load(std::memory_order_acquire);
+    stats.default_threads = channel->default_threads.load(std::memory_order_relaxed);
+    stats.applied_threads = channel->applied_threads.load(std::memory_order_relaxed);
+    stats.num_regions = num_regions - prev_num_regions;
+    prev_num_regions = num_regions;
+
+    // Only account the ticks on which the application opened a region.
+    if(stats.num_regions != 0 && published_cpus != 0)
+    {
+        sum_default_oversub += stats.default_threads / (double) published_cpus;
+        sum_applied_oversub += stats.applied_threads / (double) published_cpus;
+        num_samples += 1;
+    }
+
+    return stats;
+}
+
+void malleable_report()
+{
+    if(!channel)
+        return;
+
+    if(num_samples != 0)
+    {
+        const double default_oversub = sum_default_oversub / num_samples;
+        const double applied_oversub = sum_applied_oversub / num_samples;
+        fprintf(stderr, "scheduler: average threads per core %.2lf without shim, "
+                        "%.2lf with shim (%.1lf%% reduction)\n",
+                default_oversub, applied_oversub,
+                100.0 * (1.0 - applied_oversub / default_oversub));
+    }
+    else
+    {
+        fprintf(stderr, "scheduler: shim reported no parallel regions\n");
+    }
+
+    prev_num_regions = 0;
+    sum_default_oversub = 0.0;
+    sum_applied_oversub = 0.0;
+    num_samples = 0;
+    channel->default_threads.store(0);
+    channel->applied_threads.store(0);
+    channel->num_regions.store(0);
+}
+
+void malleable_shutdown()
+{
+    if(!channel)
+        return;
+
+    munmap(channel, sizeof(MalleableChannel));
+    shm_unlink(channel_name);
+    channel = nullptr;
+}
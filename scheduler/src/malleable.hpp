@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+
+/// Oversubscription statistics of the managed application.
+struct MalleableStats
+{
+    /// Team size the application would have used without the shim.
+    uint32_t default_threads = 0;
+
+    /// Team size the shim applied on the last parallel region.
+    uint32_t applied_threads = 0;
+
+    /// Number of parallel regions entered since the previous consume.
+    uint64_t num_regions = 0;
+};
+
+/// Initialises the thread-count malleability channel.
+///
+/// Returns whether it is enabled (see `SCHEDULER_MALLEABLE`).
+extern bool malleable_init();
+
+/// Whether the malleability channel is enabled.
+extern bool malleable_enabled();
+
+/// Prepares the environment of a freshly forked application so it loads
+/// the runtime shim and finds the channel. Must be called in the child.
+extern void malleable_prepare_child();
+
+/// Publishes the number of cores per cluster of the current state.
+extern void malleable_publish(int num_little, int num_big);
+
+/// Consumes the oversubscription statistics reported by the shim.
+extern auto malleable_consume() -> MalleableStats;
+
+/// Prints the oversubscription summary of the episode and resets it.
+extern void malleable_report();
+
+/// Unmaps and unlinks the channel.
+extern void malleable_shutdown();
@@ -0,0 +1,37 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+/// Shared memory layout of the thread-count malleability channel.
+///
+/// The scheduler publishes the number of cores of the current `State` and
+/// the runtime shim (see `omp_malleable.cpp`) reads it at the entry of every
+/// parallel region to size the OpenMP team accordingly. The shim reports back
+/// which team sizes it actually used.
+///
+/// Both sides map the same object, thus only lock-free atomics live here.
+struct MalleableChannel
+{
+    static constexpr uint32_t MAGIC = 0x4d4c4231; // "MLB1"
+
+    uint32_t magic;
+
+    /// Team size the scheduler wants for the next parallel regions.
+    std::atomic<uint32_t> num_threads;
+
+    /// Cores available on each cluster for the current state.
+    std::atomic<uint32_t> num_little;
+    std::atomic<uint32_t> num_big;
+
+    /// Team size the application would have used without the shim.
+    std::atomic<uint32_t> default_threads;
+
+    /// Team size the shim applied on the last parallel region.
+    std::atomic<uint32_t> applied_threads;
+
+    /// Number of parallel regions the shim has seen.
+    std::atomic<uint64_t> num_regions;
+};
+
+/// Environment variable used to pass the channel name to the application.
+#define MALLEABLE_CHANNEL_ENV "SCHEDULER_MALLEABLE_SHM"
@@ -0,0 +1,253 @@
+#include "numa.hpp"
+#include "sysfs.hpp"
+#include "time.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/syscall.h>
+
+// NUMA awareness.
+//
+// The states only say how many cores of each kind an application gets, and
+// their CPU lists assume consecutive indices share a cluster. On a NUMA
+// server CPUs are often numbered across nodes (0, 2, 4... on one socket),
+// so the CPUs of a state are renumbered node by node before being applied.
+//
+// Moving an application to the CPUs of another node leaves its memory
+// behind. Memory following migrates its pages (migrate_pages, so no libnuma
+// is needed) from every other node to the nodes of its new CPUs, and the
+// time and pages it took are part of the cost of that switch.
+
+static int num_nodes;
+static uint64_t node_cpus[NUMA_MAX_NODES];
+static int node_ids[NUMA_MAX_NODES];
+static int cpu_order[64];
+static int num_ordered_cpus;
+static bool follow_memory;
+static NumaMigrationCost pending_cost;
+
+bool numa_init()
+{
+    char root[PATH_MAX] = "/sys/devices/system/node";
+    char path[PATH_MAX + 64];
+    char buffer[256];
+
+    num_nodes = 0;
+    num_ordered_cpus = 0;
+    follow_memory = false;
+    pending_cost = NumaMigrationCost{};
+
+    if(auto s = std::getenv("SCHEDULER_NUMA_ROOT"))
+        snprintf(root, sizeof(root), "%s", s);
+
+    if(auto s = std::getenv("SCHEDULER_NUMA_FOLLOW"))
+        follow_memory = (atoi(s) != 0);
+
+    for(int node = 0; node < 64 && num_nodes < NUMA_MAX_NODES; ++node)
+    {
+        snprintf(path, sizeof(path), "%s/node%d/cpulist", root, node);
+        if(!sysfs_read(path, buffer, sizeof(buffer)))
+            continue;
+
+        // Memory-only nodes have no CPUs to be grouped.
+        const uint64_t cpus = sysfs_parse_cpu_list(buffer);
+        if(cpus == 0)
+            continue;
+
+        node_ids[num_nodes] = node;
+        node_cpus[num_nodes] = cpus;
+        ++num_nodes;
+    }
+
+    if(num_nodes < 2)
+        return false;
+
+    uint64_t ordered = 0;
+    for(int n = 0; n < num_nodes; ++n)
+    {
+        for(int cpu = 0; cpu < 64; ++cpu)
+        {
+            if((node_cpus[n] & (uint64_t(1) << cpu)) && !(ordered & (uint64_t(1) << cpu)))
+            {
+                cpu_order[num_ordered_cpus++] = cpu;
+                ordered |= uint64_t(1) << cpu;
+            }
+        }
+
+        sysfs_format_cpu_list(node_cpus[n], buffer, sizeof(buffer));
+        fprintf(stderr, "scheduler: numa node %d on cpus %s\n", node_ids[n], buffer);
+    }
+
+    if(follow_memory)
+        fprintf(stderr, "scheduler: memory follows the application across nodes\n");
+
+    return true;
+}
+
+bool numa_enabled()
+{
+    return num_nodes >= 2;
+}
+
+/// Mask of the nodes (by id) of the CPUs in `cpus`.
+static uint64_t nodes_of_cpus(uint64_t cpus)
+{
+    uint64_t nodes = 0;
+    for(int n = 0; n < num_nodes; ++n)
+    {
+        if(node_cpus[n] & cpus)
+            nodes |= uint64_t(1) << node_ids[n];
+    }
+    return nodes;
+}
+
+void numa_group_cpus(const char* cpus, char* buffer, size_t size)
+{
+    snprintf(buffer, size, "%s", cpus);
+    if(!numa_enabled())
+        return;
+
+    const uint64_t mask = sysfs_parse_cpu_list(cpus);
+    uint64_t grouped = 0;
+    for(int i = 0; i < 64; ++i)
+    {
+        if(mask & (uint64_t(1) << i))
+            grouped |= uint64_t(1) << ((i < num_ordered_cpus)? cpu_order[i] : i);
+    }
+
+    sysfs_format_cpu_list(grouped, buffer, size);
+}
+
+int numa_node_pages(int pid, uint64_t* pages, int max_nodes)
+{
+    char path[64];
+    char line[4096];
+
+    for(int i = 0; i < max_nodes; ++i)
+        pages[i] = 0;
+
+    sprintf(path, "/proc/%d/numa_maps", pid);
+    FILE* stream = fopen(path, "r");
+    if(!stream)
+        return 0;
+
+    // Each mapping lists its resident pages per node as "N<node>=<pages>",
+    // in units of its "kernelpagesize_kB", which are counted as 4kB pages.
+    int count = 0;
+    while(fgets(line, sizeof(line), stream))
+    {
+        uint64_t page_kb = 4;
+        if(const char* p = strstr(line, "kernelpagesize_kB="))
+            page_kb = strtoull(p + 18, nullptr, 10);
+
+        for(const char* p = strstr(line, " N"); p; p = strstr(p + 1, " N"))
+        {
+            char* end;
+            const long node = strtol(p + 2, &end, 10);
+            if(end == p + 2 || *end != '=' || node < 0 || node >= max_nodes)
+                continue;
+
+            pages[node] += strtoull(end + 1, nullptr, 10) * (page_kb / 4);
+            if(node + 1 > count)
+                count = node + 1;
+        }
+    }
+
+    fclose(stream);
+    return count;
+}
+
+double numa_local_fraction(int pid, const char* cpus)
+{
+    if(!numa_enabled())
+        return 1.0;
+
+    uint64_t pages[NUMA_MAX_NODES];
+    const int count = numa_node_pages(pid, pages, NUMA_MAX_NODES);
+    const uint64_t nodes = nodes_of_cpus(sysfs_parse_cpu_list(cpus));
+
+    uint64_t local = 0, total = 0;
+    for(int node = 0; node < count; ++node)
+    {
+        total += pages[node];
+        if(nodes & (uint64_t(1) << node))
+            local += pages[node];
+    }
+
+    return (total > 0)? double(local) / total : 1.0;
+}
+
+/// Resident pages of `pid` on the nodes of the mask `nodes`.
+static uint64_t remote_pages(int pid, uint64_t nodes)
+{
+    uint64_t pages[NUMA_MAX_NODES];
+    const int count = numa_node_pages(pid, pages, NUMA_MAX_NODES);
+    uint64_t total = 0;
+    for(int node = 0; node < count; ++node)
+    {
+        if(nodes & (uint64_t(1) << node))
+            total += pages[node];
+    }
+    return total;
+}
+
+void numa_follow(int pid, const char* cpus)
+{
+    if(!numa_enabled() || !follow_memory || pid <= 0)
+        return;
+
+    const uint64_t to_nodes = nodes_of_cpus(sysfs_parse_cpu_list(cpus));
+    const uint64_t from_nodes = nodes_of_cpus(~uint64_t(0)) & ~to_nodes;
+    if(to_nodes == 0 || from_nodes == 0)
+        return;
+
+    const uint64_t remote = remote_pages(pid, from_nodes);
+    if(remote == 0)
+        return;
+
+    // The kernel takes the number of bits plus one.
+    unsigned long old_nodes[NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1] = {};
+    unsigned long new_nodes[NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1] = {};
+    const size_t bits = 8 * sizeof(unsigned long);
+    for(int node = 0; node < NUMA_MAX_NODES; ++node)
+    {
+        if(from_nodes & (uint64_t(1) << node))
+            old_nodes[node / bits] |= 1ul << (node % bits);
+        if(to_nodes & (uint64_t(1) << node))
+            new_nodes[node / bits] |= 1ul << (node % bits);
+    }
+
+    const uint64_t start = get_time();
+    const long not_moved = syscall(SYS_migrate_pages, pid, NUMA_MAX_NODES + 1, old_nodes, new_nodes);
+    const uint64_t elapsed = get_time() - start;
+
+    if(not_moved == -1)
+    {
+        perror("scheduler: failed to migrate pages");
+        return;
+    }
+
+    // What the kernel could not move (e.g. pages shared with other
+    // processes) stays remote.
+    const uint64_t still_remote = remote_pages(pid, from_nodes);
+    const uint64_t moved = remote - std::min(remote, still_remote);
+
+    pending_cost.usec += elapsed / 1000;
+    pending_cost.pages += moved;
+    fprintf(stderr, "scheduler: migrated the memory of %d to the nodes of cpus %s "
+                    "(%llu of %llu remote pages, %llums)\n",
+            pid, cpus, (unsigned long long) moved, (unsigned long long) remote,
+            (unsigned long long) (elapsed / 1000000));
+}
+
+auto numa_consume_cost() -> NumaMigrationCost
+{
+    const auto cost = pending_cost;
+    pending_cost = NumaMigrationCost{};
+    return cost;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// Maximum number of NUMA nodes supported.
+constexpr int NUMA_MAX_NODES = 16;
+
+/// Cost of the memory moved along with the application.
+struct NumaMigrationCost
+{
+    uint64_t pages = 0;     //< 4kB pages moved to the new nodes (from numa_maps)
+    uint64_t usec = 0;      //< time spent in migrate_pages
+};
+
+/// Discovers the NUMA topology under `SCHEDULER_NUMA_ROOT`
+/// (/sys/devices/system/node by default).
+///
+/// With `SCHEDULER_NUMA_FOLLOW=1`, the memory of the application follows
+/// it whenever it moves to the CPUs of other nodes.
+///
+/// Returns whether there are several nodes.
+extern bool numa_init();
+
+/// Whether there are several NUMA nodes.
+extern bool numa_enabled();
+
+/// Writes to `buffer` the CPU list `cpus` of a state, with CPU indices
+/// renumbered so that consecutive indices fill a node before the next one.
+/// States made of few cores thus stay within a single node. The list is
+/// kept as is on a single node.
+extern void numa_group_cpus(const char* cpus, char* buffer, size_t size);
+
+/// Gets the resident memory of `pid` on every node (from its numa_maps), in
+/// 4kB pages.
+///
+/// Returns the number of nodes written to `pages`.
+extern int numa_node_pages(int pid, uint64_t* pages, int max_nodes);
+
+/// Fraction of the resident pages of `pid` on the nodes of the CPU list
+/// `cpus`.
+extern double numa_local_fraction(int pid, const char* cpus);
+
+/// Migrates the pages of `pid` to the nodes of the CPU list `cpus`, if
+/// memory following is enabled.
+extern void numa_follow(int pid, const char* cpus);
+
+/// Consumes the cost of the migrations done since the previous call.
+extern auto numa_consume_cost() -> NumaMigrationCost;
@@ -0,0 +1,102 @@
+// Runtime shim preloaded into OpenMP applications managed by the scheduler.
+//
+// It interposes the libgomp entry points of `#pragma omp parallel` and, for
+// regions without an explicit `num_threads` clause, sets the team size to the
+// core count published by the scheduler through the malleability channel
+// (see `malleable_channel.hpp`). Nested regions are left untouched.
+//
+// This is built as bin/libomp_malleable.so and has no dependencies beyond
+// libdl, so it can be preloaded into any binary (OpenMP or not).
+#include "malleable_channel.hpp"
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using GompParallelFn = void (*)(void (*)(void*), void*, unsigned, unsigned);
+using GompParallelStartFn = void (*)(void (*)(void*), void*, unsigned);
+using OmpSetNumThreadsFn = void (*)(int);
+using OmpGetIntFn = int (*)();
+
+static MalleableChannel* channel;
+static GompParallelFn real_GOMP_parallel;
+static GompParallelStartFn real_GOMP_parallel_start;
+static OmpSetNumThreadsFn real_omp_set_num_threads;
+static OmpGetIntFn real_omp_get_max_threads;
+static OmpGetIntFn real_omp_get_level;
+
+/// Team size last set through `omp_set_num_threads`.
+static int curr_num_threads;
+
+__attribute__((constructor))
+static void malleable_shim_init()
+{
+    real_GOMP_parallel = (GompParallelFn) dlsym(RTLD_NEXT, "GOMP_parallel");
+    real_GOMP_parallel_start = (GompParallelStartFn) dlsym(RTLD_NEXT, "GOMP_parallel_start");
+    real_omp_set_num_threads = (OmpSetNumThreadsFn) dlsym(RTLD_NEXT, "omp_set_num_threads");
+    real_omp_get_max_threads = (OmpGetIntFn) dlsym(RTLD_NEXT, "omp_get_max_threads");
+    real_omp_get_level = (OmpGetIntFn) dlsym(RTLD_NEXT, "omp_get_level");
+
+    const char* name = std::getenv(MALLEABLE_CHANNEL_ENV);
+    if(!name)
+        return;
+
+    const int fd = shm_open(name, O_RDWR, 0);
+    if(fd == -1)
+        return;
+
+    void* ptr = mmap(nullptr, sizeof(MalleableChannel), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(ptr == MAP_FAILED)
+        return;
+
+    channel = static_cast<MalleableChannel*>(ptr);
+    if(channel->magic != MalleableChannel::MAGIC)
+    {
+        munmap(ptr, sizeof(MalleableChannel));
+        channel = nullptr;
+    }
+}
+
+/// Called at the entry of every parallel region. Returns the `num_threads`
+/// argument to forward to libgomp.
+static unsigned malleable_region_enter(unsigned num_threads)
+{
+    if(!channel || !real_omp_set_num_threads || !real_omp_get_max_threads)
+        return num_threads;
+
+    // Respect explicit num_threads clauses and nested regions.
+    if(num_threads != 0 || (real_omp_get_level && real_omp_get_level() != 0))
+        return num_threads;
+
+    if(channel->default_threads.load(std::memory_order_relaxed) == 0)
+        channel->default_threads.store(real_omp_get_max_threads(), std::memory_order_relaxed);
+
+    const int wanted = channel->num_threads.load(std::memory_order_acquire);
+    if(wanted > 0 && wanted != curr_num_threads)
+    {
+        real_omp_set_num_threads(wanted);
+        curr_num_threads = wanted;
+    }
+
+    channel->applied_threads.store(real_omp_get_max_threads(), std::memory_order_relaxed);
+    channel->num_regions.fetch_add(1, std::memory_order_release);
+    return num_threads;
+}
+
+extern "C" void
+GOMP_parallel(void (*fn)(void*), void* data, unsigned num_threads, unsigned flags)
+{
+    num_threads = malleable_region_enter(num_threads);
+    real_GOMP_parallel(fn, data, num_threads, flags);
+}
+
+extern "C" void
+GOMP_parallel_start(void (*fn)(void*), void* data, unsigned num_threads)
+{
+    num_threads = malleable_region_enter(num_threads);
+    real_GOMP_parallel_start(fn, data, num_threads);
+}
@@ -1,9 +1,11 @@
 #include "perf.hpp"
+#include "counter_plan.hpp"
+#include "pmu.hpp"
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <limits>
+#include <fcntl.h>
 #include <unistd.h>
 #include <asm/unistd.h>
 #include <sys/ioctl.h>
@@ -11,456 +13,442 @@
 #include <linux/perf_event.h>
 
 
-//sure you have exactly 11 lines and 6 columns per line because variable curr_index_pmc_a15+1 assumed it configuration.
-int64_t pmcs_a15[] = {   0x01,0x02,0x03,0x04,0x05,0x08,
-                         0x09,0x10,0x12,0x13,0x14,0x15,
-                         0x16,0x17,0x18,0x19,0x1B,0x1D,
-                         0x40,0x41,0x42,0x43,0x46,0x47,
-                         0x48,0x4C,0x4D,0x50,0x51,0x52,
-                         0x53,0x56,0x58,0x60,0x61,0x62,
-			 0x64,0x66,0x67,0x68,0x69,0x6A,
-                         0x6C,0x6D,0x6E,0x70,0x71,0x72,
-                         0x73,0x74,0x75,0x76,0x78,0x79,
-                         0x7A,0x7E,0x00,0x00,0x00,0x00}; //10x6
-
-
-//sure you have exactly 10 lines and 4 columns per line because variable curr_index_pmc_a15+1 assumed it configuration.
-int64_t pmcs_a7[] = {   0x01,0x02,0x03,0x04,
-			0x05,0x06,0x07,0x08,
-			0x09,0x0A,0x0C,0x0D,
-                        0x0E,0x0F,0x10,0x12,
-                        0x13,0x14,0x15,0x16,
-                        0x17,0x18,0x19,0x1D,
-                        0x60,0x61,0xC0,0xC1,
-                        0xC4,0xC5,0xC6,0xC9,
-                        0xCA,0x00,0x00,0x00}; //9X4
-
-/// Maximum events that can be recorded simultaneously.
-///
-/// The Cortex A7 is a limiting factor here because it contains
-/// only four performance counting registers.
-constexpr int MAX_EVENTS_PER_GROUP = 7;
+/// Events of the Cortex-A15 collected by rotation, one group per episode.
+static const PmuEvent events_a15[] = {
+    {"L1I_CACHE_REFILL", 0x01, 0},      {"L1I_TLB_REFILL", 0x02, 0},
+    {"L1D_CACHE_REFILL", 0x03, 0},      {"L1D_CACHE", 0x04, 0},
+    {"L1D_TLB_REFILL", 0x05, 0},        {"INST_RETIRED", 0x08, 0},
+    {"EXC_TAKEN", 0x09, 0},             {"BR_MIS_PRED", 0x10, 0},
+    {"BR_PRED", 0x12, 0},               {"MEM_ACCESS", 0x13, 0},
+    {"L1I_CACHE", 0x14, 0},             {"L1D_CACHE_WB", 0x15, 0},
+    {"L2D_CACHE", 0x16, 0},             {"L2D_CACHE_REFILL", 0x17, 0},
+    {"L2D_CACHE_WB", 0x18, 0},          {"BUS_ACCESS", 0x19, 0},
+    {"INST_SPEC", 0x1B, 0},             {"BUS_CYCLES", 0x1D, 0},
+    {"L1D_CACHE_LD", 0x40, 0},          {"L1D_CACHE_ST", 0x41, 0},
+    {"L1D_CACHE_REFILL_LD", 0x42, 0},   {"L1D_CACHE_REFILL_ST", 0x43, 0},
+    {"L1D_CACHE_WB_VICTIM", 0x46, 0},   {"L1D_CACHE_WB_CLEAN", 0x47, 0},
+    {"L1D_CACHE_INVAL", 0x48, 0},       {"L1D_TLB_REFILL_LD", 0x4C, 0},
+    {"L1D_TLB_REFILL_ST", 0x4D, 0},     {"L2D_CACHE_LD", 0x50, 0},
+    {"L2D_CACHE_ST", 0x51, 0},          {"L2D_CACHE_REFILL_LD", 0x52, 0},
+    {"L2D_CACHE_REFILL_ST", 0x53, 0},   {"L2D_CACHE_WB_VICTIM", 0x56, 0},
+    {"L2D_CACHE_INVAL", 0x58, 0},       {"BUS_ACCESS_LD", 0x60, 0},
+    {"BUS_ACCESS_ST", 0x61, 0},         {"BUS_ACCESS_SHARED", 0x62, 0},
+    {"BUS_ACCESS_NORMAL", 0x64, 0},     {"MEM_ACCESS_LD", 0x66, 0},
+    {"MEM_ACCESS_ST", 0x67, 0},         {"UNALIGNED_LD_SPEC", 0x68, 0},
+    {"UNALIGNED_ST_SPEC", 0x69, 0},     {"UNALIGNED_LDST_SPEC", 0x6A, 0},
+    {"LDREX_SPEC", 0x6C, 0},            {"STREX_PASS_SPEC", 0x6D, 0},
+    {"STREX_FAIL_SPEC", 0x6E, 0},       {"LD_SPEC", 0x70, 0},
+    {"ST_SPEC", 0x71, 0},               {"LDST_SPEC", 0x72, 0},
+    {"DP_SPEC", 0x73, 0},               {"ASE_SPEC", 0x74, 0},
+    {"VFP_SPEC", 0x75, 0},              {"PC_WRITE_SPEC", 0x76, 0},
+    {"BR_IMMED_SPEC", 0x78, 0},         {"BR_RETURN_SPEC", 0x79, 0},
+    {"BR_INDIRECT_SPEC", 0x7A, 0},      {"DMB_SPEC", 0x7E, 0},
+};
+
+/// Events of the Cortex-A7 collected by rotation, one group per episode.
+static const PmuEvent events_a7[] = {
+    {"L1I_CACHE_REFILL", 0x01, 0},      {"L1I_TLB_REFILL", 0x02, 0},
+    {"L1D_CACHE_REFILL", 0x03, 0},      {"L1D_CACHE", 0x04, 0},
+    {"L1D_TLB_REFILL", 0x05, 0},        {"LD_RETIRED", 0x06, 0},
+    {"ST_RETIRED", 0x07, 0},            {"INST_RETIRED", 0x08, 0},
+    {"EXC_TAKEN", 0x09, 0},             {"EXC_RETURN", 0x0A, 0},
+    {"PC_WRITE_RETIRED", 0x0C, 0},      {"BR_IMMED_RETIRED", 0x0D, 0},
+    {"BR_RETURN_RETIRED", 0x0E, 0},     {"UNALIGNED_LDST_RETIRED", 0x0F, 0},
+    {"BR_MIS_PRED", 0x10, 0},           {"BR_PRED", 0x12, 0},
+    {"MEM_ACCESS", 0x13, 0},            {"L1I_CACHE", 0x14, 0},
+    {"L1D_CACHE_WB", 0x15, 0},          {"L2D_CACHE", 0x16, 0},
+    {"L2D_CACHE_REFILL", 0x17, 0},      {"L2D_CACHE_WB", 0x18, 0},
+    {"BUS_ACCESS", 0x19, 0},            {"BUS_CYCLES", 0x1D, 0},
+    {"BUS_ACCESS_LD", 0x60, 0},         {"BUS_ACCESS_ST", 0x61, 0},
+    {"EXT_MEM_REQ", 0xC0, 0},           {"EXT_MEM_REQ_NC", 0xC1, 0},
+    {"READ_ALLOC_ENTER", 0xC4, 0},      {"READ_ALLOC", 0xC5, 0},
+    {"PRE_DECODE_ERR", 0xC6, 0},        {"STALL_SB_FULL", 0xC9, 0},
+    {"SNOOP", 0xCA, 0},
+};
+
+/// The Cortex-A7 has four programmable counters and the Cortex-A15 six,
+/// besides the fixed cycle counter.
+static const PmuConstraints pmu_a7 = {"Cortex-A7", 4, 0x11};
+static const PmuConstraints pmu_a15 = {"Cortex-A15", 6, 0x11};
 
 /// Maximum number of processor cores we are going to use.
-constexpr int MAX_PROCESSORS = 8;
+constexpr int MAX_PROCESSORS = 64;
 
-/// Number of software counters to collect.
-constexpr int NUM_SOFTWARE_COUNTERS = 2;
+/// Software event tags.
+struct CpuMigrations
+{
+    static constexpr uint32_t type = PERF_TYPE_SOFTWARE;
+    static constexpr uint64_t code = PERF_COUNT_SW_CPU_MIGRATIONS;
+    static constexpr const char* name() { return "cpu_migrations"; }
+};
 
-struct PerfEvent
+struct ContextSwitches
 {
-    int fd;
-    uint64_t id;
-    uint64_t prev_value;
+    static constexpr uint32_t type = PERF_TYPE_SOFTWARE;
+    static constexpr uint64_t code = PERF_COUNT_SW_CONTEXT_SWITCHES;
+    static constexpr const char* name() { return "context_switches"; }
 };
 
-static PerfEvent perf_cpu[MAX_PROCESSORS][MAX_EVENTS_PER_GROUP];
-static PerfEvent perf_sw[MAX_PROCESSORS][NUM_SOFTWARE_COUNTERS];
-static int num_processors;
+using SoftwareEvents = EventSet<CpuMigrations, ContextSwitches>;
 
+/// Privilege levels counted by a group.
+enum CountDomain
+{
+    COUNT_USER,
+    COUNT_KERNEL,
+    COUNT_ALL,
+};
 
-void perf_init()
+/// A perf group, read positionally (no PERF_FORMAT_ID).
+///
+/// A scaled group also reads its enabled and running times, and its counts
+/// are extrapolated to the whole period when the kernel had to multiplex it
+/// with other groups of the same CPU.
+struct PerfGroup
 {
+    int num_events;
+    bool scaled;
+    int fds[PERF_MAX_GROUP_EVENTS];
+    uint64_t prev_values[PERF_MAX_GROUP_EVENTS];
+    uint64_t prev_enabled;
+    uint64_t prev_running;
+};
 
-    static int curr_index_pmc_a15 = 0;
-    static int curr_index_pmc_a7 = 0;
+/// Maximum number of our own tasks counted by `perf_self_attach`.
+constexpr int MAX_SELF_TASKS = 4;
 
-    auto perf_event_open = [](struct perf_event_attr *hw_event, pid_t pid,
-                               int cpu, int group_fd, unsigned long flags) {
-        return syscall(__NR_perf_event_open, hw_event, pid, cpu,
-                       group_fd, flags);
-    };
+/// One of our own tasks, counted by a scaled group of the events of
+/// `BigEvents` the PMU of its housekeeping CPU has. The system-wide groups
+/// of that CPU already take its counters, so the group is multiplexed.
+struct SelfTask
+{
+    int tid;
+    PerfGroup group;
+    size_t indices[BigEvents::size];    //< index in `BigEvents` of each event
+};
 
-    num_processors = get_nprocs_conf();
-    assert(num_processors <= MAX_PROCESSORS);
+static SelfTask self_tasks[MAX_SELF_TASKS];
+static int num_self_tasks;
+static PerfGroup perf_hw[MAX_PROCESSORS];
+static PerfGroup perf_sw[MAX_PROCESSORS];
+static PerfGroup perf_kernel[MAX_PROCESSORS];
+static int num_processors;
+static bool count_split = false;
+static int cgroup_fd = -1;
 
-    //fprintf(stderr, "scheduler: detected %d processors\n", num_processors);
+#if defined PMCS_A15_ONLY || defined PMCS_A7_ONLY
+static CounterPlan collect_plan;
+static bool has_collect_plan = false;
+#endif
 
-#ifdef PMCS_A7_ONLY
-    for(int cpu = START_INDEX_LITTLE; cpu <= END_INDEX_LITTLE; ++cpu)
+static int perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
+                           int cpu, int group_fd, unsigned long flags)
+{
+    return syscall(__NR_perf_event_open, hw_event, pid, cpu,
+                   group_fd, flags);
+}
+
+/// Opens the event `type` and `config` with the attributes of `pe`, retargeted
+/// to the core PMU of `pmu_cpu`.
+static int open_event(struct perf_event_attr& pe, uint32_t type, uint64_t config,
+                      int pmu_cpu, pid_t pid, int cpu, int group_fd, unsigned long flags)
+{
+    uint32_t resolved_type = type;
+    uint64_t resolved_config = config;
+    pmu_resolve_event(pmu_cpu, resolved_type, resolved_config);
+    pe.type = resolved_type;
+    pe.config = resolved_config;
+    auto fd = perf_event_open(&pe, pid, cpu, group_fd, flags);
+
+    // Kernels predating hybrid support know no PMU type in the config
+    // of a generic event, yet match it against the right PMU themselves.
+    if(fd == -1 && (pe.type != type || pe.config != config))
     {
-        for(int i = 0; i < MAX_EVENTS_PER_GROUP; ++i)
-        {
-            uint64_t config;
-            int group_fd;
-            struct perf_event_attr pe;
-            memset(&pe, 0, sizeof(pe));
-
-
-            switch(i)
-            {
-                case 0:
-                    config = PERF_COUNT_HW_CPU_CYCLES; //0x11
-                    group_fd = -1;
-                    pe.type = PERF_TYPE_HARDWARE;
-                    break;
-                case 1:
-                    config = pmcs_a7[curr_index_pmc_a7];
-                    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-                    break;
-                case 2:
-                    config = pmcs_a7[curr_index_pmc_a7+1];
-                    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-                    break;
-                case 3:
-                    config = pmcs_a7[curr_index_pmc_a7+2];
-                    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-                    break;
-                case 4:
-                    config = pmcs_a7[curr_index_pmc_a7+3];
-                    group_fd = perf_cpu[cpu][0].fd;
-		    pe.type = PERF_TYPE_RAW;
-                    break;
-                default:
-                    perf_cpu[cpu][i].fd = -1;
-                    perf_cpu[cpu][i].id = -1;
-		    pe.type = PERF_TYPE_RAW;
-                    continue;
-            }
-
-            pe.size = sizeof(pe);
-            //pe.type = PERF_TYPE_RAW;
-            pe.config = config;
-            pe.exclude_hv = true;
-            pe.exclude_kernel = true;
-            pe.disabled = true;
-            pe.read_format = PERF_FORMAT_ID | PERF_FORMAT_GROUP;
-
-            const auto fd = perf_event_open(&pe, -1, cpu, group_fd, 0);
-            if(fd == -1)
-            {
-                perror("scheduler: failed to initialise perf");
-                abort();
-            }
-
-            perf_cpu[cpu][i].fd = fd;
-            ioctl(fd, PERF_EVENT_IOC_ID, &perf_cpu[cpu][i].id);
-            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
-            perf_cpu[cpu][i].prev_value = 0;
-        }
+        pe.type = type;
+        pe.config = config;
+        fd = perf_event_open(&pe, pid, cpu, group_fd, flags);
     }
-    curr_index_pmc_a7 +=4;
 
-#else
-    for(int cpu = START_INDEX_LITTLE; cpu <= END_INDEX_LITTLE; ++cpu)
+    return fd;
+}
+
+/// Opens on `cpu` a group of `num_events` events, led by the first one.
+static void open_group(PerfGroup& group, int cpu, const uint32_t* types,
+                       const uint64_t* configs, int num_events, CountDomain domain)
+{
+    assert(num_events <= PERF_MAX_GROUP_EVENTS);
+
+    // Kernel twins share the counters with the user groups.
+    group.num_events = num_events;
+    group.scaled = count_split && types[0] != PERF_TYPE_SOFTWARE;
+    group.prev_enabled = 0;
+    group.prev_running = 0;
+    for(int i = 0; i < num_events; ++i)
     {
-        for(int i = 0; i < MAX_EVENTS_PER_GROUP; ++i)
+        struct perf_event_attr pe;
+        memset(&pe, 0, sizeof(pe));
+        pe.size = sizeof(pe);
+        pe.exclude_hv = true;
+        pe.exclude_kernel = (domain == COUNT_USER);
+        pe.exclude_user = (domain == COUNT_KERNEL);
+        pe.disabled = true;
+        pe.read_format = PERF_FORMAT_GROUP;
+        if(group.scaled)
+            pe.read_format |= PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        const int group_fd = (i == 0)? -1 : group.fds[0];
+        const int pid = (cgroup_fd != -1)? cgroup_fd : -1;
+        const unsigned long flags = (cgroup_fd != -1)? PERF_FLAG_PID_CGROUP : 0;
+        const auto fd = open_event(pe, types[i], configs[i], cpu, pid, cpu, group_fd, flags);
+        if(fd == -1)
         {
-            uint64_t config;
-            int group_fd;
-            struct perf_event_attr pe;
-            memset(&pe, 0, sizeof(pe));
-
-
-            switch(i)
-            {
-                case 0:
-		    config = PERF_COUNT_HW_CPU_CYCLES;
-		    group_fd = -1;
-                    pe.type = PERF_TYPE_HARDWARE;
-		    break;
-                case 1:
-		    config = 0x08;
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-		    break;
-                case 2:
-		    config = 0x13;
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-		    break;
-		case 3:
-                    config = 0x17;
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-		    break;
-		case 4:
-                    config = 0x19;
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-		    break;
-                default:
-		    perf_cpu[cpu][i].fd = -1;
-		    perf_cpu[cpu][i].id = -1;
-                    pe.type = PERF_TYPE_RAW;
-		    continue;
-            }
-
-            pe.size = sizeof(pe);
-            //pe.type = PERF_TYPE_RAW;
-            pe.config = config;
-            pe.exclude_hv = true;
-            pe.exclude_kernel = true;
-            pe.disabled = true;
-            pe.read_format = PERF_FORMAT_ID | PERF_FORMAT_GROUP;
-
-            const auto fd = perf_event_open(&pe, -1, cpu, group_fd, 0);
-            if(fd == -1)
-            {
-                perror("scheduler: failed to initialise perf");
-                abort();
-            }
-
-            perf_cpu[cpu][i].fd = fd;
-            ioctl(fd, PERF_EVENT_IOC_ID, &perf_cpu[cpu][i].id);
-            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
-            perf_cpu[cpu][i].prev_value = 0;
+            perror("scheduler: failed to initialise perf");
+            abort();
         }
+
+        group.fds[i] = fd;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        group.prev_values[i] = 0;
     }
+}
 
-#endif
+/// Opens on `cpu` a group with the events of `Set`, in order, with the
+/// codes of its PMU.
+template<class Set>
+static void open_set(PerfGroup& group, int cpu, CountDomain domain)
+{
+    uint32_t types[Set::size];
+    uint64_t configs[Set::size];
+    for(size_t i = 0; i < Set::size; ++i)
+    {
+        types[i] = Set::type(i);
+        configs[i] = Set::code(i);
+        pmu_map_event(cpu, Set::name(i), types[i], configs[i]);
+    }
+    open_group(group, cpu, types, configs, Set::size, domain);
+}
 
-#ifdef PMCS_A15_ONLY
-    for(int cpu = START_INDEX_BIG; cpu <= END_INDEX_BIG; ++cpu)
+/// Reads the counts of a scaled group since the previous read into `counts`.
+static void consume_scaled(PerfGroup& group, uint64_t* counts)
+{
+    uint64_t data[3 + PERF_MAX_GROUP_EVENTS];
+
+    const auto size = sizeof(uint64_t) * (3 + group.num_events);
+    if(read(group.fds[0], data, size) != (ssize_t) size)
     {
-        for(int i = 0; i < MAX_EVENTS_PER_GROUP; ++i)
-        {
-            uint64_t config;
-            int group_fd;
-            struct perf_event_attr pe;
-            memset(&pe, 0, sizeof(pe));
-
-
-            switch(i)
-            {
-                case 0:
-		    config = PERF_COUNT_HW_CPU_CYCLES;
-		    group_fd = -1;
-                    pe.type = PERF_TYPE_HARDWARE;
-		    break;
-                case 1:
-		    config = pmcs_a15[curr_index_pmc_a15];
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-		    break;
-                case 2:
-		    config = pmcs_a15[curr_index_pmc_a15+1];
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-		    break;
-		case 3:
-                    config = pmcs_a15[curr_index_pmc_a15+2];
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-		    break;
-		case 4:
-                    config = pmcs_a15[curr_index_pmc_a15+3];
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-		    break;
-                case 5:
-                    config = pmcs_a15[curr_index_pmc_a15+4];
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-                    break;
-                case 6:
-                    config = pmcs_a15[curr_index_pmc_a15+5];
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-                    break;
-                default:
-		    perf_cpu[cpu][i].fd = -1;
-		    perf_cpu[cpu][i].id = -1;
-                    pe.type = PERF_TYPE_RAW;
-		    continue;
-            }
-
-            pe.size = sizeof(pe);
-            //pe.type = PERF_TYPE_RAW;
-            pe.config = config;
-            pe.exclude_hv = true;
-            pe.exclude_kernel = true;
-            pe.disabled = true;
-            pe.read_format = PERF_FORMAT_ID | PERF_FORMAT_GROUP;
-
-            const auto fd = perf_event_open(&pe, -1, cpu, group_fd, 0);
-            if(fd == -1)
-            {
-                perror("scheduler: failed to initialise perf");
-                abort();
-            }
-
-            perf_cpu[cpu][i].fd = fd;
-            ioctl(fd, PERF_EVENT_IOC_ID, &perf_cpu[cpu][i].id);
-            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
-            perf_cpu[cpu][i].prev_value = 0;
-        }
+        perror("scheduler: failed to read performance counters");
+        abort();
     }
-    curr_index_pmc_a15 +=6;
 
-#else
-    for(int cpu = START_INDEX_BIG; cpu <= END_INDEX_BIG; ++cpu)
+    const uint64_t enabled = data[1] - group.prev_enabled;
+    const uint64_t running = data[2] - group.prev_running;
+    group.prev_enabled = data[1];
+    group.prev_running = data[2];
+
+    for(int i = 0; i < group.num_events; ++i)
     {
-        for(int i = 0; i < MAX_EVENTS_PER_GROUP; ++i)
-        {
-            uint64_t config;
-            int group_fd;
-            struct perf_event_attr pe;
-            memset(&pe, 0, sizeof(pe));
-
-
-            switch(i)
-            {
-                case 0:
-		    config = PERF_COUNT_HW_CPU_CYCLES;
-		    group_fd = -1;
-                    pe.type = PERF_TYPE_HARDWARE;
-		    break;
-                case 1:
-		    config = 0x08;
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-		    break;
-                case 2:
-		    config = 0x13;
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-		    break;
-		case 3:
-                    config = 0x17;
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-		    break;
-		case 4:
-                    config = 0x19;
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-		    break;
-                case 5:
-                    config = 0x6C;
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-                    break;
-                case 6:
-                    config = 0x6D;
-		    group_fd = perf_cpu[cpu][0].fd;
-                    pe.type = PERF_TYPE_RAW;
-                    break;
-                default:
-		    perf_cpu[cpu][i].fd = -1;
-		    perf_cpu[cpu][i].id = -1;
-                    pe.type = PERF_TYPE_RAW;
-		    continue;
-            }
-
-            pe.size = sizeof(pe);
-            //pe.type = PERF_TYPE_RAW;
-            pe.config = config;
-            pe.exclude_hv = true;
-            pe.exclude_kernel = true;
-            pe.disabled = true;
-            pe.read_format = PERF_FORMAT_ID | PERF_FORMAT_GROUP;
-
-            const auto fd = perf_event_open(&pe, -1, cpu, group_fd, 0);
-            if(fd == -1)
-            {
-                perror("scheduler: failed to initialise perf");
-                abort();
-            }
-
-            perf_cpu[cpu][i].fd = fd;
-            ioctl(fd, PERF_EVENT_IOC_ID, &perf_cpu[cpu][i].id);
-            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
-            perf_cpu[cpu][i].prev_value = 0;
-        }
+        counts[i] = data[3 + i] - group.prev_values[i];
+        group.prev_values[i] = data[3 + i];
+        if(running > 0 && running < enabled)
+            counts[i] = uint64_t(double(counts[i]) * enabled / running);
     }
+}
 
-#endif
-    for(int cpu = 0; cpu < num_processors; ++cpu)
+/// Reads the group opened by `open_set<Set>`.
+template<class Set>
+static auto consume_set(PerfGroup& group) -> Set
+{
+    typename Set::ReadFormat data;
+
+    if(group.num_events == 0)
+        return Set{};
+
+    assert(group.num_events == Set::size);
+    if(group.scaled)
     {
+        Set counts;
+        consume_scaled(group, counts.values);
+        return counts;
+    }
 
-        for(int i = 0; i < NUM_SOFTWARE_COUNTERS; ++i)
-        {
-                uint64_t config;
-                int group_fd;
-
-                switch(i)
-                {
-                        case 0:
-	                    config = PERF_COUNT_SW_CPU_MIGRATIONS;
-	                    group_fd = -1;
-                            //group_fd = perf_sw[cpu][0].fd;
-	                    break;
-                        case 1:
-	                    config = PERF_COUNT_SW_CONTEXT_SWITCHES;
-	                    group_fd = perf_sw[cpu][0].fd;
-	                    break;
-                        default:
-	                    perf_sw[cpu][i].fd = -1;
-	                    perf_sw[cpu][i].id = -1;
-	                    continue;
-                }
-
-                struct perf_event_attr pe;
-                memset(&pe, 0, sizeof(pe));
-                pe.size = sizeof(pe);
-                pe.type = PERF_TYPE_SOFTWARE;
-                pe.config = config;
-                pe.exclude_hv = true;
-                pe.exclude_kernel = false;
-                pe.disabled = true;
-                pe.read_format = PERF_FORMAT_ID | PERF_FORMAT_GROUP;
-
-                const auto fd = perf_event_open(&pe, -1, cpu, group_fd, 0);
-                if(fd == -1)
-                {
-                     perror("scheduler: failed to initialise perf");
-                     abort();
-                }
-
-                perf_sw[cpu][i].fd = fd;
-                ioctl(fd, PERF_EVENT_IOC_ID, &perf_sw[cpu][i].id);
-                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
-                perf_sw[cpu][i].prev_value = 0;
-          }
+    if(read(group.fds[0], &data, sizeof(data)) != sizeof(data))
+    {
+        perror("scheduler: failed to read performance counters");
+        abort();
     }
 
+    return Set::delta(data, group.prev_values);
+}
 
-    for(int cpu = 0; cpu < num_processors; ++cpu)
+bool perf_set_cgroup(const char* path)
+{
+    if(cgroup_fd != -1)
     {
-        const auto leader_fd = perf_cpu[cpu][0].fd;
-        ioctl(leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        close(cgroup_fd);
+        cgroup_fd = -1;
     }
 
-    for(int cpu = 0; cpu < num_processors; ++cpu)
+    if(!path)
+        return true;
+
+    cgroup_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(cgroup_fd == -1)
     {
-        const auto leader_fd = perf_sw[cpu][0].fd;
-        ioctl(leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        perror("scheduler: failed to open cgroup to count");
+        return false;
     }
 
+    fprintf(stderr, "scheduler: counting only the tasks of %s\n", path);
+    return true;
 }
 
+bool perf_cgroup_scoped()
+{
+    return cgroup_fd != -1;
+}
 
-void perf_shutdown()
+int perf_num_collect_groups()
+{
+#if defined PMCS_A15_ONLY || defined PMCS_A7_ONLY
+    if(!has_collect_plan)
+    {
+#ifdef PMCS_A15_ONLY
+        const auto& pmu = pmu_a15;
+        const auto catalogue = events_a15;
+        const int catalogue_size = sizeof(events_a15) / sizeof(*events_a15);
+#else
+        const auto& pmu = pmu_a7;
+        const auto catalogue = events_a7;
+        const int catalogue_size = sizeof(events_a7) / sizeof(*events_a7);
+#endif
+        const PmuEvent* events[PLAN_MAX_GROUPS * PLAN_MAX_COUNTERS];
+        const int num_events = plan_select_events(catalogue, catalogue_size,
+                                                  std::getenv("SCHEDULER_COLLECT_EVENTS"),
+                                                  events, PLAN_MAX_GROUPS * PLAN_MAX_COUNTERS);
+        if(num_events <= 0 || !plan_counter_groups(pmu, events, num_events, collect_plan))
+            return 0;
+
+        has_collect_plan = true;
+    }
+    return collect_plan.num_groups;
+#else
+    return 1;
+#endif
+}
+
+void perf_collect_group_label(int index, char* buffer, size_t size)
 {
+#if defined PMCS_A15_ONLY || defined PMCS_A7_ONLY
+    assert(has_collect_plan);
+    plan_group_label(collect_plan.groups[index % collect_plan.num_groups], buffer, size);
+#else
+    snprintf(buffer, size, "fixed");
+#endif
+}
+
+void perf_init()
+{
+    static int curr_group = 0;
+    static bool logged_events = false;
+
+    num_processors = get_nprocs_conf();
+    assert(num_processors <= MAX_PROCESSORS);
+
+    static bool discovered_pmus = false;
+    if(!discovered_pmus)
+    {
+        discovered_pmus = true;
+        pmu_init();
+    }
+
+    count_split = false;
+    if(auto s = std::getenv("SCHEDULER_COUNT_MODE"))
+    {
+        if(!strcmp(s, "split"))
+            count_split = true;
+        else if(strcmp(s, "user"))
+            fprintf(stderr, "scheduler: Unrecognized SCHEDULER_COUNT_MODE: %s\n", s);
+    }
+
+    //fprintf(stderr, "scheduler: detected %d processors\n", num_processors);
+
+    if(!logged_events)
+    {
+        logged_events = true;
+        char names[256];
+        LittleEvents::names(names, sizeof(names), ",");
+        fprintf(stderr, "scheduler: little cluster events: %s\n", names);
+        BigEvents::names(names, sizeof(names), ",");
+        fprintf(stderr, "scheduler: big cluster events: %s\n", names);
+        if(count_split)
+        {
+            KernelEvents::names(names, sizeof(names), ",");
+            fprintf(stderr, "scheduler: kernel events on every cpu: %s\n", names);
+        }
+    }
+
+#if defined PMCS_A15_ONLY || defined PMCS_A7_ONLY
+    if(perf_num_collect_groups() == 0)
+        abort();
+
+    // The cycle counter leads the planned events.
+    uint32_t collect_types[PERF_MAX_GROUP_EVENTS] = {Cycles::type};
+    uint64_t collect_configs[PERF_MAX_GROUP_EVENTS] = {Cycles::code};
+    const auto& group = collect_plan.groups[curr_group++ % collect_plan.num_groups];
+    for(int i = 0; i < group.num_events; ++i)
+    {
+        collect_types[i + 1] = PERF_TYPE_RAW;
+        collect_configs[i + 1] = group.events[i]->code;
+    }
+#endif
+
     for(int cpu = 0; cpu < num_processors; ++cpu)
     {
-        for(int i = 0; i < MAX_EVENTS_PER_GROUP; ++i)
+        if(pmu_is_little(cpu))
         {
-            const auto fd = perf_cpu[cpu][i].fd;
-            if(fd != -1)
-            {
-                close(perf_cpu[cpu][i].fd);
-                perf_cpu[cpu][i].fd = -1;
-                perf_cpu[cpu][i].id = -1;
-                perf_cpu[cpu][i].prev_value = 0;
-            }
+#ifdef PMCS_A7_ONLY
+            open_group(perf_hw[cpu], cpu, collect_types, collect_configs, group.num_events + 1, COUNT_USER);
+#else
+            open_set<LittleEvents>(perf_hw[cpu], cpu, COUNT_USER);
+#endif
+        }
+        else if(pmu_is_big(cpu))
+        {
+#ifdef PMCS_A15_ONLY
+            open_group(perf_hw[cpu], cpu, collect_types, collect_configs, group.num_events + 1, COUNT_USER);
+#else
+            open_set<BigEvents>(perf_hw[cpu], cpu, COUNT_USER);
+#endif
         }
     }
 
+    for(int cpu = 0; cpu < num_processors; ++cpu)
+    {
+        open_set<SoftwareEvents>(perf_sw[cpu], cpu, COUNT_ALL);
+        if(count_split)
+            open_set<KernelEvents>(perf_kernel[cpu], cpu, COUNT_KERNEL);
+    }
 
     for(int cpu = 0; cpu < num_processors; ++cpu)
     {
+        if(perf_hw[cpu].num_events)
+            ioctl(perf_hw[cpu].fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        if(perf_kernel[cpu].num_events)
+            ioctl(perf_kernel[cpu].fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        ioctl(perf_sw[cpu].fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
 
-        for(int i = 0; i < NUM_SOFTWARE_COUNTERS; ++i)
+
+void perf_shutdown()
+{
+    for(int cpu = 0; cpu < num_processors; ++cpu)
+    {
+        for(auto group : {&perf_hw[cpu], &perf_sw[cpu], &perf_kernel[cpu]})
         {
-            close(perf_sw[cpu][i].fd);
-            perf_sw[cpu][i].fd = -1;
-            perf_sw[cpu][i].id = -1;
-            perf_sw[cpu][i].prev_value = 0;
+            for(int i = 0; i < group->num_events; ++i)
+                close(group->fds[i]);
+            group->num_events = 0;
         }
     }
 }
@@ -470,129 +458,193 @@ int perf_nprocs()
     return num_processors;
 }
 
-auto perf_consume_hw(int cpu) -> PerfHardwareData
+bool perf_split_enabled()
+{
+    return count_split;
+}
+
+auto perf_consume_little(int cpu) -> LittleEvents
+{
+    assert(pmu_is_little(cpu));
+#ifdef PMCS_A7_ONLY
+    return LittleEvents{};
+#else
+    return consume_set<LittleEvents>(perf_hw[cpu]);
+#endif
+}
+
+auto perf_consume_big(int cpu) -> BigEvents
+{
+    assert(pmu_is_big(cpu));
+#ifdef PMCS_A15_ONLY
+    return BigEvents{};
+#else
+    return consume_set<BigEvents>(perf_hw[cpu]);
+#endif
+}
+
+auto perf_consume_kernel(int cpu) -> KernelEvents
+{
+    assert(cpu < num_processors);
+    return consume_set<KernelEvents>(perf_kernel[cpu]);
+}
+
+auto perf_consume_collect(int cpu) -> CollectCounts
 {
     struct
     {
-        uint64_t nr;    /* The number of events */
-        struct {
-            uint64_t value; /* The value of the event */
-            uint64_t id;    /* if PERF_FORMAT_ID */
-        } values[MAX_EVENTS_PER_GROUP];
+        uint64_t nr;
+        uint64_t values[PERF_MAX_GROUP_EVENTS];
     } data;
 
+    CollectCounts counts;
 
-    assert(cpu < num_processors);
- 
-
-    const auto fd = perf_cpu[cpu][0].fd;
+#ifdef PMCS_A15_ONLY
+    counts.count = 7; // cycles plus the six counters of the Cortex A15
+    if(!pmu_is_big(cpu))
+        return counts;
+#elif defined PMCS_A7_ONLY
+    counts.count = 5; // cycles plus the four counters of the Cortex A7
+    if(!pmu_is_little(cpu))
+        return counts;
+#else
+    return counts;
+#endif
 
-    if(fd == -1)
-        return PerfHardwareData{};
+    auto& group = perf_hw[cpu];
+    if(group.scaled)
+    {
+        consume_scaled(group, counts.values);
+        return counts;
+    }
 
-    if(read(fd, &data, sizeof(data)) == -1)
+    const auto size = sizeof(uint64_t) * (1 + group.num_events);
+    if(read(group.fds[0], &data, size) != (ssize_t) size)
     {
         perror("scheduler: failed to read hardware counters");
         abort();
     }
 
-    uint64_t counters[MAX_EVENTS_PER_GROUP];
-    memset(counters, -1, sizeof(counters));
-
-
-    for(uint64_t s = 0; s < data.nr; ++s)
+    for(int i = 0; i < group.num_events; ++i)
     {
-        for(int pi = 0; pi < MAX_EVENTS_PER_GROUP; ++pi)
-        {
-            if(data.values[s].id == perf_cpu[cpu][pi].id)
-            {
-                const auto value = data.values[s].value;
-                const auto prev_value = perf_cpu[cpu][pi].prev_value;
-                const auto u64_max = std::numeric_limits<uint64_t>::max();
-
-                if(value >= prev_value)
-                {
-                    counters[pi] = value - prev_value;
-                }
-                else
-                {
-                    counters[pi] = 0;
-                    counters[pi] += u64_max - prev_value;
-                    counters[pi] += value;
-                }
-
-                perf_cpu[cpu][pi].prev_value = value;
-            }
-        }
+        counts.values[i] = data.values[i] - group.prev_values[i];
+        group.prev_values[i] = data.values[i];
     }
 
+    return counts;
+}
 
-    return PerfHardwareData {
-        counters[0],
-        counters[1],
-        counters[2],
-        counters[3],
-	counters[4],
-        counters[5],
-        counters[6],
+auto perf_consume_sw(int cpu) -> PerfSoftwareData
+{
+    assert(cpu < num_processors);
+
+    const auto counts = consume_set<SoftwareEvents>(perf_sw[cpu]);
+    return PerfSoftwareData {
+        counts.get<CpuMigrations>(),
+        counts.get<ContextSwitches>(),
     };
 }
 
-auto perf_consume_sw(int cpu) -> PerfSoftwareData
+/// Whether `Set` has the event `type` and `code`.
+template<class Set>
+static bool set_has_event(uint32_t type, uint64_t code)
 {
-    struct
+    for(size_t i = 0; i < Set::size; ++i)
     {
-        uint64_t nr;    /* The number of events */
-        struct {
-            uint64_t value; /* The value of the event */
-            uint64_t id;    /* if PERF_FORMAT_ID */
-        } values[NUM_SOFTWARE_COUNTERS];
-    } data;
-
-    assert(cpu < num_processors);
+        if(Set::type(i) == type && Set::code(i) == code)
+            return true;
+    }
+    return false;
+}
 
-    const auto fd = perf_sw[cpu][0].fd;
+bool perf_self_attach(int tid, int cpu)
+{
+    if(tid == 0)
+        tid = syscall(__NR_gettid);
 
-    if(fd == -1)
-        return PerfSoftwareData{};
+    if(num_self_tasks == MAX_SELF_TASKS)
+    {
+        fprintf(stderr, "scheduler: too many tasks to count\n");
+        return false;
+    }
 
-    if(read(fd, &data, sizeof(data)) == -1)
+    auto& task = self_tasks[num_self_tasks];
+    auto& group = task.group;
+    task.tid = tid;
+    group.num_events = 0;
+    group.scaled = true;
+    group.prev_enabled = 0;
+    group.prev_running = 0;
+
+    // The Cortex-A7 has none of the exclusive monitor events of the A15.
+    const bool is_little = pmu_is_little(cpu);
+    for(size_t i = 0; i < BigEvents::size; ++i)
     {
-        perror("scheduler: failed to read software counters");
-        abort();
+        if(is_little && !set_has_event<LittleEvents>(BigEvents::type(i), BigEvents::code(i)))
+            continue;
+
+        struct perf_event_attr pe;
+        memset(&pe, 0, sizeof(pe));
+        pe.size = sizeof(pe);
+        pe.exclude_hv = true;
+        pe.exclude_kernel = true;
+        pe.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+                       | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        uint32_t type = BigEvents::type(i);
+        uint64_t config = BigEvents::code(i);
+        pmu_map_event(cpu, BigEvents::name(i), type, config);
+
+        const int group_fd = (group.num_events == 0)? -1 : group.fds[0];
+        const auto fd = open_event(pe, type, config, cpu, tid, -1, group_fd, 0);
+        if(fd == -1)
+        {
+            perror("scheduler: failed to count own task");
+            for(int e = 0; e < group.num_events; ++e)
+                close(group.fds[e]);
+            group.num_events = 0;
+            return false;
+        }
+
+        task.indices[group.num_events] = i;
+        group.fds[group.num_events] = fd;
+        group.prev_values[group.num_events] = 0;
+        group.num_events += 1;
     }
 
-    uint64_t counters[NUM_SOFTWARE_COUNTERS];
-    memset(counters, -1, sizeof(counters));
+    num_self_tasks += 1;
+    return true;
+}
+
+void perf_self_detach(int tid)
+{
+    if(tid == 0)
+        tid = syscall(__NR_gettid);
 
-    for(uint64_t s = 0; s < data.nr; ++s)
+    for(int t = 0; t < num_self_tasks; ++t)
     {
-        for(int pi = 0; pi < NUM_SOFTWARE_COUNTERS; ++pi)
+        if(self_tasks[t].tid == tid)
         {
-            if(data.values[s].id == perf_sw[cpu][pi].id)
-            {
-                const auto value = data.values[s].value;
-                const auto prev_value = perf_sw[cpu][pi].prev_value;
-                const auto u64_max = std::numeric_limits<uint64_t>::max();
-
-                if(value >= prev_value)
-                {
-                    counters[pi] = value - prev_value;
-                }
-                else
-                {
-                    counters[pi] = 0;
-                    counters[pi] += u64_max - prev_value;
-                    counters[pi] += value;
-                }
-
-                perf_sw[cpu][pi].prev_value = value;
-            }
+            for(int i = 0; i < self_tasks[t].group.num_events; ++i)
+                close(self_tasks[t].group.fds[i]);
+            self_tasks[t] = self_tasks[--num_self_tasks];
+            return;
         }
     }
+}
 
-    return PerfSoftwareData {
-        counters[0],
-        counters[1],
-    };
+auto perf_consume_self() -> BigEvents
+{
+    BigEvents counts;
+
+    for(int t = 0; t < num_self_tasks; ++t)
+    {
+        auto& task = self_tasks[t];
+        uint64_t values[PERF_MAX_GROUP_EVENTS];
+        consume_scaled(task.group, values);
+        for(int i = 0; i < task.group.num_events; ++i)
+            counts.values[task.indices[i]] += values[i];
+    }
+
+    return counts;
 }
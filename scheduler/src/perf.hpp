@@ -1,5 +1,8 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
+#include <linux/perf_event.h>
+#include "event_set.hpp"
 
 
 #define START_INDEX_LITTLE 0
@@ -7,9 +10,12 @@
 #define START_INDEX_BIG 4
 #define END_INDEX_BIG 7
 
-//only one at a time may be enabled
+//only one at a time may be enabled (only honoured when collecting, the
+//predictor and the agent always need the fixed events on both clusters)
+#if SCHEDULER_TYPE == 0
 #define PMCS_A15_ONLY
 //#define PMCS_A7_ONLY
+#endif
 
 
 /// Software hardware counters.
@@ -19,19 +25,106 @@ struct PerfSoftwareData
     uint64_t context_switches = -1;
 };
 
-/// Hardware performance counters.
-struct PerfHardwareData
+/// Hardware event tags (ARMv7 architectural events, which `pmu_map_event`
+/// replaces on PMUs that code them differently).
+struct Cycles
 {
-    static const uint64_t no_value = -1;
-    uint64_t pmu_1 = -1;
-    uint64_t pmu_2 = -1;
-    uint64_t pmu_3 = -1;
-    uint64_t pmu_4 = -1;
-    uint64_t pmu_5 = -1;
-    uint64_t pmu_6 = -1;
-    uint64_t pmu_7 = -1;
+    static constexpr uint32_t type = PERF_TYPE_HARDWARE;
+    static constexpr uint64_t code = PERF_COUNT_HW_CPU_CYCLES;
+    static constexpr const char* name() { return "cycles"; }
 };
 
+struct Instructions
+{
+    static constexpr uint32_t type = PERF_TYPE_RAW;
+    static constexpr uint64_t code = 0x08;
+    static constexpr const char* name() { return "inst_retired"; }
+};
+
+struct MemAccess
+{
+    static constexpr uint32_t type = PERF_TYPE_RAW;
+    static constexpr uint64_t code = 0x13;
+    static constexpr const char* name() { return "mem_access"; }
+};
+
+struct L2Refill
+{
+    static constexpr uint32_t type = PERF_TYPE_RAW;
+    static constexpr uint64_t code = 0x17;
+    static constexpr const char* name() { return "l2d_cache_refill"; }
+};
+
+struct BusAccess
+{
+    static constexpr uint32_t type = PERF_TYPE_RAW;
+    static constexpr uint64_t code = 0x19;
+    static constexpr const char* name() { return "bus_access"; }
+};
+
+struct LdrexSpec
+{
+    static constexpr uint32_t type = PERF_TYPE_RAW;
+    static constexpr uint64_t code = 0x6C;
+    static constexpr const char* name() { return "ldrex_spec"; }
+};
+
+struct StrexPassSpec
+{
+    static constexpr uint32_t type = PERF_TYPE_RAW;
+    static constexpr uint64_t code = 0x6D;
+    static constexpr const char* name() { return "strex_pass_spec"; }
+};
+
+/// Events counted on every tick on the little cluster.
+using LittleEvents = EventSet<Cycles, Instructions, MemAccess, L2Refill, BusAccess>;
+
+/// Events counted on every tick on the big cluster.
+using BigEvents = EventSet<Cycles, Instructions, MemAccess, L2Refill, BusAccess,
+                           LdrexSpec, StrexPassSpec>;
+
+/// Events counted in kernel mode on every CPU when counting is split (see
+/// `SCHEDULER_COUNT_MODE`), as twins of the user-mode events of each cluster.
+using KernelEvents = EventSet<Cycles, Instructions>;
+
+/// Maximum events of a group (the cycle counter plus the six programmable
+/// counters of the Cortex A15).
+constexpr int PERF_MAX_GROUP_EVENTS = 7;
+
+/// Counts of a collect group, which is planned at run time and so cannot be
+/// an `EventSet`. The cycle counter comes first and unused slots count zero.
+struct CollectCounts
+{
+    int count = 0;
+    uint64_t values[PERF_MAX_GROUP_EVENTS] = {};
+
+    CollectCounts& operator+=(const CollectCounts& other)
+    {
+        count = other.count;
+        for(int i = 0; i < other.count; ++i)
+            values[i] += other.values[i];
+        return *this;
+    }
+};
+
+/// Number of counter groups to collect, one per episode, when collecting a
+/// single cluster (planned from `SCHEDULER_COLLECT_EVENTS` or every known
+/// event), or 1 otherwise.
+///
+/// Returns 0 if the events could not be planned.
+extern int perf_num_collect_groups();
+
+/// Writes the label (event codes) of the group collected on episode `index`.
+extern void perf_collect_group_label(int index, char* buffer, size_t size);
+
+/// Restricts the hardware and software counters opened by the next
+/// `perf_init` to the tasks of the cgroup v2 group at `path`, or counts
+/// system-wide if `path` is null.
+extern bool perf_set_cgroup(const char* path);
+
+/// Whether counting is restricted to a cgroup.
+extern bool perf_cgroup_scoped();
+
 /// Initialises the performance counting subsystem.
 extern void perf_init();
 
@@ -41,12 +134,41 @@ extern void perf_shutdown();
 /// Gets the number of processors configured on the system (even if offline).
 extern int perf_nprocs();
 
-/// Consumes the hardware performance counters regarding the specified
-/// CPU index.
+/// Whether kernel mode is counted apart from user mode.
+///
+/// Hardware events only count user mode by default. With
+/// `SCHEDULER_COUNT_MODE=split`, `KernelEvents` are also counted in kernel
+/// mode only, and every hardware group is scaled for multiplexing since the
+/// twins compete for the same counters.
+extern bool perf_split_enabled();
+
+/// Consumes the hardware performance counters of the little cluster CPU `cpu`.
 ///
 /// A consume operation obtains counters as if they were reset during
 /// the previous consume operation.
-extern auto perf_consume_hw(int cpu) -> PerfHardwareData;
+extern auto perf_consume_little(int cpu) -> LittleEvents;
+
+/// Consumes the hardware performance counters of the big cluster CPU `cpu`.
+extern auto perf_consume_big(int cpu) -> BigEvents;
+
+/// Consumes the kernel-mode counters of `cpu`, or zero counts if counting
+/// is not split.
+extern auto perf_consume_kernel(int cpu) -> KernelEvents;
+
+/// Consumes the collect group counters of `cpu`, on the cluster being
+/// collected.
+extern auto perf_consume_collect(int cpu) -> CollectCounts;
+
+/// Starts counting in user mode the events of `BigEvents` on our own task
+/// `tid` (or the calling thread if zero), which runs on `cpu`. Events the
+/// PMU of `cpu` lacks count zero.
+extern bool perf_self_attach(int tid, int cpu);
+
+/// Stops counting our own task `tid` (or the calling thread if zero).
+extern void perf_self_detach(int tid);
+
+/// Consumes the counts of every task attached with `perf_self_attach`.
+extern auto perf_consume_self() -> BigEvents;
 
 /// Consumes the software performance counters regarding this process.
 ///
@@ -0,0 +1,353 @@
+#include "pmu.hpp"
+#include "perf.hpp"
+#include "sysfs.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
+#include <dirent.h>
+#include <linux/limits.h>
+#include <linux/perf_event.h>
+
+// Hybrid PMU discovery.
+//
+// Heterogeneous systems register one PMU per core type (armv7_cortex_a7 and
+// armv7_cortex_a15, armv8_pmuv3_0 and _1, cpu_core and cpu_atom...), each
+// with its own type id and the mask of the CPUs it counts. An event opened
+// with the generic types is left for the kernel to match against whichever
+// PMU accepts it, so each cluster's events are instead bound to the PMU of
+// its CPUs explicitly.
+//
+// Which CPUs make up each cluster, and the codes of the events on each PMU,
+// are taken from sysfs and a table per PMU family as well, so the counters
+// follow the hardware and not a particular board.
+
+#ifndef PERF_PMU_TYPE_SHIFT
+#define PERF_PMU_TYPE_SHIFT 32
+#endif
+
+/// Maximum number of CPUs whose topology is read.
+constexpr int MAX_TOPOLOGY_CPUS = 64;
+
+/// Maximum number of entries of `SCHEDULER_EVENT_CODES`.
+constexpr int MAX_EVENT_OVERRIDES = 8;
+
+/// Code of an event of perf.hpp on a family of PMUs.
+struct PmuEventCode
+{
+    const char* event;
+    uint32_t type;
+    uint64_t config;
+};
+
+/// Codes of the events of a PMU family, matched by the prefix of its name.
+struct PmuEventTable
+{
+    const char* prefix;
+    const PmuEventCode* codes;
+    int num_codes;
+};
+
+/// x86 (cpu, cpu_core and cpu_atom) has none of the ARM codes, so the
+/// closest generic events stand in. There is no exclusive monitor to count.
+static const PmuEventCode codes_x86[] = {
+    {"inst_retired", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"mem_access", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                     | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                     | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16)},
+    {"l2d_cache_refill", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"bus_access", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BUS_CYCLES},
+    {"ldrex_spec", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_DUMMY},
+    {"strex_pass_spec", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_DUMMY},
+};
+
+static const PmuEventTable event_tables[] = {
+    {"cpu", codes_x86, sizeof(codes_x86) / sizeof(*codes_x86)},
+};
+
+/// Table of the PMU of this architecture when it registers no `cpus`.
+#if defined(__x86_64__) || defined(__i386__)
+static const PmuEventTable* const default_table = &event_tables[0];
+#else
+static const PmuEventTable* const default_table = nullptr;
+#endif
+
+static PmuDevice devices[PMU_MAX_DEVICES];
+static int num_devices;
+static uint64_t little_cpus;
+static uint64_t big_cpus;
+static PmuEventCode overrides[MAX_EVENT_OVERRIDES];
+static char override_names[MAX_EVENT_OVERRIDES][32];
+static int num_overrides;
+
+/// Reads a number of every CPU from `file` under its directory. Returns the
+/// mask of the CPUs it could be read for.
+static uint64_t read_cpu_values(const char* root, const char* file, long* values)
+{
+    char path[PATH_MAX + 64];
+    char buffer[64];
+
+    uint64_t mask = 0;
+    for(int cpu = 0; cpu < MAX_TOPOLOGY_CPUS; ++cpu)
+    {
+        snprintf(path, sizeof(path), "%s/cpu%d/%s", root, cpu, file);
+        if(!sysfs_read(path, buffer, sizeof(buffer)))
+            continue;
+        values[cpu] = strtol(buffer, nullptr, 10);
+        mask |= uint64_t(1) << cpu;
+    }
+    return mask;
+}
+
+/// Gets the mask of the CPUs `first` to `last`.
+static uint64_t cpu_range(int first, int last)
+{
+    return ((uint64_t(2) << last) - 1) & ~((uint64_t(1) << first) - 1);
+}
+
+/// Splits the CPUs into the LITTLE and big clusters.
+static void discover_clusters()
+{
+    char root[PATH_MAX] = "/sys/devices/system/cpu";
+    if(auto s = std::getenv("SCHEDULER_CPU_ROOT"))
+        snprintf(root, sizeof(root), "%s", s);
+
+    little_cpus = cpu_range(START_INDEX_LITTLE, END_INDEX_LITTLE);
+    big_cpus = cpu_range(START_INDEX_BIG, END_INDEX_BIG);
+
+    for(const char* file : {"cpu_capacity", "cpufreq/cpuinfo_max_freq", "topology/cluster_id"})
+    {
+        long values[MAX_TOPOLOGY_CPUS];
+        const uint64_t cpus = read_cpu_values(root, file, values);
+        if(cpus == 0)
+            continue;
+
+        bool has_lowest = false;
+        long lowest = 0;
+        for(int cpu = 0; cpu < MAX_TOPOLOGY_CPUS; ++cpu)
+        {
+            if((cpus & (uint64_t(1) << cpu)) && (!has_lowest || values[cpu] < lowest))
+            {
+                lowest = values[cpu];
+                has_lowest = true;
+            }
+        }
+
+        uint64_t little = 0;
+        for(int cpu = 0; cpu < MAX_TOPOLOGY_CPUS; ++cpu)
+        {
+            if((cpus & (uint64_t(1) << cpu)) && values[cpu] == lowest)
+                little |= uint64_t(1) << cpu;
+        }
+
+        // Every CPU alike tells nothing, try the next source.
+        if(little == cpus)
+            continue;
+
+        char little_list[256], big_list[256];
+        sysfs_format_cpu_list(little, little_list, sizeof(little_list));
+        sysfs_format_cpu_list(cpus & ~little, big_list, sizeof(big_list));
+        fprintf(stderr, "scheduler: clusters from %s: little %s, big %s\n", file, little_list, big_list);
+
+        if(little != little_cpus || (cpus & ~little) != big_cpus)
+        {
+            fprintf(stderr, "scheduler: core placement still assumes cpus %d-%d are little and %d-%d big, "
+                            "only the counters follow sysfs\n",
+                    START_INDEX_LITTLE, END_INDEX_LITTLE, START_INDEX_BIG, END_INDEX_BIG);
+        }
+
+        little_cpus = little;
+        big_cpus = cpus & ~little;
+        return;
+    }
+}
+
+/// Parses `SCHEDULER_EVENT_CODES`.
+static void parse_overrides()
+{
+    num_overrides = 0;
+
+    const char* s = std::getenv("SCHEDULER_EVENT_CODES");
+    while(s && *s && num_overrides < MAX_EVENT_OVERRIDES)
+    {
+        const char* end = strchr(s, ',');
+        const size_t length = end? size_t(end - s) : strlen(s);
+        const char* equals = static_cast<const char*>(memchr(s, '=', length));
+
+        auto& name = override_names[num_overrides];
+        if(!equals || size_t(equals - s) >= sizeof(name))
+        {
+            fprintf(stderr, "scheduler: Unrecognized SCHEDULER_EVENT_CODES entry: %.*s\n", (int) length, s);
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "%.*s", (int) (equals - s), s);
+            auto& code = overrides[num_overrides++];
+            code.event = name;
+            if(!strncmp(equals + 1, "none", 4))
+            {
+                code.type = PERF_TYPE_SOFTWARE;
+                code.config = PERF_COUNT_SW_DUMMY;
+            }
+            else
+            {
+                code.type = PERF_TYPE_RAW;
+                code.config = strtoull(equals + 1, nullptr, 0);
+            }
+        }
+
+        s = end? end + 1 : nullptr;
+    }
+}
+
+int pmu_init()
+{
+    char root[PATH_MAX] = "/sys/bus/event_source/devices";
+    char path[PATH_MAX + 320];
+    char buffer[256];
+
+    num_devices = 0;
+    discover_clusters();
+    parse_overrides();
+
+    if(auto s = std::getenv("SCHEDULER_PMU_DEVICES"))
+        snprintf(root, sizeof(root), "%s", s);
+
+    DIR* dir = opendir(root);
+    if(!dir)
+        return 0;
+
+    while(auto entry = readdir(dir))
+    {
+        if(entry->d_name[0] == '.' || num_devices == PMU_MAX_DEVICES)
+            continue;
+
+        // Uncore and software PMUs have no `cpus` (at most a `cpumask`).
+        snprintf(path, sizeof(path), "%s/%s/cpus", root, entry->d_name);
+        if(!sysfs_read(path, buffer, sizeof(buffer)))
+            continue;
+        const uint64_t cpus = sysfs_parse_cpu_list(buffer);
+
+        snprintf(path, sizeof(path), "%s/%s/type", root, entry->d_name);
+        if(!sysfs_read(path, buffer, sizeof(buffer)) || cpus == 0)
+            continue;
+
+        auto& device = devices[num_devices++];
+        snprintf(device.name, sizeof(device.name), "%.63s", entry->d_name);
+        device.type = strtoul(buffer, nullptr, 10);
+        device.cpus = cpus;
+    }
+
+    closedir(dir);
+
+    for(int i = 0; i < num_devices; ++i)
+    {
+        fprintf(stderr, "scheduler: pmu %s (type %u) on cpus 0x%llx\n", devices[i].name,
+                devices[i].type, (unsigned long long) devices[i].cpus);
+    }
+
+    // Every cluster is expected to be counted by a single PMU.
+    for(auto cluster : {std::make_pair("little", little_cpus), std::make_pair("big", big_cpus)})
+    {
+        const PmuDevice* first = nullptr;
+        for(int cpu = 0; cpu < MAX_TOPOLOGY_CPUS; ++cpu)
+        {
+            if(!(cluster.second & (uint64_t(1) << cpu)))
+                continue;
+            if(!first)
+            {
+                first = pmu_for_cpu(cpu);
+            }
+            else if(pmu_for_cpu(cpu) != first)
+            {
+                fprintf(stderr, "scheduler: the %s cluster spans several pmus\n", cluster.first);
+                break;
+            }
+        }
+    }
+
+    return num_devices;
+}
+
+uint64_t pmu_little_cpus()
+{
+    return little_cpus;
+}
+
+uint64_t pmu_big_cpus()
+{
+    return big_cpus;
+}
+
+/// Gets the table of the events of the PMU of `cpu`, or null if the codes of
+/// perf.hpp are the right ones.
+static auto table_for_cpu(int cpu) -> const PmuEventTable*
+{
+    const auto device = pmu_for_cpu(cpu);
+    if(!device)
+        return default_table;
+
+    for(const auto& table : event_tables)
+    {
+        if(!strncmp(device->name, table.prefix, strlen(table.prefix)))
+            return &table;
+    }
+    return nullptr;
+}
+
+void pmu_map_event(int cpu, const char* name, uint32_t& type, uint64_t& config)
+{
+    for(int i = 0; i < num_overrides; ++i)
+    {
+        if(!strcmp(overrides[i].event, name))
+        {
+            type = overrides[i].type;
+            config = overrides[i].config;
+            return;
+        }
+    }
+
+    if(const auto table = table_for_cpu(cpu))
+    {
+        for(int i = 0; i < table->num_codes; ++i)
+        {
+            if(!strcmp(table->codes[i].event, name))
+            {
+                type = table->codes[i].type;
+                config = table->codes[i].config;
+                return;
+            }
+        }
+    }
+}
+
+auto pmu_for_cpu(int cpu) -> const PmuDevice*
+{
+    if(cpu < 0 || cpu >= 64)
+        return nullptr;
+
+    for(int i = 0; i < num_devices; ++i)
+    {
+        if(devices[i].cpus & (uint64_t(1) << cpu))
+            return &devices[i];
+    }
+    return nullptr;
+}
+
+void pmu_resolve_event(int cpu, uint32_t& type, uint64_t& config)
+{
+    // A single PMU is the one generic events already go to.
+    const auto device = pmu_for_cpu(cpu);
+    if(!device || num_devices < 2)
+        return;
+
+    if(type == PERF_TYPE_RAW)
+    {
+        type = device->type;
+    }
+    else if(type == PERF_TYPE_HARDWARE || type == PERF_TYPE_HW_CACHE)
+    {
+        config = (config & 0xFFFFFFFFull) | (uint64_t(device->type) << PERF_PMU_TYPE_SHIFT);
+    }
+}
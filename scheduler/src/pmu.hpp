@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+
+/// Maximum number of core PMUs known.
+constexpr int PMU_MAX_DEVICES = 8;
+
+/// A core PMU, as registered under /sys/bus/event_source/devices.
+struct PmuDevice
+{
+    char name[64];
+    uint32_t type;      //< perf type id of the PMU
+    uint64_t cpus;      //< mask of the CPUs it counts
+};
+
+/// Discovers the core PMUs (those with a `cpus` file) under
+/// `SCHEDULER_PMU_DEVICES` (/sys/bus/event_source/devices by default), and
+/// the clusters from the `cpu_capacity`, `cpufreq/cpuinfo_max_freq` or
+/// `topology/cluster_id` of each CPU under `SCHEDULER_CPU_ROOT`
+/// (/sys/devices/system/cpu by default). The CPUs of the lowest value are
+/// the LITTLE cluster and the rest the big one. Without any difference
+/// between CPUs, the layout of perf.hpp is assumed.
+///
+/// `SCHEDULER_EVENT_CODES` overrides the code of events of perf.hpp on every
+/// PMU, as a list of `name=code` (raw codes) or `name=none` (not counted),
+/// e.g. `ldrex_spec=0x21d0,strex_pass_spec=none`.
+///
+/// Returns how many PMUs there are. Systems with a single PMU type valid on
+/// every CPU have none, in which case events are opened as is.
+extern int pmu_init();
+
+/// Gets the mask of the CPUs of the LITTLE cluster.
+extern uint64_t pmu_little_cpus();
+
+/// Gets the mask of the CPUs of the big cluster.
+extern uint64_t pmu_big_cpus();
+
+/// Whether `cpu` is in the LITTLE cluster.
+inline bool pmu_is_little(int cpu)
+{
+    return cpu >= 0 && cpu < 64 && (pmu_little_cpus() & (uint64_t(1) << cpu));
+}
+
+/// Whether `cpu` is in the big cluster.
+inline bool pmu_is_big(int cpu)
+{
+    return cpu >= 0 && cpu < 64 && (pmu_big_cpus() & (uint64_t(1) << cpu));
+}
+
+/// Gets the core PMU counting `cpu`, or null if there is none.
+extern auto pmu_for_cpu(int cpu) -> const PmuDevice*;
+
+/// Replaces the code of the event `name` of perf.hpp by that of the core PMU
+/// of `cpu`, from the table of its PMU family or `SCHEDULER_EVENT_CODES`.
+///
+/// The tags of perf.hpp carry the ARM architectural codes, which every ARMv7
+/// and ARMv8 PMU shares. Events a PMU has no counterpart for become a dummy
+/// software event, which counts zero.
+extern void pmu_map_event(int cpu, const char* name, uint32_t& type, uint64_t& config);
+
+/// Retargets an event to the core PMU of `cpu`, if there are several.
+///
+/// Raw events take the type of the PMU, and generic hardware events keep
+/// their type but carry the PMU type in the upper half of their config (as
+/// hybrid kernels expect). Any other event is left untouched.
+extern void pmu_resolve_event(int cpu, uint32_t& type, uint64_t& config);
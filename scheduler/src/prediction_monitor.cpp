@@ -0,0 +1,262 @@
+#include "prediction_monitor.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+
+// Prediction-quality monitor.
+//
+// Every switch decided by a model is logged with the throughput gain the
+// model predicted, and the gain actually measured over the ticks that follow
+// (relative to the ticks that preceded it). The absolute difference between
+// both is the error of that decision.
+//
+// Errors are accumulated per model and fed into a Page-Hinkley test. Once the
+// test detects an upward drift on the error, the policy falls back to a safe
+// heuristic for a while, after which the model is trusted again.
+
+/// Number of ticks averaged before and after a switch.
+constexpr int MEASURE_TICKS = 5;
+
+/// Number of ticks the safe heuristic stays in charge after a drift alarm.
+constexpr int FALLBACK_TICKS = 50;
+
+/// Smoothing factor of the rolling error.
+constexpr double EWMA_ALPHA = 0.2;
+
+/// Magnitude of changes tolerated by the Page-Hinkley test.
+constexpr double PH_DELTA = 0.05;
+
+/// Alarm threshold of the Page-Hinkley test.
+constexpr double PH_THRESHOLD = 1.0;
+
+/// Maximum number of distinct models tracked.
+constexpr int MAX_MODELS = 4;
+
+/// Page-Hinkley test for an increase on the mean of a stream.
+struct PageHinkley
+{
+    uint64_t count = 0;
+    double mean = 0.0;
+    double cumsum = 0.0;
+    double min_cumsum = 0.0;
+
+    /// Adds a sample and returns whether drift has been detected.
+    bool add(double x)
+    {
+        count += 1;
+        mean += (x - mean) / count;
+        cumsum += x - mean - PH_DELTA;
+        min_cumsum = std::min(min_cumsum, cumsum);
+        return (cumsum - min_cumsum) > PH_THRESHOLD;
+    }
+
+    void reset()
+    {
+        *this = PageHinkley{};
+    }
+};
+
+struct ModelStats
+{
+    char name[32] = {0};
+    uint64_t num_switches = 0;
+    uint64_t num_alarms = 0;
+    double sum_abs_error = 0.0;
+    double sum_sq_error = 0.0;
+    double rolling_error = 0.0;
+    PageHinkley ph;
+};
+
+static char app_name[64];
+static ModelStats models[MAX_MODELS];
+static int num_models;
+static FILE* switch_stream;
+
+/// Throughput of the last ticks, most recent at `history_pos - 1`.
+static double history[MEASURE_TICKS];
+static int history_pos;
+static int history_count;
+
+/// The switch whose outcome is being measured, if any.
+static ModelStats* pending_model;
+static State pending_from, pending_to;
+static double pending_predicted_gain;
+static double pending_before;
+static double pending_sum;
+static int pending_ticks;
+
+static int fallback_ticks;
+
+static auto find_model(const char* name) -> ModelStats*
+{
+    for(int i = 0; i < num_models; ++i)
+    {
+        if(!strcmp(models[i].name, name))
+            return &models[i];
+    }
+
+    if(num_models == MAX_MODELS)
+        return &models[MAX_MODELS - 1];
+
+    auto& model = models[num_models++];
+    model = ModelStats{};
+    snprintf(model.name, sizeof(model.name), "%s", name);
+    return &model;
+}
+
+void monitor_init(const char* app)
+{
+    const char* base = strrchr(app, '/');
+    snprintf(app_name, sizeof(app_name), "%s", base? base + 1 : app);
+
+    num_models = 0;
+    history_pos = 0;
+    history_count = 0;
+    pending_model = nullptr;
+    fallback_ticks = 0;
+
+    char filename[64];
+    sprintf(filename, "scheduler_%d.switches", getpid());
+    switch_stream = fopen(filename, "w");
+    if(!switch_stream)
+    {
+        perror("scheduler: failed to open switches log");
+    }
+    else
+    {
+        fprintf(switch_stream, "app,model,from,to,predicted_gain,measured_gain,abs_error,drift\n");
+    }
+}
+
+void monitor_tick(double throughput)
+{
+    if(fallback_ticks > 0 && --fallback_ticks == 0)
+        fprintf(stderr, "scheduler: leaving safe heuristic policy\n");
+
+    if(pending_model)
+    {
+        pending_sum += throughput;
+        pending_ticks += 1;
+
+        if(pending_ticks == MEASURE_TICKS)
+        {
+            auto& model = *pending_model;
+            const double after = pending_sum / pending_ticks;
+            const double measured_gain = (pending_before > 0.0)? after / pending_before - 1.0 : 0.0;
+            const double error = std::fabs(measured_gain - pending_predicted_gain);
+
+            model.num_switches += 1;
+            model.sum_abs_error += error;
+            model.sum_sq_error += error * error;
+            model.rolling_error = (model.num_switches == 1)? error
+                                : EWMA_ALPHA * error + (1.0 - EWMA_ALPHA) * model.rolling_error;
+
+            const bool drift = model.ph.add(error);
+
+            if(switch_stream)
+            {
+                fprintf(switch_stream, "%s,%s,%d,%d,%.4lf,%.4lf,%.4lf,%d\n",
+                        app_name, model.name, pending_from, pending_to,
+                        pending_predicted_gain, measured_gain, error, drift);
+                fflush(switch_stream);
+            }
+
+            if(drift)
+            {
+                fprintf(stderr, "scheduler: drift detected on model %s (rolling error %.3lf), "
+                                "falling back to safe heuristic policy\n",
+                        model.name, model.rolling_error);
+                model.num_alarms += 1;
+                model.ph.reset();
+                fallback_ticks = FALLBACK_TICKS;
+            }
+
+            pending_model = nullptr;
+        }
+    }
+
+    history[history_pos] = throughput;
+    history_pos = (history_pos + 1) % MEASURE_TICKS;
+    history_count = std::min(history_count + 1, MEASURE_TICKS);
+}
+
+void monitor_switch(const char* model_name, State from, State to,
+                    double predicted_from, double predicted_to)
+{
+    if(history_count == 0)
+        return;
+
+    double before = 0.0;
+    for(int i = 0; i < history_count; ++i)
+        before += history[i];
+
+    pending_model = find_model(model_name);
+    pending_from = from;
+    pending_to = to;
+    pending_predicted_gain = (predicted_from > 0.0)? predicted_to / predicted_from - 1.0 : 0.0;
+    pending_before = before / history_count;
+    pending_sum = 0.0;
+    pending_ticks = 0;
+}
+
+bool monitor_is_evaluating()
+{
+    return pending_model != nullptr;
+}
+
+bool monitor_in_fallback()
+{
+    return fallback_ticks > 0;
+}
+
+auto monitor_fallback_state(double usage_little, double usage_big) -> State
+{
+    // Mostly serial applications benefit from the big cluster alone, while
+    // parallel ones are safer on every core.
+    if(usage_little + usage_big < 150.0)
+        return STATE_4b;
+    return STATE_4l4b;
+}
+
+void monitor_report(const char* path)
+{
+    FILE* stream = fopen(path, "w");
+    if(!stream)
+    {
+        perror("scheduler: failed to open prediction error summary");
+    }
+    else
+    {
+        fprintf(stream, "app,model,switches,mean_abs_error,rmse,rolling_error,drift_alarms\n");
+        for(int i = 0; i < num_models; ++i)
+        {
+            const auto& model = models[i];
+            const double n = std::max<double>(1, model.num_switches);
+            fprintf(stream, "%s,%s,%llu,%.4lf,%.4lf,%.4lf,%llu\n",
+                    app_name, model.name,
+                    (unsigned long long) model.num_switches,
+                    model.sum_abs_error / n,
+                    std::sqrt(model.sum_sq_error / n),
+                    model.rolling_error,
+                    (unsigned long long) model.num_alarms);
+        }
+        fclose(stream);
+    }
+
+    for(int i = 0; i < num_models; ++i)
+    {
+        auto& model = models[i];
+        model.num_switches = 0;
+        model.num_alarms = 0;
+        model.sum_abs_error = 0.0;
+        model.sum_sq_error = 0.0;
+    }
+
+    history_pos = 0;
+    history_count = 0;
+    pending_model = nullptr;
+    fallback_ticks = 0;
+}
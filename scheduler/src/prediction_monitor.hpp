@@ -0,0 +1,33 @@
+#pragma once
+#include "states.hpp"
+
+/// Initialises the prediction-quality monitor for the application `app_name`.
+extern void monitor_init(const char* app_name);
+
+/// Feeds the throughput measured on this tick.
+extern void monitor_tick(double throughput);
+
+/// Registers a switch decided by the model `model_name`, with the throughput
+/// it predicted for the state being left and for the state being entered.
+///
+/// The measured gain is compared with the predicted gain once enough ticks
+/// have been observed on the new state.
+extern void monitor_switch(const char* model_name, State from, State to,
+                           double predicted_from, double predicted_to);
+
+/// Whether the outcome of the last switch is still being measured.
+///
+/// Policies should hold their state meanwhile, or the measurement would
+/// be attributed to the wrong switch.
+extern bool monitor_is_evaluating();
+
+/// Whether drift has been detected and the policy must use the safe
+/// heuristic (`monitor_fallback_state`) instead of the model.
+extern bool monitor_in_fallback();
+
+/// State chosen by the safe heuristic policy.
+extern auto monitor_fallback_state(double usage_little, double usage_big) -> State;
+
+/// Writes the error summary of the episode to `path` and resets the
+/// per-episode statistics.
+extern void monitor_report(const char* path);
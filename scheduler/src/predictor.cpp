@@ -0,0 +1,524 @@
+#include "predictor.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <libgen.h>
+#include <linux/limits.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "time.hpp"
+
+// Online throughput predictor.
+//
+// For each state we keep a linear model mapping the (normalised) counters
+// observed on the previous tick into the throughput observed on the current
+// tick. Every tick the model of the current state is updated with recursive
+// least squares (RLS) with a forgetting factor, so the coefficients drift
+// towards the behaviour of the running application (and of its current
+// phase) instead of staying at their offline values.
+//
+// The RLS update for a model (w, P) with features x and target y is
+//
+//      k = P x / (lambda + x' P x)
+//      e = y - w' x
+//      w = w + k e
+//      P = (P - k x' P) / lambda
+//
+// which is O(n^2) on the number of features, well within the tick budget.
+//
+// A state is scored with its own number of cores as features, not those of
+// the current state. Models without offline coefficients start at zero and
+// would all predict the same, so every candidate is tried for a few ticks
+// before choosing, and afterwards a random candidate is tried every now
+// and then (`SCHEDULER_PREDICTOR_EXPLORE`, 2% of the ticks by default) so
+// that a model that went stale gets new samples.
+//
+// The offline coefficients file is watched with inotify. Whenever it is
+// rewritten (or a new file is renamed over it) the new coefficients are
+// validated against the feature schema, and the states whose coefficients
+// changed are replaced in a copy of the model set, which is swapped in
+// between ticks. The adapted models of the other states are kept. The
+// previous set is retired on the next poll, once no tick can still be
+// using it.
+
+const char* const predictor_feature_names[PREDICTOR_NUM_FEATURES] = {
+    "bias",
+    "ipc_little",
+    "ipc_big",
+    "mem_access_per_inst",
+    "l2_refill_per_inst",
+    "bus_access_per_inst",
+    "context_switches_per_ms",
+    "usage_little",
+    "usage_big",
+    "cores_little",
+    "cores_big",
+};
+
+/// Number of states with a model.
+constexpr int NUM_STATES = STATE_4l4b + 1;
+
+/// States the predictor may choose from.
+static const State candidate_states[] = { STATE_4l, STATE_4b, STATE_4l4b };
+
+/// Minimum predicted relative gain required to leave the current state.
+constexpr double SWITCH_MIN_GAIN = 0.05;
+
+/// Initial diagonal of the covariance matrix. Large values mean little
+/// trust in the initial coefficients.
+constexpr double INITIAL_COVARIANCE = 100.0;
+
+/// Updates a model without offline coefficients needs before it is trusted.
+constexpr uint64_t MIN_EXPLORE_UPDATES = 3;
+
+/// Position of the number of cores among the features.
+constexpr int FEATURE_CORES_LITTLE = 9;
+constexpr int FEATURE_CORES_BIG = 10;
+
+struct RlsModel
+{
+    double w[PREDICTOR_NUM_FEATURES];
+    double P[PREDICTOR_NUM_FEATURES][PREDICTOR_NUM_FEATURES];
+    uint64_t num_updates;
+    bool has_file_w;                        //< whether loaded from the model file
+    double file_w[PREDICTOR_NUM_FEATURES];  //< coefficients of the model file
+};
+
+/// Models of every state. Swapped as a whole on hot reloads.
+struct ModelSet
+{
+    RlsModel models[NUM_STATES];
+};
+
+static std::atomic<ModelSet*> model_set {nullptr};
+static ModelSet* retired_set;
+static double forgetting_factor;
+static double explore_rate;
+static unsigned int explore_seed;
+
+/// Hot reload of the offline coefficients.
+static int inotify_fd = -1;
+static char model_path[PATH_MAX];
+static char model_basename[NAME_MAX + 1];
+
+/// Prediction error statistics.
+static double sum_abs_error;
+static uint64_t num_errors;
+static uint64_t max_update_time;
+
+static auto curr_models() -> RlsModel*
+{
+    return model_set.load(std::memory_order_acquire)->models;
+}
+
+static void reset_covariance(RlsModel& model)
+{
+    for(int i = 0; i < PREDICTOR_NUM_FEATURES; ++i)
+    {
+        for(int j = 0; j < PREDICTOR_NUM_FEATURES; ++j)
+            model.P[i][j] = (i == j)? INITIAL_COVARIANCE : 0.0;
+    }
+    model.num_updates = 0;
+}
+
+/// Loads the offline coefficients of each state.
+///
+/// The file has a `features` line naming the features in order (which must
+/// match `predictor_feature_names`), followed by one line per state with
+/// the state index and its coefficients. Lines starting with `#` are ignored.
+static bool load_model(const char* path, ModelSet* set)
+{
+    auto models = set->models;
+
+    FILE* stream = fopen(path, "r");
+    if(!stream)
+    {
+        perror("scheduler: failed to open predictor model");
+        return false;
+    }
+
+    char line[1024];
+    bool has_schema = false;
+    int num_states = 0;
+
+    while(fgets(line, sizeof(line), stream))
+    {
+        if(line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if(!strncmp(line, "features", 8))
+        {
+            int i = 0;
+            for(char* tok = strtok(line + 8, " \t\n"); tok; tok = strtok(nullptr, " \t\n"), ++i)
+            {
+                if(i >= PREDICTOR_NUM_FEATURES || strcmp(tok, predictor_feature_names[i]))
+                {
+                    fprintf(stderr, "scheduler: predictor model feature %d (%s) does not match schema\n", i, tok);
+                    fclose(stream);
+                    return false;
+                }
+            }
+
+            if(i != PREDICTOR_NUM_FEATURES)
+            {
+                fprintf(stderr, "scheduler: predictor model has %d features, expected %d\n",
+                        i, PREDICTOR_NUM_FEATURES);
+                fclose(stream);
+                return false;
+            }
+
+            has_schema = true;
+            continue;
+        }
+
+        if(!has_schema)
+        {
+            fprintf(stderr, "scheduler: predictor model lacks a features line\n");
+            fclose(stream);
+            return false;
+        }
+
+        char* p = line;
+        char* end;
+        const long state = strtol(p, &end, 10);
+        if(end == p || state < 0 || state >= NUM_STATES)
+        {
+            fprintf(stderr, "scheduler: invalid state on predictor model: %s", line);
+            fclose(stream);
+            return false;
+        }
+
+        for(int i = 0; i < PREDICTOR_NUM_FEATURES; ++i)
+        {
+            p = end;
+            models[state].file_w[i] = strtod(p, &end);
+            if(end == p)
+            {
+                fprintf(stderr, "scheduler: missing coefficients for state %ld\n", state);
+                fclose(stream);
+                return false;
+            }
+        }
+
+        memcpy(models[state].w, models[state].file_w, sizeof(models[state].w));
+        models[state].has_file_w = true;
+        num_states += 1;
+    }
+
+    fclose(stream);
+    fprintf(stderr, "scheduler: loaded predictor coefficients for %d states from %s\n",
+            num_states, path);
+    return true;
+}
+
+/// Allocates a model set with zeroed coefficients.
+static auto new_model_set() -> ModelSet*
+{
+    auto set = new ModelSet;
+    for(int s = 0; s < NUM_STATES; ++s)
+    {
+        memset(set->models[s].w, 0, sizeof(set->models[s].w));
+        set->models[s].has_file_w = false;
+        reset_covariance(set->models[s]);
+    }
+    return set;
+}
+
+/// Starts watching the directory of the model file, so replacing the file
+/// by a rename (the usual way to update it atomically) is also noticed.
+static void watch_model(const char* path)
+{
+    char dir[PATH_MAX];
+    char base[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    snprintf(base, sizeof(base), "%s", path);
+    snprintf(model_path, sizeof(model_path), "%s", path);
+    snprintf(model_basename, sizeof(model_basename), "%s", basename(base));
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_fd == -1)
+    {
+        perror("scheduler: failed to initialise inotify, model hot reload disabled");
+        return;
+    }
+
+    if(inotify_add_watch(inotify_fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+    {
+        perror("scheduler: failed to watch predictor model, hot reload disabled");
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+}
+
+bool predictor_init()
+{
+    forgetting_factor = 0.98;
+    explore_rate = 0.02;
+    explore_seed = static_cast<unsigned int>(get_time());
+    sum_abs_error = 0.0;
+    num_errors = 0;
+    max_update_time = 0;
+
+    delete retired_set;
+    delete model_set.exchange(new_model_set());
+    retired_set = nullptr;
+
+    if(auto s = std::getenv("SCHEDULER_PREDICTOR_LAMBDA"))
+    {
+        sscanf(s, "%lf", &forgetting_factor);
+        if(forgetting_factor <= 0.0 || forgetting_factor > 1.0)
+        {
+            fprintf(stderr, "scheduler: invalid SCHEDULER_PREDICTOR_LAMBDA: %s\n", s);
+            forgetting_factor = 0.98;
+        }
+    }
+
+    if(auto s = std::getenv("SCHEDULER_PREDICTOR_EXPLORE"))
+    {
+        sscanf(s, "%lf", &explore_rate);
+        if(explore_rate < 0.0 || explore_rate > 1.0)
+        {
+            fprintf(stderr, "scheduler: invalid SCHEDULER_PREDICTOR_EXPLORE: %s\n", s);
+            explore_rate = 0.02;
+        }
+    }
+
+    if(auto s = std::getenv("SCHEDULER_PREDICTOR_MODEL"))
+    {
+        if(!load_model(s, model_set.load()))
+            return false;
+        watch_model(s);
+    }
+
+    fprintf(stderr, "scheduler: online predictor with forgetting factor %.3lf\n",
+            forgetting_factor);
+    return true;
+}
+
+bool predictor_poll_reload()
+{
+    // Nothing may still reference the set swapped out on the previous poll.
+    delete retired_set;
+    retired_set = nullptr;
+
+    if(inotify_fd == -1)
+        return false;
+
+    alignas(struct inotify_event) char buffer[4096];
+    bool changed = false;
+
+    while(true)
+    {
+        const auto count = read(inotify_fd, buffer, sizeof(buffer));
+        if(count <= 0)
+            break;
+
+        for(char* p = buffer; p < buffer + count; )
+        {
+            const auto event = reinterpret_cast<struct inotify_event*>(p);
+            if(event->len && !strcmp(event->name, model_basename))
+                changed = true;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    if(!changed)
+        return false;
+
+    auto loaded = new_model_set();
+    if(!load_model(model_path, loaded))
+    {
+        fprintf(stderr, "scheduler: rejected new predictor model, keeping the current one\n");
+        delete loaded;
+        return false;
+    }
+
+    // Only the states whose offline coefficients changed lose what they
+    // adapted so far.
+    auto set = new ModelSet(*model_set.load(std::memory_order_acquire));
+    int num_changed = 0;
+    for(int s = 0; s < NUM_STATES; ++s)
+    {
+        const auto& model = loaded->models[s];
+        if(model.has_file_w && (!set->models[s].has_file_w
+            || memcmp(model.file_w, set->models[s].file_w, sizeof(model.file_w))))
+        {
+            set->models[s] = model;
+            num_changed += 1;
+        }
+    }
+    delete loaded;
+
+    if(num_changed == 0)
+    {
+        fprintf(stderr, "scheduler: predictor model unchanged, keeping the adapted coefficients\n");
+        delete set;
+        return false;
+    }
+
+    retired_set = model_set.exchange(set, std::memory_order_acq_rel);
+    fprintf(stderr, "scheduler: predictor model hot reloaded (%d states changed)\n", num_changed);
+    return true;
+}
+
+/// Gets `features` with the number of cores of `state` instead of those of
+/// the state they were observed on.
+static auto features_for_state(State state, const PredictorFeatures& features) -> PredictorFeatures
+{
+    auto result = features;
+    result.values[FEATURE_CORES_LITTLE] = state_num_little(state) / 4.0;
+    result.values[FEATURE_CORES_BIG] = state_num_big(state) / 4.0;
+    return result;
+}
+
+double predictor_predict(State state, const PredictorFeatures& features)
+{
+    const auto& w = curr_models()[state].w;
+    const auto x = features_for_state(state, features);
+    double y = 0.0;
+    for(int i = 0; i < PREDICTOR_NUM_FEATURES; ++i)
+        y += w[i] * x.values[i];
+    return y;
+}
+
+double predictor_update(State state, const PredictorFeatures& features,
+                        double throughput)
+{
+    const auto start_time = get_time();
+
+    auto& model = curr_models()[state];
+    const auto state_features = features_for_state(state, features);
+    const auto& x = state_features.values;
+
+    const double predicted = predictor_predict(state, features);
+    const double error = throughput - predicted;
+
+    // Px = P x
+    double Px[PREDICTOR_NUM_FEATURES];
+    double denom = forgetting_factor;
+    for(int i = 0; i < PREDICTOR_NUM_FEATURES; ++i)
+    {
+        Px[i] = 0.0;
+        for(int j = 0; j < PREDICTOR_NUM_FEATURES; ++j)
+            Px[i] += model.P[i][j] * x[j];
+        denom += x[i] * Px[i];
+    }
+
+    // Gain vector and coefficient update.
+    double k[PREDICTOR_NUM_FEATURES];
+    for(int i = 0; i < PREDICTOR_NUM_FEATURES; ++i)
+    {
+        k[i] = Px[i] / denom;
+        model.w[i] += k[i] * error;
+    }
+
+    // P is symmetric, thus x' P equals (P x)'.
+    for(int i = 0; i < PREDICTOR_NUM_FEATURES; ++i)
+    {
+        for(int j = 0; j < PREDICTOR_NUM_FEATURES; ++j)
+            model.P[i][j] = (model.P[i][j] - k[i] * Px[j]) / forgetting_factor;
+    }
+
+    // Guard against the covariance blowing up when the features stop
+    // exciting some direction for a long time (a known RLS pitfall).
+    for(int i = 0; i < PREDICTOR_NUM_FEATURES; ++i)
+    {
+        if(!std::isfinite(model.P[i][i]) || model.P[i][i] > 1e6)
+        {
+            reset_covariance(model);
+            break;
+        }
+    }
+
+    model.num_updates += 1;
+
+    const double rel_error = (throughput > 0.0)? std::fabs(error) / throughput : 0.0;
+    sum_abs_error += rel_error;
+    num_errors += 1;
+
+    const auto update_time = get_time() - start_time;
+    if(update_time > max_update_time)
+        max_update_time = update_time;
+
+    return rel_error;
+}
+
+auto predictor_choose(State current_state,
+                      const PredictorFeatures& features) -> State
+{
+    const auto models = curr_models();
+    const int num_candidates = sizeof(candidate_states) / sizeof(*candidate_states);
+
+    // Try the candidates nothing is known about yet, starting from the
+    // current one.
+    if(!models[current_state].has_file_w && models[current_state].num_updates < MIN_EXPLORE_UPDATES)
+        return current_state;
+    for(const auto state : candidate_states)
+    {
+        if(!models[state].has_file_w && models[state].num_updates < MIN_EXPLORE_UPDATES)
+            return state;
+    }
+
+    if(explore_rate > 0.0 && rand_r(&explore_seed) < explore_rate * RAND_MAX)
+        return candidate_states[rand_r(&explore_seed) % num_candidates];
+
+    State best_state = current_state;
+    const double current_throughput = predictor_predict(current_state, features);
+    double best_throughput = current_throughput * (1.0 + SWITCH_MIN_GAIN);
+
+    for(const auto state : candidate_states)
+    {
+        const double throughput = predictor_predict(state, features);
+        if(throughput > best_throughput)
+        {
+            best_state = state;
+            best_throughput = throughput;
+        }
+    }
+
+    return best_state;
+}
+
+void predictor_report(const char* model_path)
+{
+    if(num_errors != 0)
+    {
+        fprintf(stderr, "scheduler: predictor mean relative error %.2lf%% over %llu ticks "
+                        "(max update time %llu us)\n",
+                100.0 * sum_abs_error / num_errors,
+                (unsigned long long) num_errors,
+                (unsigned long long) (max_update_time / 1000));
+    }
+
+    sum_abs_error = 0.0;
+    num_errors = 0;
+    max_update_time = 0;
+
+    // Save the adapted coefficients so they can seed the next run.
+    FILE* stream = fopen(model_path, "w");
+    if(!stream)
+    {
+        perror("scheduler: failed to save predictor model");
+        return;
+    }
+
+    fprintf(stream, "features");
+    for(int i = 0; i < PREDICTOR_NUM_FEATURES; ++i)
+        fprintf(stream, " %s", predictor_feature_names[i]);
+    fprintf(stream, "\n");
+
+    const auto models = curr_models();
+    for(int s = 0; s < NUM_STATES; ++s)
+    {
+        fprintf(stream, "%d", s);
+        for(int i = 0; i < PREDICTOR_NUM_FEATURES; ++i)
+            fprintf(stream, " %.9g", models[s].w[i]);
+        fprintf(stream, "\n");
+    }
+
+    fclose(stream);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "states.hpp"
+
+/// Number of features of the throughput predictor (including the bias).
+constexpr int PREDICTOR_NUM_FEATURES = 11;
+
+/// Names of the features, in order. Model files must list exactly these.
+extern const char* const predictor_feature_names[PREDICTOR_NUM_FEATURES];
+
+/// Normalised counter features observed during a tick.
+struct PredictorFeatures
+{
+    double values[PREDICTOR_NUM_FEATURES];
+};
+
+/// Initialises the online throughput predictor.
+///
+/// The per-state coefficients are loaded from `SCHEDULER_PREDICTOR_MODEL`
+/// when set, otherwise they start from zero. A random candidate state is
+/// explored on `SCHEDULER_PREDICTOR_EXPLORE` (0.02) of the choices.
+extern bool predictor_init();
+
+/// Checks whether the model file has been replaced and, if the new one is
+/// valid, swaps in the states whose coefficients changed. The others keep
+/// their adapted coefficients. Must be called between ticks.
+///
+/// Returns whether a new model has been loaded.
+extern bool predictor_poll_reload();
+
+/// Predicts the throughput (in instructions per nanosecond) the application
+/// would have on `state` given the features observed on the previous tick,
+/// with the number of cores of `state` in place of the observed ones.
+extern double predictor_predict(State state, const PredictorFeatures& features);
+
+/// Updates the model of `state` with the throughput observed on this tick
+/// while running on `state`, given the features of the previous tick.
+///
+/// Returns the relative prediction error before the update.
+extern double predictor_update(State state, const PredictorFeatures& features,
+                               double throughput);
+
+/// Chooses the candidate state with the highest predicted throughput.
+///
+/// The current state is kept unless another one is predicted to be
+/// noticeably better. Candidates whose model has neither offline
+/// coefficients nor a few updates are tried first, and a random one is
+/// tried now and then.
+extern auto predictor_choose(State current_state,
+                             const PredictorFeatures& features) -> State;
+
+/// Prints the prediction error summary and saves the adapted coefficients.
+extern void predictor_report(const char* model_path);
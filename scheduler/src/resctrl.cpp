@@ -0,0 +1,325 @@
+#include "resctrl.hpp"
+#include "sysfs.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <linux/limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Cache and memory bandwidth allocation through the resctrl filesystem
+// (Intel RDT, AMD PQoS or ARM MPAM).
+//
+// The managed application gets its own control group, whose schemata cap
+// the L3 ways it may fill and the memory bandwidth it may use, on every
+// cache domain alike. The monitoring data of the group (LLC occupancy and
+// memory bandwidth) are reported as observations, so a policy can trade
+// cache for cores.
+
+/// Maximum number of cache domains (usually one per socket).
+constexpr int MAX_DOMAINS = 16;
+
+static bool is_enabled;
+static char resctrl_root[PATH_MAX];
+static char group_path[PATH_MAX + 32];
+static int domains[MAX_DOMAINS];
+static int num_domains;
+static bool has_l3;
+static bool has_mba;
+static uint64_t cbm_mask;
+static int min_cbm_bits;
+static int min_bandwidth;
+static int bandwidth_gran;
+static int l3_step;
+static int mba_step;
+static ResctrlMonitor prev_monitor;
+
+static bool read_info(const char* name, char* buffer, size_t size)
+{
+    char path[PATH_MAX + 64];
+    snprintf(path, sizeof(path), "%s/info/%s", resctrl_root, name);
+    return sysfs_read(path, buffer, size);
+}
+
+/// Reads the cache domain ids from the L3 (or MB) line of the default
+/// schemata, e.g. "L3:0=fffff;1=fffff".
+static void read_domains()
+{
+    char path[PATH_MAX + 16];
+    char buffer[1024];
+
+    num_domains = 0;
+    snprintf(path, sizeof(path), "%s/schemata", resctrl_root);
+    if(!sysfs_read(path, buffer, sizeof(buffer)))
+        return;
+
+    for(char* line = strtok(buffer, "\n"); line; line = strtok(nullptr, "\n"))
+    {
+        while(*line == ' ')
+            ++line;
+        if(strncmp(line, "L3:", 3) && strncmp(line, "MB:", 3))
+            continue;
+
+        for(const char* p = line + 3; *p && num_domains < MAX_DOMAINS; )
+        {
+            char* end;
+            const long id = strtol(p, &end, 10);
+            if(end == p || *end != '=')
+                break;
+            domains[num_domains++] = (int) id;
+            p = strchr(end, ';');
+            if(!p)
+                break;
+            ++p;
+        }
+        return;
+    }
+}
+
+static auto read_monitor() -> ResctrlMonitor
+{
+    char path[PATH_MAX + 320];
+    char buffer[64];
+    ResctrlMonitor monitor;
+
+    snprintf(path, sizeof(path), "%s/mon_data", group_path);
+    DIR* dir = opendir(path);
+    if(!dir)
+        return monitor;
+
+    // One directory per L3 domain: mon_L3_00, mon_L3_01...
+    while(auto entry = readdir(dir))
+    {
+        if(strncmp(entry->d_name, "mon_L3_", 7))
+            continue;
+
+        const struct { const char* name; uint64_t* value; } files[] = {
+            {"llc_occupancy", &monitor.llc_occupancy},
+            {"mbm_total_bytes", &monitor.mbm_total_bytes},
+            {"mbm_local_bytes", &monitor.mbm_local_bytes},
+        };
+
+        for(const auto& file : files)
+        {
+            snprintf(path, sizeof(path), "%s/mon_data/%s/%s", group_path, entry->d_name, file.name);
+            if(sysfs_read(path, buffer, sizeof(buffer)))
+                *file.value += strtoull(buffer, nullptr, 10);
+        }
+    }
+
+    closedir(dir);
+    return monitor;
+}
+
+bool resctrl_init()
+{
+    char buffer[64];
+
+    is_enabled = false;
+    group_path[0] = '\0';
+    l3_step = 0;
+    mba_step = 0;
+    strcpy(resctrl_root, "/sys/fs/resctrl");
+
+    if(auto s = std::getenv("SCHEDULER_RESCTRL"))
+    {
+        if(!strcmp(s, "true") || !strcmp(s, "1"))
+            is_enabled = true;
+        else if(strcmp(s, "false") && strcmp(s, "0"))
+            fprintf(stderr, "scheduler: Unrecognized SCHEDULER_RESCTRL: %s\n", s);
+    }
+
+    if(auto s = std::getenv("SCHEDULER_RESCTRL_ROOT"))
+        snprintf(resctrl_root, sizeof(resctrl_root), "%s", s);
+
+    if(!is_enabled)
+        return false;
+
+    has_l3 = read_info("L3/cbm_mask", buffer, sizeof(buffer));
+    if(has_l3)
+    {
+        cbm_mask = strtoull(buffer, nullptr, 16);
+        min_cbm_bits = read_info("L3/min_cbm_bits", buffer, sizeof(buffer))? atoi(buffer) : 1;
+    }
+
+    has_mba = read_info("MB/min_bandwidth", buffer, sizeof(buffer));
+    if(has_mba)
+    {
+        min_bandwidth = atoi(buffer);
+        bandwidth_gran = read_info("MB/bandwidth_gran", buffer, sizeof(buffer))? atoi(buffer) : 10;
+        if(bandwidth_gran <= 0)
+            bandwidth_gran = 10;
+    }
+
+    read_domains();
+
+    if((!has_l3 && !has_mba) || num_domains == 0)
+    {
+        fprintf(stderr, "scheduler: no cache or bandwidth allocation under %s\n", resctrl_root);
+        is_enabled = false;
+        return false;
+    }
+
+    fprintf(stderr, "scheduler: resctrl under %s (%d domains%s%s)\n", resctrl_root, num_domains,
+            has_l3? ", L3" : "", has_mba? ", MB" : "");
+    return true;
+}
+
+bool resctrl_enabled()
+{
+    return is_enabled;
+}
+
+bool resctrl_attach(int pid)
+{
+    if(!is_enabled)
+        return false;
+
+    char path[PATH_MAX + 64];
+
+    snprintf(group_path, sizeof(group_path), "%s/scheduler.%d", resctrl_root, pid);
+    if(mkdir(group_path, 0755) == -1 && errno != EEXIST)
+    {
+        perror("scheduler: failed to create resctrl group");
+        group_path[0] = '\0';
+        return false;
+    }
+
+    // Only one task may be written at a time. Threads created later stay in
+    // the group of the thread creating them.
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR* dir = opendir(path);
+    snprintf(path, sizeof(path), "%s/tasks", group_path);
+    int num_tasks = 0;
+    if(dir)
+    {
+        while(auto entry = readdir(dir))
+        {
+            if(entry->d_name[0] != '.' && sysfs_write(path, "%s", entry->d_name))
+                ++num_tasks;
+        }
+        closedir(dir);
+    }
+
+    if(num_tasks == 0)
+    {
+        perror("scheduler: failed to move application into resctrl group");
+        rmdir(group_path);
+        group_path[0] = '\0';
+        return false;
+    }
+
+    prev_monitor = read_monitor();
+    fprintf(stderr, "scheduler: application %d moved into %s\n", pid, group_path);
+    return resctrl_set_allocation(0, 0);
+}
+
+void resctrl_detach()
+{
+    if(group_path[0] == '\0')
+        return;
+
+    // Removing a group moves its tasks back to the default group.
+    if(rmdir(group_path) == -1 && errno != ENOTEMPTY)
+        perror("scheduler: failed to remove resctrl group");
+
+    group_path[0] = '\0';
+}
+
+bool resctrl_set_allocation(int l3, int mba)
+{
+    if(group_path[0] == '\0')
+        return false;
+
+    if(l3 < 0 || l3 >= RESCTRL_NUM_L3_STEPS || mba < 0 || mba >= RESCTRL_NUM_MBA_STEPS)
+    {
+        fprintf(stderr, "scheduler: invalid resctrl steps %d/%d\n", l3, mba);
+        return false;
+    }
+
+    char path[PATH_MAX + 64];
+    char line[32 * MAX_DOMAINS];
+    snprintf(path, sizeof(path), "%s/schemata", group_path);
+
+    bool ok = true;
+
+    if(has_l3)
+    {
+        // The mask must be contiguous, so take the lowest ways of the full one.
+        int num_ways = 0, first_way = 0;
+        for(int bit = 63; bit >= 0; --bit)
+        {
+            if(cbm_mask & (uint64_t(1) << bit))
+            {
+                ++num_ways;
+                first_way = bit;
+            }
+        }
+
+        const int ways = std::max(min_cbm_bits, (num_ways * RESCTRL_L3_STEPS[l3] + 99) / 100);
+        const uint64_t mask = ((ways >= 64)? ~uint64_t(0) : ((uint64_t(1) << ways) - 1)) << first_way;
+
+        size_t length = snprintf(line, sizeof(line), "L3:");
+        for(int d = 0; d < num_domains && length < sizeof(line); ++d)
+            length += snprintf(&line[length], sizeof(line) - length, "%s%d=%" PRIx64, d? ";" : "", domains[d], mask & cbm_mask);
+        if(!sysfs_write(path, "%s\n", line))
+        {
+            perror("scheduler: failed to write L3 schemata");
+            ok = false;
+        }
+    }
+
+    if(has_mba)
+    {
+        int percent = RESCTRL_MBA_STEPS[mba] / bandwidth_gran * bandwidth_gran;
+        percent = std::max(percent, min_bandwidth);
+
+        size_t length = snprintf(line, sizeof(line), "MB:");
+        for(int d = 0; d < num_domains && length < sizeof(line); ++d)
+            length += snprintf(&line[length], sizeof(line) - length, "%s%d=%d", d? ";" : "", domains[d], percent);
+        if(!sysfs_write(path, "%s\n", line))
+        {
+            perror("scheduler: failed to write MB schemata");
+            ok = false;
+        }
+    }
+
+    if(ok && (l3 != l3_step || mba != mba_step))
+    {
+        fprintf(stderr, "scheduler: cache allocation set to %d%% of L3 and %d%% of bandwidth\n",
+                RESCTRL_L3_STEPS[l3], RESCTRL_MBA_STEPS[mba]);
+    }
+
+    l3_step = l3;
+    mba_step = mba;
+    return ok;
+}
+
+int resctrl_l3_step()
+{
+    return l3_step;
+}
+
+int resctrl_mba_step()
+{
+    return mba_step;
+}
+
+auto resctrl_consume_monitor() -> ResctrlMonitor
+{
+    if(group_path[0] == '\0')
+        return ResctrlMonitor{};
+
+    const auto monitor = read_monitor();
+
+    ResctrlMonitor delta;
+    delta.llc_occupancy = monitor.llc_occupancy;
+    delta.mbm_total_bytes = monitor.mbm_total_bytes - prev_monitor.mbm_total_bytes;
+    delta.mbm_local_bytes = monitor.mbm_local_bytes - prev_monitor.mbm_local_bytes;
+    prev_monitor = monitor;
+    return delta;
+}
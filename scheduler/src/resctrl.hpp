@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+
+/// Steps (in percentage of the L3 ways) that may be allocated to the
+/// resctrl group of the application.
+constexpr int RESCTRL_L3_STEPS[] = { 100, 75, 50, 25 };
+
+/// Steps (in percentage of the memory bandwidth) that may be allocated to
+/// the resctrl group of the application.
+constexpr int RESCTRL_MBA_STEPS[] = { 100, 70, 40, 20 };
+
+/// Number of entries in `RESCTRL_L3_STEPS` and `RESCTRL_MBA_STEPS`.
+constexpr int RESCTRL_NUM_L3_STEPS = sizeof(RESCTRL_L3_STEPS) / sizeof(int);
+constexpr int RESCTRL_NUM_MBA_STEPS = sizeof(RESCTRL_MBA_STEPS) / sizeof(int);
+
+/// Cache and memory bandwidth monitoring of the group (from its mon_data).
+struct ResctrlMonitor
+{
+    uint64_t llc_occupancy = 0;     //< bytes of L3 occupied now
+    uint64_t mbm_total_bytes = 0;   //< bytes transferred since the last consume
+    uint64_t mbm_local_bytes = 0;   //< bytes transferred to the local node since the last consume
+};
+
+/// Initialises the resctrl backend.
+///
+/// Returns whether cache and bandwidth allocation is enabled (see
+/// `SCHEDULER_RESCTRL`). The resctrl filesystem is expected at
+/// `SCHEDULER_RESCTRL_ROOT` (/sys/fs/resctrl by default).
+extern bool resctrl_init();
+
+/// Whether cache and bandwidth allocation is enabled.
+extern bool resctrl_enabled();
+
+/// Creates a resctrl group for the process `pid` and moves every thread of
+/// it into the group.
+extern bool resctrl_attach(int pid);
+
+/// Removes the group created by `resctrl_attach`, moving its tasks back to
+/// the default group.
+extern void resctrl_detach();
+
+/// Sets the schemata of the group to `RESCTRL_L3_STEPS[l3_step]` percent of
+/// the L3 ways and `RESCTRL_MBA_STEPS[mba_step]` percent of the bandwidth,
+/// on every cache domain. Resources the system lacks are left alone.
+extern bool resctrl_set_allocation(int l3_step, int mba_step);
+
+/// Gets the L3 step currently applied to the group.
+extern int resctrl_l3_step();
+
+/// Gets the MBA step currently applied to the group.
+extern int resctrl_mba_step();
+
+/// Consumes the monitoring counters of the group.
+///
+/// A consume operation obtains transfer counters as if they were reset
+/// during the previous consume operation.
+extern auto resctrl_consume_monitor() -> ResctrlMonitor;
@@ -0,0 +1,209 @@
+#include "sampler.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include "housekeeping.hpp"
+#include "pmu.hpp"
+#include "spsc_ring.hpp"
+#include "time.hpp"
+
+// Counter sampler.
+//
+// A dedicated thread reads the counters at a fixed period (on absolute
+// deadlines, so it does not drift) and pushes timestamped samples into a
+// lock-free ring. The decision thread drains the ring on its own cadence
+// and aggregates whatever has been sampled since, so a slow `taskset` or a
+// slow agent reply never delays nor stretches a sample.
+//
+// If the decision thread falls so far behind that the ring fills up, the
+// sampler keeps merging new periods into a pending sample until there is
+// room, so no counts are lost.
+
+/// Samples held between two consumes.
+constexpr size_t RING_CAPACITY = 256;
+
+static SpscRing<CounterSample, RING_CAPACITY> ring;
+static uint64_t period_ns;
+static uint64_t last_sample_time;
+static pthread_t sampler_thread;
+static std::atomic<bool> running {false};
+
+void CounterSample::merge(const CounterSample& other)
+{
+    time = other.time;
+    interval += other.interval;
+    num_samples += other.num_samples;
+    little += other.little;
+    big += other.big;
+    collect += other.collect;
+    kernel_little += other.kernel_little;
+    kernel_big += other.kernel_big;
+    cpu_migrations += other.cpu_migrations;
+    context_switches += other.context_switches;
+    big_context_switches += other.big_context_switches;
+}
+
+/// Reads every counter since the previous sample.
+static auto take_sample() -> CounterSample
+{
+    CounterSample sample;
+
+    for(int cpu = 0, max_cpu = perf_nprocs(); cpu < max_cpu; ++cpu)
+    {
+        if(pmu_is_little(cpu))
+            sample.little += perf_consume_little(cpu);
+        else if(pmu_is_big(cpu))
+            sample.big += perf_consume_big(cpu);
+    }
+
+#if SCHEDULER_TYPE == 0
+    for(int cpu = 0, max_cpu = perf_nprocs(); cpu < max_cpu; ++cpu)
+    {
+        sample.collect += perf_consume_collect(cpu);
+    }
+#endif
+
+    housekeeping_subtract(sample.little, sample.big);
+
+    if(perf_split_enabled())
+    {
+        for(int cpu = 0, max_cpu = perf_nprocs(); cpu < max_cpu; ++cpu)
+        {
+            if(pmu_is_little(cpu))
+                sample.kernel_little += perf_consume_kernel(cpu);
+            else if(pmu_is_big(cpu))
+                sample.kernel_big += perf_consume_kernel(cpu);
+        }
+    }
+
+    for(int cpu = 0, max_cpu = perf_nprocs(); cpu < max_cpu; ++cpu)
+    {
+        const auto sw_data = perf_consume_sw(cpu);
+        sample.cpu_migrations += sw_data.cpu_migrations;
+        sample.context_switches += sw_data.context_switches;
+        if(pmu_is_big(cpu))
+            sample.big_context_switches += sw_data.context_switches;
+    }
+
+    sample.time = get_time();
+    sample.interval = sample.time - last_sample_time;
+    sample.num_samples = 1;
+    last_sample_time = sample.time;
+    return sample;
+}
+
+static void* sampler_main(void*)
+{
+    CounterSample pending;
+    bool has_pending = false;
+
+    housekeeping_enter_sampler();
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    while(running.load(std::memory_order_acquire))
+    {
+        deadline.tv_nsec += period_ns;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR)
+            continue;
+
+        const auto sample = take_sample();
+        if(has_pending)
+        {
+            pending.merge(sample);
+        }
+        else
+        {
+            pending = sample;
+            has_pending = true;
+        }
+
+        if(ring.push(pending))
+            has_pending = false;
+
+        // Skip the deadlines already missed, rather than sampling back to back.
+        const uint64_t next_deadline = deadline.tv_sec * 1000000000ull + deadline.tv_nsec + period_ns;
+        if(sample.time > next_deadline)
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+    }
+
+    housekeeping_leave_sampler();
+    return nullptr;
+}
+
+void sampler_init()
+{
+    period_ns = 50 * 1000000ull;
+
+    if(auto s = std::getenv("SCHEDULER_SAMPLE_PERIOD_MS"))
+    {
+        period_ns = strtoull(s, nullptr, 10) * 1000000ull;
+    }
+
+    if(period_ns)
+        fprintf(stderr, "scheduler: sampling counters every %llums\n",
+                (unsigned long long) to_millis(period_ns));
+}
+
+bool sampler_start(uint64_t start_time)
+{
+    last_sample_time = start_time;
+    ring.clear();
+
+    if(!period_ns)
+        return true;
+
+    // Signals (SIGUSR1/SIGUSR2 ticks, SIGCHLD) must reach the main thread.
+    sigset_t all, prev;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &prev);
+
+    running.store(true, std::memory_order_release);
+    const int error = pthread_create(&sampler_thread, nullptr, sampler_main, nullptr);
+
+    pthread_sigmask(SIG_SETMASK, &prev, nullptr);
+
+    if(error)
+    {
+        fprintf(stderr, "scheduler: failed to start sampler thread: %s\n", strerror(error));
+        running.store(false);
+        return false;
+    }
+
+    return true;
+}
+
+void sampler_stop()
+{
+    if(running.exchange(false))
+        pthread_join(sampler_thread, nullptr);
+    ring.clear();
+}
+
+auto sampler_consume() -> CounterSample
+{
+    if(!running.load(std::memory_order_acquire))
+        return take_sample();
+
+    CounterSample window;
+    CounterSample sample;
+
+    // Nothing sampled yet since the previous consume, wait for the next one.
+    while(!ring.pop(sample))
+        usleep(1000);
+
+    window = sample;
+    while(ring.pop(sample))
+        window.merge(sample);
+
+    return window;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include "perf.hpp"
+
+/// Counters accumulated over one or more sampling periods.
+struct CounterSample
+{
+    /// Time at the end of the last period.
+    uint64_t time = 0;
+    /// Length of the periods covered.
+    uint64_t interval = 0;
+    /// Number of periods covered.
+    uint32_t num_samples = 0;
+
+    LittleEvents little;
+    BigEvents big;
+    CollectCounts collect;
+    /// Kernel-mode counts, if counting is split.
+    KernelEvents kernel_little;
+    KernelEvents kernel_big;
+    uint64_t cpu_migrations = 0;
+    uint64_t context_switches = 0;
+    /// Context switches on the big cluster only.
+    uint64_t big_context_switches = 0;
+
+    /// Accumulates `other`, which must follow this sample in time.
+    void merge(const CounterSample& other);
+};
+
+/// Initialises the sampler.
+///
+/// The sampling period is taken from `SCHEDULER_SAMPLE_PERIOD_MS` (50ms
+/// by default). A period of zero disables the sampler thread, in which case
+/// the counters are read synchronously whenever they are consumed.
+extern void sampler_init();
+
+/// Starts sampling the counters opened by `perf_init`, from `start_time`.
+extern bool sampler_start(uint64_t start_time);
+
+/// Stops sampling. Must be called before `perf_shutdown`.
+extern void sampler_stop();
+
+/// Consumes the counters sampled since the previous call.
+///
+/// Waits for the next sample if none has been taken yet.
+extern auto sampler_consume() -> CounterSample;
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+/// Lock-free ring buffer for a single producer thread and a single
+/// consumer thread.
+///
+/// `Capacity` must be a power of two. Indices grow without bound and are
+/// masked on access, so a full ring is `head - tail == Capacity`.
+template<class T, size_t Capacity>
+class SpscRing
+{
+    static_assert(Capacity && !(Capacity & (Capacity - 1)), "capacity must be a power of two");
+
+public:
+    /// Pushes `value` (producer only). Returns false if the ring is full.
+    bool push(const T& value)
+    {
+        const auto head = this->head.load(std::memory_order_relaxed);
+        if(head - this->tail.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        items[head & (Capacity - 1)] = value;
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Pops into `value` (consumer only). Returns false if the ring is empty.
+    bool pop(T& value)
+    {
+        const auto tail = this->tail.load(std::memory_order_relaxed);
+        if(tail == this->head.load(std::memory_order_acquire))
+            return false;
+
+        value = items[tail & (Capacity - 1)];
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Discards every item. Only safe while the producer is stopped.
+    void clear()
+    {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    T items[Capacity];
+    alignas(64) std::atomic<size_t> head {0};
+    alignas(64) std::atomic<size_t> tail {0};
+};
@@ -29,7 +29,7 @@ enum State
     STATE_4l4b,  //index 23
 };
 
-const char *configs[]={"0",
+static const char *configs[]={"0",
 		        "0-1",
 		        "0-2",
 		        "0-3", 
@@ -55,4 +55,32 @@ const char *configs[]={"0",
 		        "0-3,4-7",  
 		       };
 
+/// Number of LITTLE cores enabled on a state.
+inline int state_num_little(State state)
+{
+    if(state <= STATE_4l)
+        return 1 + (state - STATE_1l);
+    else if(state <= STATE_4b)
+        return 0;
+    else
+        return 1 + (state - STATE_1l1b) / 4;
+}
+
+/// Number of big cores enabled on a state.
+inline int state_num_big(State state)
+{
+    if(state <= STATE_4l)
+        return 0;
+    else if(state <= STATE_4b)
+        return 1 + (state - STATE_1b);
+    else
+        return 1 + (state - STATE_1l1b) % 4;
+}
+
+/// Number of cores enabled on a state.
+inline int state_num_cpus(State state)
+{
+    return state_num_little(state) + state_num_big(state);
+}
+
 #endif // STATES_H_
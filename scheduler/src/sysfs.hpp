@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdio>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+/// Writes a formatted string into a (usually sysfs, procfs or cgroupfs) file.
+///
+/// Returns false (and leaves `errno` set) on failure.
+inline bool sysfs_write(const char* path, const char* fmt, ...)
+{
+    FILE* stream = fopen(path, "w");
+    if(!stream)
+        return false;
+
+    va_list va;
+    va_start(va, fmt);
+    vfprintf(stream, fmt, va);
+    va_end(va);
+
+    // Kernel files report write errors on flush, not on fprintf.
+    return fclose(stream) == 0;
+}
+
+/// Reads up to `size - 1` bytes of a file into `buffer` and null terminates it.
+///
+/// Returns false on failure.
+inline bool sysfs_read(const char* path, char* buffer, size_t size)
+{
+    FILE* stream = fopen(path, "r");
+    if(!stream)
+        return false;
+
+    const auto count = fread(buffer, 1, size - 1, stream);
+    fclose(stream);
+    buffer[count] = '\0';
+    return true;
+}
+
+/// Parses a CPU list (as in sysfs or taskset, e.g. "0-2,4") into a mask of
+/// the first 64 CPUs.
+inline uint64_t sysfs_parse_cpu_list(const char* cpus)
+{
+    uint64_t mask = 0;
+    for(const char* p = cpus; *p; )
+    {
+        char* end;
+        const long first = strtol(p, &end, 10);
+        if(end == p)
+            break;
+
+        long last = first;
+        if(*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for(long cpu = first; cpu <= last && cpu < 64; ++cpu)
+            mask |= uint64_t(1) << cpu;
+        p = (*end == ',')? end + 1 : end;
+    }
+    return mask;
+}
+
+/// Writes the mask of the first 64 CPUs `mask` as a CPU list (e.g. "0-2,4").
+inline void sysfs_format_cpu_list(uint64_t mask, char* buffer, size_t size)
+{
+    size_t length = 0;
+    buffer[0] = '\0';
+    for(int cpu = 0; cpu < 64 && length < size; ++cpu)
+    {
+        if(!(mask & (uint64_t(1) << cpu)))
+            continue;
+
+        int last = cpu;
+        while(last + 1 < 64 && (mask & (uint64_t(1) << (last + 1))))
+            ++last;
+
+        if(last == cpu)
+            length += snprintf(&buffer[length], size - length, "%s%d", length? "," : "", cpu);
+        else
+            length += snprintf(&buffer[length], size - length, "%s%d-%d", length? "," : "", cpu, last);
+        cpu = last;
+    }
+}
@@ -0,0 +1,378 @@
+#include "thread_policy.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+// The thread policy gives the scheduler a lever finer than core masks.
+//
+// Every tick we read the CPU time (utime + stime) consumed by each thread
+// of the managed application and compare it with the most active thread.
+// Threads doing most of the work are boosted (lower nice and, if the kernel
+// supports it, a higher uclamp.min) so they win CPU time on a busy cluster.
+// Threads barely doing anything are demoted to SCHED_BATCH, and threads that
+// stayed inactive for a while are demoted to SCHED_IDLE.
+//
+// The original settings of every thread are saved the first time we touch
+// it, and restored by `thread_policy_restore()`.
+
+#ifndef SCHED_BATCH
+#define SCHED_BATCH 3
+#endif
+
+#ifndef SCHED_IDLE
+#define SCHED_IDLE 5
+#endif
+
+/// Maximum number of threads of the application we keep track of.
+constexpr int MAX_TRACKED_THREADS = 512;
+
+/// Threads with at least this fraction of the activity of the most active
+/// thread are considered throughput-critical.
+constexpr double CRITICAL_ACTIVITY = 0.50;
+
+/// Threads with less than this fraction of the activity of the most active
+/// thread are considered helpers.
+constexpr double HELPER_ACTIVITY = 0.05;
+
+/// Number of consecutive inactive ticks before a thread is considered idle.
+constexpr int IDLE_TICKS = 5;
+
+/// Flags and layout of `sched_setattr(2)`, which glibc does not wrap.
+constexpr uint64_t SCHED_FLAG_KEEP_POLICY = 0x08;
+constexpr uint64_t SCHED_FLAG_KEEP_PARAMS = 0x10;
+constexpr uint64_t SCHED_FLAG_UTIL_CLAMP_MIN = 0x20;
+constexpr uint64_t SCHED_FLAG_UTIL_CLAMP_MAX = 0x40;
+
+struct SchedAttr
+{
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+    uint32_t sched_util_min;
+    uint32_t sched_util_max;
+};
+
+/// The settings applied to a thread of each `ThreadClass`.
+struct ThreadSettings
+{
+    int policy;
+    int nice;
+    uint32_t util_min;
+    uint32_t util_max;
+};
+
+static const ThreadSettings class_settings[] = {
+    /* THREAD_CLASS_NORMAL   */ { SCHED_OTHER,  0,    0, 1024 },
+    /* THREAD_CLASS_CRITICAL */ { SCHED_OTHER, -5,  512, 1024 },
+    /* THREAD_CLASS_HELPER   */ { SCHED_BATCH,  5,    0,  512 },
+    /* THREAD_CLASS_IDLE     */ { SCHED_IDLE,   0,    0,  256 },
+};
+
+static const char* class_names[] = {
+    "normal", "critical", "helper", "idle",
+};
+
+struct ThreadEntry
+{
+    int tid;
+    uint64_t prev_ticks;
+    uint64_t delta_ticks;
+    int num_samples;
+    int idle_ticks;
+    bool alive;
+    ThreadClass thread_class;
+
+    /// Settings of the thread before we touched it.
+    int orig_policy;
+    int orig_priority;
+    int orig_nice;
+    uint32_t orig_util_min;
+    uint32_t orig_util_max;
+};
+
+static ThreadEntry threads[MAX_TRACKED_THREADS];
+static int num_threads;
+static bool is_enabled;
+static bool use_uclamp;
+
+static int sched_setattr(int tid, SchedAttr* attr)
+{
+    return syscall(SYS_sched_setattr, tid, attr, 0);
+}
+
+static int sched_getattr(int tid, SchedAttr* attr)
+{
+    return syscall(SYS_sched_getattr, tid, attr, sizeof(*attr), 0);
+}
+
+/// Reads the amount of CPU time (in clock ticks) consumed by a thread.
+static bool read_thread_ticks(int pid, int tid, uint64_t* ticks)
+{
+    char path[64];
+    char buffer[512];
+
+    sprintf(path, "/proc/%d/task/%d/stat", pid, tid);
+    FILE* stream = fopen(path, "r");
+    if(!stream)
+        return false;
+
+    const auto count = fread(buffer, 1, sizeof(buffer) - 1, stream);
+    fclose(stream);
+    buffer[count] = '\0';
+
+    // The command name may contain spaces, so skip past its closing paren.
+    const char* p = strrchr(buffer, ')');
+    if(!p)
+        return false;
+
+    unsigned long long utime, stime;
+    if(sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+              &utime, &stime) != 2)
+        return false;
+
+    *ticks = utime + stime;
+    return true;
+}
+
+static auto find_or_add_thread(int tid) -> ThreadEntry*
+{
+    for(int i = 0; i < num_threads; ++i)
+    {
+        if(threads[i].tid == tid)
+            return &threads[i];
+    }
+
+    if(num_threads == MAX_TRACKED_THREADS)
+        return nullptr;
+
+    auto& entry = threads[num_threads++];
+    memset(&entry, 0, sizeof(entry));
+    entry.tid = tid;
+    entry.thread_class = THREAD_CLASS_NORMAL;
+
+    // Real-time policies must be restored along with their priority.
+    struct sched_param param;
+    errno = 0;
+    entry.orig_policy = sched_getscheduler(tid);
+    entry.orig_nice = getpriority(PRIO_PROCESS, tid);
+    if(entry.orig_policy == -1 || errno != 0 || sched_getparam(tid, &param) == -1)
+    {
+        entry.orig_policy = SCHED_OTHER;
+        entry.orig_priority = 0;
+        entry.orig_nice = 0;
+    }
+    else
+    {
+        entry.orig_priority = param.sched_priority;
+    }
+
+    SchedAttr attr;
+    memset(&attr, 0, sizeof(attr));
+    if(use_uclamp && sched_getattr(tid, &attr) == 0)
+    {
+        entry.orig_util_min = attr.sched_util_min;
+        entry.orig_util_max = attr.sched_util_max;
+    }
+    else
+    {
+        entry.orig_util_min = 0;
+        entry.orig_util_max = 1024;
+    }
+
+    return &entry;
+}
+
+static void apply_settings(int tid, int policy, int priority, int nice,
+                           uint32_t util_min, uint32_t util_max)
+{
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+
+    if(sched_setscheduler(tid, policy, &param) == -1 && errno != ESRCH)
+        perror("scheduler: failed to set thread scheduling policy");
+
+    // SCHED_IDLE threads ignore the nice value.
+    if(policy != SCHED_IDLE)
+    {
+        if(setpriority(PRIO_PROCESS, tid, nice) == -1 && errno != ESRCH)
+            perror("scheduler: failed to set thread nice value");
+    }
+
+    if(use_uclamp)
+    {
+        SchedAttr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.sched_flags = SCHED_FLAG_KEEP_POLICY | SCHED_FLAG_KEEP_PARAMS
+                         | SCHED_FLAG_UTIL_CLAMP_MIN | SCHED_FLAG_UTIL_CLAMP_MAX;
+        attr.sched_util_min = util_min;
+        attr.sched_util_max = util_max;
+
+        if(sched_setattr(tid, &attr) == -1 && errno != ESRCH)
+        {
+            perror("scheduler: failed to set uclamp, disabling it");
+            use_uclamp = false;
+        }
+    }
+}
+
+static void set_thread_class(ThreadEntry& entry, ThreadClass thread_class)
+{
+    if(entry.thread_class == thread_class)
+        return;
+
+    fprintf(stderr, "scheduler: thread %d %s -> %s\n", entry.tid,
+            class_names[entry.thread_class], class_names[thread_class]);
+
+    if(thread_class == THREAD_CLASS_NORMAL)
+    {
+        apply_settings(entry.tid, entry.orig_policy, entry.orig_priority, entry.orig_nice,
+                       entry.orig_util_min, entry.orig_util_max);
+    }
+    else
+    {
+        const auto& s = class_settings[thread_class];
+        apply_settings(entry.tid, s.policy, 0, s.nice, s.util_min, s.util_max);
+    }
+
+    entry.thread_class = thread_class;
+}
+
+bool thread_policy_init()
+{
+    num_threads = 0;
+    is_enabled = false;
+    use_uclamp = false;
+
+    if(auto s = std::getenv("SCHEDULER_THREAD_POLICY"))
+    {
+        if(!strcmp(s, "true") || !strcmp(s, "1"))
+            is_enabled = true;
+        else if(strcmp(s, "false") && strcmp(s, "0"))
+            fprintf(stderr, "scheduler: Unrecognized SCHEDULER_THREAD_POLICY: %s\n", s);
+    }
+
+    if(auto s = std::getenv("SCHEDULER_THREAD_UCLAMP"))
+    {
+        if(!strcmp(s, "true") || !strcmp(s, "1"))
+        {
+            // Kernels without CONFIG_UCLAMP_TASK do not expose this knob.
+            use_uclamp = (access("/proc/sys/kernel/sched_util_clamp_min", F_OK) == 0);
+            if(!use_uclamp)
+                fprintf(stderr, "scheduler: uclamp is not supported by this kernel\n");
+        }
+    }
+
+    if(is_enabled)
+    {
+        fprintf(stderr, "scheduler: per-thread policy enabled%s\n",
+                use_uclamp? " (with uclamp)" : "");
+    }
+
+    return is_enabled;
+}
+
+void thread_policy_update(int pid)
+{
+    if(!is_enabled || pid == -1)
+        return;
+
+    char path[64];
+    sprintf(path, "/proc/%d/task", pid);
+
+    DIR* dir = opendir(path);
+    if(!dir)
+        return;
+
+    for(int i = 0; i < num_threads; ++i)
+        threads[i].alive = false;
+
+    uint64_t max_delta = 0;
+
+    while(auto ent = readdir(dir))
+    {
+        const int tid = atoi(ent->d_name);
+        if(tid <= 0)
+            continue;
+
+        uint64_t ticks;
+        if(!read_thread_ticks(pid, tid, &ticks))
+            continue;
+
+        auto entry = find_or_add_thread(tid);
+        if(!entry)
+            continue;
+
+        // The first sample of a thread is its lifetime CPU time, which
+        // tells nothing about the last tick.
+        entry->delta_ticks = (entry->num_samples > 0 && ticks >= entry->prev_ticks)?
+                                ticks - entry->prev_ticks : 0;
+        entry->prev_ticks = ticks;
+        entry->num_samples += 1;
+        entry->alive = true;
+
+        if(entry->delta_ticks > max_delta)
+            max_delta = entry->delta_ticks;
+    }
+
+    closedir(dir);
+
+    // Nothing ran this tick, leave every thread as it is.
+    if(max_delta == 0)
+        return;
+
+    for(int i = 0; i < num_threads; ++i)
+    {
+        auto& entry = threads[i];
+        if(!entry.alive || entry.num_samples < 2)
+            continue;
+
+        const double activity = entry.delta_ticks / (double) max_delta;
+
+        if(entry.delta_ticks == 0)
+            entry.idle_ticks += 1;
+        else
+            entry.idle_ticks = 0;
+
+        if(entry.idle_ticks >= IDLE_TICKS)
+            set_thread_class(entry, THREAD_CLASS_IDLE);
+        else if(activity >= CRITICAL_ACTIVITY)
+            set_thread_class(entry, THREAD_CLASS_CRITICAL);
+        else if(activity < HELPER_ACTIVITY)
+            set_thread_class(entry, THREAD_CLASS_HELPER);
+        else
+            set_thread_class(entry, THREAD_CLASS_NORMAL);
+    }
+
+    // Forget threads that have died so their slots can be reused.
+    int alive_count = 0;
+    for(int i = 0; i < num_threads; ++i)
+    {
+        if(threads[i].alive)
+            threads[alive_count++] = threads[i];
+    }
+    num_threads = alive_count;
+}
+
+void thread_policy_restore()
+{
+    if(!is_enabled)
+        return;
+
+    for(int i = 0; i < num_threads; ++i)
+        set_thread_class(threads[i], THREAD_CLASS_NORMAL);
+
+    num_threads = 0;
+}
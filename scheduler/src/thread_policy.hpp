@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+
+/// Classes of threads the thread policy may put a managed thread into.
+///
+/// The class is decided every tick from the CPU time each thread consumed
+/// since the previous tick, relative to the most active thread of the app.
+enum ThreadClass
+{
+    THREAD_CLASS_NORMAL,    //< untouched, runs with its original settings
+    THREAD_CLASS_CRITICAL,  //< throughput-critical, boosted
+    THREAD_CLASS_HELPER,    //< barely active, demoted to SCHED_BATCH
+    THREAD_CLASS_IDLE,      //< inactive for a while, demoted to SCHED_IDLE
+};
+
+/// Initialises the per-thread policy subsystem.
+///
+/// Returns whether the subsystem is enabled (see `SCHEDULER_THREAD_POLICY`).
+extern bool thread_policy_init();
+
+/// Samples the activity of every thread of the process `pid` and moves
+/// each of them into its corresponding `ThreadClass`.
+///
+/// This is orthogonal to the core placement (`State`) of the process, thus
+/// it may be called after any reconfiguration.
+extern void thread_policy_update(int pid);
+
+/// Reverts every thread we have touched to its original settings and
+/// forgets about them.
+extern void thread_policy_restore();
@@ -0,0 +1,153 @@
+#!/bin/bash
+
+# Runs the microbenchmarks under the agent and compares the CSP it reports
+# with the one each benchmark expects, along with the agent's overhead.
+#
+# Build the agent and the benchmarks first (`make build bench`). Then run
+#
+#   ./bench/run_bench.sh [benchmark [key=value ...]]
+#
+# With no arguments, every benchmark of the suite below is run. Each run
+# happens in a directory of its own under bench/results, which keeps the
+# agent's files and the output of the benchmark.
+#
+# For each expected window the measured CSP is the mean of the CSV rows
+# inside it. The first and last tenth of the window are skipped, since the
+# agent's phases do not line up with the benchmark's, and its elapsed time
+# starts at VMInit, a few tens of milliseconds after the JVM uptime does.
+#
+# JINN_JUC_PROBES defaults to `true` so that j.u.c locks are visible. The
+# other JINN_* variables are passed on to the agent.
+#
+#   ./bench/run_bench.sh --probe-overhead [benchmark [key=value ...]]
+#
+# measures the cost of the j.u.c probes instead. Each benchmark (by default
+# the AQS ones below, from lock/unlock alone to longer critical sections)
+# is run without the agent, under the agent with JINN_JUC_PROBES=false and
+# with it `true`, and their throughputs are compared. The probes slow down
+# every lock and unlock by the Java to native transitions and the bytecode
+# wrapped around them, which the agent cannot time itself, so the agent's
+# own estimate (its overhead line and the time of the probes) is printed
+# next to them. Differences of a few percent are within the noise of a
+# single run; use seconds=... to run longer.
+
+ROOT=`cd $(dirname $0)/.. && pwd`
+RESULTS="$ROOT/bench/results"
+
+SUITE=(
+    "sync threads=4 cs_us=20 nc_us=20"
+    "sync threads=4 cs_us=5 nc_us=50"
+    "sync threads=8 cs_us=10 nc_us=10"
+    "reentrant threads=4 cs_us=20 nc_us=20"
+    "reentrant threads=4 cs_us=20 nc_us=20 fair=true"
+    "stamped threads=4 cs_us=20 nc_us=20 write_ratio=0.5"
+    "pingpong threads=2 work_us=50"
+    "queue producers=2 consumers=2 work_us=0.1"
+    "mix threads=4 phase_ms=500"
+)
+
+OVERHEAD_SUITE=(
+    "reentrant threads=1 cs_us=0 nc_us=0"
+    "reentrant threads=4 cs_us=0 nc_us=0"
+    "reentrant threads=4 cs_us=1 nc_us=1"
+    "reentrant threads=4 cs_us=20 nc_us=20"
+    "queue producers=2 consumers=2 work_us=0.1"
+)
+
+if [ -z ${JAVA_HOME+x} ]; then
+    JAVA=java
+else
+    JAVA="$JAVA_HOME/bin/java"
+fi
+
+export JINN_JUC_PROBES=${JINN_JUC_PROBES-true}
+
+run_one() {
+    local name=$1
+    local dir="$RESULTS/$(echo "$@" | tr ' =' '_-')"
+
+    rm -rf "$dir"
+    mkdir -p "$dir"
+    (cd "$dir" && "$ROOT/run.sh" -cp "$ROOT/bench/bin" Bench "$@" >out.txt 2>err.txt)
+
+    local csv=`ls "$dir"/sync_jvmti.*.csp 2>/dev/null | head -1`
+    if [ -z "$csv" ]; then
+        echo "$*: no CSV produced, see $dir/err.txt"
+        return
+    fi
+
+    local overhead=`sed -n 's/.*agent overhead: .*(\([0-9.]*\)% of the application time).*/\1/p' "$dir/err.txt"`
+
+    awk -v name="$*" -v overhead="${overhead:-?}" '
+        BEGIN { n = 0; }
+        FNR == NR {
+            if ($1 == "expected") {
+                margin = ($3 - $2) / 10;
+                from[n] = $2 + margin; to[n] = $3 - margin; expected[n] = $4; ++n;
+            }
+            next;
+        }
+        FNR == 1 { next; }
+        {
+            for (i = 0; i < n; ++i) {
+                if ($1 >= from[i] && $1 < to[i]) {
+                    sum[i] += $2; count[i] += 1;
+                }
+            }
+        }
+        END {
+            for (i = 0; i < n; ++i) {
+                measured = count[i] ? sum[i] / count[i] : -1;
+                printf "%-50s %7d-%-7d expected %6.2f%%  measured %6.2f%%  diff %+7.2f  overhead %s%%\n",
+                       name, from[i], to[i], expected[i], measured, measured - expected[i], overhead;
+            }
+        }' "$dir/out.txt" FS=, "$csv"
+}
+
+throughput_of() {
+    sed -n 's/^throughput=\([0-9]*\) ops\/s$/\1/p' "$1/out.txt"
+}
+
+run_overhead() {
+    local dir="$RESULTS/overhead_$(echo "$@" | tr ' =' '_-')"
+
+    rm -rf "$dir"
+    mkdir -p "$dir/none" "$dir/off" "$dir/on"
+    (cd "$dir/none" && "$JAVA" -cp "$ROOT/bench/bin" Bench "$@" >out.txt 2>err.txt)
+    (cd "$dir/off" && JINN_JUC_PROBES=false "$ROOT/run.sh" -cp "$ROOT/bench/bin" Bench "$@" >out.txt 2>err.txt)
+    (cd "$dir/on" && JINN_JUC_PROBES=true "$ROOT/run.sh" -cp "$ROOT/bench/bin" Bench "$@" >out.txt 2>err.txt)
+
+    local none=`throughput_of "$dir/none"`
+    local off=`throughput_of "$dir/off"`
+    local on=`throughput_of "$dir/on"`
+    if [ -z "$none" ] || [ -z "$off" ] || [ -z "$on" ]; then
+        echo "$*: no throughput, see the err.txt files under $dir"
+        return
+    fi
+
+    local overhead=`sed -n 's/.*agent overhead: .*(\([0-9.]*\)% of the application time).*/\1/p' "$dir/on/err.txt"`
+    local probe_ns=`sed -n 's/.*j\.u\.c probes ran [0-9]* times, ~\([0-9]*\)ns each.*/\1/p' "$dir/on/err.txt"`
+
+    awk -v name="$*" -v none="$none" -v off="$off" -v on="$on" \
+        -v overhead="${overhead:-?}" -v probe_ns="${probe_ns:-?}" 'BEGIN {
+            printf "%-50s none %10d  probes off %10d  on %10d ops/s  probes %+6.1f%%  agent %+6.1f%%  self-reported %s%% (%sns/probe)\n",
+                   name, none, off, on, (on / off - 1) * 100, (on / none - 1) * 100, overhead, probe_ns;
+        }'
+}
+
+if [ "$1" = "--probe-overhead" ]; then
+    shift
+    if [ $# -gt 0 ]; then
+        run_overhead "$@"
+    else
+        for bench in "${OVERHEAD_SUITE[@]}"; do
+            run_overhead $bench
+        done
+    fi
+elif [ $# -gt 0 ]; then
+    run_one "$@"
+else
+    for bench in "${SUITE[@]}"; do
+        run_one $bench
+    done
+fi
@@ -0,0 +1,56 @@
+/**
+ * Entry point of the synchronization microbenchmarks.
+ *
+ * Usage: java Bench <benchmark> [key=value ...]
+ *
+ * Benchmarks: sync, reentrant, stamped, pingpong, queue and mix. See each
+ * class for its parameters. Every benchmark prints the contention its
+ * parameters should produce as lines of the form
+ *
+ *   expected <from_ms> <to_ms> <csp>
+ *
+ * where the window is in milliseconds since the JVM started, as the elapsed
+ * time in the agent's CSV, and the CSP is a percentage. run_bench.sh
+ * compares these with what the agent reports.
+ */
+public final class Bench {
+    private Bench() {
+    }
+
+    public static void main(String[] args) throws Exception {
+        if (args.length < 1) {
+            System.err.println("usage: java Bench <sync|reentrant|stamped|pingpong|queue|mix> [key=value ...]");
+            System.exit(1);
+        }
+
+        final Options options = new Options(args, 1);
+        final Benchmark benchmark;
+        switch (args[0]) {
+            case "sync":
+                benchmark = new SyncCounter(options);
+                break;
+            case "reentrant":
+                benchmark = new ReentrantCounter(options);
+                break;
+            case "stamped":
+                benchmark = new StampedCounter(options);
+                break;
+            case "pingpong":
+                benchmark = new PingPong(options);
+                break;
+            case "queue":
+                benchmark = new ProducerConsumer(options);
+                break;
+            case "mix":
+                benchmark = new PhaseMix(options);
+                break;
+            default:
+                System.err.println("Unknown benchmark: " + args[0]);
+                System.exit(1);
+                return;
+        }
+
+        options.checkUnused();
+        benchmark.run(args[0]);
+    }
+}
@@ -0,0 +1,96 @@
+import java.lang.management.ManagementFactory;
+import java.util.concurrent.CyclicBarrier;
+
+/**
+ * Base of the benchmarks: runs `threads` workers for `warmup` plus `seconds`
+ * seconds, and prints the expected contention of the measured window.
+ *
+ * The expected CSP follows the agent's definition: the time threads spend
+ * blocked on a lock over the time they are not waiting or parked. For
+ * `threads` threads that each hold a lock for `cs` and then work outside of
+ * it for `nc`, the lock saturates once threads * cs >= cs + nc. From then
+ * on it serves one critical section at a time, each thread gets the lock
+ * once every threads * cs, and the rest of that time it is blocked:
+ *
+ *   csp = 1 - (cs + nc) / (threads * cs)
+ *
+ * Below saturation threads only collide by chance, and the model predicts
+ * no contention, so expect small positive values there. HotSpot also spins
+ * briefly before blocking, and spins are invisible to the agent. Both
+ * models assume one core per thread.
+ */
+abstract class Benchmark {
+    protected final int threads;
+    protected final double warmup;
+    protected final double seconds;
+
+    protected Benchmark(Options options, int defaultThreads) {
+        this.threads = options.getInt("threads", defaultThreads);
+        this.warmup = options.getDouble("warmup", 2.0);
+        this.seconds = options.getDouble("seconds", 10.0);
+    }
+
+    /** Work done by a thread, until `deadline` (System.nanoTime). */
+    protected abstract long work(int id, long deadline) throws Exception;
+
+    /** Prints the expected contention between `from` and `to` (uptime ms). */
+    protected abstract void printExpected(long from, long to);
+
+    /** Describes the parameters. */
+    protected abstract String describe();
+
+    /** The expected CSP (in percent) of the model above. */
+    static double expectedCsp(int threads, double cs, double nc) {
+        if (cs <= 0 || threads <= 1) {
+            return 0.0;
+        }
+        return Math.max(0.0, 1.0 - (cs + nc) / (threads * cs)) * 100.0;
+    }
+
+    static void printExpectedLine(long from, long to, double csp) {
+        System.out.printf("expected %d %d %.2f%n", from, to, csp);
+    }
+
+    static long uptime() {
+        return ManagementFactory.getRuntimeMXBean().getUptime();
+    }
+
+    final void run(String name) throws Exception {
+        final int cores = Runtime.getRuntime().availableProcessors();
+        System.out.println("benchmark=" + name + " threads=" + threads + " " + describe());
+        if (threads > cores) {
+            System.out.println("warning: " + threads + " threads on " + cores
+                    + " cores, the expected values assume one core per thread");
+        }
+
+        final CyclicBarrier barrier = new CyclicBarrier(threads + 1);
+        final long[] ops = new long[threads];
+        final Thread[] workers = new Thread[threads];
+        final long[] deadline = new long[1];
+        for (int i = 0; i < threads; ++i) {
+            final int id = i;
+            workers[i] = new Thread(() -> {
+                try {
+                    barrier.await();
+                    ops[id] = work(id, deadline[0]);
+                } catch (Exception e) {
+                    throw new RuntimeException(e);
+                }
+            }, "bench-" + i);
+            workers[i].start();
+        }
+
+        final long start = uptime();
+        deadline[0] = System.nanoTime() + (long) ((warmup + seconds) * 1e9);
+        barrier.await();
+
+        printExpected(start + (long) (warmup * 1000), start + (long) ((warmup + seconds) * 1000));
+
+        long total = 0;
+        for (int i = 0; i < threads; ++i) {
+            workers[i].join();
+            total += ops[i];
+        }
+        System.out.printf("throughput=%.0f ops/s%n", total / (warmup + seconds));
+    }
+}
@@ -0,0 +1,52 @@
+import java.util.HashMap;
+import java.util.HashSet;
+import java.util.Map;
+import java.util.Set;
+
+/** Parameters of a benchmark, given as key=value arguments. */
+final class Options {
+    private final Map<String, String> values = new HashMap<>();
+    private final Set<String> used = new HashSet<>();
+
+    Options(String[] args, int from) {
+        for (int i = from; i < args.length; ++i) {
+            final int eq = args[i].indexOf('=');
+            if (eq <= 0) {
+                throw new IllegalArgumentException("Expected key=value: " + args[i]);
+            }
+            values.put(args[i].substring(0, eq), args[i].substring(eq + 1));
+        }
+    }
+
+    /** Sets `key` unless it was given, and returns these options. */
+    Options withDefault(String key, int value) {
+        if (!values.containsKey(key)) {
+            values.put(key, Integer.toString(value));
+        }
+        return this;
+    }
+
+    int getInt(String key, int fallback) {
+        used.add(key);
+        return values.containsKey(key) ? Integer.parseInt(values.get(key)) : fallback;
+    }
+
+    double getDouble(String key, double fallback) {
+        used.add(key);
+        return values.containsKey(key) ? Double.parseDouble(values.get(key)) : fallback;
+    }
+
+    boolean getBoolean(String key, boolean fallback) {
+        used.add(key);
+        return values.containsKey(key) ? Boolean.parseBoolean(values.get(key)) : fallback;
+    }
+
+    /** Fails on parameters no benchmark asked for, which are likely typos. */
+    void checkUnused() {
+        for (String key : values.keySet()) {
+            if (!used.contains(key)) {
+                throw new IllegalArgumentException("Unknown parameter: " + key);
+            }
+        }
+    }
+}
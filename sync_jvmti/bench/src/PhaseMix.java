@@ -0,0 +1,60 @@
+/**
+ * A synchronized counter whose critical section alternates between a long
+ * and a short one every phase_ms, so that the CSP changes in steps.
+ *
+ * Parameters: threads (4), phase_ms (500), high_cs_us (40), low_cs_us (2)
+ * and nc_us (20).
+ *
+ * The expected CSP is printed per phase, which checks that the agent's
+ * phases follow the application's.
+ */
+final class PhaseMix extends Benchmark {
+    private final long phase;
+    private final long highCs;
+    private final long lowCs;
+    private final long nc;
+    private final Object lock = new Object();
+    private long counter;
+
+    PhaseMix(Options options) {
+        super(options, 4);
+        this.phase = options.getInt("phase_ms", 500);
+        this.highCs = Work.micros(options.getDouble("high_cs_us", 40));
+        this.lowCs = Work.micros(options.getDouble("low_cs_us", 2));
+        this.nc = Work.micros(options.getDouble("nc_us", 20));
+    }
+
+    @Override
+    protected String describe() {
+        return "phase_ms=" + phase + " high_cs_ns=" + highCs + " low_cs_ns=" + lowCs + " nc_ns=" + nc;
+    }
+
+    @Override
+    protected void printExpected(long from, long to) {
+        // Phases count from the start of the warm up.
+        final long start = from - (long) (warmup * 1000);
+        for (long k = (from - start) / phase; start + k * phase < to; ++k) {
+            final long cs = (k % 2 == 0) ? highCs : lowCs;
+            printExpectedLine(Math.max(from, start + k * phase), Math.min(to, start + (k + 1) * phase),
+                    expectedCsp(threads, cs, nc));
+        }
+    }
+
+    @Override
+    protected long work(int id, long deadline) {
+        final long start = deadline - (long) ((warmup + seconds) * 1e9);
+        final long phaseNanos = phase * 1000000L;
+        long ops = 0;
+        long now;
+        while ((now = System.nanoTime()) < deadline) {
+            final long cs = (((now - start) / phaseNanos) % 2 == 0) ? highCs : lowCs;
+            synchronized (lock) {
+                ++counter;
+                Work.spin(cs);
+            }
+            Work.spin(nc);
+            ++ops;
+        }
+        return ops;
+    }
+}
@@ -0,0 +1,64 @@
+/**
+ * Pairs of threads taking turns through wait/notify on a shared monitor.
+ *
+ * Parameters: threads (2, rounded up to pairs) and work_us (50), the work
+ * done on each turn, outside of the monitor.
+ *
+ * Each thread spends about half of its time waiting for its turn. Waiting
+ * is not contention, so the expected CSP is zero: this checks that waits
+ * and contention are told apart.
+ */
+final class PingPong extends Benchmark {
+    private static final long WAIT_TIMEOUT_MS = 10;
+
+    private final long work;
+    private final Pair[] pairs;
+
+    private static final class Pair {
+        int turn;
+    }
+
+    PingPong(Options options) {
+        super(options, 2);
+        if (threads % 2 != 0) {
+            throw new IllegalArgumentException("pingpong needs an even number of threads");
+        }
+        this.work = Work.micros(options.getDouble("work_us", 50));
+        this.pairs = new Pair[threads / 2];
+        for (int i = 0; i < pairs.length; ++i) {
+            pairs[i] = new Pair();
+        }
+    }
+
+    @Override
+    protected String describe() {
+        return "work_ns=" + work;
+    }
+
+    @Override
+    protected void printExpected(long from, long to) {
+        printExpectedLine(from, to, 0.0);
+    }
+
+    @Override
+    protected long work(int id, long deadline) throws InterruptedException {
+        final Pair pair = pairs[id / 2];
+        final int me = id % 2;
+        long ops = 0;
+        while (System.nanoTime() < deadline) {
+            synchronized (pair) {
+                // Time out now and then, the partner may be gone.
+                while (pair.turn != me && System.nanoTime() < deadline) {
+                    pair.wait(WAIT_TIMEOUT_MS);
+                }
+            }
+            Work.spin(work);
+            synchronized (pair) {
+                pair.turn = 1 - me;
+                pair.notify();
+            }
+            ++ops;
+        }
+        return ops;
+    }
+}
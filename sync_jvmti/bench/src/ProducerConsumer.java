@@ -0,0 +1,87 @@
+import java.util.concurrent.ArrayBlockingQueue;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * Producers and consumers exchanging items through an ArrayBlockingQueue.
+ *
+ * Parameters: producers (2), consumers (2), capacity (64) and work_us (2),
+ * the time to produce or consume an item.
+ *
+ * Every put and take holds the single lock of the queue for `op`, which is
+ * measured before the run, so with balanced producers and consumers this
+ * is the counter model with cs = op and nc = work. Waits for a full or
+ * empty queue are parks, not contention. The lock is only visible to the
+ * agent with JINN_JUC_PROBES=true.
+ */
+final class ProducerConsumer extends Benchmark {
+    private static final int CALIBRATION_ROUNDS = 200000;
+
+    private final int producers;
+    private final long work;
+    private final ArrayBlockingQueue<Integer> queue;
+    private final double op;
+
+    ProducerConsumer(Options options) {
+        super(withThreads(options), 4);
+        this.producers = options.getInt("producers", 2);
+        this.work = Work.micros(options.getDouble("work_us", 2));
+        this.queue = new ArrayBlockingQueue<>(options.getInt("capacity", 64));
+        this.op = calibrate();
+        if (threads <= producers) {
+            throw new IllegalArgumentException("queue needs producers and consumers");
+        }
+    }
+
+    /** The threads are the producers plus the consumers, unless given. */
+    private static Options withThreads(Options options) {
+        final int threads = options.getInt("producers", 2) + options.getInt("consumers", 2);
+        return options.withDefault("threads", threads);
+    }
+
+    /** Measures the time of an uncontended put or take, in nanoseconds. */
+    private double calibrate() {
+        long elapsed = 0;
+        for (int round = 0; round < 2; ++round) {
+            // The first round warms the JIT up.
+            final long start = System.nanoTime();
+            for (int i = 0; i < CALIBRATION_ROUNDS; ++i) {
+                queue.offer(i);
+                queue.poll();
+            }
+            elapsed = System.nanoTime() - start;
+        }
+        return elapsed / (2.0 * CALIBRATION_ROUNDS);
+    }
+
+    @Override
+    protected String describe() {
+        return String.format("producers=%d consumers=%d work_ns=%d op_ns=%.0f",
+                producers, threads - producers, work, op);
+    }
+
+    @Override
+    protected void printExpected(long from, long to) {
+        printExpectedLine(from, to, expectedCsp(threads, op, work));
+    }
+
+    @Override
+    protected long work(int id, long deadline) throws InterruptedException {
+        long ops = 0;
+        if (id < producers) {
+            while (System.nanoTime() < deadline) {
+                Work.spin(work);
+                if (queue.offer(id, 10, TimeUnit.MILLISECONDS)) {
+                    ++ops;
+                }
+            }
+        } else {
+            while (System.nanoTime() < deadline) {
+                if (queue.poll(10, TimeUnit.MILLISECONDS) != null) {
+                    Work.spin(work);
+                    ++ops;
+                }
+            }
+        }
+        return ops;
+    }
+}
@@ -0,0 +1,50 @@
+import java.util.concurrent.locks.ReentrantLock;
+
+/**
+ * A counter behind a ReentrantLock.
+ *
+ * Parameters: threads (4), cs_us (20), nc_us (20) and fair (false).
+ *
+ * The lock is only visible to the agent with JINN_JUC_PROBES=true; without
+ * it its waits are accounted as parking and the CSP stays near zero.
+ */
+final class ReentrantCounter extends Benchmark {
+    private final long cs;
+    private final long nc;
+    private final ReentrantLock lock;
+    private long counter;
+
+    ReentrantCounter(Options options) {
+        super(options, 4);
+        this.cs = Work.micros(options.getDouble("cs_us", 20));
+        this.nc = Work.micros(options.getDouble("nc_us", 20));
+        this.lock = new ReentrantLock(options.getBoolean("fair", false));
+    }
+
+    @Override
+    protected String describe() {
+        return "cs_ns=" + cs + " nc_ns=" + nc + " fair=" + lock.isFair();
+    }
+
+    @Override
+    protected void printExpected(long from, long to) {
+        printExpectedLine(from, to, expectedCsp(threads, cs, nc));
+    }
+
+    @Override
+    protected long work(int id, long deadline) {
+        long ops = 0;
+        while (System.nanoTime() < deadline) {
+            lock.lock();
+            try {
+                ++counter;
+                Work.spin(cs);
+            } finally {
+                lock.unlock();
+            }
+            Work.spin(nc);
+            ++ops;
+        }
+        return ops;
+    }
+}
@@ -0,0 +1,74 @@
+import java.util.concurrent.locks.StampedLock;
+
+/**
+ * A counter behind a StampedLock, read optimistically.
+ *
+ * Parameters: threads (4), cs_us (20), nc_us (20) and write_ratio (0.25),
+ * the share of the operations that write.
+ *
+ * Optimistic reads never block, so only writes hold the lock and the
+ * expected CSP is that of the model with a critical section of
+ * write_ratio * cs per operation. StampedLock does not use
+ * AbstractQueuedSynchronizer, so the agent sees its waits as parking even
+ * with JINN_JUC_PROBES=true. This benchmark shows that gap.
+ */
+final class StampedCounter extends Benchmark {
+    private final long cs;
+    private final long nc;
+    private final double writeRatio;
+    private final StampedLock lock = new StampedLock();
+    private long counter;
+
+    StampedCounter(Options options) {
+        super(options, 4);
+        this.cs = Work.micros(options.getDouble("cs_us", 20));
+        this.nc = Work.micros(options.getDouble("nc_us", 20));
+        this.writeRatio = options.getDouble("write_ratio", 0.25);
+    }
+
+    @Override
+    protected String describe() {
+        return "cs_ns=" + cs + " nc_ns=" + nc + " write_ratio=" + writeRatio;
+    }
+
+    @Override
+    protected void printExpected(long from, long to) {
+        // Reads still spend cs, just not holding the lock.
+        final double held = writeRatio * cs;
+        printExpectedLine(from, to, expectedCsp(threads, held, cs + nc - held));
+    }
+
+    @Override
+    protected long work(int id, long deadline) {
+        // Spread the writes evenly instead of drawing them at random.
+        final long period = writeRatio > 0 ? Math.max(1, Math.round(1 / writeRatio)) : Long.MAX_VALUE;
+        long ops = 0;
+        while (System.nanoTime() < deadline) {
+            if (ops % period == id % period) {
+                final long stamp = lock.writeLock();
+                try {
+                    ++counter;
+                    Work.spin(cs);
+                } finally {
+                    lock.unlockWrite(stamp);
+                }
+            } else {
+                long stamp = lock.tryOptimisticRead();
+                long value = counter;
+                Work.spin(cs);
+                if (!lock.validate(stamp)) {
+                    stamp = lock.readLock();
+                    try {
+                        value = counter;
+                    } finally {
+                        lock.unlockRead(stamp);
+                    }
+                }
+                Work.sink = value;
+            }
+            Work.spin(nc);
+            ++ops;
+        }
+        return ops;
+    }
+}
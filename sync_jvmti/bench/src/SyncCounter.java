@@ -0,0 +1,42 @@
+/**
+ * A counter behind a synchronized block.
+ *
+ * Parameters: threads (4), cs_us (20), the time the monitor is held, and
+ * nc_us (20), the time spent outside of it.
+ */
+final class SyncCounter extends Benchmark {
+    private final long cs;
+    private final long nc;
+    private final Object lock = new Object();
+    private long counter;
+
+    SyncCounter(Options options) {
+        super(options, 4);
+        this.cs = Work.micros(options.getDouble("cs_us", 20));
+        this.nc = Work.micros(options.getDouble("nc_us", 20));
+    }
+
+    @Override
+    protected String describe() {
+        return "cs_ns=" + cs + " nc_ns=" + nc;
+    }
+
+    @Override
+    protected void printExpected(long from, long to) {
+        printExpectedLine(from, to, expectedCsp(threads, cs, nc));
+    }
+
+    @Override
+    protected long work(int id, long deadline) {
+        long ops = 0;
+        while (System.nanoTime() < deadline) {
+            synchronized (lock) {
+                ++counter;
+                Work.spin(cs);
+            }
+            Work.spin(nc);
+            ++ops;
+        }
+        return ops;
+    }
+}
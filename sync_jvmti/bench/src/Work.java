@@ -0,0 +1,25 @@
+/** Busy work of a known duration. */
+final class Work {
+    /** Keeps the JIT from removing the work. */
+    static volatile long sink;
+
+    private Work() {
+    }
+
+    /** Spins on the CPU for about `nanos` nanoseconds. */
+    static void spin(long nanos) {
+        if (nanos <= 0) {
+            return;
+        }
+        final long start = System.nanoTime();
+        long x = 0;
+        while (System.nanoTime() - start < nanos) {
+            x += 31 * x + 17;
+        }
+        sink = x;
+    }
+
+    static long micros(double us) {
+        return (long) (us * 1000.0);
+    }
+}
@@ -15,6 +15,52 @@
 #   JINN_SCHED_POLICY: The policy for scheduling the JVM application.
 #                      Possible values: SimpleVM
 #
+#   JINN_PERF_SCOPE: What the hardware counters count. `system` counts every
+#                    process (needs CAP_PERFMON or perf_event_paranoid <= 0),
+#                    `process` counts the JVM on each CPU and `thread` counts
+#                    each Java thread. By default, system-wide counting is
+#                    tried first and the process is counted if it is denied.
+#
+#   JINN_PERF_COUNT_MODE: When set to `split`, cycles and instructions are also
+#                         counted in kernel mode, and the CSV gets their counts
+#                         per CPU, the share of the cycles spent in the kernel
+#                         and the IPC of the kernel. Defaults to `user`.
+#
+#   When built with `make LOOM=1`, virtual threads are tracked on JDK 21+:
+#   their time unmounted, the saturation of their carriers and the monitor
+#   blocks that pinned a carrier are added to the CSV.
+#
+#   JINN_THREAD_ROLES: When set to `true`, the native thread ids and roles
+#                      (mutator, gc, concurrent-gc, jit, vm) of the JVM threads
+#                      are published to sync_jvmti.<pid>.roles, and GC pauses
+#                      and the CPU time of GC and JIT threads are profiled.
+#
+#   JINN_ROLE_PLACEMENT: When set to `true`, implies JINN_THREAD_ROLES and keeps
+#                        JIT and concurrent GC threads on JINN_LITTLE_CPUS
+#                        (0-3 by default), and mutators and stop-the-world GC
+#                        threads on JINN_BIG_CPUS (4-7 by default).
+#
+#   JINN_ROLE_INTERVAL: The minimum amount of time (in milliseconds) between
+#                       rediscoveries of the JVM threads. Defaults to 1000.
+#
+#   JINN_JUC_PROBES: When set to `true`, the j.u.c locks (AbstractQueuedSynchronizer)
+#                    are instrumented as they load. Their wait time counts
+#                    towards the CSP, and their wait and hold times and the
+#                    most waited locks of each phase are added to the CSV.
+#
+#   JINN_CONVOYS: When set to `true`, monitor handoffs between blocked threads
+#                 and wait-for chains are tracked. Convoys (JINN_CONVOY_HANDOFFS
+#                 FIFO handoffs in a row, 4 by default, each within
+#                 JINN_CONVOY_INTERVAL microseconds of the last, 100 by default)
+#                 and chains of more than JINN_CHAIN_LENGTH blocked threads
+#                 (2 by default) are written to sync_jvmti.<pid>.convoys.
+#
+#   JINN_OVERHEAD_SAMPLE: Every how many events of a thread one is timed to
+#                         estimate the overhead of the agent, reported per
+#                         phase in the CSV and in total at exit. Defaults
+#                         to 0, which disables the accounting (16 is a
+#                         reasonable period).
+#
 # Example:
 # ./run.sh -jar SyncTable.jar
 # ./run.sh -cp ../sync_soot/inputs/HashSync HashSync 32 1000000 10
@@ -22,6 +68,7 @@
 # ./run.sh -cp ../sync_soot/inputs/FreqCounter FreqCounter
 # ./run.sh -cp ../sync_soot/inputs/JavaFreqCounter FreqCounter 32 1000 4000 30 800 20
 # ./run.sh -cp ../sync_soot/inputs/SortedList Sort 32 15000
+# ./run.sh -cp bench/bin Bench sync threads=4 cs_us=20 nc_us=20
 #
 
 if [ $# -lt 1 ]
@@ -2,7 +2,13 @@
 #include <cassert>
 #include <cstring>
 #include <atomic>
+#include <cstdint>
+#include "convoy.hpp"
+#include "juc.hpp"
+#include "overhead.hpp"
+#include "perf.hpp"
 #include "phase.hpp"
+#include "roles.hpp"
 #include "time.hpp"
 using std::memory_order_relaxed;
 
@@ -25,11 +31,71 @@ static thread_local uint64_t thread_cs_start_time {0};
 /// Same use as above, but for timing MonitorWait and MonitorWaited.
 static thread_local uint64_t thread_wait_start_time {0};
 
+/// Time the current garbage collection pause started, or zero.
+static std::atomic<uint64_t> gc_start_time {0};
+
 /// An index for this thread in the per-thread arrays in the
 /// AtomicPhase structure. Note that all untracked threads have
 /// its indice equal 0. Tracked threads have indices greater than 0.
 static thread_local int thread_id = 0;
 
+#ifdef JINN_LOOM
+/// Whether virtual threads are tracked. This needs a JVMTI 21 environment.
+static bool loom_enabled = false;
+
+/// Time the virtual thread currently mounted on this carrier was mounted.
+static thread_local uint64_t carrier_mount_time {0};
+
+/// Whether this thread has ever carried a virtual thread.
+static thread_local bool is_carrier {false};
+#endif
+
+/// The state of a virtual thread. It is owned by the virtual thread object
+/// through its tag.
+///
+/// A virtual thread may block on a carrier and resume on another, so the
+/// start of its blocking operations cannot be kept in carrier-local storage.
+struct VirtualThreadState
+{
+    uint64_t cs_start_time = 0;
+    uint64_t wait_start_time = 0;
+    uint64_t unmount_time = 0;
+
+    /// Whether the thread left its carrier since it started blocking. A
+    /// thread blocking without unmounting pins its carrier.
+    bool unmounted_while_blocked = false;
+};
+
+/// Gets the state of `thread` if it is a tracked virtual thread.
+static auto get_virtual_state(jvmtiEnv* jvmti_env, jthread thread) -> VirtualThreadState*
+{
+#ifdef JINN_LOOM
+    jlong tag = 0;
+    if(loom_enabled && jvmti_env->GetTag(thread, &tag) == JVMTI_ERROR_NONE)
+        return reinterpret_cast<VirtualThreadState*>(static_cast<intptr_t>(tag));
+#endif
+    return nullptr;
+}
+
+/// Accounts a monitor block of a virtual thread that pinned its carrier.
+static void record_pinned(AtomicPhasePtr& phase_ptr, VirtualThreadState* vstate,
+                          uint64_t blocked_time)
+{
+    if(vstate && !vstate->unmounted_while_blocked)
+    {
+        phase_ptr->phase_pinned_time.fetch_add(blocked_time, memory_order_relaxed);
+        phase_ptr->phase_pinned_count.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+/// Gets the key under which a monitor is tracked (its identity hash).
+static int32_t monitor_key(jvmtiEnv* jvmti_env, jobject object)
+{
+    jint hash = 0;
+    jvmti_env->GetObjectHashCode(object, &hash);
+    return hash;
+}
+
 /// We are detouring sun.misc.Unsafe.park in order to monitor parking.
 /// This stores the original method target (before our detour).
 static void (*original_Unsafe_Park)(JNIEnv *env, jobject unsafe,
@@ -41,6 +107,8 @@ static void JNICALL
 detoured_Unsafe_Park(JNIEnv *env, jobject unsafe,
                      jboolean is_absolute, jlong time)
 {
+    OverheadScope overhead(::thread_id);
+
     {
     auto phase_ptr = get_phase();
     phase_ptr->record_cpu(::thread_id);
@@ -48,13 +116,18 @@ detoured_Unsafe_Park(JNIEnv *env, jobject unsafe,
             AtomicPhase::THREAD_STATE_PARKING, memory_order_relaxed);
     }
 
+    // Parking to acquire a j.u.c lock is accounted as contention instead.
+    const bool in_lock_acquire = juc_park_in_acquire();
+
     const auto thread_park_start_time = get_time();
     original_Unsafe_Park(env, unsafe, is_absolute, time);
     const auto park_time = get_time() - thread_park_start_time;
+    overhead.exclude(park_time);
 
     {
     auto phase_ptr = get_phase();
-    phase_ptr->phase_park_time.fetch_add(park_time, memory_order_relaxed);
+    if(!in_lock_acquire)
+        phase_ptr->phase_park_time.fetch_add(park_time, memory_order_relaxed);
     phase_ptr->record_cpu(::thread_id);
     phase_ptr->phase_thread_state_change[thread_id].store(
             AtomicPhase::THREAD_STATE_RUNNING, memory_order_relaxed);
@@ -69,10 +142,16 @@ MonitorWait(jvmtiEnv *jvmti_env,
             jobject object,
             jlong timeout)
 {
+    OverheadScope overhead(::thread_id);
+
     const auto curr_time = get_time();
     phase_checkpoint(curr_time);
 
-    thread_wait_start_time = curr_time;
+    const auto vstate = get_virtual_state(jvmti_env, thread);
+    auto& wait_start_time = vstate? vstate->wait_start_time : ::thread_wait_start_time;
+    wait_start_time = curr_time;
+    if(vstate)
+        vstate->unmounted_while_blocked = false;
 
     auto phase_ptr = get_phase();
     phase_ptr->record_cpu(::thread_id);
@@ -88,19 +167,25 @@ MonitorWaited(jvmtiEnv *jvmti_env,
             jobject object,
             jboolean timed_out)
 {
+    OverheadScope overhead(::thread_id);
+
+    const auto vstate = get_virtual_state(jvmti_env, thread);
+    auto& wait_start_time = vstate? vstate->wait_start_time : ::thread_wait_start_time;
+
     // The JVM may report waited for something that it did not report wait.
     // https://bugs.openjdk.java.net/browse/JDK-8075259
-    if(thread_wait_start_time == 0)
+    if(wait_start_time == 0)
         return;
 
     const auto curr_time = get_time();
     phase_checkpoint(curr_time);
 
-    const auto wait_time = curr_time - thread_wait_start_time;
-    thread_wait_start_time = 0;
+    const auto wait_time = curr_time - wait_start_time;
+    wait_start_time = 0;
 
     auto phase_ptr = get_phase();
     phase_ptr->phase_wait_time.fetch_add(wait_time, memory_order_relaxed);
+    record_pinned(phase_ptr, vstate, wait_time);
     phase_ptr->record_cpu(::thread_id);
     phase_ptr->phase_thread_state_change[thread_id].store(
             AtomicPhase::THREAD_STATE_RUNNING, memory_order_relaxed);
@@ -114,12 +199,24 @@ MonitorContendedEnter(jvmtiEnv *jvmti_env,
             jthread thread,
             jobject object)
 {
+    OverheadScope overhead(::thread_id);
+
     const auto curr_time = get_time();
     phase_checkpoint(curr_time);
 
-    thread_cs_start_time = curr_time;
+    const auto vstate = get_virtual_state(jvmti_env, thread);
+    auto& cs_start_time = vstate? vstate->cs_start_time : ::thread_cs_start_time;
+    cs_start_time = curr_time;
+    if(vstate)
+        vstate->unmounted_while_blocked = false;
+
+    // The hash may block on a safepoint, which must not happen while we
+    // hold the phase.
+    const auto key = convoy_enabled()? monitor_key(jvmti_env, object) : 0;
 
     auto phase_ptr = get_phase();
+    if(convoy_enabled())
+        convoy_contended_enter(phase_ptr, ::thread_id, key, curr_time);
     phase_ptr->record_cpu(::thread_id);
     phase_ptr->phase_thread_state_change[thread_id].store(
             AtomicPhase::THREAD_STATE_CONTENDED, memory_order_relaxed);
@@ -133,16 +230,25 @@ MonitorContendedEntered(jvmtiEnv *jvmti_env,
             jthread thread,
             jobject object)
 {
-    assert(thread_cs_start_time != 0);
+    OverheadScope overhead(::thread_id);
+
+    const auto vstate = get_virtual_state(jvmti_env, thread);
+    auto& cs_start_time = vstate? vstate->cs_start_time : ::thread_cs_start_time;
+    assert(cs_start_time != 0);
 
     const auto curr_time = get_time();
     phase_checkpoint(curr_time);
 
-    const auto cs_time = curr_time - thread_cs_start_time;
-    thread_cs_start_time = 0;
+    const auto cs_time = curr_time - cs_start_time;
+    cs_start_time = 0;
+
+    const auto key = convoy_enabled()? monitor_key(jvmti_env, object) : 0;
 
     auto phase_ptr = get_phase();
     phase_ptr->phase_cs_time.fetch_add(cs_time, memory_order_relaxed);
+    record_pinned(phase_ptr, vstate, cs_time);
+    if(convoy_enabled())
+        convoy_contended_entered(phase_ptr, ::thread_id, key, curr_time);
     phase_ptr->record_cpu(::thread_id);
     phase_ptr->phase_thread_state_change[thread_id].store(
             AtomicPhase::THREAD_STATE_RUNNING, memory_order_relaxed);
@@ -154,6 +260,8 @@ ThreadStart(jvmtiEnv *jvmti_env,
             JNIEnv* jni_env,
             jthread thread)
 {
+    OverheadScope overhead(::thread_id);
+
     // We do not want to count the internal VM threads. These are launched
     // before boot. Note that they do not have a corresponding ThreadEnd,
     // so we do not have to worry about it there.
@@ -183,8 +291,11 @@ ThreadStart(jvmtiEnv *jvmti_env,
     const auto curr_time = get_time();
     phase_checkpoint(curr_time);
 
-    auto phase_ptr = get_phase();
     ::thread_id = phase_alloc_thread();
+    roles_register_mutator(::thread_id);
+    perf_thread_start(::thread_id);
+
+    auto phase_ptr = get_phase();
     phase_ptr->phase_thread_change_count.fetch_add(1, memory_order_relaxed);
     phase_ptr->record_cpu(::thread_id);
     phase_ptr->phase_thread_state_change[thread_id].store(
@@ -197,18 +308,199 @@ ThreadEnd(jvmtiEnv *jvmti_env,
             JNIEnv* jni_env,
             jthread thread)
 {
+    OverheadScope overhead(::thread_id);
+
     const auto curr_time = get_time();
     phase_checkpoint(curr_time);
 
+    roles_unregister_mutator(::thread_id);
+    perf_thread_end(::thread_id);
+    juc_thread_end();
+
     auto phase_ptr = get_phase();
     phase_ptr->phase_thread_change_count.fetch_sub(1, memory_order_relaxed);
+#ifdef JINN_LOOM
+    if(is_carrier)
+        phase_ptr->phase_carrier_change_count.fetch_sub(1, memory_order_relaxed);
+#endif
     phase_ptr->record_cpu(::thread_id);
     phase_ptr->phase_thread_state_change[thread_id].store(
             AtomicPhase::THREAD_STATE_DIED, memory_order_relaxed);
 }
 
+#ifdef JINN_LOOM
+/// Starts accounting the time a virtual thread spends on this carrier.
+static void mount_carrier(AtomicPhasePtr& phase_ptr, uint64_t curr_time)
+{
+    if(!is_carrier)
+    {
+        is_carrier = true;
+        phase_ptr->phase_carrier_change_count.fetch_add(1, memory_order_relaxed);
+    }
+    carrier_mount_time = curr_time;
+}
+
+/// Stops accounting the time a virtual thread spends on this carrier.
+static void unmount_carrier(AtomicPhasePtr& phase_ptr, uint64_t curr_time)
+{
+    if(carrier_mount_time != 0)
+    {
+        phase_ptr->phase_vthread_mounted_time.fetch_add(
+                curr_time - carrier_mount_time, memory_order_relaxed);
+        carrier_mount_time = 0;
+    }
+}
+
+/// Called when a virtual thread starts, mounted on its first carrier.
+static void JNICALL
+VirtualThreadStart(jvmtiEnv *jvmti_env,
+            JNIEnv* jni_env,
+            jthread vthread)
+{
+    OverheadScope overhead(::thread_id);
 
+    const auto curr_time = get_time();
+    phase_checkpoint(curr_time);
+
+    auto vstate = new VirtualThreadState();
+    if(jvmti_env->SetTag(vthread, static_cast<jlong>(reinterpret_cast<intptr_t>(vstate))))
+    {
+        delete vstate;
+        return;
+    }
+
+    auto phase_ptr = get_phase();
+    phase_ptr->phase_vthread_change_count.fetch_add(1, memory_order_relaxed);
+    mount_carrier(phase_ptr, curr_time);
+}
 
+/// Called when a virtual thread ends, still mounted on its carrier.
+static void JNICALL
+VirtualThreadEnd(jvmtiEnv *jvmti_env,
+            JNIEnv* jni_env,
+            jthread vthread)
+{
+    OverheadScope overhead(::thread_id);
+
+    const auto vstate = get_virtual_state(jvmti_env, vthread);
+    if(!vstate)
+        return;
+
+    jvmti_env->SetTag(vthread, 0);
+    delete vstate;
+
+    const auto curr_time = get_time();
+    phase_checkpoint(curr_time);
+
+    auto phase_ptr = get_phase();
+    phase_ptr->phase_vthread_change_count.fetch_sub(1, memory_order_relaxed);
+    unmount_carrier(phase_ptr, curr_time);
+}
+
+/// Called when a virtual thread is mounted on a carrier
+/// (com.sun.hotspot.events.VirtualThreadMount).
+static void JNICALL
+VirtualThreadMount(jvmtiEnv *jvmti_env,
+            JNIEnv* jni_env,
+            jthread vthread)
+{
+    OverheadScope overhead(::thread_id);
+
+    const auto vstate = get_virtual_state(jvmti_env, vthread);
+    if(!vstate)
+        return;
+
+    const auto curr_time = get_time();
+    phase_checkpoint(curr_time);
+
+    auto phase_ptr = get_phase();
+    if(vstate->unmount_time != 0)
+    {
+        phase_ptr->phase_vthread_unmounted_time.fetch_add(
+                curr_time - vstate->unmount_time, memory_order_relaxed);
+        vstate->unmount_time = 0;
+    }
+    mount_carrier(phase_ptr, curr_time);
+}
+
+/// Called when a virtual thread is about to leave its carrier
+/// (com.sun.hotspot.events.VirtualThreadUnmount).
+static void JNICALL
+VirtualThreadUnmount(jvmtiEnv *jvmti_env,
+            JNIEnv* jni_env,
+            jthread vthread)
+{
+    OverheadScope overhead(::thread_id);
+
+    const auto vstate = get_virtual_state(jvmti_env, vthread);
+    if(!vstate)
+        return;
+
+    const auto curr_time = get_time();
+    phase_checkpoint(curr_time);
+
+    vstate->unmount_time = curr_time;
+    if(vstate->cs_start_time != 0 || vstate->wait_start_time != 0)
+        vstate->unmounted_while_blocked = true;
+
+    auto phase_ptr = get_phase();
+    unmount_carrier(phase_ptr, curr_time);
+}
+
+/// Sets the callback of the HotSpot extension event `id`, which enables it.
+static bool enable_extension_event(jvmtiEnv* jvmti, const char* id,
+                                   jvmtiExtensionEvent callback)
+{
+    jint num_events = 0;
+    jvmtiExtensionEventInfo* events = nullptr;
+    if(jvmti->GetExtensionEvents(&num_events, &events))
+        return false;
+
+    bool enabled = false;
+    for(jint i = 0; i < num_events; ++i)
+    {
+        if(!enabled && !strcmp(events[i].id, id))
+        {
+            enabled = !jvmti->SetExtensionEventCallback(
+                    events[i].extension_event_index, callback);
+        }
+
+        for(jint p = 0; p < events[i].param_count; ++p)
+            jvmti->Deallocate((unsigned char*)events[i].params[p].name);
+        jvmti->Deallocate((unsigned char*)events[i].params);
+        jvmti->Deallocate((unsigned char*)events[i].id);
+        jvmti->Deallocate((unsigned char*)events[i].short_description);
+    }
+
+    jvmti->Deallocate((unsigned char*)events);
+    return enabled;
+}
+#endif
+
+/// Called when a stop-the-world garbage collection begins.
+///
+/// The VM is at a safepoint, so neither JNI nor most of JVMTI may be used
+/// here. We only take the time.
+static void JNICALL
+GarbageCollectionStart(jvmtiEnv *jvmti_env)
+{
+    gc_start_time.store(get_time(), memory_order_relaxed);
+}
+
+/// Called when a stop-the-world garbage collection ends.
+static void JNICALL
+GarbageCollectionFinish(jvmtiEnv *jvmti_env)
+{
+    const auto start_time = gc_start_time.exchange(0, memory_order_relaxed);
+    if(start_time == 0)
+        return;
+
+    const auto pause_time = get_time() - start_time;
+
+    auto phase_ptr = get_phase();
+    phase_ptr->phase_gc_pause_time.fetch_add(pause_time, memory_order_relaxed);
+    phase_ptr->phase_gc_count.fetch_add(1, memory_order_relaxed);
+}
 
 /// Called once the VM is ready.
 static void JNICALL
@@ -217,6 +509,13 @@ VMInit(jvmtiEnv *jvmti_env,
             jthread thread)
 {
     phase_vm_init();
+
+    // The thread running VMInit (the main thread) never gets a ThreadStart,
+    // but it is a mutator all the same.
+    ::thread_id = phase_alloc_thread();
+    roles_register_mutator(::thread_id);
+    perf_thread_start(::thread_id);
+
     is_vm_alive.store(true);
 }
 
@@ -226,9 +525,35 @@ VMDeath(jvmtiEnv *jvmti_env,
             JNIEnv* jni_env)
 {
     phase_vm_die();
+    juc_report();
     is_vm_alive.store(false);
 }
 
+/// Called whenever a class is about to be loaded.
+///
+/// We use this to instrument the j.u.c locks.
+static void JNICALL
+ClassFileLoadHook(jvmtiEnv *jvmti_env,
+            JNIEnv* jni_env,
+            jclass class_being_redefined,
+            jobject loader,
+            const char* name,
+            jobject protection_domain,
+            jint class_data_len,
+            const unsigned char* class_data,
+            jint* new_class_data_len,
+            unsigned char** new_class_data)
+{
+    OverheadScope overhead(::thread_id);
+
+    // Locks live in the bootstrap class loader.
+    if(loader == nullptr && class_being_redefined == nullptr)
+    {
+        juc_transform(jvmti_env, name, class_data, class_data_len,
+                      new_class_data_len, new_class_data);
+    }
+}
+
 /// Called whenever a native method is bound to an address.
 ///
 /// We use this to detour sun.misc.Unsafe.park into our own native method.
@@ -288,17 +613,42 @@ Agent_OnLoad(JavaVM *vm, char *options, void *reserved)
 {
     jvmtiError err;
 
-    jvmtiEnv *jvmti;
-    if(vm->GetEnv((void **)&jvmti, JVMTI_VERSION_1_0) != JNI_OK)
+    jvmtiEnv *jvmti = nullptr;
+#ifdef JINN_LOOM
+    // Virtual threads are hidden from environments older than JVMTI 21.
+    loom_enabled = (vm->GetEnv((void **)&jvmti, JVMTI_VERSION_21) == JNI_OK);
+    if(loom_enabled)
+    {
+        jvmtiCapabilities potential_caps;
+        memset(&potential_caps, 0, sizeof(potential_caps));
+        jvmti->GetPotentialCapabilities(&potential_caps);
+        loom_enabled = (potential_caps.can_support_virtual_threads
+                        && potential_caps.can_tag_objects);
+    }
+    if(!loom_enabled)
+        fprintf(stderr, "sync_jvmti: JVMTI 21 unavailable, virtual threads are not tracked.\n");
+#endif
+    if(!jvmti && vm->GetEnv((void **)&jvmti, JVMTI_VERSION_1_0) != JNI_OK)
     {
         fprintf(stderr, "sync_jvmti: Failed to get environment\n");
         return 1;
     }
 
+    roles_init();
+    overhead_init();
+    juc_init(jvmti);
+    convoy_init();
+
     jvmtiCapabilities caps;
     memset(&caps, 0, sizeof(caps));
     caps.can_generate_monitor_events = true;
     caps.can_generate_native_method_bind_events = true;
+    caps.can_generate_garbage_collection_events = roles_enabled();
+    caps.can_generate_all_class_hook_events = juc_enabled();
+#ifdef JINN_LOOM
+    caps.can_support_virtual_threads = loom_enabled;
+    caps.can_tag_objects = loom_enabled;
+#endif
     if((err = jvmti->AddCapabilities(&caps)))
     {
         fprintf(stderr, "sync_jvmti: Failed to add capabilities (%d)\n", err);
@@ -343,6 +693,43 @@ Agent_OnLoad(JavaVM *vm, char *options, void *reserved)
                                     JVMTI_EVENT_NATIVE_METHOD_BIND,
                                     NULL);
 
+    if(roles_enabled())
+    {
+        callbacks.GarbageCollectionStart = GarbageCollectionStart;
+        jvmti->SetEventNotificationMode(JVMTI_ENABLE,
+                                        JVMTI_EVENT_GARBAGE_COLLECTION_START,
+                                        NULL);
+
+        callbacks.GarbageCollectionFinish = GarbageCollectionFinish;
+        jvmti->SetEventNotificationMode(JVMTI_ENABLE,
+                                        JVMTI_EVENT_GARBAGE_COLLECTION_FINISH,
+                                        NULL);
+    }
+
+    if(juc_enabled())
+    {
+        fprintf(stderr, "sync_jvmti: Instrumenting j.u.c locks.\n");
+        callbacks.ClassFileLoadHook = ClassFileLoadHook;
+        jvmti->SetEventNotificationMode(JVMTI_ENABLE,
+                                        JVMTI_EVENT_CLASS_FILE_LOAD_HOOK,
+                                        NULL);
+    }
+
+#ifdef JINN_LOOM
+    if(loom_enabled)
+    {
+        callbacks.VirtualThreadStart = VirtualThreadStart;
+        jvmti->SetEventNotificationMode(JVMTI_ENABLE,
+                                        JVMTI_EVENT_VIRTUAL_THREAD_START,
+                                        NULL);
+
+        callbacks.VirtualThreadEnd = VirtualThreadEnd;
+        jvmti->SetEventNotificationMode(JVMTI_ENABLE,
+                                        JVMTI_EVENT_VIRTUAL_THREAD_END,
+                                        NULL);
+    }
+#endif
+
     callbacks.VMInit = VMInit;
     jvmti->SetEventNotificationMode(JVMTI_ENABLE,
                                     JVMTI_EVENT_VM_INIT,
@@ -359,6 +746,22 @@ Agent_OnLoad(JavaVM *vm, char *options, void *reserved)
         return 1;
     }
 
+#ifdef JINN_LOOM
+    // Mounts and unmounts are only reported through HotSpot extensions.
+    if(loom_enabled
+        && (!enable_extension_event(jvmti, "com.sun.hotspot.events.VirtualThreadMount",
+                                    (jvmtiExtensionEvent) VirtualThreadMount)
+            || !enable_extension_event(jvmti, "com.sun.hotspot.events.VirtualThreadUnmount",
+                                       (jvmtiExtensionEvent) VirtualThreadUnmount)))
+    {
+        fprintf(stderr, "sync_jvmti: Failed to enable virtual thread mount events\n");
+    }
+    else if(loom_enabled)
+    {
+        fprintf(stderr, "sync_jvmti: Tracking virtual threads.\n");
+    }
+#endif
+
     std::atomic<uint64_t> u64_atomic;
     if(!u64_atomic.is_lock_free())
         fprintf(stderr, "sync_jvmti: aligned atomic_uint64_t is not lock free!!!\n");
@@ -376,5 +779,7 @@ JNIEXPORT void JNICALL
 Agent_OnUnload(JavaVM *vm)
 {
     phase_shutdown();
+    roles_shutdown();
+    convoy_shutdown();
     fprintf(stderr, "sync_jvmti: Agent has been unloaded\n");
 }
@@ -0,0 +1,522 @@
+#include "classfile.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// A minimal class file rewriter.
+//
+// Rewriting the bytecode of a method in place means relocating branches,
+// exception tables and stack map frames. Instead, the original method is
+// kept as is under another name, and a small wrapper with straight-line
+// code takes its place:
+//
+//     aload_0; <arg>; invokestatic enter_probe
+//   start:
+//     aload_0; <load every argument>; invokevirtual <name>$jinn
+//     aload_0; <arg>; invokestatic exit_probe
+//     <return>
+//   handler:                              // any Throwable
+//     astore <n>; aload_0; <arg>; invokestatic exit_probe
+//     aload <n>; athrow
+//
+// Only the constant pool and the method table grow. The handler is the
+// only branch target, so a single full frame describes it.
+
+/// Constant pool tags.
+enum : uint8_t
+{
+    CONSTANT_Utf8 = 1,
+    CONSTANT_Integer = 3,
+    CONSTANT_Float = 4,
+    CONSTANT_Long = 5,
+    CONSTANT_Double = 6,
+    CONSTANT_Class = 7,
+    CONSTANT_String = 8,
+    CONSTANT_Fieldref = 9,
+    CONSTANT_Methodref = 10,
+    CONSTANT_InterfaceMethodref = 11,
+    CONSTANT_NameAndType = 12,
+    CONSTANT_MethodHandle = 15,
+    CONSTANT_MethodType = 16,
+    CONSTANT_Dynamic = 17,
+    CONSTANT_InvokeDynamic = 18,
+    CONSTANT_Module = 19,
+    CONSTANT_Package = 20,
+};
+
+constexpr uint16_t ACC_PRIVATE = 0x0002;
+constexpr uint16_t ACC_STATIC = 0x0008;
+constexpr uint16_t ACC_NATIVE = 0x0100;
+constexpr uint16_t ACC_ABSTRACT = 0x0400;
+
+/// Verification types of the stack map frames.
+constexpr uint8_t ITEM_Integer = 1;
+constexpr uint8_t ITEM_Float = 2;
+constexpr uint8_t ITEM_Double = 3;
+constexpr uint8_t ITEM_Long = 4;
+constexpr uint8_t ITEM_Object = 7;
+
+namespace
+{
+struct Reader
+{
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+    bool ok;
+
+    bool need(size_t n)
+    {
+        if(pos + n > size)
+            ok = false;
+        return ok;
+    }
+
+    uint32_t u1() { return need(1)? data[pos++] : 0; }
+    uint32_t u2() { uint32_t hi = u1(); return (hi << 8) | u1(); }
+    uint32_t u4() { uint32_t hi = u2(); return (hi << 16) | u2(); }
+    void skip(size_t n) { if(need(n)) pos += n; }
+};
+
+struct Writer
+{
+    std::vector<unsigned char>& out;
+
+    void u1(uint32_t v) { out.push_back(uint8_t(v)); }
+    void u2(uint32_t v) { u1(v >> 8); u1(v); }
+    void u4(uint32_t v) { u2(v >> 16); u2(v); }
+    void bytes(const unsigned char* p, size_t n) { out.insert(out.end(), p, p + n); }
+    void patch_u4(size_t at, uint32_t v)
+    {
+        out[at] = uint8_t(v >> 24); out[at+1] = uint8_t(v >> 16);
+        out[at+2] = uint8_t(v >> 8); out[at+3] = uint8_t(v);
+    }
+};
+
+/// Constant pool entries appended to the class.
+struct ConstantPool
+{
+    std::vector<unsigned char> entries;
+    uint32_t count;     //< next index to be allocated
+
+    uint16_t utf8(const std::string& s)
+    {
+        Writer w{entries};
+        w.u1(CONSTANT_Utf8);
+        w.u2(s.size());
+        w.bytes((const unsigned char*) s.data(), s.size());
+        return count++;
+    }
+
+    uint16_t pair(uint8_t tag, uint16_t a, uint16_t b)
+    {
+        Writer w{entries};
+        w.u1(tag);
+        w.u2(a);
+        w.u2(b);
+        return count++;
+    }
+
+    uint16_t klass(const std::string& name)
+    {
+        const auto name_index = utf8(name);
+        Writer w{entries};
+        w.u1(CONSTANT_Class);
+        w.u2(name_index);
+        return count++;
+    }
+
+    uint16_t methodref(uint16_t class_index, const std::string& name, const std::string& desc)
+    {
+        const auto nat = pair(CONSTANT_NameAndType, utf8(name), utf8(desc));
+        return pair(CONSTANT_Methodref, class_index, nat);
+    }
+};
+
+/// A parameter (or return) type of a method descriptor.
+struct Type
+{
+    char kind;          //< first character of its descriptor (V for void)
+    std::string name;   //< class name for references (internal form)
+};
+
+/// Parses the descriptor of a method into its parameters and return type.
+bool parse_descriptor(const std::string& desc, std::vector<Type>& params, Type& ret)
+{
+    size_t i = 1;
+    if(desc.empty() || desc[0] != '(')
+        return false;
+
+    auto parse_type = [&](Type& type) {
+        const size_t start = i;
+        while(i < desc.size() && desc[i] == '[')
+            ++i;
+        if(i >= desc.size())
+            return false;
+        if(desc[i] == 'L')
+        {
+            const auto end = desc.find(';', i);
+            if(end == std::string::npos)
+                return false;
+            i = end;
+        }
+        ++i;
+
+        type.kind = desc[start];
+        if(type.kind == '[')
+            type.name = desc.substr(start, i - start);
+        else if(type.kind == 'L')
+            type.name = desc.substr(start + 1, i - start - 2);
+        return true;
+    };
+
+    while(i < desc.size() && desc[i] != ')')
+    {
+        Type type;
+        if(!parse_type(type))
+            return false;
+        params.push_back(type);
+    }
+
+    ++i;
+    return i < desc.size() && parse_type(ret) && i == desc.size();
+}
+
+int slots_of(const Type& type)
+{
+    return (type.kind == 'J' || type.kind == 'D')? 2 : (type.kind == 'V')? 0 : 1;
+}
+
+bool is_reference(const Type& type)
+{
+    return type.kind == 'L' || type.kind == '[';
+}
+
+/// Emits `aload_0; <first argument or null>; invokestatic probe`.
+void emit_probe(Writer& code, const std::vector<Type>& params, uint16_t probe_ref)
+{
+    code.u1(0x2a);                                      // aload_0
+    code.u1(!params.empty() && is_reference(params[0])?
+            0x2b : 0x01);                               // aload_1 / aconst_null
+    code.u1(0xb8);                                      // invokestatic
+    code.u2(probe_ref);
+}
+
+/// A method found in the class to be wrapped.
+struct Found
+{
+    const ClassFileWrap* wrap;
+    uint16_t access;
+    uint16_t name_index;
+    uint16_t desc_index;
+    std::vector<unsigned char> exceptions;  //< raw Exceptions attribute
+};
+}
+
+bool classfile_wrap_methods(const unsigned char* data, size_t size,
+                            const ClassFileWrap* wraps, int num_wraps,
+                            std::vector<unsigned char>& output)
+{
+    Reader in{data, size, 0, true};
+
+    if(in.u4() != 0xCAFEBABE)
+        return false;
+    in.u2();
+    const auto major_version = in.u2();
+
+    // The constant pool, as the offset of each entry.
+    const auto cp_count = in.u2();
+    const size_t cp_start = in.pos;
+    std::vector<size_t> cp_offsets(cp_count, 0);
+    for(uint32_t i = 1; i < cp_count && in.ok; ++i)
+    {
+        cp_offsets[i] = in.pos;
+        switch(in.u1())
+        {
+            case CONSTANT_Utf8: in.skip(in.u2()); break;
+            case CONSTANT_Class: case CONSTANT_String: case CONSTANT_MethodType:
+            case CONSTANT_Module: case CONSTANT_Package: in.skip(2); break;
+            case CONSTANT_MethodHandle: in.skip(3); break;
+            case CONSTANT_Integer: case CONSTANT_Float: case CONSTANT_Fieldref:
+            case CONSTANT_Methodref: case CONSTANT_InterfaceMethodref:
+            case CONSTANT_NameAndType: case CONSTANT_Dynamic:
+            case CONSTANT_InvokeDynamic: in.skip(4); break;
+            case CONSTANT_Long: case CONSTANT_Double: in.skip(8); ++i; break;
+            default: return false;
+        }
+    }
+    const size_t cp_end = in.pos;
+
+    auto utf8_at = [&](uint32_t index) -> std::string {
+        if(index == 0 || index >= cp_count || data[cp_offsets[index]] != CONSTANT_Utf8)
+            return std::string();
+        const size_t at = cp_offsets[index];
+        const size_t length = (data[at+1] << 8) | data[at+2];
+        return std::string((const char*) &data[at+3], length);
+    };
+
+    in.u2();
+    const auto this_class = in.u2();
+    in.u2();
+    in.skip(2 * in.u2());
+
+    // Fields are copied as they are.
+    const auto num_fields = in.u2();
+    for(uint32_t f = 0; f < num_fields && in.ok; ++f)
+    {
+        in.skip(6);
+        const auto num_attributes = in.u2();
+        for(uint32_t a = 0; a < num_attributes && in.ok; ++a)
+        {
+            in.u2();
+            in.skip(in.u4());
+        }
+    }
+
+    // Methods are copied, renaming the ones to be wrapped.
+    const size_t methods_start = in.pos;
+    const auto num_methods = in.u2();
+    std::vector<Found> found;
+    std::vector<size_t> rename_at;     //< offsets of the name of those methods
+    for(uint32_t m = 0; m < num_methods && in.ok; ++m)
+    {
+        const auto access = in.u2();
+        const size_t name_at = in.pos;
+        const auto name_index = in.u2();
+        const auto desc_index = in.u2();
+        const auto name = utf8_at(name_index);
+        const auto desc = utf8_at(desc_index);
+
+        const ClassFileWrap* wrap = nullptr;
+        for(int w = 0; w < num_wraps; ++w)
+        {
+            if(name == wraps[w].name && desc == wraps[w].descriptor
+                && !(access & (ACC_STATIC | ACC_NATIVE | ACC_ABSTRACT)))
+                wrap = &wraps[w];
+        }
+
+        Found method{wrap, uint16_t(access), uint16_t(name_index), uint16_t(desc_index), {}};
+        const auto num_attributes = in.u2();
+        for(uint32_t a = 0; a < num_attributes && in.ok; ++a)
+        {
+            const size_t attribute_at = in.pos;
+            const auto attribute_name = utf8_at(in.u2());
+            in.skip(in.u4());
+            if(wrap && in.ok && attribute_name == "Exceptions")
+                method.exceptions.assign(&data[attribute_at], &data[in.pos]);
+        }
+
+        if(wrap)
+        {
+            found.push_back(std::move(method));
+            rename_at.push_back(name_at);
+        }
+    }
+    const size_t methods_end = in.pos;
+
+    if(!in.ok || found.empty())
+        return false;
+
+    // New constants: names, probes and the methods called by the wrappers.
+    ConstantPool cp{{}, cp_count};
+    const auto code_name = cp.utf8("Code");
+    const auto stack_map_name = cp.utf8("StackMapTable");
+    const auto throwable_class = cp.klass("java/lang/Throwable");
+
+    struct Probe { std::string name; uint16_t ref; };
+    std::vector<Probe> probes;
+    auto probe_ref = [&](const char* name) -> uint16_t {
+        for(const auto& probe : probes)
+        {
+            if(probe.name == name)
+                return probe.ref;
+        }
+        probes.push_back(Probe{name, cp.methodref(this_class, name, CLASSFILE_PROBE_DESCRIPTOR)});
+        return probes.back().ref;
+    };
+
+    std::vector<unsigned char> new_methods;
+    Writer methods{new_methods};
+    std::vector<uint16_t> renamed_names;
+
+    for(const auto& method : found)
+    {
+        const std::string name = utf8_at(method.name_index);
+        const std::string desc = utf8_at(method.desc_index);
+
+        std::vector<Type> params;
+        Type ret;
+        if(!parse_descriptor(desc, params, ret))
+            return false;
+
+        const auto renamed_name = cp.utf8(name + "$jinn");
+        renamed_names.push_back(renamed_name);
+        const auto nat = cp.pair(CONSTANT_NameAndType, renamed_name, method.desc_index);
+        const auto original_ref = cp.pair(CONSTANT_Methodref, this_class, nat);
+        const auto enter_ref = method.wrap->enter_probe? probe_ref(method.wrap->enter_probe) : 0;
+        const auto exit_ref = method.wrap->exit_probe? probe_ref(method.wrap->exit_probe) : 0;
+
+        int param_slots = 0;
+        for(const auto& param : params)
+            param_slots += slots_of(param);
+
+        // The code of the wrapper.
+        std::vector<unsigned char> code_bytes;
+        Writer code{code_bytes};
+
+        if(enter_ref)
+            emit_probe(code, params, enter_ref);
+
+        const size_t try_start = code_bytes.size();
+        code.u1(0x2a);                                  // aload_0
+        int slot = 1;
+        for(const auto& param : params)
+        {
+            switch(param.kind)
+            {
+                case 'J': code.u1(0x16); break;         // lload
+                case 'F': code.u1(0x17); break;         // fload
+                case 'D': code.u1(0x18); break;         // dload
+                case 'L': case '[': code.u1(0x19); break; // aload
+                default: code.u1(0x15); break;          // iload
+            }
+            code.u1(slot);
+            slot += slots_of(param);
+        }
+        code.u1((method.access & ACC_PRIVATE)? 0xb7 : 0xb6); // invokespecial / invokevirtual
+        code.u2(original_ref);
+
+        if(exit_ref)
+            emit_probe(code, params, exit_ref);
+
+        switch(ret.kind)
+        {
+            case 'V': code.u1(0xb1); break;             // return
+            case 'J': code.u1(0xad); break;             // lreturn
+            case 'F': code.u1(0xae); break;             // freturn
+            case 'D': code.u1(0xaf); break;             // dreturn
+            case 'L': case '[': code.u1(0xb0); break;   // areturn
+            default: code.u1(0xac); break;              // ireturn
+        }
+
+        const size_t handler = code_bytes.size();
+        const int exception_slot = 1 + param_slots;
+        if(exit_ref)
+        {
+            code.u1(0x3a); code.u1(exception_slot);     // astore
+            emit_probe(code, params, exit_ref);
+            code.u1(0x19); code.u1(exception_slot);     // aload
+            code.u1(0xbf);                              // athrow
+        }
+
+        if(exception_slot > 255)
+            return false;
+
+        const int max_stack = std::max(std::max(2 + slots_of(ret), 1 + param_slots), 2);
+        const int max_locals = exception_slot + 1;
+
+        // The frame at the handler: `this`, the arguments and the exception.
+        std::vector<unsigned char> frame_bytes;
+        Writer frame{frame_bytes};
+        frame.u1(255);                                  // full_frame
+        frame.u2(handler);
+        frame.u2(1 + params.size());
+        frame.u1(ITEM_Object);
+        frame.u2(this_class);
+        for(const auto& param : params)
+        {
+            switch(param.kind)
+            {
+                case 'J': frame.u1(ITEM_Long); break;
+                case 'F': frame.u1(ITEM_Float); break;
+                case 'D': frame.u1(ITEM_Double); break;
+                case 'L': case '[': frame.u1(ITEM_Object); frame.u2(cp.klass(param.name)); break;
+                default: frame.u1(ITEM_Integer); break;
+            }
+        }
+        frame.u2(1);
+        frame.u1(ITEM_Object);
+        frame.u2(throwable_class);
+
+        // The wrapper itself.
+        methods.u2(method.access);
+        methods.u2(method.name_index);
+        methods.u2(method.desc_index);
+        methods.u2(method.exceptions.empty()? 1 : 2);
+
+        methods.u2(code_name);
+        const size_t length_at = new_methods.size();
+        methods.u4(0);
+        methods.u2(max_stack);
+        methods.u2(max_locals);
+        methods.u4(code_bytes.size());
+        methods.bytes(code_bytes.data(), code_bytes.size());
+        if(exit_ref)
+        {
+            methods.u2(1);
+            methods.u2(try_start);
+            methods.u2(handler);
+            methods.u2(handler);
+            methods.u2(0);                              // any
+            methods.u2(major_version >= 50? 1 : 0);
+            if(major_version >= 50)
+            {
+                methods.u2(stack_map_name);
+                methods.u4(2 + frame_bytes.size());
+                methods.u2(1);
+                methods.bytes(frame_bytes.data(), frame_bytes.size());
+            }
+        }
+        else
+        {
+            methods.u2(0);
+            methods.u2(0);
+        }
+        methods.patch_u4(length_at, new_methods.size() - length_at - 4);
+
+        if(!method.exceptions.empty())
+            methods.bytes(method.exceptions.data(), method.exceptions.size());
+    }
+
+    // The probes, as private static native methods.
+    for(const auto& probe : probes)
+    {
+        methods.u2(ACC_PRIVATE | ACC_STATIC | ACC_NATIVE);
+        methods.u2(cp.utf8(probe.name));
+        methods.u2(cp.utf8(CLASSFILE_PROBE_DESCRIPTOR));
+        methods.u2(0);
+    }
+
+    if(cp.count > 0xFFFF)
+        return false;
+
+    // Assemble the class: the constant pool grows, the wrapped methods are
+    // renamed, and the wrappers and probes are appended to the methods.
+    std::vector<unsigned char> result;
+    result.reserve(size + cp.entries.size() + new_methods.size());
+    Writer out{result};
+
+    out.bytes(data, 8);
+    out.u2(cp.count);
+    out.bytes(&data[cp_start], cp_end - cp_start);
+    out.bytes(cp.entries.data(), cp.entries.size());
+
+    out.bytes(&data[cp_end], methods_start - cp_end);
+    out.u2(num_methods + found.size() + probes.size());
+
+    const size_t methods_at = result.size();
+    out.bytes(&data[methods_start + 2], methods_end - methods_start - 2);
+    for(size_t i = 0; i < rename_at.size(); ++i)
+    {
+        const size_t at = methods_at + (rename_at[i] - methods_start - 2);
+        result[at] = uint8_t(renamed_names[i] >> 8);
+        result[at+1] = uint8_t(renamed_names[i]);
+    }
+    out.bytes(new_methods.data(), new_methods.size());
+
+    out.bytes(&data[methods_end], size - methods_end);
+
+    output.swap(result);
+    return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+/// Descriptor of the probes called by the wrappers, which receive the
+/// object whose method was called and the first argument of the call (or
+/// null if it is not a reference).
+constexpr const char* CLASSFILE_PROBE_DESCRIPTOR = "(Ljava/lang/Object;Ljava/lang/Object;)V";
+
+/// A method to wrap with probes.
+struct ClassFileWrap
+{
+    const char* name;           //< name of the method
+    const char* descriptor;     //< descriptor of the method
+    const char* enter_probe;    //< probe called on entry, or null
+    const char* exit_probe;     //< probe called on return or throw, or null
+};
+
+/// Wraps the instance methods `wraps` of a class with probes.
+///
+/// Each method found is renamed to `<name>$jinn`, and a method with its
+/// original name, descriptor and access calls the enter probe, the renamed
+/// method and then the exit probe, which also runs if the call throws. The
+/// probes are declared as private static native methods of the class
+/// itself, so they must be exported by the agent as JNI functions.
+///
+/// Returns false if the class is malformed or none of the methods is found,
+/// leaving `output` untouched.
+extern bool classfile_wrap_methods(const unsigned char* data, size_t size,
+                                   const ClassFileWrap* wraps, int num_wraps,
+                                   std::vector<unsigned char>& output);
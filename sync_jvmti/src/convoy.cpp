@@ -0,0 +1,403 @@
+#include "convoy.hpp"
+#include "time.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+// Lock convoys and wait chains.
+//
+// A high CSP may come from a single lock held for long, or from a convoy:
+// a monitor that is handed over from one blocked thread to the next, each
+// holding it only briefly, so that the threads spend their time waking
+// each other up. Both look the same on the CSP, but convoys respond to core
+// placement (e.g. keeping the queue on a single cluster) very differently.
+//
+// We only see contended acquisitions. A ContendedEntered event is sent to
+// a thread once it is handed the monitor it blocked on, and while it holds
+// it, so the events of a monitor are serialised by the monitor itself. The
+// state of each monitor is kept on a table indexed by identity hash:
+//
+//  + its owner, which is the last thread handed the monitor. We do not see
+//    releases, so this is only an approximation of the current owner.
+//  + a ticket counter, taken on ContendedEnter, that tells whether waiters
+//    are served in arrival (FIFO) order.
+//  + the current streak of FIFO handoffs that came shortly after the
+//    previous one. A streak of at least `JINN_CONVOY_HANDOFFS` handoffs
+//    is a convoy.
+//
+// Together with the monitor each thread blocks on, the owners make up the
+// wait-for graph. It is followed on every ContendedEnter, and chains with
+// more than `JINN_CHAIN_LENGTH` blocked threads are reported.
+//
+// Convoys (once per phase they are active in) and long chains are written
+// to `sync_jvmti.<pid>.convoys` with their threads and monitors.
+
+/// Maximum number of monitors we keep track of at once.
+constexpr int MAX_MONITORS = 1024;
+
+/// Number of slots following the hash of a monitor that may hold it. The
+/// table is probed while the phase is held, so this must stay small.
+constexpr int MAX_MONITOR_PROBES = 8;
+
+/// Time after which an idle monitor may give its slot to another.
+constexpr uint64_t MONITOR_IDLE_TIME = 1000000000;
+
+struct MonitorEntry
+{
+    std::atomic<int32_t> key;
+    std::atomic<int> owner;
+    std::atomic<uint32_t> next_ticket;
+    std::atomic<uint64_t> last_used;
+
+    // Only touched while holding the monitor.
+    uint32_t last_served_ticket;
+    uint64_t last_handoff_time;
+    uint32_t streak_handoffs;
+    uint64_t streak_start_time;
+    uint8_t num_streak_threads;
+    uint16_t streak_threads[PhaseReport::MAX_ENTRIES];
+    uint64_t report_phase;
+    int report_slot;
+};
+
+static bool is_enabled;
+static uint32_t convoy_min_handoffs;
+static uint64_t convoy_max_interval;
+static uint32_t report_chain_length;
+static FILE* report_stream;
+
+static MonitorEntry monitors[MAX_MONITORS];
+
+/// The monitor slot (plus one) each thread is blocked on, or zero.
+static std::atomic<int> waiting_on[AtomicPhase::MAX_THREADS];
+
+/// The ticket each thread took when it blocked.
+static uint32_t waiting_ticket[AtomicPhase::MAX_THREADS];
+
+bool convoy_init()
+{
+    is_enabled = false;
+    convoy_min_handoffs = 4;
+    convoy_max_interval = 100;
+    report_chain_length = 2;
+    report_stream = nullptr;
+
+    for(int i = 0; i < MAX_MONITORS; ++i)
+        monitors[i].key.store(0, std::memory_order_relaxed);
+
+    for(int i = 0; i < AtomicPhase::MAX_THREADS; ++i)
+        waiting_on[i].store(0, std::memory_order_relaxed);
+
+    if(auto s = std::getenv("JINN_CONVOYS"))
+    {
+        if(!strcmp(s, "true") || !strcmp(s, "1"))
+            is_enabled = true;
+        else if(strcmp(s, "false") && strcmp(s, "0"))
+            fprintf(stderr, "sync_jvmti: Unrecognized JINN_CONVOYS: %s\n", s);
+    }
+
+    if(auto s = std::getenv("JINN_CONVOY_HANDOFFS"))
+        sscanf(s, "%" SCNu32, &convoy_min_handoffs);
+
+    if(auto s = std::getenv("JINN_CONVOY_INTERVAL"))
+        sscanf(s, "%" SCNu64, &convoy_max_interval);
+
+    if(auto s = std::getenv("JINN_CHAIN_LENGTH"))
+        sscanf(s, "%" SCNu32, &report_chain_length);
+
+    // Microseconds into our time unit.
+    convoy_max_interval *= 1000;
+
+    if(!is_enabled)
+        return false;
+
+    char path[128];
+    sprintf(path, "sync_jvmti.%ld.convoys", (long) getpid());
+    report_stream = fopen(path, "w");
+    if(!report_stream)
+    {
+        perror("sync_jvmti: Failed to open convoy report file");
+        is_enabled = false;
+        return false;
+    }
+
+    fprintf(stderr, "sync_jvmti: Reporting lock convoys and wait chains to %s\n", path);
+    return true;
+}
+
+void convoy_shutdown()
+{
+    if(report_stream)
+    {
+        fclose(report_stream);
+        report_stream = nullptr;
+    }
+}
+
+bool convoy_enabled()
+{
+    return is_enabled;
+}
+
+static void reset_monitor(MonitorEntry& entry, uint64_t curr_time)
+{
+    entry.owner.store(0, std::memory_order_relaxed);
+    entry.next_ticket.store(0, std::memory_order_relaxed);
+    entry.last_used.store(curr_time, std::memory_order_relaxed);
+    entry.last_served_ticket = 0;
+    entry.last_handoff_time = 0;
+    entry.streak_handoffs = 0;
+    entry.num_streak_threads = 0;
+    entry.report_phase = 0;
+}
+
+/// Finds (or claims) the slot of the monitor `key`, or returns -1 if the
+/// slots it may take are full of monitors in use.
+static int find_monitor(int32_t key, uint64_t curr_time)
+{
+    key = key? key : 1;
+    const auto start = static_cast<uint32_t>(key) % MAX_MONITORS;
+
+    for(int i = 0; i < MAX_MONITOR_PROBES; ++i)
+    {
+        const int slot = (start + i) % MAX_MONITORS;
+        auto& entry = monitors[slot];
+
+        int32_t curr = entry.key.load(std::memory_order_acquire);
+        if(curr == 0 && entry.key.compare_exchange_strong(curr, key, std::memory_order_acq_rel))
+        {
+            reset_monitor(entry, curr_time);
+            return slot;
+        }
+        if(curr == key)
+        {
+            entry.last_used.store(curr_time, std::memory_order_relaxed);
+            return slot;
+        }
+    }
+
+    // Monitors are never freed by the VM as far as we know, so take over
+    // the slot of one that has not been contended for a while.
+    for(int i = 0; i < MAX_MONITOR_PROBES; ++i)
+    {
+        const int slot = (start + i) % MAX_MONITORS;
+        auto& entry = monitors[slot];
+
+        int32_t curr = entry.key.load(std::memory_order_acquire);
+        if(curr_time - entry.last_used.load(std::memory_order_relaxed) > MONITOR_IDLE_TIME
+            && entry.key.compare_exchange_strong(curr, key, std::memory_order_acq_rel))
+        {
+            reset_monitor(entry, curr_time);
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+/// Claims a report of the phase, or returns null if there are too many.
+static auto claim_report(AtomicPhasePtr& phase_ptr, int* slot) -> PhaseReport*
+{
+    const auto index = phase_ptr->phase_report_count.fetch_add(1, std::memory_order_relaxed);
+    if(index >= AtomicPhase::MAX_REPORTS)
+        return nullptr;
+    *slot = index;
+    return &phase_ptr->phase_reports[index];
+}
+
+void convoy_contended_enter(AtomicPhasePtr& phase_ptr, int thread_id,
+                            int32_t key, uint64_t curr_time)
+{
+    const int slot = find_monitor(key, curr_time);
+    if(slot < 0)
+        phase_ptr->phase_monitor_drop_count.fetch_add(1, std::memory_order_relaxed);
+    if(slot < 0 || thread_id <= 0 || thread_id >= AtomicPhase::MAX_THREADS)
+        return;
+
+    auto& entry = monitors[slot];
+    waiting_ticket[thread_id] = entry.next_ticket.fetch_add(1, std::memory_order_relaxed) + 1;
+    waiting_on[thread_id].store(slot + 1, std::memory_order_relaxed);
+
+    // Follow the wait-for graph: we wait for the owner of the monitor, who
+    // may be waiting for the owner of another monitor, and so on.
+    PhaseReport chain;
+    chain.num_threads = 1;
+    chain.threads[0] = thread_id;
+    chain.monitors[0] = entry.key.load(std::memory_order_relaxed);
+
+    int owner = entry.owner.load(std::memory_order_relaxed);
+    while(owner > 0 && chain.num_threads < PhaseReport::MAX_ENTRIES)
+    {
+        // The owner is stale if it is in the chain already (it released the
+        // monitor, or this is a deadlock, which we cannot tell apart).
+        bool seen = false;
+        for(int i = 0; i < chain.num_threads; ++i)
+            seen |= (chain.threads[i] == owner);
+        if(seen)
+            break;
+
+        chain.threads[chain.num_threads++] = owner;
+
+        const int owner_waiting_on = waiting_on[owner].load(std::memory_order_relaxed);
+        if(owner_waiting_on == 0 || chain.num_threads == PhaseReport::MAX_ENTRIES)
+            break;
+
+        const auto& next = monitors[owner_waiting_on - 1];
+        chain.monitors[chain.num_threads - 1] = next.key.load(std::memory_order_relaxed);
+        owner = next.owner.load(std::memory_order_relaxed);
+    }
+
+    // Every thread but the last one in the chain is blocked.
+    const uint32_t length = chain.num_threads - (chain.num_threads > 1);
+    auto max_length = phase_ptr->phase_max_chain_length.load(std::memory_order_relaxed);
+    while(length > max_length
+            && !phase_ptr->phase_max_chain_length.compare_exchange_weak(max_length, length,
+                                                                       std::memory_order_relaxed))
+    {
+    }
+
+    if(length > report_chain_length)
+    {
+        phase_ptr->phase_long_chain_count.fetch_add(1, std::memory_order_relaxed);
+
+        int report_slot;
+        if(auto report = claim_report(phase_ptr, &report_slot))
+        {
+            chain.kind = PhaseReport::KIND_CHAIN;
+            chain.handoffs = 0;
+            chain.start_time = chain.end_time = curr_time;
+            *report = chain;
+        }
+    }
+}
+
+/// Records the current convoy of `entry` into the phase.
+static void report_convoy(AtomicPhasePtr& phase_ptr, MonitorEntry& entry, bool ended)
+{
+    PhaseReport* report;
+    if(entry.report_phase == phase_ptr->phase_number + 1)
+    {
+        report = &phase_ptr->phase_reports[entry.report_slot];
+    }
+    else if((report = claim_report(phase_ptr, &entry.report_slot)) != nullptr)
+    {
+        entry.report_phase = phase_ptr->phase_number + 1;
+    }
+    else
+    {
+        return;
+    }
+
+    report->kind = ended? PhaseReport::KIND_CONVOY_ENDED : PhaseReport::KIND_CONVOY;
+    report->num_threads = entry.num_streak_threads;
+    memcpy(report->threads, entry.streak_threads, sizeof(report->threads));
+    report->monitors[0] = entry.key.load(std::memory_order_relaxed);
+    report->handoffs = entry.streak_handoffs;
+    report->start_time = entry.streak_start_time;
+    report->end_time = entry.last_handoff_time;
+}
+
+void convoy_contended_entered(AtomicPhasePtr& phase_ptr, int thread_id,
+                              int32_t key, uint64_t curr_time)
+{
+    if(thread_id <= 0 || thread_id >= AtomicPhase::MAX_THREADS)
+        return;
+
+    const int waited_slot = waiting_on[thread_id].exchange(0, std::memory_order_relaxed);
+    const int slot = find_monitor(key, curr_time);
+    if(slot < 0 || waited_slot != slot + 1)
+        return;
+
+    auto& entry = monitors[slot];
+    const int prev_owner = entry.owner.exchange(thread_id, std::memory_order_relaxed);
+
+    const auto ticket = waiting_ticket[thread_id];
+    const bool fifo = (ticket == entry.last_served_ticket + 1);
+    const bool brief = (entry.last_handoff_time != 0
+                        && curr_time - entry.last_handoff_time <= convoy_max_interval);
+    if(ticket > entry.last_served_ticket)
+        entry.last_served_ticket = ticket;
+
+    phase_ptr->phase_handoff_count.fetch_add(1, std::memory_order_relaxed);
+    if(fifo)
+        phase_ptr->phase_fifo_handoff_count.fetch_add(1, std::memory_order_relaxed);
+
+    if(fifo && brief)
+    {
+        if(entry.streak_handoffs == 0)
+        {
+            entry.streak_start_time = entry.last_handoff_time;
+            entry.num_streak_threads = 0;
+            if(prev_owner > 0)
+                entry.streak_threads[entry.num_streak_threads++] = prev_owner;
+        }
+
+        bool seen = false;
+        for(int i = 0; i < entry.num_streak_threads; ++i)
+            seen |= (entry.streak_threads[i] == thread_id);
+        if(!seen && entry.num_streak_threads < PhaseReport::MAX_ENTRIES)
+            entry.streak_threads[entry.num_streak_threads++] = thread_id;
+
+        entry.last_handoff_time = curr_time;
+
+        // The streak becomes a convoy once long enough, and then all of its
+        // handoffs count as part of it.
+        if(++entry.streak_handoffs >= convoy_min_handoffs)
+        {
+            const uint32_t convoy_handoffs = (entry.streak_handoffs == convoy_min_handoffs)?
+                                             entry.streak_handoffs : 1;
+            phase_ptr->phase_convoy_handoff_count.fetch_add(convoy_handoffs, std::memory_order_relaxed);
+            report_convoy(phase_ptr, entry, false);
+        }
+    }
+    else
+    {
+        if(entry.streak_handoffs >= convoy_min_handoffs)
+            report_convoy(phase_ptr, entry, true);
+
+        entry.streak_handoffs = 0;
+        entry.last_handoff_time = curr_time;
+    }
+}
+
+void convoy_checkpoint(AtomicPhase* phase_ptr, uint64_t elapsed_time)
+{
+    if(!report_stream)
+        return;
+
+    const auto count = phase_ptr->phase_report_count.load(std::memory_order_relaxed);
+    const auto num_reports = std::min<uint32_t>(count, AtomicPhase::MAX_REPORTS);
+
+    for(uint32_t i = 0; i < num_reports; ++i)
+    {
+        const auto& report = phase_ptr->phase_reports[i];
+        if(report.kind == PhaseReport::KIND_CHAIN)
+        {
+            fprintf(report_stream, "%" PRIu64 " chain length=%d ", elapsed_time,
+                    report.num_threads - (report.num_threads > 1));
+            for(int j = 0; j < report.num_threads; ++j)
+            {
+                if(j + 1 < report.num_threads)
+                    fprintf(report_stream, "t%u>%08x>", report.threads[j], (unsigned) report.monitors[j]);
+                else
+                    fprintf(report_stream, "t%u\n", report.threads[j]);
+            }
+        }
+        else
+        {
+            fprintf(report_stream, "%" PRIu64 " convoy monitor=%08x handoffs=%u span_us=%" PRIu64 " threads=",
+                    elapsed_time, (unsigned) report.monitors[0], report.handoffs,
+                    (report.end_time - report.start_time) / 1000);
+            for(int j = 0; j < report.num_threads; ++j)
+                fprintf(report_stream, "%s%u", j? ":" : "", report.threads[j]);
+            fprintf(report_stream, "%s\n", report.kind == PhaseReport::KIND_CONVOY_ENDED? " ended" : "");
+        }
+    }
+
+    if(count > num_reports)
+        fprintf(report_stream, "%" PRIu64 " dropped=%u\n", elapsed_time, count - num_reports);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include "phase.hpp"
+
+/// Initialises the convoy and wait chain detection.
+///
+/// Returns whether it is enabled (see `JINN_CONVOYS`).
+extern bool convoy_init();
+
+/// Closes the convoy report file.
+extern void convoy_shutdown();
+
+/// Whether convoys and wait chains are being detected.
+extern bool convoy_enabled();
+
+/// Called when the thread `thread_id` blocks on the monitor whose identity
+/// hash is `key`. Follows the wait-for graph from there.
+extern void convoy_contended_enter(AtomicPhasePtr& phase_ptr, int thread_id,
+                                   int32_t key, uint64_t curr_time);
+
+/// Called when the thread `thread_id` is handed the monitor `key` it was
+/// blocked on. Must be called while the monitor is held.
+extern void convoy_contended_entered(AtomicPhasePtr& phase_ptr, int thread_id,
+                                     int32_t key, uint64_t curr_time);
+
+/// Writes the convoys and wait chains of a phase to the report file.
+extern void convoy_checkpoint(AtomicPhase* phase_ptr, uint64_t elapsed_time);
@@ -0,0 +1,504 @@
+#include "juc.hpp"
+#include "classfile.hpp"
+#include "overhead.hpp"
+#include "phase.hpp"
+#include "time.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// j.u.c lock instrumentation.
+//
+// Locks of java.util.concurrent never reach the monitor events, and their
+// park is indistinguishable from any other use of LockSupport. We therefore
+// rewrite AbstractQueuedSynchronizer (and its base AbstractOwnableSynchronizer)
+// as they are loaded, wrapping the few methods every lock goes through with
+// calls to native probes exported by this library:
+//
+//  + `acquire*` and `tryAcquire*Nanos` are the slow paths of the locks. The
+//    time spent in them is the time spent waiting for the lock, which is
+//    accounted as contention (i.e. it counts towards the CSP) instead of
+//    parking when they park.
+//  + `setExclusiveOwnerThread` is called by every exclusive lock whenever it
+//    changes hands, even on the uncontended fast path, which tells us for
+//    how long locks are held.
+//  + shared holds start when `acquireShared*` returns and end at
+//    `releaseShared`. Read locks go through both even when uncontended
+//    (`ReadLock.lock` is `acquireShared`), but semaphores and latches are
+//    released by threads other than the ones that acquired them, so only
+//    the read locks of `ReentrantReadWriteLock` are tracked. Whether an
+//    interruptible or timed acquisition succeeded is asked to the lock.
+//
+// Locks are told apart by their identity hash, computed once per probe. Since the owner probe runs
+// on every lock and unlock of the application, the holds are buffered per
+// thread and only flushed to the phase every millisecond or so, and the cost
+// of the probes themselves is measured on a sample of the calls. That only
+// covers their native bodies: the transitions from Java and the wrapping
+// bytecode are measured by `bench/run_bench.sh --probe-overhead`.
+
+/// Maximum nesting of locks held by a thread we keep track of.
+constexpr int MAX_HELD_LOCKS = 16;
+
+/// Number of distinct locks whose holds a thread buffers.
+constexpr int MAX_BUFFERED_LOCKS = 8;
+
+/// Every how many probe calls one is timed.
+constexpr uint32_t PROBE_SAMPLE_PERIOD = 64;
+
+/// Every how many probe calls a thread publishes its call count.
+constexpr uint32_t PROBE_FLUSH_PERIOD = 1024;
+
+struct HeldLock
+{
+    int32_t key;
+    uint64_t since;
+};
+
+struct BufferedLock
+{
+    int32_t key;
+    uint64_t hold_time;
+    uint32_t acquire_count;
+};
+
+/// The synchronizer of `ReentrantReadWriteLock`, whose shared holds we track.
+struct ReadLockSync
+{
+    jclass klass;
+    jmethodID get_read_hold_count;
+};
+
+static bool is_enabled;
+static jvmtiEnv* probe_jvmti;
+
+static std::atomic<uint64_t> total_probe_calls;
+static std::atomic<uint64_t> total_probe_samples;
+static std::atomic<uint64_t> total_probe_sample_time;
+
+/// The time at which the thread started acquiring a lock, or zero.
+static thread_local uint64_t acquire_start_time {0};
+
+/// Whether the thread parked since `acquire_start_time`.
+static thread_local bool acquire_parked {false};
+
+/// The key of the lock the thread was made owner of since
+/// `acquire_start_time`, or zero.
+static thread_local int32_t acquire_key {0};
+
+static thread_local HeldLock held_locks[MAX_HELD_LOCKS];
+static thread_local int num_held_locks {0};
+
+static thread_local BufferedLock buffered_locks[MAX_BUFFERED_LOCKS];
+static thread_local int num_buffered_locks {0};
+static thread_local uint64_t buffered_since {0};
+
+static thread_local uint32_t probe_calls {0};
+static thread_local uint32_t probe_samples {0};
+static thread_local uint64_t probe_sample_time {0};
+
+static const ClassFileWrap aqs_wraps[] = {
+    {"acquire", "(I)V", "jinnAcquireEnter", "jinnAcquireExit"},
+    {"acquireInterruptibly", "(I)V", "jinnAcquireEnter", "jinnAcquireExit"},
+    {"tryAcquireNanos", "(IJ)Z", "jinnAcquireEnter", "jinnAcquireExit"},
+    {"acquireShared", "(I)V", "jinnAcquireEnter", "jinnSharedAcquireExit"},
+    {"acquireSharedInterruptibly", "(I)V", "jinnAcquireEnter", "jinnSharedTryAcquireExit"},
+    {"tryAcquireSharedNanos", "(IJ)Z", "jinnAcquireEnter", "jinnSharedTryAcquireExit"},
+    {"releaseShared", "(I)Z", "jinnSharedRelease", nullptr},
+};
+
+static const ClassFileWrap aos_wraps[] = {
+    {"setExclusiveOwnerThread", "(Ljava/lang/Thread;)V", "jinnOwner", nullptr},
+};
+
+bool juc_init(jvmtiEnv* jvmti)
+{
+    is_enabled = false;
+    probe_jvmti = jvmti;
+    total_probe_calls.store(0, std::memory_order_relaxed);
+    total_probe_samples.store(0, std::memory_order_relaxed);
+    total_probe_sample_time.store(0, std::memory_order_relaxed);
+
+    if(auto s = std::getenv("JINN_JUC_PROBES"))
+    {
+        if(!strcmp(s, "true") || !strcmp(s, "1"))
+            is_enabled = true;
+        else if(strcmp(s, "false") && strcmp(s, "0"))
+            fprintf(stderr, "sync_jvmti: Unrecognized JINN_JUC_PROBES: %s\n", s);
+    }
+
+    return is_enabled;
+}
+
+bool juc_enabled()
+{
+    return is_enabled;
+}
+
+bool juc_transform(jvmtiEnv* jvmti, const char* name,
+                   const unsigned char* data, jint size,
+                   jint* new_size, unsigned char** new_data)
+{
+    if(!is_enabled || name == nullptr)
+        return false;
+
+    const ClassFileWrap* wraps;
+    int num_wraps;
+    if(!strcmp(name, "java/util/concurrent/locks/AbstractQueuedSynchronizer"))
+    {
+        wraps = aqs_wraps;
+        num_wraps = sizeof(aqs_wraps) / sizeof(*aqs_wraps);
+    }
+    else if(!strcmp(name, "java/util/concurrent/locks/AbstractOwnableSynchronizer"))
+    {
+        wraps = aos_wraps;
+        num_wraps = sizeof(aos_wraps) / sizeof(*aos_wraps);
+    }
+    else
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> output;
+    if(!classfile_wrap_methods(data, size, wraps, num_wraps, output))
+    {
+        fprintf(stderr, "sync_jvmti: failed to instrument %s\n", name);
+        return false;
+    }
+
+    unsigned char* memory;
+    if(jvmti->Allocate(output.size(), &memory) != JVMTI_ERROR_NONE)
+    {
+        fprintf(stderr, "sync_jvmti: failed to instrument %s\n", name);
+        return false;
+    }
+
+    memcpy(memory, output.data(), output.size());
+    *new_size = static_cast<jint>(output.size());
+    *new_data = memory;
+    return true;
+}
+
+bool juc_park_in_acquire()
+{
+    if(acquire_start_time == 0)
+        return false;
+    acquire_parked = true;
+    return true;
+}
+
+/// Publishes the holds buffered by this thread to the current phase.
+static void flush_holds()
+{
+    if(num_buffered_locks == 0)
+        return;
+
+    uint64_t hold_time = 0;
+    uint32_t acquire_count = 0;
+
+    auto phase_ptr = get_phase();
+    for(int i = 0; i < num_buffered_locks; ++i)
+    {
+        const auto& lock = buffered_locks[i];
+        hold_time += lock.hold_time;
+        acquire_count += lock.acquire_count;
+
+        const int slot = phase_ptr->find_lock(lock.key);
+        if(slot >= 0)
+        {
+            phase_ptr->lock_hold_time[slot].fetch_add(lock.hold_time, std::memory_order_relaxed);
+            phase_ptr->lock_acquire_count[slot].fetch_add(lock.acquire_count, std::memory_order_relaxed);
+        }
+    }
+    phase_ptr->phase_juc_hold_time.fetch_add(hold_time, std::memory_order_relaxed);
+    phase_ptr->phase_juc_acquire_count.fetch_add(acquire_count, std::memory_order_relaxed);
+
+    num_buffered_locks = 0;
+}
+
+/// Buffers a hold of `key` released at `curr_time`.
+static void buffer_hold(int32_t key, uint64_t since, uint64_t curr_time)
+{
+    int i = 0;
+    while(i < num_buffered_locks && buffered_locks[i].key != key)
+        ++i;
+
+    if(i == MAX_BUFFERED_LOCKS)
+    {
+        flush_holds();
+        i = 0;
+    }
+
+    if(i == num_buffered_locks)
+    {
+        if(num_buffered_locks == 0)
+            buffered_since = curr_time;
+        buffered_locks[i] = BufferedLock { key, 0, 0 };
+        ++num_buffered_locks;
+    }
+
+    buffered_locks[i].hold_time += curr_time - since;
+    buffered_locks[i].acquire_count += 1;
+
+    if(to_millis(curr_time - buffered_since) >= 1)
+        flush_holds();
+}
+
+static void push_hold(int32_t key, uint64_t curr_time)
+{
+    // When too deeply nested, forget the outermost lock.
+    if(num_held_locks == MAX_HELD_LOCKS)
+    {
+        memmove(&held_locks[0], &held_locks[1], sizeof(HeldLock) * (MAX_HELD_LOCKS - 1));
+        --num_held_locks;
+    }
+    held_locks[num_held_locks++] = HeldLock { key, curr_time };
+}
+
+static void pop_hold(int32_t key, uint64_t curr_time)
+{
+    // Locks are usually released in reverse order, but need not be.
+    for(int i = num_held_locks - 1; i >= 0; --i)
+    {
+        if(held_locks[i].key == key)
+        {
+            buffer_hold(key, held_locks[i].since, curr_time);
+            memmove(&held_locks[i], &held_locks[i + 1], sizeof(HeldLock) * (num_held_locks - i - 1));
+            --num_held_locks;
+            return;
+        }
+    }
+}
+
+static int32_t lock_key(jobject lock)
+{
+    jint hash = 0;
+    if(lock == nullptr || probe_jvmti->GetObjectHashCode(lock, &hash) != JVMTI_ERROR_NONE)
+        return 0;
+    return hash? hash : 1;
+}
+
+/// Looks up `ReentrantReadWriteLock.Sync` the first time it is needed.
+static auto read_lock_sync(JNIEnv* env) -> const ReadLockSync&
+{
+    static const ReadLockSync sync = [env] {
+        ReadLockSync sync { nullptr, nullptr };
+        const auto klass = env->FindClass("java/util/concurrent/locks/ReentrantReadWriteLock$Sync");
+        if(klass != nullptr)
+        {
+            sync.get_read_hold_count = env->GetMethodID(klass, "getReadHoldCount", "()I");
+            if(sync.get_read_hold_count != nullptr)
+                sync.klass = static_cast<jclass>(env->NewGlobalRef(klass));
+            env->DeleteLocalRef(klass);
+        }
+        if(env->ExceptionCheck())
+            env->ExceptionClear();
+        if(sync.klass == nullptr)
+            fprintf(stderr, "sync_jvmti: read locks of ReentrantReadWriteLock will not be tracked\n");
+        return sync;
+    }();
+    return sync;
+}
+
+/// Whether the shared holds of `lock` are tracked.
+static bool is_read_lock(JNIEnv* env, jobject lock)
+{
+    const auto& sync = read_lock_sync(env);
+    return sync.klass != nullptr && lock != nullptr && env->IsInstanceOf(lock, sync.klass);
+}
+
+/// Whether the thread holds `lock` more times than the holds we track.
+static bool holds_read_lock(JNIEnv* env, jobject lock, int32_t key)
+{
+    const jint count = env->CallIntMethod(lock, read_lock_sync(env).get_read_hold_count);
+    if(env->ExceptionCheck())
+    {
+        env->ExceptionClear();
+        return false;
+    }
+
+    int num_held = 0;
+    for(int i = 0; i < num_held_locks; ++i)
+        num_held += (held_locks[i].key == key);
+    return count > num_held;
+}
+
+/// Counts a probe call, and times it if it is part of the sample.
+class ProbeScope
+{
+public:
+    ProbeScope() :
+        start_time((++probe_calls % PROBE_SAMPLE_PERIOD) == 0? get_time() : 0)
+    {}
+
+    ~ProbeScope()
+    {
+        if(start_time)
+        {
+            const auto time = get_time() - start_time;
+            probe_sample_time += time;
+            ++probe_samples;
+
+            // Probes run in the threads of the application, which we cannot
+            // tell apart from here.
+            if(overhead_enabled())
+                overhead_add(0, time * PROBE_SAMPLE_PERIOD);
+        }
+
+        if(probe_calls == PROBE_FLUSH_PERIOD)
+            flush_probes();
+    }
+
+    static void flush_probes()
+    {
+        total_probe_calls.fetch_add(probe_calls, std::memory_order_relaxed);
+        total_probe_samples.fetch_add(probe_samples, std::memory_order_relaxed);
+        total_probe_sample_time.fetch_add(probe_sample_time, std::memory_order_relaxed);
+        probe_calls = probe_samples = 0;
+        probe_sample_time = 0;
+    }
+
+private:
+    uint64_t start_time;
+};
+
+void juc_thread_end()
+{
+    if(!is_enabled)
+        return;
+    flush_holds();
+    ProbeScope::flush_probes();
+}
+
+void juc_report()
+{
+    if(!is_enabled)
+        return;
+
+    ProbeScope::flush_probes();
+
+    const auto calls = total_probe_calls.load(std::memory_order_relaxed);
+    const auto samples = total_probe_samples.load(std::memory_order_relaxed);
+    const auto sample_time = total_probe_sample_time.load(std::memory_order_relaxed);
+    const double ns_per_call = samples? static_cast<double>(sample_time) / samples : 0.0;
+
+    fprintf(stderr, "sync_jvmti: j.u.c probes ran %llu times, ~%.0fns each (~%.1fms in total)\n",
+            static_cast<unsigned long long>(calls), ns_per_call, ns_per_call * calls / 1e6);
+}
+
+/// Ends an acquisition of `lock` started by `jinnAcquireEnter`, whose key
+/// is `key` if already known, or zero.
+static void end_acquire(jobject lock, int32_t key)
+{
+    const auto curr_time = get_time();
+    if(acquire_start_time == 0)
+        return;
+
+    const auto wait_time = curr_time - acquire_start_time;
+    const bool contended = acquire_parked;
+    acquire_start_time = 0;
+    acquire_parked = false;
+
+    // Acquisitions that never parked are just a failed fast path.
+    if(!contended)
+        return;
+
+    if(key == 0)
+        key = lock_key(lock);
+
+    auto phase_ptr = get_phase();
+    phase_ptr->phase_cs_time.fetch_add(wait_time, std::memory_order_relaxed);
+    phase_ptr->phase_juc_wait_time.fetch_add(wait_time, std::memory_order_relaxed);
+    phase_ptr->phase_juc_contended_count.fetch_add(1, std::memory_order_relaxed);
+
+    const int slot = phase_ptr->find_lock(key);
+    if(slot >= 0)
+        phase_ptr->lock_wait_time[slot].fetch_add(wait_time, std::memory_order_relaxed);
+}
+
+extern "C" {
+
+JNIEXPORT void JNICALL
+Java_java_util_concurrent_locks_AbstractQueuedSynchronizer_jinnAcquireEnter(
+        JNIEnv* env, jclass klass, jobject lock, jobject arg)
+{
+    ProbeScope probe;
+    acquire_start_time = get_time();
+    acquire_parked = false;
+    acquire_key = 0;
+}
+
+JNIEXPORT void JNICALL
+Java_java_util_concurrent_locks_AbstractQueuedSynchronizer_jinnAcquireExit(
+        JNIEnv* env, jclass klass, jobject lock, jobject arg)
+{
+    ProbeScope probe;
+    // The lock was handed to us through `setExclusiveOwnerThread`, unless
+    // the acquisition failed.
+    end_acquire(lock, acquire_key);
+}
+
+JNIEXPORT void JNICALL
+Java_java_util_concurrent_locks_AbstractQueuedSynchronizer_jinnSharedAcquireExit(
+        JNIEnv* env, jclass klass, jobject lock, jobject arg)
+{
+    ProbeScope probe;
+    if(!is_read_lock(env, lock))
+    {
+        end_acquire(lock, 0);
+        return;
+    }
+
+    const auto key = lock_key(lock);
+    end_acquire(lock, key);
+    push_hold(key, get_time());
+}
+
+JNIEXPORT void JNICALL
+Java_java_util_concurrent_locks_AbstractQueuedSynchronizer_jinnSharedTryAcquireExit(
+        JNIEnv* env, jclass klass, jobject lock, jobject arg)
+{
+    ProbeScope probe;
+    if(!is_read_lock(env, lock))
+    {
+        end_acquire(lock, 0);
+        return;
+    }
+
+    // The acquisition may have been interrupted or timed out, in which case
+    // the thread does not hold the lock any more times than before.
+    const auto key = lock_key(lock);
+    end_acquire(lock, key);
+    if(holds_read_lock(env, lock, key))
+        push_hold(key, get_time());
+}
+
+JNIEXPORT void JNICALL
+Java_java_util_concurrent_locks_AbstractQueuedSynchronizer_jinnSharedRelease(
+        JNIEnv* env, jclass klass, jobject lock, jobject arg)
+{
+    ProbeScope probe;
+    if(is_read_lock(env, lock))
+        pop_hold(lock_key(lock), get_time());
+}
+
+JNIEXPORT void JNICALL
+Java_java_util_concurrent_locks_AbstractOwnableSynchronizer_jinnOwner(
+        JNIEnv* env, jclass klass, jobject lock, jobject owner)
+{
+    ProbeScope probe;
+    const auto key = lock_key(lock);
+    if(owner != nullptr)
+    {
+        if(acquire_start_time != 0)
+            acquire_key = key;
+        push_hold(key, get_time());
+    }
+    else
+    {
+        pop_hold(key, get_time());
+    }
+}
+
+}
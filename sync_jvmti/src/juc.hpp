@@ -0,0 +1,31 @@
+#pragma once
+#include <jvmti.h>
+
+/// Initialises the j.u.c lock instrumentation.
+///
+/// Returns whether it is enabled (see `JINN_JUC_PROBES`), in which case the
+/// agent must deliver ClassFileLoadHook events to `juc_transform`.
+extern bool juc_init(jvmtiEnv* jvmti);
+
+/// Whether j.u.c locks are instrumented.
+extern bool juc_enabled();
+
+/// Instruments `AbstractQueuedSynchronizer` and `AbstractOwnableSynchronizer`
+/// as they are loaded. Other classes are left untouched.
+///
+/// Returns whether the class was transformed into `new_data`.
+extern bool juc_transform(jvmtiEnv* jvmti, const char* name,
+                          const unsigned char* data, jint size,
+                          jint* new_size, unsigned char** new_data);
+
+/// Tells a park of the calling thread is about to happen, and whether it
+/// happens while acquiring a j.u.c lock (whose wait is then accounted as
+/// contention instead of parking).
+extern bool juc_park_in_acquire();
+
+/// Flushes the lock statistics buffered by the calling thread.
+extern void juc_thread_end();
+
+/// Reports the number of probes run and the estimated cost of their native
+/// bodies.
+extern void juc_report();
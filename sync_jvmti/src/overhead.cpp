@@ -0,0 +1,93 @@
+#include "overhead.hpp"
+#include "phase.hpp"
+#include "top.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+
+// Overhead of the agent.
+//
+// Operators need to know how much a phase is slowed down by the agent
+// before enabling it on a production JVM. The time spent in the callbacks,
+// the bookkeeping around parks and the j.u.c probes is measured on a sample
+// of the events of each thread (every `JINN_OVERHEAD_SAMPLE`th, if set) and
+// scaled up. Reading the clock on every event would double the cost of the
+// cheapest ones, and even sampled it is not free, so it is opt-in.
+//
+// The estimate is accumulated per phase, which becomes a column of the CSV,
+// and per thread, which is reported along with the totals at VM death.
+// Checkpoints run in a thread of their own and are always timed.
+
+static constexpr int MAX_REPORTED_THREADS = 4;
+
+uint32_t overhead_sample_period;
+thread_local uint32_t overhead_countdown {1};
+thread_local uint64_t overhead_pending {0};
+
+static std::atomic<uint64_t> thread_overhead_time[AtomicPhase::MAX_THREADS];
+static std::atomic<uint64_t> total_checkpoint_time;
+
+void overhead_init()
+{
+    overhead_sample_period = 0;
+    total_checkpoint_time.store(0, std::memory_order_relaxed);
+
+    for(int i = 0; i < AtomicPhase::MAX_THREADS; ++i)
+        thread_overhead_time[i].store(0, std::memory_order_relaxed);
+
+    if(auto s = std::getenv("JINN_OVERHEAD_SAMPLE"))
+        sscanf(s, "%" SCNu32, &overhead_sample_period);
+}
+
+bool overhead_enabled()
+{
+    return overhead_sample_period != 0;
+}
+
+void overhead_add(int thread_id, uint64_t time)
+{
+    if(thread_id < 0 || thread_id >= AtomicPhase::MAX_THREADS)
+        thread_id = 0;
+
+    thread_overhead_time[thread_id].fetch_add(time, std::memory_order_relaxed);
+    overhead_pending += time;
+}
+
+void overhead_add_checkpoint(uint64_t time)
+{
+    total_checkpoint_time.fetch_add(time, std::memory_order_relaxed);
+}
+
+void overhead_report(uint64_t run_time)
+{
+    if(!overhead_enabled())
+        return;
+
+    uint64_t event_time = 0;
+    int top_threads[MAX_REPORTED_THREADS];
+    int num_top_threads = 0;
+
+    for(int i = 0; i < AtomicPhase::MAX_THREADS; ++i)
+    {
+        const auto time = thread_overhead_time[i].load(std::memory_order_relaxed);
+        event_time += time;
+        if(i == 0)
+            continue;
+
+        top_insert(top_threads, num_top_threads, MAX_REPORTED_THREADS, i, time,
+                   [](int thread_id) { return thread_overhead_time[thread_id].load(std::memory_order_relaxed); });
+    }
+
+    const auto checkpoint_time = total_checkpoint_time.load(std::memory_order_relaxed);
+    fprintf(stderr, "sync_jvmti: agent overhead: %.1fms in events, %.1fms in checkpoints (%.3f%% of the application time)\n",
+            event_time / 1e6, checkpoint_time / 1e6,
+            ((event_time + checkpoint_time) / (double) std::max<uint64_t>(1, run_time)) * 100);
+
+    for(int i = 0; i < num_top_threads; ++i)
+    {
+        fprintf(stderr, "sync_jvmti: agent overhead on thread %d: %.1fms\n", top_threads[i],
+                thread_overhead_time[top_threads[i]].load(std::memory_order_relaxed) / 1e6);
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include "time.hpp"
+
+/// Every how many agent events (per thread) one is timed, or zero if the
+/// overhead of the agent is not accounted.
+extern uint32_t overhead_sample_period;
+
+/// Countdown to the next event timed by the calling thread.
+extern thread_local uint32_t overhead_countdown;
+
+/// Overhead of the calling thread not yet charged to a phase.
+extern thread_local uint64_t overhead_pending;
+
+/// Initialises the overhead accounting (see `JINN_OVERHEAD_SAMPLE`).
+extern void overhead_init();
+
+/// Whether the overhead of the agent is being accounted.
+extern bool overhead_enabled();
+
+/// Accounts `time` spent by the agent on behalf of the thread `thread_id`
+/// (zero for threads we do not track), which must be the calling thread.
+///
+/// The time is charged to a phase the next time the thread holds one (see
+/// `AtomicPhase::record_cpu`), as taking the phase again here would cost
+/// about as much as the rest of a cheap event.
+extern void overhead_add(int thread_id, uint64_t time);
+
+/// Accounts `time` spent running a checkpoint.
+extern void overhead_add_checkpoint(uint64_t time);
+
+/// Reports the total overhead, relative to the time the application ran.
+extern void overhead_report(uint64_t run_time);
+
+/// Tells whether the calling thread should time its current event.
+inline bool overhead_sampled()
+{
+    if(overhead_sample_period == 0 || --overhead_countdown != 0)
+        return false;
+    overhead_countdown = overhead_sample_period;
+    return true;
+}
+
+/// Times the enclosing scope on a sample of the calls, and accounts it as
+/// overhead of the agent once the scope ends.
+class OverheadScope
+{
+public:
+    explicit OverheadScope(const int& thread_id) :
+        thread_id(thread_id), start_time(overhead_sampled()? get_time() : 0)
+    {}
+
+    OverheadScope(const OverheadScope&) = delete;
+    OverheadScope& operator=(const OverheadScope&) = delete;
+
+    ~OverheadScope()
+    {
+        if(start_time)
+        {
+            const auto time = get_time() - start_time;
+            overhead_add(thread_id, (time > excluded_time? time - excluded_time : 0)
+                                    * overhead_sample_period);
+        }
+    }
+
+    /// Excludes `time` of the scope that was not spent by the agent.
+    void exclude(uint64_t time)
+    {
+        excluded_time += time;
+    }
+
+private:
+    const int& thread_id;
+    uint64_t start_time;
+    uint64_t excluded_time = 0;
+};
@@ -1,5 +1,8 @@
 #include "perf.hpp"
+#include "phase.hpp"
+#include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -22,89 +25,339 @@ constexpr int MAX_PROCESSORS = 8;
 /// Number of software counters to collect.
 constexpr int NUM_SOFTWARE_COUNTERS = 2;
 
+/// Number of kernel-mode twins (cycles and instructions) when split.
+constexpr int NUM_KERNEL_COUNTERS = 2;
+
 struct PerfEvent
 {
     int fd;
     uint64_t id;
     uint64_t prev_value;
+    uint64_t prev_enabled;  //< group leader only, if scaled
+    uint64_t prev_running;  //< group leader only, if scaled
+};
+
+/// States of the per-thread counters slots.
+///
+/// A slot goes live when its thread opens its counters, dead when the
+/// thread ends, and free once the checkpoint has read and closed them.
+constexpr uint8_t SLOT_FREE = 0;
+constexpr uint8_t SLOT_LIVE = 1;
+constexpr uint8_t SLOT_DEAD = 2;
+
+/// Hardware events of each group, and their kernel-mode twins.
+static const uint64_t hw_configs[MAX_EVENTS_PER_GROUP] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+static const uint64_t kernel_configs[NUM_KERNEL_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
 };
 
 static PerfEvent perf_cpu[MAX_PROCESSORS][MAX_EVENTS_PER_GROUP];
 static PerfEvent perf_sw[NUM_SOFTWARE_COUNTERS];
+static PerfEvent perf_kernel[MAX_PROCESSORS][NUM_KERNEL_COUNTERS];
 static int num_processors;
 
-void perf_init()
+/// What the hardware events count (see `PerfScope`).
+static PerfScope scope;
+
+/// Whether hardware events could be opened at all in the scope.
+static bool hw_available;
+
+/// Per-thread groups, indexed by thread id, in the thread scope.
+static PerfEvent perf_thread[AtomicPhase::MAX_THREADS][MAX_EVENTS_PER_GROUP];
+static PerfEvent perf_thread_kernel[AtomicPhase::MAX_THREADS][NUM_KERNEL_COUNTERS];
+static std::atomic<uint8_t> thread_slot_state[AtomicPhase::MAX_THREADS];
+
+/// Whether any thread could be counted, in the thread scope.
+static std::atomic<bool> any_thread_counted;
+
+/// Counts of the threads attributed to each CPU but not consumed yet, in
+/// the thread scope.
+static uint64_t thread_hw_sum[MAX_PROCESSORS][MAX_EVENTS_PER_GROUP];
+static uint64_t thread_kernel_sum[MAX_PROCESSORS][NUM_KERNEL_COUNTERS];
+
+/// Whether kernel mode is counted apart from user mode. The kernel twins
+/// compete with the user group for the same counters, so the hardware
+/// groups are then scaled by their enabled and running times.
+static bool count_split;
+
+/// Consumes the group led by `events[0]` into `counters`, matching values
+/// by id (PERF_FORMAT_ID). A scaled group also reads its enabled and running
+/// times, and its deltas are extrapolated to the whole period when the
+/// kernel had to multiplex it.
+static void consume_group(PerfEvent* events, int num_events, bool scaled,
+                          uint64_t* counters, const char* what)
 {
-    auto perf_event_open = [](struct perf_event_attr *hw_event, pid_t pid,
-                               int cpu, int group_fd, unsigned long flags) {
-        return syscall(__NR_perf_event_open, hw_event, pid, cpu,
-                       group_fd, flags);
-    };
+    // nr, [time_enabled, time_running], then {value, id} per event.
+    uint64_t data[3 + 2 * MAX_EVENTS_PER_GROUP];
+
+    for(int pi = 0; pi < num_events; ++pi)
+        counters[pi] = -1;
+
+    if(events[0].fd == -1)
+        return;
+
+    if(read(events[0].fd, data, sizeof(data)) == -1)
+    {
+        fprintf(stderr, "sync_jvmti: failed to read %s counters: %s\n", what, strerror(errno));
+        abort();
+    }
+
+    const uint64_t nr = data[0];
+    const uint64_t* values = &data[scaled? 3 : 1];
+
+    double scale = 1.0;
+    if(scaled)
+    {
+        const uint64_t enabled = data[1] - events[0].prev_enabled;
+        const uint64_t running = data[2] - events[0].prev_running;
+        events[0].prev_enabled = data[1];
+        events[0].prev_running = data[2];
+        if(running > 0 && running < enabled)
+            scale = double(enabled) / running;
+    }
+
+    for(uint64_t s = 0; s < nr; ++s)
+    {
+        const auto value = values[2 * s];
+        const auto id = values[2 * s + 1];
+        for(int pi = 0; pi < num_events; ++pi)
+        {
+            if(id == events[pi].id)
+            {
+                const auto prev_value = events[pi].prev_value;
+                const auto u64_max = std::numeric_limits<uint64_t>::max();
 
+                if(value >= prev_value)
+                {
+                    counters[pi] = value - prev_value;
+                }
+                else
+                {
+                    counters[pi] = 0;
+                    counters[pi] += u64_max - prev_value;
+                    counters[pi] += value;
+                }
+
+                counters[pi] = uint64_t(counters[pi] * scale);
+                events[pi].prev_value = value;
+            }
+        }
+    }
+}
+
+static long perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
+                            int cpu, int group_fd, unsigned long flags)
+{
+    return syscall(__NR_perf_event_open, hw_event, pid, cpu, group_fd, flags);
+}
+
+/// Marks the events of a group as not open.
+static void clear_group(PerfEvent* events, int num_events)
+{
+    for(int i = 0; i < num_events; ++i)
+    {
+        events[i].fd = -1;
+        events[i].id = -1;
+        events[i].prev_value = 0;
+        events[i].prev_enabled = 0;
+        events[i].prev_running = 0;
+    }
+}
+
+static void close_group(PerfEvent* events, int num_events)
+{
+    for(int i = 0; i < num_events; ++i)
+    {
+        if(events[i].fd != -1)
+            close(events[i].fd);
+    }
+    clear_group(events, num_events);
+}
+
+/// Opens and enables a group of hardware events counting `pid` on `cpu`.
+///
+/// User mode is counted unless `kernel` is set, in which case only kernel
+/// mode is. On failure nothing is left open and errno tells why.
+static bool open_hw_group(PerfEvent* events, const uint64_t* configs, int num_events,
+                          bool kernel, pid_t pid, int cpu, bool inherit)
+{
+    for(int i = 0; i < num_events; ++i)
+    {
+        struct perf_event_attr pe;
+        memset(&pe, 0, sizeof(pe));
+        pe.size = sizeof(pe);
+        pe.type = PERF_TYPE_HARDWARE;
+        pe.config = configs[i];
+        pe.exclude_hv = true;
+        pe.exclude_kernel = !kernel;
+        pe.exclude_user = kernel;
+        pe.disabled = true;
+        pe.inherit = inherit;
+        pe.read_format = PERF_FORMAT_ID | PERF_FORMAT_GROUP | (count_split?
+            PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING : 0);
+
+        const int group_fd = (i == 0)? -1 : events[0].fd;
+        const auto fd = perf_event_open(&pe, pid, cpu, group_fd, 0);
+        if(fd == -1)
+        {
+            const int saved_errno = errno;
+            close_group(events, i);
+            errno = saved_errno;
+            return false;
+        }
+
+        events[i].fd = fd;
+        ioctl(fd, PERF_EVENT_IOC_ID, &events[i].id);
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        events[i].prev_value = 0;
+        events[i].prev_enabled = 0;
+        events[i].prev_running = 0;
+    }
+
+    ioctl(events[0].fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+/// Opens the hardware groups (and their kernel twins) of `pid` on `cpu`.
+static bool open_hw_groups(PerfEvent* events, PerfEvent* kernel_events,
+                           pid_t pid, int cpu, bool inherit)
+{
+    if(!open_hw_group(events, hw_configs, MAX_EVENTS_PER_GROUP, false, pid, cpu, inherit))
+        return false;
+
+    if(count_split && !open_hw_group(kernel_events, kernel_configs, NUM_KERNEL_COUNTERS,
+                                     true, pid, cpu, inherit))
+    {
+        const int saved_errno = errno;
+        close_group(events, MAX_EVENTS_PER_GROUP);
+        errno = saved_errno;
+        return false;
+    }
+
+    return true;
+}
+
+/// Opens the per-CPU hardware groups of the current scope (system or
+/// process). On failure nothing is left open and errno tells why.
+static bool open_cpu_groups()
+{
+    const pid_t pid = (scope == PERF_SCOPE_SYSTEM)? -1 : 0;
+    const bool inherit = (scope == PERF_SCOPE_PROCESS);
+
+    for(int cpu = 0; cpu < num_processors; ++cpu)
+    {
+        if(!open_hw_groups(perf_cpu[cpu], perf_kernel[cpu], pid, cpu, inherit))
+        {
+            const int saved_errno = errno;
+            for(int i = 0; i < cpu; ++i)
+            {
+                close_group(perf_cpu[i], MAX_EVENTS_PER_GROUP);
+                close_group(perf_kernel[i], NUM_KERNEL_COUNTERS);
+            }
+            errno = saved_errno;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void perf_init()
+{
     num_processors = get_nprocs_conf();
     assert(num_processors <= MAX_PROCESSORS);
     
     fprintf(stderr, "sync_jvmti: detected %d processors\n", num_processors);
 
-    for(int cpu = 0; cpu < num_processors; ++cpu)
+    count_split = false;
+    if(auto s = std::getenv("JINN_PERF_COUNT_MODE"))
     {
-        for(int i = 0; i < MAX_EVENTS_PER_GROUP; ++i)
+        if(!strcmp(s, "split"))
+        {
+            count_split = true;
+            fprintf(stderr, "sync_jvmti: Counting kernel mode apart from user mode.\n");
+        }
+        else if(strcmp(s, "user"))
         {
-            uint64_t config;
-            int group_fd;
+            fprintf(stderr, "sync_jvmti: Unrecognized JINN_PERF_COUNT_MODE: %s\n", s);
+        }
+    }
 
-            switch(i)
-            {
-                case 0:
-		    config = PERF_COUNT_HW_CPU_CYCLES;
-		    group_fd = -1;
-		    break;
-                case 1:
-		    config = PERF_COUNT_HW_INSTRUCTIONS;
-		    group_fd = perf_cpu[cpu][0].fd;
-		    break;
-                case 2:
-		    config = PERF_COUNT_HW_CACHE_MISSES;
-		    group_fd = perf_cpu[cpu][0].fd;
-		    break;
-		case 3:
-		    config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS;
-		    group_fd = perf_cpu[cpu][0].fd;
-		    break;
-		case 4:
-		    config = PERF_COUNT_HW_BRANCH_MISSES;
-		    group_fd = perf_cpu[cpu][0].fd;
-		    break;
-                default:
-		    perf_cpu[cpu][i].fd = -1;
-		    perf_cpu[cpu][i].id = -1;
-		    continue;
-            }
+    // Without an explicit scope, system-wide counting is attempted first.
+    bool scope_is_explicit = false;
+    scope = PERF_SCOPE_SYSTEM;
+    if(auto s = std::getenv("JINN_PERF_SCOPE"))
+    {
+        scope_is_explicit = true;
+        if(!strcmp(s, "system"))
+            scope = PERF_SCOPE_SYSTEM;
+        else if(!strcmp(s, "process"))
+            scope = PERF_SCOPE_PROCESS;
+        else if(!strcmp(s, "thread"))
+            scope = PERF_SCOPE_THREAD;
+        else
+        {
+            fprintf(stderr, "sync_jvmti: Unrecognized JINN_PERF_SCOPE: %s\n", s);
+            scope_is_explicit = false;
+        }
+    }
 
-            struct perf_event_attr pe;
-            memset(&pe, 0, sizeof(pe));
-            pe.size = sizeof(pe);
-            pe.type = PERF_TYPE_HARDWARE;
-            pe.config = config;
-            pe.exclude_hv = true;
-            pe.exclude_kernel = true;
-            pe.disabled = true;
-            pe.read_format = PERF_FORMAT_ID | PERF_FORMAT_GROUP;
-
-            const auto fd = perf_event_open(&pe, -1, cpu, group_fd, 0);
-            if(fd == -1)
-            {
-                perror("sync_jvmti: failed to initialise perf");
-                abort();
-            }
+    for(int cpu = 0; cpu < MAX_PROCESSORS; ++cpu)
+    {
+        clear_group(perf_cpu[cpu], MAX_EVENTS_PER_GROUP);
+        clear_group(perf_kernel[cpu], NUM_KERNEL_COUNTERS);
+        for(int i = 0; i < MAX_EVENTS_PER_GROUP; ++i)
+            thread_hw_sum[cpu][i] = 0;
+        for(int i = 0; i < NUM_KERNEL_COUNTERS; ++i)
+            thread_kernel_sum[cpu][i] = 0;
+    }
+
+    for(int t = 0; t < AtomicPhase::MAX_THREADS; ++t)
+    {
+        clear_group(perf_thread[t], MAX_EVENTS_PER_GROUP);
+        clear_group(perf_thread_kernel[t], NUM_KERNEL_COUNTERS);
+        thread_slot_state[t].store(SLOT_FREE, std::memory_order_relaxed);
+    }
+
+    clear_group(perf_sw, NUM_SOFTWARE_COUNTERS);
+    any_thread_counted.store(false, std::memory_order_relaxed);
 
-            perf_cpu[cpu][i].fd = fd;
-            ioctl(fd, PERF_EVENT_IOC_ID, &perf_cpu[cpu][i].id);
-            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
-            perf_cpu[cpu][i].prev_value = 0;
+    hw_available = true;
+    if(scope != PERF_SCOPE_THREAD && !open_cpu_groups())
+    {
+        // Counting other processes needs CAP_PERFMON (or root) or a
+        // perf_event_paranoid of at most 0, which is rarely the case. The
+        // JVM itself can still be counted.
+        if(!scope_is_explicit && (errno == EACCES || errno == EPERM))
+        {
+            fprintf(stderr, "sync_jvmti: System-wide counting denied, counting this process only.\n");
+            scope = PERF_SCOPE_PROCESS;
+            hw_available = open_cpu_groups();
+        }
+        else
+        {
+            hw_available = false;
         }
     }
 
+    if(!hw_available)
+    {
+        perror("sync_jvmti: Hardware counters disabled");
+    }
+    else
+    {
+        fprintf(stderr, "sync_jvmti: Counting hardware events %s.\n",
+                (scope == PERF_SCOPE_SYSTEM)? "system-wide" :
+                (scope == PERF_SCOPE_PROCESS)? "for this process" : "per thread");
+    }
+
     for(int i = 0; i < NUM_SOFTWARE_COUNTERS; ++i)
     {
 	uint64_t config;
@@ -134,13 +387,15 @@ void perf_init()
 	pe.exclude_hv = true;
 	pe.exclude_kernel = false;
 	pe.disabled = true;
+	pe.inherit = true;  // the threads the JVM creates from now on
 	pe.read_format = PERF_FORMAT_ID | PERF_FORMAT_GROUP;
 
 	const auto fd = perf_event_open(&pe, 0, -1, group_fd, 0);
 	if(fd == -1)
 	{
-	    perror("sync_jvmti: failed to initialise perf");
-	    abort();
+	    perror("sync_jvmti: Software counters disabled");
+	    close_group(perf_sw, i);
+	    break;
 	}
 
 	perf_sw[i].fd = fd;
@@ -149,13 +404,7 @@ void perf_init()
 	perf_sw[i].prev_value = 0;
     }
 
-    for(int cpu = 0; cpu < num_processors; ++cpu)
-    {
-        const auto leader_fd = perf_cpu[cpu][0].fd;
-        ioctl(leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
-    }
-
-    if(true)
+    if(perf_sw[0].fd != -1)
     {
         const auto leader_fd = perf_sw[0].fd;
         ioctl(leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
@@ -166,85 +415,136 @@ void perf_shutdown()
 {
     for(int cpu = 0; cpu < num_processors; ++cpu)
     {
-        for(int i = 0; i < MAX_EVENTS_PER_GROUP; ++i)
+        close_group(perf_cpu[cpu], MAX_EVENTS_PER_GROUP);
+        close_group(perf_kernel[cpu], NUM_KERNEL_COUNTERS);
+    }
+
+    for(int t = 0; t < AtomicPhase::MAX_THREADS; ++t)
+    {
+        if(thread_slot_state[t].load(std::memory_order_acquire) != SLOT_FREE)
         {
-            const auto fd = perf_cpu[cpu][i].fd;
-            if(fd != -1)
-            {
-                close(perf_cpu[cpu][i].fd);
-                perf_cpu[cpu][i].fd = -1;
-                perf_cpu[cpu][i].id = -1;
-                perf_cpu[cpu][i].prev_value = 0;
-            }
+            close_group(perf_thread[t], MAX_EVENTS_PER_GROUP);
+            close_group(perf_thread_kernel[t], NUM_KERNEL_COUNTERS);
+            thread_slot_state[t].store(SLOT_FREE, std::memory_order_relaxed);
         }
     }
 
-    for(int i = 0; i < NUM_SOFTWARE_COUNTERS; ++i)
+    close_group(perf_sw, NUM_SOFTWARE_COUNTERS);
+}
+
+void perf_thread_start(int thread_id)
+{
+    if(scope != PERF_SCOPE_THREAD || !hw_available)
+        return;
+
+    assert(thread_id > 0 && thread_id < AtomicPhase::MAX_THREADS);
+
+    if(!open_hw_groups(perf_thread[thread_id], perf_thread_kernel[thread_id], 0, -1, false))
     {
-	close(perf_sw[i].fd);
-	perf_sw[i].fd = -1;
-	perf_sw[i].id = -1;
-	perf_sw[i].prev_value = 0;
+        static std::atomic_flag reported = ATOMIC_FLAG_INIT;
+        if(!reported.test_and_set())
+            perror("sync_jvmti: failed to count thread");
+        return;
     }
+
+    // Publishes the descriptors to the checkpoint.
+    thread_slot_state[thread_id].store(SLOT_LIVE, std::memory_order_release);
+    any_thread_counted.store(true, std::memory_order_relaxed);
 }
 
-int perf_nprocs()
+void perf_thread_end(int thread_id)
 {
-    return num_processors;
+    if(thread_id <= 0 || thread_id >= AtomicPhase::MAX_THREADS)
+        return;
+
+    // The counters are closed by the checkpoint after their last read, so
+    // it never reads a descriptor that was closed (or reused) under it.
+    uint8_t expected = SLOT_LIVE;
+    thread_slot_state[thread_id].compare_exchange_strong(expected, SLOT_DEAD,
+                                                         std::memory_order_relaxed);
 }
 
-auto perf_consume_hw(int cpu) -> PerfHardwareData
+void perf_attribute_threads(const uint8_t* thread_cpu, int max_threads)
 {
-    struct
+    if(scope != PERF_SCOPE_THREAD)
+        return;
+
+    for(int t = 1; t <= max_threads && t < AtomicPhase::MAX_THREADS; ++t)
     {
-        uint64_t nr;    /* The number of events */
-        struct {
-            uint64_t value; /* The value of the event */
-            uint64_t id;    /* if PERF_FORMAT_ID */
-        } values[MAX_EVENTS_PER_GROUP];
-    } data;
+        const auto state = thread_slot_state[t].load(std::memory_order_acquire);
+        if(state == SLOT_FREE)
+            continue;
 
-    assert(cpu < num_processors);
+        const int cpu = (thread_cpu[t] < num_processors)? thread_cpu[t] : 0;
+
+        uint64_t counters[MAX_EVENTS_PER_GROUP];
+        uint64_t kernel_counters[NUM_KERNEL_COUNTERS];
+        consume_group(perf_thread[t], MAX_EVENTS_PER_GROUP, count_split, counters, "thread");
+        consume_group(perf_thread_kernel[t], NUM_KERNEL_COUNTERS, count_split, kernel_counters, "thread kernel");
 
-    const auto fd = perf_cpu[cpu][0].fd;
+        for(int i = 0; i < MAX_EVENTS_PER_GROUP; ++i)
+        {
+            if(counters[i] != uint64_t(-1))
+                thread_hw_sum[cpu][i] += counters[i];
+        }
 
-    if(fd == -1)
-        return PerfHardwareData{};
+        for(int i = 0; i < NUM_KERNEL_COUNTERS; ++i)
+        {
+            if(kernel_counters[i] != uint64_t(-1))
+                thread_kernel_sum[cpu][i] += kernel_counters[i];
+        }
 
-    if(read(fd, &data, sizeof(data)) == -1)
-    {
-        perror("sync_jvmti: failed to read hardware counters");
-        abort();
+        if(state == SLOT_DEAD)
+        {
+            close_group(perf_thread[t], MAX_EVENTS_PER_GROUP);
+            close_group(perf_thread_kernel[t], NUM_KERNEL_COUNTERS);
+            thread_slot_state[t].store(SLOT_FREE, std::memory_order_relaxed);
+        }
     }
+}
 
-    uint64_t counters[MAX_EVENTS_PER_GROUP];
-    memset(counters, -1, sizeof(counters));
+int perf_nprocs()
+{
+    return num_processors;
+}
+
+bool perf_split_enabled()
+{
+    return count_split;
+}
+
+auto perf_scope() -> PerfScope
+{
+    return scope;
+}
 
-    for(uint64_t s = 0; s < data.nr; ++s)
+auto perf_consume_hw(int cpu) -> PerfHardwareData
+{
+    assert(cpu < num_processors);
+
+    uint64_t counters[MAX_EVENTS_PER_GROUP];
+    uint64_t kernel_counters[NUM_KERNEL_COUNTERS];
+    if(scope == PERF_SCOPE_THREAD)
     {
-        for(int pi = 0; pi < MAX_EVENTS_PER_GROUP; ++pi)
-        {
-            if(data.values[s].id == perf_cpu[cpu][pi].id)
-            {
-                const auto value = data.values[s].value;
-                const auto prev_value = perf_cpu[cpu][pi].prev_value;
-                const auto u64_max = std::numeric_limits<uint64_t>::max();
+        const bool counted = any_thread_counted.load(std::memory_order_relaxed);
 
-                if(value >= prev_value)
-                {
-                    counters[pi] = value - prev_value;
-                }
-                else
-                {
-                    counters[pi] = 0;
-                    counters[pi] += u64_max - prev_value;
-                    counters[pi] += value;
-                }
+        for(int i = 0; i < MAX_EVENTS_PER_GROUP; ++i)
+        {
+            counters[i] = counted? thread_hw_sum[cpu][i] : -1;
+            thread_hw_sum[cpu][i] = 0;
+        }
 
-                perf_cpu[cpu][pi].prev_value = value;
-            }
+        for(int i = 0; i < NUM_KERNEL_COUNTERS; ++i)
+        {
+            kernel_counters[i] = (counted && count_split)? thread_kernel_sum[cpu][i] : -1;
+            thread_kernel_sum[cpu][i] = 0;
         }
     }
+    else
+    {
+        consume_group(perf_cpu[cpu], MAX_EVENTS_PER_GROUP, count_split, counters, "hardware");
+        consume_group(perf_kernel[cpu], NUM_KERNEL_COUNTERS, count_split, kernel_counters, "kernel");
+    }
 
     return PerfHardwareData {
         counters[0],
@@ -252,59 +552,15 @@ auto perf_consume_hw(int cpu) -> PerfHardwareData
         counters[2],
         counters[3],
 	counters[4],
+        kernel_counters[0],
+        kernel_counters[1],
     };
 }
 
 auto perf_consume_sw() -> PerfSoftwareData
 {
-    struct
-    {
-        uint64_t nr;    /* The number of events */
-        struct {
-            uint64_t value; /* The value of the event */
-            uint64_t id;    /* if PERF_FORMAT_ID */
-        } values[NUM_SOFTWARE_COUNTERS];
-    } data;
-
-    const auto fd = perf_sw[0].fd;
-
-    if(fd == -1)
-        return PerfSoftwareData{};
-
-    if(read(fd, &data, sizeof(data)) == -1)
-    {
-        perror("sync_jvmti: failed to read software counters");
-        abort();
-    }
-
     uint64_t counters[NUM_SOFTWARE_COUNTERS];
-    memset(counters, -1, sizeof(counters));
-
-    for(uint64_t s = 0; s < data.nr; ++s)
-    {
-        for(int pi = 0; pi < NUM_SOFTWARE_COUNTERS; ++pi)
-        {
-            if(data.values[s].id == perf_sw[pi].id)
-            {
-                const auto value = data.values[s].value;
-                const auto prev_value = perf_sw[pi].prev_value;
-                const auto u64_max = std::numeric_limits<uint64_t>::max();
-
-                if(value >= prev_value)
-                {
-                    counters[pi] = value - prev_value;
-                }
-                else
-                {
-                    counters[pi] = 0;
-                    counters[pi] += u64_max - prev_value;
-                    counters[pi] += value;
-                }
-
-                perf_sw[pi].prev_value = value;
-            }
-        }
-    }
+    consume_group(perf_sw, NUM_SOFTWARE_COUNTERS, false, counters, "software");
 
     return PerfSoftwareData {
         counters[0],
@@ -16,9 +16,24 @@ struct PerfHardwareData
     uint64_t cache_misses = -1;
     uint64_t branch_instructions = -1;
     uint64_t branch_misses = -1;
+    uint64_t kernel_cycles = -1;        //< only if counting is split
+    uint64_t kernel_instructions = -1;  //< only if counting is split
+};
+
+/// What the hardware events count.
+enum PerfScope
+{
+    PERF_SCOPE_SYSTEM,   //< every process, per CPU (needs privileges)
+    PERF_SCOPE_PROCESS,  //< this process and the threads it creates, per CPU
+    PERF_SCOPE_THREAD,   //< each Java thread, attributed to its last CPU
 };
 
 /// Initialises the performance counting subsystem.
+///
+/// The scope is taken from `JINN_PERF_SCOPE` (system, process or thread).
+/// Without it, system-wide counting is attempted and the process scope is
+/// used when that is denied. Counters that cannot be opened at all are
+/// reported as -1.
 extern void perf_init();
 
 /// Shutdowns the performance counting subsystem.
@@ -27,6 +42,30 @@ extern void perf_shutdown();
 /// Gets the number of processors configured on the system (even if offline).
 extern int perf_nprocs();
 
+/// Whether kernel mode is counted apart from user mode.
+///
+/// Hardware events only count user mode by default. With
+/// `JINN_PERF_COUNT_MODE=split`, cycles and instructions are also counted
+/// in kernel mode only.
+extern bool perf_split_enabled();
+
+/// Gets the scope of the hardware events.
+extern auto perf_scope() -> PerfScope;
+
+/// Opens the counters of the calling thread, in the thread scope.
+///
+/// Thread ids are the ones allocated by `phase_alloc_thread`.
+extern void perf_thread_start(int thread_id);
+
+/// Tells the counters of the calling thread are no longer needed, in the
+/// thread scope. They are closed once read by the checkpoint.
+extern void perf_thread_end(int thread_id);
+
+/// Reads the counters of every thread and attributes them to the CPU each
+/// one last ran on (`thread_cpu[thread_id]`), to be consumed by
+/// `perf_consume_hw`. Does nothing outside the thread scope.
+extern void perf_attribute_threads(const uint8_t* thread_cpu, int max_threads);
+
 /// Consumes the hardware performance counters regarding the specified
 /// CPU index.
 ///
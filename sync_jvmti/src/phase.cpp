@@ -8,9 +8,17 @@
 #include <shared_mutex>
 #include <unistd.h>
 #include <sched.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include "phase.hpp"
+#include "convoy.hpp"
+#include "juc.hpp"
+#include "overhead.hpp"
 #include "perf.hpp"
+#include "roles.hpp"
 #include "time.hpp"
+#include "top.hpp"
 
 using std::memory_order_acquire;
 using std::memory_order_release;
@@ -42,7 +50,7 @@ static void phase_checkpoint_safe(AtomicPhase*, uint64_t curr_time);
 // to the next one.
 //
 // We want to measure contention on each phase. How to do this efficiently
-// with no extra synchronizations, threads, signals, etc?
+// with no extra synchronizations in the application threads?
 //
 // We use a data structure to accumulate all information about a phase.
 // Any thread owning a reference to this structure is said to be a mutator of
@@ -101,6 +109,12 @@ static void phase_checkpoint_safe(AtomicPhase*, uint64_t curr_time);
 // I know, not simple, but fast and beautiful. This achieves our third
 // goal of not introducing any more contention. We want to measure contention,
 // more contention would disturb the measurements.
+//
+// Finally, the checkpoint itself (taking the writer lock, waiting for the
+// mutators and printing the phase) must not run in a mutator, or it would
+// delay the very thread being measured. The checkpoint runs in a thread of
+// our own. A mutator that notices the phase expired only flips a flag and
+// wakes it through a futex, and only the first one to notice does so.
 
 static std::shared_timed_mutex phase_mutex;
 static AtomicPhase phase_buffer[2];
@@ -123,9 +137,35 @@ static uint64_t total_wait_time;
 /// The total time of the application spent parked.
 static uint64_t total_park_time;
 
+/// The total time the application spent paused by the garbage collector.
+static uint64_t total_gc_pause_time;
+
+/// The total number of garbage collection pauses.
+static uint64_t total_gc_count;
+
+/// The total time virtual threads pinned their carriers while blocked.
+static uint64_t total_pinned_time;
+
+/// The total time spent waiting for and holding j.u.c locks.
+static uint64_t total_juc_wait_time;
+static uint64_t total_juc_hold_time;
+
+/// The total running time of the application (see `phase_accum_time`).
+static uint64_t total_accum_time;
+
+/// The time the previous checkpoint took to run. It ran during the
+/// current phase.
+static uint64_t prev_checkpoint_time;
+
 /// The number of threads seen on the previous phase.
 static int32_t prev_phase_thread_count;
 
+/// The number of virtual threads alive on the previous phase.
+static int32_t prev_phase_vthread_count;
+
+/// The number of carriers of virtual threads seen on the previous phase.
+static int32_t prev_phase_carrier_count;
+
 /// The state of the running thread.
 ///
 /// See `AtomicPhase::THREAD_STATE_*` constants for details. Note the value on
@@ -147,10 +187,16 @@ static uint64_t app_start_time;
 static FILE* csv_stream;
 
 /// Sometimes, we want to profile over fixed periods of time (instead of
-/// relying on JVMTI events), so we use a thread for this.
+/// relying on JVMTI events), in which case the checkpoint thread also wakes
+/// up by itself once each phase expires.
 static bool use_fixed_intervals;
-static std::thread profiler_thread;
-static std::atomic<bool> profiler_thread_kill;
+
+/// The thread running the checkpoints.
+static std::thread checkpoint_thread;
+static std::atomic<bool> checkpoint_thread_kill;
+
+/// Futex word set by the mutators to request a checkpoint.
+static std::atomic<uint32_t> checkpoint_requested;
 
 void phase_init()
 {
@@ -161,12 +207,24 @@ void phase_init()
     phase_buf_index = 0;
     phase_buffer[0].reset();
     phase_buffer[1].reset();
+    phase_buffer[0].phase_number = 0;
+    phase_buffer[1].phase_number = 1;
 
     total_cs_time = 0;
+    total_accum_time = 0;
+    prev_checkpoint_time = 0;
     total_wait_time = 0;
     total_park_time = 0;
+    total_gc_pause_time = 0;
+    total_gc_count = 0;
+
+    total_pinned_time = 0;
+    total_juc_wait_time = 0;
+    total_juc_hold_time = 0;
 
     prev_phase_thread_count = 0;
+    prev_phase_vthread_count = 0;
+    prev_phase_carrier_count = 0;
 
     for(int i = 0; i < AtomicPhase::MAX_THREADS; ++i)
     {
@@ -181,8 +239,8 @@ void phase_init()
     use_fixed_intervals = false;
     phase_duration = 50;
 
-    phase_init_settings();
     perf_init();
+    phase_init_settings();
 
     // Must be the last statement in this function. This should
     // fence the execution of the memory operations above.
@@ -202,7 +260,17 @@ void phase_init_settings()
     else
     {
         fprintf(stderr, "sync_jvmti: Printing to CSV file %s\n", csvname);
-        fprintf(csv_stream, "Elapsed Time (ms),CSP (%%),Num Threads,Thread State,Thread CPU,CPU Cycles,CPU Instructions,CPU Cache Miss,CPU Branch Instructions,CPU Branch Misses,SW CPU Migrations,SW Context Switches\n");
+        fprintf(csv_stream, "Elapsed Time (ms),CSP (%%),Num Threads,Thread State,Thread CPU,CPU Cycles,CPU Instructions,CPU Cache Miss,CPU Branch Instructions,CPU Branch Misses,SW CPU Migrations,SW Context Switches%s%s%s%s%s%s\n",
+                perf_split_enabled()? ",CPU Kernel Cycles,CPU Kernel Instructions,Kernel Cycles (%),Kernel IPC" : "",
+                roles_enabled()? ",GC Pauses,GC Pause (%),GC CPU (ms),Concurrent GC CPU (ms),JIT CPU (ms)" : "",
+#ifdef JINN_LOOM
+                ",Virtual Threads,Carriers,Carrier Saturation (%),VT Unmounted (ms),Pinned (%),Pinned Blocks",
+#else
+                "",
+#endif
+                juc_enabled()? ",J.U.C Wait (ms),J.U.C Hold (ms),J.U.C Acquires,J.U.C Contended,Hot Locks,Dropped Locks" : "",
+                convoy_enabled()? ",Handoffs,FIFO Handoffs (%),Convoy Handoffs,Max Wait Chain,Long Chains,Dropped Monitors" : "",
+                overhead_enabled()? ",Agent Overhead (%)" : "");
     }
 
     if(auto s = std::getenv("JINN_PHASE_INTERVAL"))
@@ -255,32 +323,65 @@ void phase_vm_init()
 {
     app_start_time = get_time();
 
-    if(use_fixed_intervals)
-    {
-	profiler_thread_kill.store(false);
-	profiler_thread = std::thread([] {
-	    const auto sleep_time = std::chrono::milliseconds(phase_duration);
-	    while(!profiler_thread_kill.load(memory_order_relaxed))
-	    {
-		std::this_thread::sleep_for(sleep_time);
-		phase_checkpoint(get_time());
-	    }
-	});
-    }
+    checkpoint_requested.store(0);
+    checkpoint_thread_kill.store(false);
+    checkpoint_thread = std::thread([] {
+        pthread_setname_np(pthread_self(), "jinn checkpoint");
+
+        while(!checkpoint_thread_kill.load(memory_order_relaxed))
+        {
+            // Sleep until a mutator requests a checkpoint or, with fixed
+            // intervals, until the phase expires.
+            struct timespec timeout = {
+                static_cast<time_t>(phase_duration / 1000),
+                static_cast<long>((phase_duration % 1000) * 1000000)
+            };
+            syscall(SYS_futex, &checkpoint_requested, FUTEX_WAIT_PRIVATE,
+                    0, use_fixed_intervals? &timeout : nullptr, nullptr, 0);
+
+            checkpoint_requested.store(0, memory_order_relaxed);
+
+            const auto curr_time = get_time();
+            if(to_millis(curr_time - ::prev_phase_time.load(memory_order_relaxed)) >= phase_duration)
+                phase_checkpoint_run(curr_time);
+        }
+    });
 }
 
 void phase_vm_die()
 {
-    if(use_fixed_intervals)
+    if(checkpoint_thread.joinable())
     {
-	profiler_thread_kill.store(true);
-	profiler_thread.join();
+        checkpoint_thread_kill.store(true);
+        checkpoint_requested.store(1);
+        syscall(SYS_futex, &checkpoint_requested, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        checkpoint_thread.join();
     }
 
     phase_checkpoint_run(get_time());
     fprintf(stderr, "sync_jvmti: total cs time: %" PRIu64 "ms\n", to_millis(total_cs_time));
     fprintf(stderr, "sync_jvmti: total wait time: %" PRIu64 "ms\n", to_millis(total_wait_time));
     fprintf(stderr, "sync_jvmti: total park time: %" PRIu64 "ms\n", to_millis(total_park_time));
+
+#ifdef JINN_LOOM
+    fprintf(stderr, "sync_jvmti: total pinned time: %" PRIu64 "ms\n", to_millis(total_pinned_time));
+#endif
+
+    if(juc_enabled())
+    {
+        fprintf(stderr, "sync_jvmti: total j.u.c wait time: %" PRIu64 "ms\n", to_millis(total_juc_wait_time));
+        fprintf(stderr, "sync_jvmti: total j.u.c hold time: %" PRIu64 "ms\n", to_millis(total_juc_hold_time));
+    }
+
+    overhead_report(total_accum_time);
+
+    if(roles_enabled())
+    {
+        const auto run_time = std::max<uint64_t>(1, get_time() - app_start_time);
+        fprintf(stderr, "sync_jvmti: total gc pause time: %" PRIu64 "ms in %" PRIu64 " pauses (%.2f%% of the run)\n",
+                to_millis(total_gc_pause_time), total_gc_count,
+                (total_gc_pause_time / (double) run_time) * 100);
+    }
 }
 
 int phase_alloc_thread()
@@ -295,6 +396,12 @@ void AtomicPhase::record_cpu(int thread_id)
     this->phase_cpu_change[thread_id].store(
             1 + sched_getcpu(),
             memory_order_relaxed);
+
+    if(overhead_pending != 0)
+    {
+        this->phase_agent_time.fetch_add(overhead_pending, memory_order_relaxed);
+        overhead_pending = 0;
+    }
 }
 
 void phase_checkpoint(uint64_t curr_time)
@@ -303,7 +410,13 @@ void phase_checkpoint(uint64_t curr_time)
     if(to_millis(curr_time - prev_phase_time) < phase_duration)
         return;
 
-    phase_checkpoint_run(curr_time);
+    // Only the first mutator to notice pays for the wake up. The flag is
+    // read first so the others do not bounce its cache line around.
+    if(checkpoint_requested.load(memory_order_relaxed)
+        || checkpoint_requested.exchange(1, memory_order_relaxed))
+        return;
+
+    syscall(SYS_futex, &checkpoint_requested, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
 }
 
 auto get_phase() -> AtomicPhasePtr
@@ -363,6 +476,13 @@ void phase_checkpoint_run(uint64_t curr_time)
     // safe to read and manipulate it with no data races.
     phase_checkpoint_safe(phase_ptr, curr_time);
 
+    // The caller took `curr_time` right before running us.
+    prev_checkpoint_time = get_time() - curr_time;
+    overhead_add_checkpoint(prev_checkpoint_time);
+
+    // Threads come and go, so their roles are refreshed now and then.
+    roles_refresh(curr_time);
+
     // Clear the phase data so it can be used for another phase.
     phase_ptr->reset();
 
@@ -388,6 +508,16 @@ void phase_checkpoint_safe(AtomicPhase* phase_ptr, uint64_t curr_time)
             phase_ptr->phase_wait_time.load(memory_order_relaxed));
     const auto phase_park_time = (
             phase_ptr->phase_park_time.load(memory_order_relaxed));
+    const auto phase_gc_pause_time = (
+            phase_ptr->phase_gc_pause_time.load(memory_order_relaxed));
+    const auto phase_gc_count = (
+            phase_ptr->phase_gc_count.load(memory_order_relaxed));
+    const auto phase_vthread_change_count = (
+            phase_ptr->phase_vthread_change_count.load(memory_order_relaxed));
+    const auto phase_carrier_change_count = (
+            phase_ptr->phase_carrier_change_count.load(memory_order_relaxed));
+    const auto phase_pinned_time = (
+            phase_ptr->phase_pinned_time.load(memory_order_relaxed));
 
     const int max_threads = thread_alloc_id;
 
@@ -417,9 +547,17 @@ void phase_checkpoint_safe(AtomicPhase* phase_ptr, uint64_t curr_time)
 
     // Update unshared global variables.
     ::total_cs_time += phase_cs_time;
+    ::total_accum_time += phase_accum_time;
     ::total_park_time += phase_park_time;
     ::total_wait_time += phase_wait_time;
+    ::total_gc_pause_time += phase_gc_pause_time;
+    ::total_gc_count += phase_gc_count;
+    ::total_pinned_time += phase_pinned_time;
+    ::total_juc_wait_time += phase_ptr->phase_juc_wait_time.load(memory_order_relaxed);
+    ::total_juc_hold_time += phase_ptr->phase_juc_hold_time.load(memory_order_relaxed);
     ::prev_phase_thread_count = curr_thread_count;
+    ::prev_phase_vthread_count += phase_vthread_change_count;
+    ::prev_phase_carrier_count += phase_carrier_change_count;
 
     // Update variables related to individual threads.
     for(int i = 0; i < AtomicPhase::MAX_THREADS; ++i)
@@ -448,6 +586,7 @@ void phase_checkpoint_safe(AtomicPhase* phase_ptr, uint64_t curr_time)
         PerfHardwareData hw_data[MAX_CPUS];
 	PerfSoftwareData sw_data;
 
+        perf_attribute_threads(prev_phase_cpu_index, max_threads);
         for(int cpu = 0; cpu < nprocs; ++cpu)
             hw_data[cpu] = perf_consume_hw(cpu);
 
@@ -458,14 +597,30 @@ void phase_checkpoint_safe(AtomicPhase* phase_ptr, uint64_t curr_time)
         char buffer_cache_miss[24 * MAX_CPUS];
         char buffer_branch_inst[24 * MAX_CPUS];
         char buffer_branch_miss[24 * MAX_CPUS];
+        char buffer_kernel_cycles[24 * MAX_CPUS];
+        char buffer_kernel_inst[24 * MAX_CPUS];
         size_t size_cpu_cycles = 0;
         size_t size_instructions = 0;
         size_t size_cache_miss = 0;
         size_t size_branch_inst = 0;
         size_t size_branch_miss = 0;
+        size_t size_kernel_cycles = 0;
+        size_t size_kernel_inst = 0;
+        uint64_t total_user_cycles = 0;
+        uint64_t total_kernel_cycles = 0;
+        uint64_t total_kernel_inst = 0;
 
         for(int cpu = 0; cpu < nprocs; ++cpu)
         {
+            // Uncounted CPUs (-1) are left out of the kernel totals.
+            if(hw_data[cpu].kernel_cycles != uint64_t(-1) && hw_data[cpu].cpu_cycles != uint64_t(-1))
+            {
+                total_user_cycles += hw_data[cpu].cpu_cycles;
+                total_kernel_cycles += hw_data[cpu].kernel_cycles;
+                if(hw_data[cpu].kernel_instructions != uint64_t(-1))
+                    total_kernel_inst += hw_data[cpu].kernel_instructions;
+            }
+
             size_cpu_cycles += sprintf(&buffer_cpu_cycles[size_cpu_cycles],
                                        "%" PRIu64 ":", hw_data[cpu].cpu_cycles);
 
@@ -480,6 +635,12 @@ void phase_checkpoint_safe(AtomicPhase* phase_ptr, uint64_t curr_time)
 
             size_branch_miss += sprintf(&buffer_branch_miss[size_branch_miss],
                                        "%" PRIu64 ":", hw_data[cpu].branch_misses);
+
+            size_kernel_cycles += sprintf(&buffer_kernel_cycles[size_kernel_cycles],
+                                       ":%" PRIu64, hw_data[cpu].kernel_cycles);
+
+            size_kernel_inst += sprintf(&buffer_kernel_inst[size_kernel_inst],
+                                       ":%" PRIu64, hw_data[cpu].kernel_instructions);
         }
 
         // Remove trailing colon.
@@ -489,6 +650,24 @@ void phase_checkpoint_safe(AtomicPhase* phase_ptr, uint64_t curr_time)
         buffer_branch_inst[--size_branch_inst] = 0;
         buffer_branch_miss[--size_branch_miss] = 0;
 
+        // Kernel columns are only present when counting is split. Their
+        // leading colon becomes the separating comma. The share of cycles
+        // spent in the kernel and its IPC are over every counted CPU.
+        char buffer_kernel_share[48] = "";
+        if(perf_split_enabled())
+        {
+            buffer_kernel_cycles[0] = ',';
+            buffer_kernel_inst[0] = ',';
+            snprintf(buffer_kernel_share, sizeof(buffer_kernel_share), ",%.2f,%.3f",
+                     (total_kernel_cycles / (double) std::max<uint64_t>(1, total_user_cycles + total_kernel_cycles)) * 100,
+                     total_kernel_inst / (double) std::max<uint64_t>(1, total_kernel_cycles));
+        }
+        else
+        {
+            buffer_kernel_cycles[0] = 0;
+            buffer_kernel_inst[0] = 0;
+        }
+
         char buffer_thread_state[16 + AtomicPhase::MAX_THREADS];
         for(int i = 1; i <= max_threads; ++i)
         {
@@ -514,7 +693,112 @@ void phase_checkpoint_safe(AtomicPhase* phase_ptr, uint64_t curr_time)
         else
             buffer_thread_cpus[--size_thread_cpus] = 0;
 
-        fprintf(csv_stream, "%lld,%.2f,%d,%s,%s,%s,%s,%s,%s,%s,%llu,%llu\n", 
+        // Pauses are reported as a share of the wall time of the phase, as
+        // they hold every mutator at once.
+        char buffer_roles[128] = "";
+        if(roles_enabled())
+        {
+            const auto usage = roles_consume_usage();
+            const auto phase_time = std::max<uint64_t>(1, curr_time - prev_phase_time);
+            snprintf(buffer_roles, sizeof(buffer_roles), ",%u,%.2f,%.3f,%.3f,%.3f",
+                     (unsigned) phase_gc_count,
+                     std::min(100.0, (phase_gc_pause_time / (double) phase_time) * 100),
+                     usage.gc_time / 1e6, usage.concurrent_gc_time / 1e6,
+                     usage.jit_time / 1e6);
+        }
+
+        // The carrier saturation is to virtual threads what the CSP is to
+        // locks: the share of the carriers' time spent running virtual
+        // threads. Pinned time is a share of that mounted time.
+        char buffer_loom[128] = "";
+#ifdef JINN_LOOM
+        {
+            const auto phase_vthread_mounted_time = (
+                    phase_ptr->phase_vthread_mounted_time.load(memory_order_relaxed));
+            const auto phase_vthread_unmounted_time = (
+                    phase_ptr->phase_vthread_unmounted_time.load(memory_order_relaxed));
+            const auto phase_pinned_count = (
+                    phase_ptr->phase_pinned_count.load(memory_order_relaxed));
+
+            const auto carrier_count = prev_phase_carrier_count;
+            const auto phase_time = std::max<uint64_t>(1, curr_time - prev_phase_time);
+            const auto carrier_time = phase_time * std::max(1, carrier_count);
+            snprintf(buffer_loom, sizeof(buffer_loom), ",%d,%d,%.2f,%.3f,%.2f,%u",
+                     (int) prev_phase_vthread_count, (int) carrier_count,
+                     std::min(100.0, (phase_vthread_mounted_time / (double) carrier_time) * 100),
+                     phase_vthread_unmounted_time / 1e6,
+                     std::min(100.0, (phase_pinned_time / (double) std::max<uint64_t>(1, phase_vthread_mounted_time)) * 100),
+                     (unsigned) phase_pinned_count);
+        }
+#endif
+
+        // j.u.c wait time is already part of the CSP. The hot locks are the
+        // ones that were waited for the most, as hash=wait/hold/acquires
+        // (microseconds), joined by colons.
+        char buffer_juc[512] = "";
+        if(juc_enabled())
+        {
+            static constexpr int MAX_HOT_LOCKS = 4;
+
+            int hot_locks[MAX_HOT_LOCKS];
+            int num_hot_locks = 0;
+            for(int i = 0; i < AtomicPhase::MAX_LOCKS; ++i)
+            {
+                top_insert(hot_locks, num_hot_locks, MAX_HOT_LOCKS, i,
+                           phase_ptr->lock_wait_time[i].load(memory_order_relaxed),
+                           [&](int slot) { return phase_ptr->lock_wait_time[slot].load(memory_order_relaxed); });
+            }
+
+            char buffer_hot_locks[64 * MAX_HOT_LOCKS] = "0";
+            size_t size_hot_locks = 0;
+            for(int i = 0; i < num_hot_locks; ++i)
+            {
+                const int slot = hot_locks[i];
+                size_hot_locks += sprintf(&buffer_hot_locks[size_hot_locks], "%s%08x=%" PRIu64 "/%" PRIu64 "/%u",
+                                          i? ":" : "",
+                                          (unsigned) phase_ptr->lock_key[slot].load(memory_order_relaxed),
+                                          phase_ptr->lock_wait_time[slot].load(memory_order_relaxed) / 1000,
+                                          phase_ptr->lock_hold_time[slot].load(memory_order_relaxed) / 1000,
+                                          (unsigned) phase_ptr->lock_acquire_count[slot].load(memory_order_relaxed));
+            }
+
+            snprintf(buffer_juc, sizeof(buffer_juc), ",%.3f,%.3f,%u,%u,%s,%u",
+                     phase_ptr->phase_juc_wait_time.load(memory_order_relaxed) / 1e6,
+                     phase_ptr->phase_juc_hold_time.load(memory_order_relaxed) / 1e6,
+                     (unsigned) phase_ptr->phase_juc_acquire_count.load(memory_order_relaxed),
+                     (unsigned) phase_ptr->phase_juc_contended_count.load(memory_order_relaxed),
+                     buffer_hot_locks,
+                     (unsigned) phase_ptr->phase_lock_drop_count.load(memory_order_relaxed));
+        }
+
+        // Convoys and chains themselves go to their own report file.
+        char buffer_convoy[128] = "";
+        if(convoy_enabled())
+        {
+            const auto phase_handoff_count = (
+                    phase_ptr->phase_handoff_count.load(memory_order_relaxed));
+            const auto phase_fifo_handoff_count = (
+                    phase_ptr->phase_fifo_handoff_count.load(memory_order_relaxed));
+            snprintf(buffer_convoy, sizeof(buffer_convoy), ",%u,%.2f,%u,%u,%u,%u",
+                     (unsigned) phase_handoff_count,
+                     (phase_fifo_handoff_count / (double) std::max<uint32_t>(1, phase_handoff_count)) * 100,
+                     (unsigned) phase_ptr->phase_convoy_handoff_count.load(memory_order_relaxed),
+                     (unsigned) phase_ptr->phase_max_chain_length.load(memory_order_relaxed),
+                     (unsigned) phase_ptr->phase_long_chain_count.load(memory_order_relaxed),
+                     (unsigned) phase_ptr->phase_monitor_drop_count.load(memory_order_relaxed));
+        }
+
+        // The checkpoint that ended the previous phase ran during this one.
+        char buffer_overhead[32] = "";
+        if(overhead_enabled())
+        {
+            const auto agent_time = (phase_ptr->phase_agent_time.load(memory_order_relaxed)
+                                     + prev_checkpoint_time);
+            snprintf(buffer_overhead, sizeof(buffer_overhead), ",%.3f",
+                     std::min(100.0, (agent_time / (double) std::max<uint64_t>(1, phase_accum_time)) * 100));
+        }
+
+        fprintf(csv_stream, "%lld,%.2f,%d,%s,%s,%s,%s,%s,%s,%s,%llu,%llu%s%s%s%s%s%s%s%s\n", 
                 (long long) elapsed_time,
                 bounded_csp,
                 (int) thread_factor,
@@ -522,6 +806,10 @@ void phase_checkpoint_safe(AtomicPhase* phase_ptr, uint64_t curr_time)
                 buffer_cpu_cycles, buffer_instructions,
                 buffer_cache_miss, buffer_branch_inst,
 		buffer_branch_miss, sw_data.cpu_migrations,
-		sw_data.context_switches);
+		sw_data.context_switches,
+                buffer_kernel_cycles, buffer_kernel_inst, buffer_kernel_share, buffer_roles, buffer_loom, buffer_juc, buffer_convoy, buffer_overhead);
     }
+
+    if(convoy_enabled())
+        convoy_checkpoint(phase_ptr, elapsed_time);
 }
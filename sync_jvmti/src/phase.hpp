@@ -1,5 +1,28 @@
 #pragma once
 #include <atomic>
+#include <cstdint>
+
+/// A convoy or wait chain seen during a phase.
+///
+/// For convoys, `threads` are the threads the monitor `monitors[0]` was
+/// handed over to. For chains, `threads[i]` waits for `monitors[i]`, which
+/// is held by `threads[i+1]`.
+struct PhaseReport
+{
+    static constexpr int MAX_ENTRIES = 8;
+
+    static constexpr uint8_t KIND_CONVOY = 1;
+    static constexpr uint8_t KIND_CONVOY_ENDED = 2;
+    static constexpr uint8_t KIND_CHAIN = 3;
+
+    uint8_t kind;
+    uint8_t num_threads;
+    uint16_t threads[MAX_ENTRIES];
+    int32_t monitors[MAX_ENTRIES];
+    uint32_t handoffs;
+    uint64_t start_time;
+    uint64_t end_time;
+};
 
 /// This structure holds information that is concurrently mutated during
 /// a phase.
@@ -9,6 +32,9 @@
 struct AtomicPhase
 {
     static constexpr int MAX_THREADS = 300;
+    static constexpr int MAX_LOCKS = 64;
+    static constexpr int MAX_LOCK_PROBES = 8;
+    static constexpr int MAX_REPORTS = 16;
 
     static constexpr uint8_t THREAD_STATE_UNCHANGED = 0;
     static constexpr uint8_t THREAD_STATE_RUNNING = 1;
@@ -26,9 +52,94 @@ struct AtomicPhase
     /// The amount of time parked.
     std::atomic<uint64_t> phase_park_time {0};
 
+    /// The amount of time the VM was paused by the garbage collector.
+    std::atomic<uint64_t> phase_gc_pause_time {0};
+
+    /// The number of garbage collection pauses that finished.
+    std::atomic<uint32_t> phase_gc_count {0};
+
     /// The amount of threads (spawned - died) during this phase.
     std::atomic<int32_t> phase_thread_change_count {0};
 
+    /// The amount of virtual threads (started - ended) during this phase.
+    std::atomic<int32_t> phase_vthread_change_count {0};
+
+    /// The amount of carriers (first mount - died) during this phase.
+    std::atomic<int32_t> phase_carrier_change_count {0};
+
+    /// The amount of time virtual threads were mounted on a carrier.
+    std::atomic<uint64_t> phase_vthread_mounted_time {0};
+
+    /// The amount of time virtual threads spent unmounted before being
+    /// mounted again (blocked, parked or waiting for a carrier).
+    std::atomic<uint64_t> phase_vthread_unmounted_time {0};
+
+    /// The amount of time virtual threads blocked on a monitor (entering
+    /// or waiting) without leaving their carrier.
+    std::atomic<uint64_t> phase_pinned_time {0};
+
+    /// The number of such pinned blocks.
+    std::atomic<uint32_t> phase_pinned_count {0};
+
+    /// The amount of time spent acquiring j.u.c locks.
+    std::atomic<uint64_t> phase_juc_wait_time {0};
+
+    /// The amount of time j.u.c locks were held exclusively.
+    std::atomic<uint64_t> phase_juc_hold_time {0};
+
+    /// The number of exclusive j.u.c lock acquisitions released.
+    std::atomic<uint32_t> phase_juc_acquire_count {0};
+
+    /// The number of j.u.c lock acquisitions that had to park.
+    std::atomic<uint32_t> phase_juc_contended_count {0};
+
+    /// Identity hashes of the j.u.c locks seen during this phase.
+    ///
+    /// A value of zero implies a free slot. Slots are claimed by
+    /// `find_lock`, so the statistics below are only per lock up to
+    /// `MAX_LOCKS` distinct locks per phase.
+    std::atomic<int32_t> lock_key[MAX_LOCKS];
+    std::atomic<uint64_t> lock_wait_time[MAX_LOCKS];
+    std::atomic<uint64_t> lock_hold_time[MAX_LOCKS];
+    std::atomic<uint32_t> lock_acquire_count[MAX_LOCKS];
+
+    /// The number of times a lock found no slot near its hash.
+    std::atomic<uint32_t> phase_lock_drop_count {0};
+
+    /// The number of monitors handed over to a blocked thread.
+    std::atomic<uint32_t> phase_handoff_count {0};
+
+    /// The number of such handoffs served in arrival order.
+    std::atomic<uint32_t> phase_fifo_handoff_count {0};
+
+    /// The number of such handoffs that were part of a convoy.
+    std::atomic<uint32_t> phase_convoy_handoff_count {0};
+
+    /// The number of blocked threads in the longest wait chain seen.
+    std::atomic<uint32_t> phase_max_chain_length {0};
+
+    /// The number of wait chains longer than the reporting threshold.
+    std::atomic<uint32_t> phase_long_chain_count {0};
+
+    /// The number of contended monitors that found no slot to be tracked in.
+    std::atomic<uint32_t> phase_monitor_drop_count {0};
+
+    /// Convoys and wait chains to report, and how many were claimed
+    /// (which may be more than `MAX_REPORTS`).
+    ///
+    /// A report is written only by the thread that claimed its slot by
+    /// incrementing `phase_report_count`.
+    PhaseReport phase_reports[MAX_REPORTS];
+    std::atomic<uint32_t> phase_report_count {0};
+
+    /// A number that tells apart the phases sharing this buffer. It only
+    /// changes while the checkpoint owns the phase.
+    uint64_t phase_number = 0;
+
+    /// The (estimated) amount of time spent by the agent on behalf of the
+    /// mutators, e.g. in event callbacks.
+    std::atomic<uint64_t> phase_agent_time {0};
+
     /// The amount of mutators still mutating this phase.
     std::atomic<int32_t> refcount {0};
 
@@ -56,15 +167,71 @@ struct AtomicPhase
 
     /// Records the CPU the calling thread is scheduled into and records it
     /// in the `phase_cpu_change[thread_id]` array.
+    ///
+    /// Also charges the overhead pending on the thread to this phase.
     void record_cpu(int thread_id);
 
+    /// Finds (or claims) the slot of the lock whose identity hash is `key`.
+    ///
+    /// This runs while the phase is held, so only the `MAX_LOCK_PROBES`
+    /// slots following the hash are looked at. Returns -1, and counts the
+    /// drop, if they are all taken by other locks.
+    int find_lock(int32_t key)
+    {
+        key = key? key : 1;
+        const auto start = static_cast<uint32_t>(key) % MAX_LOCKS;
+        for(int i = 0; i < MAX_LOCK_PROBES; ++i)
+        {
+            const int slot = (start + i) % MAX_LOCKS;
+            int32_t curr = lock_key[slot].load(std::memory_order_relaxed);
+            if(curr == 0 && lock_key[slot].compare_exchange_strong(curr, key, std::memory_order_relaxed))
+                return slot;
+            if(curr == key)
+                return slot;
+        }
+        phase_lock_drop_count.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+
     /// Resets the state of the phase.
     void reset()
     {
         phase_cs_time.store(0, std::memory_order_relaxed);
         phase_wait_time.store(0, std::memory_order_relaxed);
         phase_park_time.store(0, std::memory_order_relaxed);
+        phase_gc_pause_time.store(0, std::memory_order_relaxed);
+        phase_gc_count.store(0, std::memory_order_relaxed);
         phase_thread_change_count.store(0, std::memory_order_relaxed);
+        phase_vthread_change_count.store(0, std::memory_order_relaxed);
+        phase_carrier_change_count.store(0, std::memory_order_relaxed);
+        phase_vthread_mounted_time.store(0, std::memory_order_relaxed);
+        phase_vthread_unmounted_time.store(0, std::memory_order_relaxed);
+        phase_pinned_time.store(0, std::memory_order_relaxed);
+        phase_pinned_count.store(0, std::memory_order_relaxed);
+        phase_juc_wait_time.store(0, std::memory_order_relaxed);
+        phase_juc_hold_time.store(0, std::memory_order_relaxed);
+        phase_juc_acquire_count.store(0, std::memory_order_relaxed);
+        phase_juc_contended_count.store(0, std::memory_order_relaxed);
+        phase_handoff_count.store(0, std::memory_order_relaxed);
+        phase_fifo_handoff_count.store(0, std::memory_order_relaxed);
+        phase_convoy_handoff_count.store(0, std::memory_order_relaxed);
+        phase_max_chain_length.store(0, std::memory_order_relaxed);
+        phase_long_chain_count.store(0, std::memory_order_relaxed);
+        phase_report_count.store(0, std::memory_order_relaxed);
+        phase_agent_time.store(0, std::memory_order_relaxed);
+        phase_lock_drop_count.store(0, std::memory_order_relaxed);
+        phase_monitor_drop_count.store(0, std::memory_order_relaxed);
+
+        // There are two phase buffers.
+        phase_number += 2;
+
+        for(int i = 0; i < MAX_LOCKS; ++i)
+        {
+            lock_key[i].store(0, std::memory_order_relaxed);
+            lock_wait_time[i].store(0, std::memory_order_relaxed);
+            lock_hold_time[i].store(0, std::memory_order_relaxed);
+            lock_acquire_count[i].store(0, std::memory_order_relaxed);
+        }
 
         for(int i = 0; i < MAX_THREADS; ++i)
         {
@@ -127,10 +294,10 @@ extern void phase_vm_die();
 /// Shutdowns the phase subsystem.
 extern void phase_shutdown();
 
-/// Tries to reach a phase checkpoint.
+/// Requests a phase checkpoint if the current phase expired.
 ///
-/// A thread shall never call this while having ownership of a
-/// reference to a phase or the thread will deadlock.
+/// The checkpoint runs asynchronously in a thread of the agent, so this
+/// never blocks the caller.
 extern void phase_checkpoint(uint64_t curr_time);
 
 /// Gets an owned reference to the current phase.
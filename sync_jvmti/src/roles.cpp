@@ -0,0 +1,368 @@
+#include "roles.hpp"
+#include "phase.hpp"
+#include "time.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// Thread roles of the JVM.
+//
+// Besides the application threads (the mutators), a JVM runs GC workers,
+// JIT compilers and a few other internal threads. These do not go through
+// ThreadStart, so the mutators register their native thread id there and
+// every other thread is classified by its name (comm) as set by HotSpot,
+// e.g. "GC Thread#0", "G1 Conc#0" or "C2 CompilerThre".
+//
+// The roles are published to `sync_jvmti.<pid>.roles` so that a placement
+// policy outside the JVM can act on them. With `JINN_ROLE_PLACEMENT=true`
+// the agent itself keeps JIT and concurrent GC threads on the LITTLE cores
+// and the mutators and stop-the-world GC workers (which hold every mutator
+// during a pause) on the big cores.
+//
+// The /proc scan is rate limited, but the CPU time of the (few) internal
+// threads is read on every checkpoint to tell how much they steal from the
+// application.
+
+/// Maximum number of JVM threads we keep track of.
+constexpr int MAX_ROLE_THREADS = 512;
+
+struct RoleThread
+{
+    int tid;
+    ThreadRole role;
+    bool placed;
+    uint64_t prev_cpu_time;
+    char comm[16];
+};
+
+/// Name prefixes of the internal threads and their roles.
+static const struct { const char* prefix; ThreadRole role; } role_prefixes[] = {
+    {"C1 Compiler", THREAD_ROLE_JIT},
+    {"C2 Compiler", THREAD_ROLE_JIT},
+    {"JVMCI", THREAD_ROLE_JIT},
+    {"Sweeper thread", THREAD_ROLE_JIT},
+    {"GC Thread", THREAD_ROLE_GC},
+    {"ParGC Thread", THREAD_ROLE_GC},
+    {"GC task thread", THREAD_ROLE_GC},
+    {"Gang worker", THREAD_ROLE_GC},
+    {"G1 ", THREAD_ROLE_CONCURRENT_GC},
+    {"ZDriver", THREAD_ROLE_CONCURRENT_GC},
+    {"ZDirector", THREAD_ROLE_CONCURRENT_GC},
+    {"ZWorker", THREAD_ROLE_CONCURRENT_GC},
+    {"Shenandoah", THREAD_ROLE_CONCURRENT_GC},
+    {"Concurrent Mark", THREAD_ROLE_CONCURRENT_GC},
+};
+
+static bool is_enabled;
+static bool apply_placement;
+static cpu_set_t little_cpus;
+static cpu_set_t big_cpus;
+static uint64_t refresh_interval;
+static uint64_t prev_refresh_time;
+static char roles_path[128];
+
+/// Native thread ids of the mutators, indexed by their thread id.
+static std::atomic<int> mutator_tids[AtomicPhase::MAX_THREADS];
+
+static RoleThread threads[MAX_ROLE_THREADS];
+static int num_threads;
+
+static bool parse_cpu_list(const char* list, cpu_set_t* set)
+{
+    CPU_ZERO(set);
+    for(const char* p = list; *p; )
+    {
+        char* end;
+        const long first = strtol(p, &end, 10);
+        if(end == p || first < 0)
+            return false;
+
+        long last = first;
+        if(*end == '-')
+        {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if(end == p || last < first)
+                return false;
+        }
+
+        for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, set);
+
+        p = (*end == ',')? end + 1 : end;
+        if(*end && *end != ',')
+            return false;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+static bool parse_cpu_env(const char* name, const char* fallback, cpu_set_t* set)
+{
+    const char* list = std::getenv(name);
+    if(list && !parse_cpu_list(list, set))
+    {
+        fprintf(stderr, "sync_jvmti: Unrecognized %s: %s\n", name, list);
+        list = nullptr;
+    }
+    return list || parse_cpu_list(fallback, set);
+}
+
+bool roles_init()
+{
+    is_enabled = false;
+    apply_placement = false;
+    refresh_interval = 1000;
+    prev_refresh_time = 0;
+    num_threads = 0;
+
+    for(int i = 0; i < AtomicPhase::MAX_THREADS; ++i)
+        mutator_tids[i].store(0, std::memory_order_relaxed);
+
+    if(auto s = std::getenv("JINN_THREAD_ROLES"))
+    {
+        if(!strcmp(s, "true") || !strcmp(s, "1"))
+            is_enabled = true;
+        else if(strcmp(s, "false") && strcmp(s, "0"))
+            fprintf(stderr, "sync_jvmti: Unrecognized JINN_THREAD_ROLES: %s\n", s);
+    }
+
+    if(auto s = std::getenv("JINN_ROLE_PLACEMENT"))
+    {
+        if(!strcmp(s, "true") || !strcmp(s, "1"))
+            apply_placement = is_enabled = true;
+        else if(strcmp(s, "false") && strcmp(s, "0"))
+            fprintf(stderr, "sync_jvmti: Unrecognized JINN_ROLE_PLACEMENT: %s\n", s);
+    }
+
+    if(auto s = std::getenv("JINN_ROLE_INTERVAL"))
+        sscanf(s, "%" PRIu64, &refresh_interval);
+
+    if(!is_enabled)
+        return false;
+
+    if(apply_placement)
+    {
+        parse_cpu_env("JINN_LITTLE_CPUS", "0-3", &little_cpus);
+        parse_cpu_env("JINN_BIG_CPUS", "4-7", &big_cpus);
+        fprintf(stderr, "sync_jvmti: Placing JIT and concurrent GC threads on the LITTLE cores.\n");
+    }
+
+    sprintf(roles_path, "sync_jvmti.%ld.roles", (long) getpid());
+    fprintf(stderr, "sync_jvmti: Publishing thread roles to %s\n", roles_path);
+    return true;
+}
+
+void roles_shutdown()
+{
+    if(is_enabled)
+        unlink(roles_path);
+}
+
+bool roles_enabled()
+{
+    return is_enabled;
+}
+
+auto roles_name(ThreadRole role) -> const char*
+{
+    switch(role)
+    {
+        case THREAD_ROLE_MUTATOR: return "mutator";
+        case THREAD_ROLE_GC: return "gc";
+        case THREAD_ROLE_CONCURRENT_GC: return "concurrent-gc";
+        case THREAD_ROLE_JIT: return "jit";
+        default: return "vm";
+    }
+}
+
+void roles_register_mutator(int thread_id)
+{
+    if(is_enabled && thread_id > 0 && thread_id < AtomicPhase::MAX_THREADS)
+        mutator_tids[thread_id].store(syscall(SYS_gettid), std::memory_order_relaxed);
+}
+
+void roles_unregister_mutator(int thread_id)
+{
+    if(is_enabled && thread_id > 0 && thread_id < AtomicPhase::MAX_THREADS)
+        mutator_tids[thread_id].store(0, std::memory_order_relaxed);
+}
+
+static auto classify(int tid, const char* comm) -> ThreadRole
+{
+    for(int i = 1; i < AtomicPhase::MAX_THREADS; ++i)
+    {
+        if(mutator_tids[i].load(std::memory_order_relaxed) == tid)
+            return THREAD_ROLE_MUTATOR;
+    }
+
+    for(const auto& entry : role_prefixes)
+    {
+        if(!strncmp(comm, entry.prefix, strlen(entry.prefix)))
+            return entry.role;
+    }
+
+    return THREAD_ROLE_VM;
+}
+
+/// Gets the time (in nanoseconds) the thread `tid` spent on a CPU.
+static uint64_t read_cpu_time(int tid)
+{
+    char path[64];
+    unsigned long long cpu_time = 0;
+
+    sprintf(path, "/proc/self/task/%d/schedstat", tid);
+    if(FILE* stream = fopen(path, "r"))
+    {
+        if(fscanf(stream, "%llu", &cpu_time) != 1)
+            cpu_time = 0;
+        fclose(stream);
+    }
+    return cpu_time;
+}
+
+static void place(RoleThread& thread)
+{
+    const cpu_set_t* cpus = nullptr;
+    if(thread.role == THREAD_ROLE_MUTATOR || thread.role == THREAD_ROLE_GC)
+        cpus = &big_cpus;
+    else if(thread.role == THREAD_ROLE_CONCURRENT_GC || thread.role == THREAD_ROLE_JIT)
+        cpus = &little_cpus;
+
+    thread.placed = true;
+    if(cpus && sched_setaffinity(thread.tid, sizeof(cpu_set_t), cpus) == -1 && errno != ESRCH)
+        perror("sync_jvmti: failed to place thread");
+}
+
+static void publish()
+{
+    char temp_path[sizeof(roles_path) + 8];
+    sprintf(temp_path, "%s.tmp", roles_path);
+
+    FILE* stream = fopen(temp_path, "w");
+    if(!stream)
+    {
+        perror("sync_jvmti: failed to publish thread roles");
+        return;
+    }
+
+    fprintf(stream, "# tid role comm\n");
+    for(int i = 0; i < num_threads; ++i)
+        fprintf(stream, "%d %s %s\n", threads[i].tid, roles_name(threads[i].role), threads[i].comm);
+    fclose(stream);
+
+    // Readers never see a partially written file.
+    if(rename(temp_path, roles_path) == -1)
+        perror("sync_jvmti: failed to publish thread roles");
+}
+
+void roles_refresh(uint64_t curr_time)
+{
+    if(!is_enabled)
+        return;
+
+    if(prev_refresh_time && to_millis(curr_time - prev_refresh_time) < refresh_interval)
+        return;
+    prev_refresh_time = curr_time;
+
+    DIR* dir = opendir("/proc/self/task");
+    if(!dir)
+        return;
+
+    static RoleThread found[MAX_ROLE_THREADS];
+    int num_found = 0;
+    bool changed = false;
+
+    while(auto entry = readdir(dir))
+    {
+        if(entry->d_name[0] == '.' || num_found == MAX_ROLE_THREADS)
+            continue;
+
+        char path[64];
+        auto& thread = found[num_found];
+        thread.tid = atoi(entry->d_name);
+        thread.comm[0] = '\0';
+
+        sprintf(path, "/proc/self/task/%d/comm", thread.tid);
+        if(FILE* stream = fopen(path, "r"))
+        {
+            if(fgets(thread.comm, sizeof(thread.comm), stream))
+                thread.comm[strcspn(thread.comm, "\n")] = '\0';
+            fclose(stream);
+        }
+
+        // Our own threads (e.g. the checkpoint thread) fall into the VM
+        // role.
+        thread.role = classify(thread.tid, thread.comm);
+        thread.placed = false;
+        thread.prev_cpu_time = 0;
+
+        bool known = false;
+        for(int i = 0; i < num_threads; ++i)
+        {
+            if(threads[i].tid == thread.tid)
+            {
+                known = true;
+                thread.prev_cpu_time = threads[i].prev_cpu_time;
+                thread.placed = threads[i].placed && threads[i].role == thread.role;
+                changed |= (threads[i].role != thread.role);
+                break;
+            }
+        }
+
+        if(!known)
+        {
+            changed = true;
+            if(thread.role != THREAD_ROLE_VM && thread.role != THREAD_ROLE_MUTATOR)
+                thread.prev_cpu_time = read_cpu_time(thread.tid);
+        }
+
+        ++num_found;
+    }
+
+    closedir(dir);
+
+    changed |= (num_found != num_threads);
+    num_threads = num_found;
+    for(int i = 0; i < num_found; ++i)
+    {
+        threads[i] = found[i];
+        if(apply_placement && !threads[i].placed)
+            place(threads[i]);
+    }
+
+    if(changed)
+        publish();
+}
+
+auto roles_consume_usage() -> RoleUsage
+{
+    RoleUsage usage;
+
+    for(int i = 0; i < num_threads; ++i)
+    {
+        auto& thread = threads[i];
+
+        uint64_t* time;
+        switch(thread.role)
+        {
+            case THREAD_ROLE_GC: time = &usage.gc_time; break;
+            case THREAD_ROLE_CONCURRENT_GC: time = &usage.concurrent_gc_time; break;
+            case THREAD_ROLE_JIT: time = &usage.jit_time; break;
+            default: continue;
+        }
+
+        const auto cpu_time = read_cpu_time(thread.tid);
+        if(cpu_time > thread.prev_cpu_time)
+            *time += cpu_time - thread.prev_cpu_time;
+        thread.prev_cpu_time = cpu_time;
+    }
+
+    return usage;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+
+/// The role a thread of the JVM plays.
+enum ThreadRole : uint8_t
+{
+    THREAD_ROLE_VM,             //< other internal threads (VM Thread, signal...)
+    THREAD_ROLE_MUTATOR,        //< application threads (seen at ThreadStart)
+    THREAD_ROLE_GC,             //< stop-the-world GC workers
+    THREAD_ROLE_CONCURRENT_GC,  //< GC threads running alongside mutators
+    THREAD_ROLE_JIT,            //< JIT compiler threads
+    THREAD_ROLE_COUNT,
+};
+
+/// CPU time (in nanoseconds) spent by the internal threads of each role.
+struct RoleUsage
+{
+    uint64_t gc_time = 0;
+    uint64_t concurrent_gc_time = 0;
+    uint64_t jit_time = 0;
+};
+
+/// Initialises the thread roles subsystem.
+///
+/// Returns whether it is enabled (see `JINN_THREAD_ROLES`).
+extern bool roles_init();
+
+/// Shutdowns the thread roles subsystem.
+extern void roles_shutdown();
+
+/// Whether thread roles are tracked.
+extern bool roles_enabled();
+
+/// Gets the name of a role.
+extern auto roles_name(ThreadRole role) -> const char*;
+
+/// Records the calling thread as the mutator of the given thread id.
+///
+/// Thread ids are the ones allocated by `phase_alloc_thread`.
+extern void roles_register_mutator(int thread_id);
+
+/// Forgets the mutator of the given thread id.
+extern void roles_unregister_mutator(int thread_id);
+
+/// Rediscovers the threads of the JVM and their roles, at most once every
+/// `JINN_ROLE_INTERVAL` milliseconds, publishing them and applying the role
+/// placement when they changed.
+///
+/// Must only be called by the checkpoint.
+extern void roles_refresh(uint64_t curr_time);
+
+/// Consumes the CPU time of the internal threads of each role.
+///
+/// A consume operation obtains times as if they were reset during the
+/// previous consume operation. Must only be called by the checkpoint.
+extern auto roles_consume_usage() -> RoleUsage;
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+
+/// Offers `index`, whose value is `value`, to the `count` indices of `top`
+/// (at most `max_count`), kept sorted by decreasing value. `value_of(i)`
+/// gives the value of an index already in `top`.
+///
+/// Zero values are never taken.
+template<class ValueOf>
+inline void top_insert(int* top, int& count, int max_count,
+                       int index, uint64_t value, ValueOf value_of)
+{
+    if(value == 0)
+        return;
+
+    if(count == max_count && value_of(top[count - 1]) >= value)
+        return;
+
+    int j = (count < max_count)? count++ : count - 1;
+    for(; j > 0 && value_of(top[j - 1]) < value; --j)
+        top[j] = top[j - 1];
+    top[j] = index;
+}